@@ -150,6 +150,12 @@ bool AbstractAnalysisData::requestStorage(int nframes)
 }
 
 
+bool AbstractAnalysisData::hasModules() const
+{
+    return impl_->modules_.hasModules();
+}
+
+
 void AbstractAnalysisData::addModule(const AnalysisDataModulePointer& module)
 {
     impl_->modules_.addModule(this, module);
@@ -251,6 +251,14 @@ public:
      * \see tryGetDataFrame()
      */
     bool requestStorage(int nframes);
+    /*! \brief
+     * Returns whether any modules have been added to process the data.
+     *
+     * Allows data sources to skip producing data that nobody uses.
+     *
+     * Does not throw.
+     */
+    bool hasModules() const;
 
     /*! \brief
      * Adds a module to process the data.
@@ -298,6 +298,12 @@ void AnalysisDataModuleManager::applyModule(AbstractAnalysisData* data, IAnalysi
 }
 
 
+bool AnalysisDataModuleManager::hasModules() const
+{
+    return !impl_->modules_.empty();
+}
+
+
 bool AnalysisDataModuleManager::hasSerialModules() const
 {
     GMX_ASSERT(impl_->state_ != Impl::eNotStarted,
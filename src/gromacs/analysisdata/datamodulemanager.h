@@ -94,6 +94,12 @@ public:
      */
     void dataPropertyAboutToChange(DataProperty property, bool bSet);
 
+    /*! \brief
+     * Whether any modules have been added.
+     *
+     * Does not throw.
+     */
+    bool hasModules() const;
     /*! \brief
      * Whether there are modules that do not support parallel processing.
      *
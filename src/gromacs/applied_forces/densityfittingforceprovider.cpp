@@ -51,6 +51,7 @@
 #include "gromacs/math/densityfittingforce.h"
 #include "gromacs/math/exponentialmovingaverage.h"
 #include "gromacs/math/gausstransform.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdtypes/commrec.h"
 #include "gromacs/mdtypes/enerdata.h"
 #include "gromacs/mdtypes/forceoutput.h"
@@ -82,6 +83,98 @@ GaussianSpreadKernelParameters::Shape makeSpreadKernel(real sigma, real nSigma,
              nSigma };
 }
 
+/*! \internal \brief Sum the spread densities of all PP ranks.
+ *
+ * Only the lattice points within the union of the spread bounding boxes
+ * of all ranks are communicated, so that the communicated volume scales
+ * with the extent of the fitted atoms rather than with the density map.
+ *
+ * \param[in,out] gaussTransform the Gauss transform holding the spread density
+ * \param[in,out] buffer         communication buffer
+ * \param[in]     cr             the communication record
+ * \returns the box enclosing the non-zero density of all ranks
+ */
+IntegerBox sumSpreadDensityOverRanks(GaussTransform3D* gaussTransform, std::vector<float>* buffer, const t_commrec& cr)
+{
+    const IntegerBox localBox = gaussTransform->spreadBoundingBox();
+
+    // Gather the spread bounding boxes of all ranks, empty boxes are left all zero
+    const int        numRanks = cr.nnodes - cr.npmenodes;
+    std::vector<int> boxes(2 * DIM * numRanks, 0);
+    if (!localBox.empty())
+    {
+        std::copy(localBox.begin().as_vec(), localBox.begin().as_vec() + DIM,
+                  boxes.begin() + 2 * DIM * cr.nodeid);
+        std::copy(localBox.end().as_vec(), localBox.end().as_vec() + DIM,
+                  boxes.begin() + 2 * DIM * cr.nodeid + DIM);
+    }
+    gmx_sumi(boxes.size(), boxes.data(), &cr);
+
+    const auto extents = gaussTransform->constView().extents();
+    IVec       begin(extents.extent(ZZ), extents.extent(YY), extents.extent(XX));
+    IVec       end(0, 0, 0);
+    for (int rank = 0; rank < numRanks; ++rank)
+    {
+        const IVec rankBegin(&boxes[2 * DIM * rank]);
+        const IVec rankEnd(&boxes[2 * DIM * rank + DIM]);
+        if (!IntegerBox(rankBegin, rankEnd).empty())
+        {
+            begin = elementWiseMin(begin, rankBegin);
+            end   = elementWiseMax(end, rankEnd);
+        }
+    }
+    const IntegerBox globalBox(begin, end);
+    if (globalBox.empty())
+    {
+        return globalBox;
+    }
+
+    // Sum the density within the global box, packed into a contiguous buffer
+    auto        density   = gaussTransform->view(globalBox);
+    const int   rowLength = end[XX] - begin[XX];
+    const index bufferSize =
+            static_cast<index>(rowLength) * (end[YY] - begin[YY]) * (end[ZZ] - begin[ZZ]);
+    buffer->resize(bufferSize);
+    auto bufferIterator = buffer->begin();
+    for (int z = begin[ZZ]; z < end[ZZ]; ++z)
+    {
+        for (int y = begin[YY]; y < end[YY]; ++y)
+        {
+            const float* row = &density(z, y, begin[XX]);
+            bufferIterator   = std::copy(row, row + rowLength, bufferIterator);
+        }
+    }
+    // \todo update to real once GaussTransform class returns real
+    gmx_sumf(bufferSize, buffer->data(), &cr);
+    bufferIterator = buffer->begin();
+    for (int z = begin[ZZ]; z < end[ZZ]; ++z)
+    {
+        for (int y = begin[YY]; y < end[YY]; ++y)
+        {
+            std::copy(bufferIterator, bufferIterator + rowLength, &density(z, y, begin[XX]));
+            bufferIterator += rowLength;
+        }
+    }
+    return globalBox;
+}
+
+/*! \internal \brief Returns the part of \p box, split along z, that a rank evaluates.
+ *
+ * \param[in] box      the box to split
+ * \param[in] rank     the rank to return the part for
+ * \param[in] numRanks the number of parts
+ */
+IntegerBox rankPartOfBox(const IntegerBox& box, int rank, int numRanks)
+{
+    if (box.empty())
+    {
+        return box;
+    }
+    const int numZ = box.end()[ZZ] - box.begin()[ZZ];
+    return { { box.begin()[XX], box.begin()[YY], box.begin()[ZZ] + (numZ * rank) / numRanks },
+             { box.end()[XX], box.end()[YY], box.begin()[ZZ] + (numZ * (rank + 1)) / numRanks } };
+}
+
 } // namespace
 
 /********************************************************************
@@ -118,6 +211,8 @@ private:
     //! the local atom coordinates transformed into the grid coordinate system
     std::vector<RVec>             transformedCoordinates_;
     std::vector<RVec>             forces_;
+    //! Buffer for communicating the spread density between ranks
+    std::vector<float>            spreadDensityBuffer_;
     DensityFittingAmplitudeLookup amplitudeLookup_;
     TranslateAndScale             transformationToDensityLattice_;
     RVec                          referenceDensityCenter_;
@@ -188,6 +283,8 @@ void DensityFittingForceProvider::Impl::calculateForces(const ForceProviderInput
 
     state_.stepsSinceLastCalculation_ = 1;
 
+    const int numThreads = std::max(1, gmx_omp_nthreads_get(emntDefault));
+
     transformedCoordinates_.resize(localAtomSet_.numAtomsLocal());
     // pick and copy atom coordinates
     std::transform(std::cbegin(localAtomSet_.localIndex()), std::cend(localAtomSet_.localIndex()),
@@ -228,25 +325,33 @@ void DensityFittingForceProvider::Impl::calculateForces(const ForceProviderInput
         }
     }
 
-    auto amplitudeIterator = amplitudes.cbegin();
+    gaussTransform_.add(transformedCoordinates_, amplitudes, numThreads);
 
-    for (const auto& r : transformedCoordinates_)
-    {
-        gaussTransform_.add({ r, *amplitudeIterator });
-        ++amplitudeIterator;
-    }
+    /* The simulated density is non-zero only within the spread bounding box,
+     * and forces on local atoms only need the derivative within the local box. */
+    const IntegerBox localSpreadBox = gaussTransform_.spreadBoundingBox();
 
-    // communicate grid
+    DensitySimilarityMeasure::PartialSums similaritySums;
     if (havePPDomainDecomposition(&forceProviderInput.cr_))
     {
-        // \todo update to real once GaussTransform class returns real
-        gmx_sumf(gaussTransform_.view().mapping().required_span_size(),
-                 gaussTransform_.view().data(), &forceProviderInput.cr_);
+        const t_commrec& cr = forceProviderInput.cr_;
+        // communicate grid
+        const IntegerBox spreadBox =
+                sumSpreadDensityOverRanks(&gaussTransform_, &spreadDensityBuffer_, cr);
+        // every rank sums over a part of the density, so that only the sums are communicated
+        similaritySums = measure_.partialSums(
+                gaussTransform_.constView(),
+                rankPartOfBox(spreadBox, cr.nodeid, cr.nnodes - cr.npmenodes), numThreads);
+        gmx_sumd(similaritySums.size(), similaritySums.data(), &cr);
+    }
+    else
+    {
+        similaritySums = measure_.partialSums(gaussTransform_.constView(), localSpreadBox, numThreads);
     }
 
     // calculate grid derivative
-    const DensitySimilarityMeasure::density& densityDerivative =
-            measure_.gradient(gaussTransform_.constView());
+    const DensitySimilarityMeasure::density& densityDerivative = measure_.gradientWithinBox(
+            gaussTransform_.constView(), similaritySums, localSpreadBox, numThreads);
     // calculate forces
     forces_.resize(localAtomSet_.numAtomsLocal());
     std::transform(
@@ -267,7 +372,7 @@ void DensityFittingForceProvider::Impl::calculateForces(const ForceProviderInput
         ++densityForceIterator;
     }
 
-    const float similarity = measure_.similarity(gaussTransform_.constView());
+    const float similarity = measure_.similarityFromSums(similaritySums);
     if (MASTER(&(forceProviderInput.cr_)))
     {
         // calculate corresponding potential energy
@@ -58,6 +58,7 @@
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxlib/network.h"
 #include "gromacs/math/utilities.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdrunutility/multisim.h"
 #include "gromacs/mdtypes/awh_history.h"
 #include "gromacs/mdtypes/awh_params.h"
@@ -67,6 +68,7 @@
 #include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 #include "gromacs/utility/stringutil.h"
 
@@ -76,6 +78,33 @@
 namespace gmx
 {
 
+namespace
+{
+
+/*! \brief
+ * The number of grid points per block for threaded loops over points.
+ *
+ * Sums over points are computed per block and the block sums are then added
+ * in order, so the result does not depend on the number of threads.
+ */
+constexpr int c_numPointsPerBlock = 1024;
+
+/*! \brief
+ * Returns the number of OpenMP threads to use for a loop over grid points.
+ *
+ * Small loops are run serially, as the threading overhead would dominate.
+ *
+ * \param[in] numPoints  The number of points in the loop.
+ */
+int numThreadsForPoints(size_t numPoints)
+{
+    const int numBlocks = (numPoints + c_numPointsPerBlock - 1) / c_numPointsPerBlock;
+
+    return std::max(1, std::min(gmx_omp_nthreads_get(emntDefault), numBlocks));
+}
+
+} // namespace
+
 void BiasState::getPmf(gmx::ArrayRef<float> pmf) const
 {
     GMX_ASSERT(pmf.size() == points_.size(), "pmf should have the size of the bias grid");
@@ -201,43 +230,115 @@ double freeEnergyMinimumValue(gmx::ArrayRef<const PointState> pointState)
 }
 
 /*! \brief
- * Find and return the log of the probability weight of a point given a coordinate value.
+ * Computes the biased probability weights of the neighbors of a grid point.
  *
  * The unnormalized weight is given by
  * w(point|value) = exp(bias(point) - U(value,point)),
  * where U is a harmonic umbrella potential.
  *
- * \param[in] dimParams     The bias dimensions parameters
- * \param[in] points        The point state.
- * \param[in] grid          The grid.
- * \param[in] pointIndex    Point to evaluate probability weight for.
- * \param[in] pointBias     Bias for the point (as a log weight).
- * \param[in] value         Coordinate value.
- * \returns the log of the biased probability weight.
+ * U is a sum of terms along each dimension and the term along a dimension
+ * only depends on the grid index of the neighbor along that axis.
+ * The neighbors span at most BiasGrid::c_maxNeighborsAlongAxis indices along
+ * each axis, so the terms are computed once for each index, relative to the
+ * index of the center point, and then looked up for each neighbor.
+ * The exponentials are computed with SIMD, when available, and the weight
+ * array is padded with zero weights up to a multiple of the SIMD width.
+ *
+ * \tparam    BiasOfPoint  Function type returning the bias of a point (as a log weight).
+ * \param[in] dimParams    The bias dimensions parameters
+ * \param[in] points       The point state.
+ * \param[in] grid         The grid.
+ * \param[in] centerPoint  The point whose neighbors to compute the weights for.
+ * \param[in] biasOfPoint  Returns the bias for a point index.
+ * \param[in] value        Coordinate value.
+ * \param[out] weight      The weight of each neighbor.
+ * \returns the sum of the weights.
  */
-double biasedLogWeightFromPoint(const std::vector<DimParams>&  dimParams,
-                                const std::vector<PointState>& points,
-                                const BiasGrid&                grid,
-                                int                            pointIndex,
-                                double                         pointBias,
-                                const awh_dvec                 value)
+template<typename BiasOfPoint>
+double calcNeighborWeights(const std::vector<DimParams>&                 dimParams,
+                           const std::vector<PointState>&                points,
+                           const BiasGrid&                               grid,
+                           int                                           centerPoint,
+                           BiasOfPoint                                   biasOfPoint,
+                           const awh_dvec                                value,
+                           std::vector<double, AlignedAllocator<double>>* weight)
 {
-    double logWeight = detail::c_largeNegativeExponent;
+    constexpr int c_maxNeighborsAlongAxis = BiasGrid::c_maxNeighborsAlongAxis;
+    constexpr int c_halfNeighbors         = c_maxNeighborsAlongAxis / 2;
+
+    const int               numDim    = grid.numDimensions();
+    const GridPoint&        center    = grid.point(centerPoint);
+    const std::vector<int>& neighbors = center.neighbor;
+
+    /* The umbrella terms, indexed by the neighbor index minus the center index along each axis */
+    double umbrellaTerm[c_biasMaxNumDim][c_maxNeighborsAlongAxis];
+    bool   haveUmbrellaTerm[c_biasMaxNumDim][c_maxNeighborsAlongAxis] = { { false } };
+
+#if GMX_SIMD_HAVE_DOUBLE
+    typedef SimdDouble PackType;
+    constexpr int      packSize = GMX_SIMD_DOUBLE_WIDTH;
+#else
+    typedef double PackType;
+    constexpr int  packSize = 1;
+#endif
+    /* Round the size of the weight array up to packSize */
+    const int numNeighbors = neighbors.size();
+    const int weightSize   = ((numNeighbors + packSize - 1) / packSize) * packSize;
+    weight->resize(weightSize);
 
-    /* Only points in the target reigon have non-zero weight */
-    if (points[pointIndex].inTargetRegion())
+    double* gmx_restrict weightData = weight->data();
+    for (int n = 0; n < numNeighbors; n++)
     {
-        logWeight = pointBias;
+        const int neighbor  = neighbors[n];
+        double    logWeight = detail::c_largeNegativeExponent;
 
-        /* Add potential for all parameter dimensions */
-        for (size_t d = 0; d < dimParams.size(); d++)
+        /* Only points in the target reigon have non-zero weight */
+        if (points[neighbor].inTargetRegion())
         {
-            double dev = getDeviationFromPointAlongGridAxis(grid, d, pointIndex, value[d]);
-            logWeight -= 0.5 * dimParams[d].betak * dev * dev;
+            logWeight = biasOfPoint(neighbor);
+
+            /* Add potential for all parameter dimensions */
+            for (int d = 0; d < numDim; d++)
+            {
+                int offset = grid.point(neighbor).index[d] - center.index[d];
+                if (grid.axis(d).numPointsInPeriod() > 0)
+                {
+                    const int numPointsInPeriod = grid.axis(d).numPointsInPeriod();
+                    offset = (((offset + c_halfNeighbors) % numPointsInPeriod) + numPointsInPeriod)
+                                     % numPointsInPeriod
+                             - c_halfNeighbors;
+                }
+                const int slot = offset + c_halfNeighbors;
+                GMX_ASSERT(slot >= 0 && slot < c_maxNeighborsAlongAxis,
+                           "Neighbors should be within the scope cutoff");
+
+                if (!haveUmbrellaTerm[d][slot])
+                {
+                    double dev = getDeviationFromPointAlongGridAxis(grid, d, neighbor, value[d]);
+                    umbrellaTerm[d][slot]     = 0.5 * dimParams[d].betak * dev * dev;
+                    haveUmbrellaTerm[d][slot] = true;
+                }
+                logWeight -= umbrellaTerm[d][slot];
+            }
         }
+        weightData[n] = logWeight;
+    }
+    for (int n = numNeighbors; n < weightSize; n++)
+    {
+        /* Pad with values that don't affect the result */
+        weightData[n] = detail::c_largeNegativeExponent;
+    }
+
+    PackType weightSumPack(0.0);
+    for (int i = 0; i < weightSize; i += packSize)
+    {
+        PackType weightPack = load<PackType>(weightData + i);
+        weightPack          = gmx::exp(weightPack);
+        weightSumPack       = weightSumPack + weightPack;
+        store(weightData + i, weightPack);
     }
 
-    return logWeight;
+    return reduce(weightSumPack);
 }
 
 } // namespace
@@ -254,26 +355,31 @@ void BiasState::calcConvolvedPmf(const std::vector<DimParams>& dimParams,
     std::vector<float> pmf(numPoints);
     getPmf(pmf);
 
-    for (size_t m = 0; m < numPoints; m++)
+    /* The points are independent, so the result does not depend on the number of threads */
+    const int numThreads = numThreadsForPoints(numPoints);
+#pragma omp parallel num_threads(numThreads)
     {
-        double           freeEnergyWeights = 0;
-        const GridPoint& point             = grid.point(m);
-        for (auto& neighbor : point.neighbor)
+        try
         {
-            /* The negative PMF is a positive bias. */
-            double biasNeighbor = -pmf[neighbor];
-
-            /* Add the convolved PMF weights for the neighbors of this point.
-               Note that this function only adds point within the target > 0 region.
-               Sum weights, take the logarithm last to get the free energy. */
-            double logWeight = biasedLogWeightFromPoint(dimParams, points_, grid, neighbor,
-                                                        biasNeighbor, point.coordValue);
-            freeEnergyWeights += std::exp(logWeight);
-        }
+            std::vector<double, AlignedAllocator<double>> neighborWeight;
 
-        GMX_RELEASE_ASSERT(freeEnergyWeights > 0,
-                           "Attempting to do log(<= 0) in AWH convolved PMF calculation.");
-        (*convolvedPmf)[m] = -std::log(static_cast<float>(freeEnergyWeights));
+#pragma omp for schedule(static)
+            for (gmx::index m = 0; m < gmx::index(numPoints); m++)
+            {
+                /* Add the convolved PMF weights for the neighbors of this point.
+                   Note that this function only adds point within the target > 0 region.
+                   The negative PMF is a positive bias.
+                   Sum weights, take the logarithm last to get the free energy. */
+                double freeEnergyWeights = calcNeighborWeights(
+                        dimParams, points_, grid, m, [&pmf](int neighbor) { return -pmf[neighbor]; },
+                        grid.point(m).coordValue, &neighborWeight);
+
+                GMX_RELEASE_ASSERT(freeEnergyWeights > 0,
+                                   "Attempting to do log(<= 0) in AWH convolved PMF calculation.");
+                (*convolvedPmf)[m] = -std::log(static_cast<float>(freeEnergyWeights));
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
     }
 }
 
@@ -297,18 +403,42 @@ void updateTargetDistribution(gmx::ArrayRef<PointState> pointState, const BiasPa
         freeEnergyCutoff = freeEnergyMinimumValue(pointState) + params.freeEnergyCutoffInKT;
     }
 
+    /* Sum the target weights per block of points, in parallel, and then add
+       the block sums in order, to get a result independent of the number of threads. */
+    const int           numPoints  = pointState.ssize();
+    const int           numBlocks  = (numPoints + c_numPointsPerBlock - 1) / c_numPointsPerBlock;
+    const int           numThreads = numThreadsForPoints(numPoints);
+    std::vector<double> blockSumTarget(numBlocks, 0.0);
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        try
+        {
+            const int pointEnd = std::min((block + 1) * c_numPointsPerBlock, numPoints);
+            for (int m = block * c_numPointsPerBlock; m < pointEnd; m++)
+            {
+                blockSumTarget[block] += pointState[m].updateTargetWeight(params, freeEnergyCutoff);
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
     double sumTarget = 0;
-    for (PointState& ps : pointState)
+    for (double blockSum : blockSumTarget)
     {
-        sumTarget += ps.updateTargetWeight(params, freeEnergyCutoff);
+        sumTarget += blockSum;
     }
     GMX_RELEASE_ASSERT(sumTarget > 0, "We should have a non-zero distribution");
 
     /* Normalize to 1 */
     double invSum = 1.0 / sumTarget;
-    for (PointState& ps : pointState)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int m = 0; m < numPoints; m++)
     {
-        ps.scaleTarget(invSum);
+        try
+        {
+            pointState[m].scaleTarget(invSum);
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
     }
 }
 
@@ -724,11 +854,20 @@ void sumHistograms(gmx::ArrayRef<PointState> pointState,
                    const gmx_multisim_t*     multiSimComm,
                    const std::vector<int>&   localUpdateList)
 {
+    const int numLocal   = localUpdateList.size();
+    const int numThreads = numThreadsForPoints(numLocal);
+
     /* The covering checking histograms are added before summing over simulations, so that the
        weights from different simulations are kept distinguishable. */
-    for (int globalIndex : localUpdateList)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int localIndex = 0; localIndex < numLocal; localIndex++)
     {
-        weightSumCovering[globalIndex] += pointState[globalIndex].weightSumIteration();
+        try
+        {
+            const int globalIndex = localUpdateList[localIndex];
+            weightSumCovering[globalIndex] += pointState[globalIndex].weightSumIteration();
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
     }
 
     /* Sum histograms over multiple simulations if needed. */
@@ -767,9 +906,14 @@ void sumHistograms(gmx::ArrayRef<PointState> pointState,
     /* Now add the partial counts and weights to the accumulating histograms.
        Note: we still need to use the weights for the update so we wait
        with resetting them until the end of the update. */
-    for (int globalIndex : localUpdateList)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int localIndex = 0; localIndex < numLocal; localIndex++)
     {
-        pointState[globalIndex].addPartialWeightAndCount();
+        try
+        {
+            pointState[localUpdateList[localIndex]].addPartialWeightAndCount();
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
     }
 }
 
@@ -926,22 +1070,62 @@ bool BiasState::isSamplingRegionCovered(const BiasParams&             params,
         weightThreshold *= grid.axis(d).spacing() * std::sqrt(dimParams[d].betak * 0.5 * M_1_PI);
     }
 
-    /* Project the sampling weights onto each dimension */
-    for (size_t m = 0; m < grid.numPoints(); m++)
+    /* Project the sampling weights onto each dimension. The points are distributed over
+       threads which set the flags for the slices along all dimensions in their own buffers,
+       these are merged afterwards. Since we only set flags, the result does not depend
+       on the number of threads. */
+    std::vector<int> sliceOffset(grid.numDimensions() + 1, 0);
+    for (int d = 0; d < grid.numDimensions(); d++)
     {
-        const PointState& pointState = points_[m];
-
-        for (int d = 0; d < grid.numDimensions(); d++)
+        sliceOffset[d + 1] = sliceOffset[d] + grid.axis(d).numPoints();
+    }
+    const int                      numPoints  = grid.numPoints();
+    const int                      numThreads = numThreadsForPoints(numPoints);
+    std::vector<std::vector<char>> threadVisited(numThreads, std::vector<char>(sliceOffset.back(), 0));
+    std::vector<std::vector<char>> threadCheckCovering(numThreads,
+                                                       std::vector<char>(sliceOffset.back(), 0));
+#pragma omp parallel num_threads(numThreads)
+    {
+        try
         {
-            int n = grid.point(m).index[d];
+            const int          thread        = gmx_omp_get_thread_num();
+            std::vector<char>& visited       = threadVisited[thread];
+            std::vector<char>& checkCovering = threadCheckCovering[thread];
+
+#pragma omp for schedule(static)
+            for (int m = 0; m < numPoints; m++)
+            {
+                const PointState& pointState = points_[m];
 
-            /* Is visited if it was already visited or if there is enough weight at the current point */
-            checkDim[d].visited[n] = checkDim[d].visited[n] || (weightSumCovering_[m] > weightThreshold);
+                /* Is visited if it was already visited or if there is enough weight at the current point */
+                const bool isVisited = (weightSumCovering_[m] > weightThreshold);
 
-            /* Check for covering if there is at least point in this slice that is in the target region and within the cutoff */
-            checkDim[d].checkCovering[n] =
-                    checkDim[d].checkCovering[n]
-                    || (pointState.inTargetRegion() && pointState.freeEnergy() < maxFreeEnergy);
+                /* Check for covering if there is at least point in this slice that is in the target region and within the cutoff */
+                const bool needsChecking =
+                        (pointState.inTargetRegion() && pointState.freeEnergy() < maxFreeEnergy);
+
+                for (int d = 0; d < grid.numDimensions(); d++)
+                {
+                    int n = sliceOffset[d] + grid.point(m).index[d];
+
+                    visited[n]       = visited[n] || isVisited;
+                    checkCovering[n] = checkCovering[n] || needsChecking;
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
+    for (int d = 0; d < grid.numDimensions(); d++)
+    {
+        for (int n = 0; n < grid.axis(d).numPoints(); n++)
+        {
+            for (int thread = 0; thread < numThreads; thread++)
+            {
+                checkDim[d].visited[n] =
+                        checkDim[d].visited[n] || threadVisited[thread][sliceOffset[d] + n];
+                checkDim[d].checkCovering[n] = checkDim[d].checkCovering[n]
+                                               || threadCheckCovering[thread][sliceOffset[d] + n];
+            }
         }
     }
 
@@ -999,9 +1183,16 @@ static void normalizeFreeEnergyAndPmfSum(std::vector<PointState>* pointState)
 {
     double minF = freeEnergyMinimumValue(*pointState);
 
-    for (PointState& ps : *pointState)
+    const int numPoints  = pointState->size();
+    const int numThreads = numThreadsForPoints(numPoints);
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int m = 0; m < numPoints; m++)
     {
-        ps.normalizeFreeEnergyAndPmfSum(minF);
+        try
+        {
+            (*pointState)[m].normalizeFreeEnergyAndPmfSum(minF);
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
     }
 }
 
@@ -1109,22 +1300,32 @@ void BiasState::updateFreeEnergyAndAddSamplesToHistogram(const std::vector<DimPa
     setHistogramUpdateScaleFactors(params, newHistogramSize, histogramSize_.histogramSize(),
                                    &weightHistScalingNew, &logPmfsumScalingNew);
 
+    /* The points in the update list are updated independently of each other,
+       so the result does not depend on the number of threads. */
+    const int numPointsToUpdate = updateList->size();
+    const int numThreads        = numThreadsForPoints(numPointsToUpdate);
+
     /* Update free energy and reference weight histogram for points in the update list. */
-    for (int pointIndex : *updateList)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int i = 0; i < numPointsToUpdate; i++)
     {
-        PointState* pointStateToUpdate = &points_[pointIndex];
-
-        /* Do updates from previous update steps that were skipped because this point was at that time non-local. */
-        if (params.skipUpdates())
+        try
         {
-            pointStateToUpdate->performPreviouslySkippedUpdates(params, histogramSize_.numUpdates(),
-                                                                weightHistScalingSkipped,
-                                                                logPmfsumScalingSkipped);
-        }
+            PointState* pointStateToUpdate = &points_[(*updateList)[i]];
+
+            /* Do updates from previous update steps that were skipped because this point was at that time non-local. */
+            if (params.skipUpdates())
+            {
+                pointStateToUpdate->performPreviouslySkippedUpdates(
+                        params, histogramSize_.numUpdates(), weightHistScalingSkipped,
+                        logPmfsumScalingSkipped);
+            }
 
-        /* Now do an update with new sampling data. */
-        pointStateToUpdate->updateWithNewSampling(params, histogramSize_.numUpdates(),
-                                                  weightHistScalingNew, logPmfsumScalingNew);
+            /* Now do an update with new sampling data. */
+            pointStateToUpdate->updateWithNewSampling(params, histogramSize_.numUpdates(),
+                                                      weightHistScalingNew, logPmfsumScalingNew);
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
     }
 
     /* Only update the histogram size after we are done with the local point updates */
@@ -1143,9 +1344,14 @@ void BiasState::updateFreeEnergyAndAddSamplesToHistogram(const std::vector<DimPa
 
     /* Update the bias. The bias is updated separately and last since it simply a function of
        the free energy and the target distribution and we want to avoid doing extra work. */
-    for (int pointIndex : *updateList)
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int i = 0; i < numPointsToUpdate; i++)
     {
-        points_[pointIndex].updateBias();
+        try
+        {
+            points_[(*updateList)[i]].updateBias();
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
     }
 
     /* Increase the update counter. */
@@ -1157,45 +1363,9 @@ double BiasState::updateProbabilityWeightsAndConvolvedBias(const std::vector<Dim
                                                            std::vector<double, AlignedAllocator<double>>* weight) const
 {
     /* Only neighbors of the current coordinate value will have a non-negligible chance of getting sampled */
-    const std::vector<int>& neighbors = grid.point(coordState_.gridpointIndex()).neighbor;
-
-#if GMX_SIMD_HAVE_DOUBLE
-    typedef SimdDouble PackType;
-    constexpr int      packSize = GMX_SIMD_DOUBLE_WIDTH;
-#else
-    typedef double PackType;
-    constexpr int  packSize = 1;
-#endif
-    /* Round the size of the weight array up to packSize */
-    const int weightSize = ((neighbors.size() + packSize - 1) / packSize) * packSize;
-    weight->resize(weightSize);
-
-    double* gmx_restrict weightData = weight->data();
-    PackType             weightSumPack(0.0);
-    for (size_t i = 0; i < neighbors.size(); i += packSize)
-    {
-        for (size_t n = i; n < i + packSize; n++)
-        {
-            if (n < neighbors.size())
-            {
-                const int neighbor = neighbors[n];
-                (*weight)[n] =
-                        biasedLogWeightFromPoint(dimParams, points_, grid, neighbor,
-                                                 points_[neighbor].bias(), coordState_.coordValue());
-            }
-            else
-            {
-                /* Pad with values that don't affect the result */
-                (*weight)[n] = detail::c_largeNegativeExponent;
-            }
-        }
-        PackType weightPack = load<PackType>(weightData + i);
-        weightPack          = gmx::exp(weightPack);
-        weightSumPack       = weightSumPack + weightPack;
-        store(weightData + i, weightPack);
-    }
-    /* Sum of probability weights */
-    double weightSum = reduce(weightSumPack);
+    double weightSum = calcNeighborWeights(
+            dimParams, points_, grid, coordState_.gridpointIndex(),
+            [this](int neighbor) { return points_[neighbor].bias(); }, coordState_.coordValue(), weight);
     GMX_RELEASE_ASSERT(weightSum > 0,
                        "zero probability weight when updating AWH probability weights.");
 
@@ -1214,17 +1384,13 @@ double BiasState::calcConvolvedBias(const std::vector<DimParams>& dimParams,
                                     const BiasGrid&               grid,
                                     const awh_dvec&               coordValue) const
 {
-    int              point     = grid.nearestIndex(coordValue);
-    const GridPoint& gridPoint = grid.point(point);
+    int point = grid.nearestIndex(coordValue);
 
     /* Sum the probability weights from the neighborhood of the given point */
-    double weightSum = 0;
-    for (int neighbor : gridPoint.neighbor)
-    {
-        double logWeight = biasedLogWeightFromPoint(dimParams, points_, grid, neighbor,
-                                                    points_[neighbor].bias(), coordValue);
-        weightSum += std::exp(logWeight);
-    }
+    std::vector<double, AlignedAllocator<double>> neighborWeight;
+    double                                        weightSum = calcNeighborWeights(
+            dimParams, points_, grid, point, [this](int neighbor) { return points_[neighbor].bias(); },
+            coordValue, &neighborWeight);
 
     /* Returns -GMX_FLOAT_MAX if no neighboring points were in the target region. */
     return (weightSum > 0) ? std::log(weightSum) : -GMX_FLOAT_MAX;
@@ -44,9 +44,12 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "gromacs/awh/bias.h"
 #include "gromacs/awh/biasgrid.h"
+#include "gromacs/awh/correlationgrid.h"
 #include "gromacs/awh/pointstate.h"
 #include "gromacs/math/functions.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdtypes/awh_params.h"
 #include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/smalloc.h"
@@ -128,24 +131,25 @@ static AwhTestParameters getAwhTestParameters()
 class BiasStateTest : public ::testing::TestWithParam<const char*>
 {
 public:
+    std::vector<DimParams>     dimParams_; //!< The dimension parameters
+    std::unique_ptr<BiasGrid>  grid_;      //!< The bias grid
     std::unique_ptr<BiasState> biasState_; //!< The bias state
 
     BiasStateTest()
     {
-        AwhTestParameters      params        = getAwhTestParameters();
-        const AwhParams&       awhParams     = params.awhParams;
-        const AwhBiasParams&   awhBiasParams = awhParams.awhBiasParams[0];
-        std::vector<DimParams> dimParams;
-        dimParams.emplace_back(1.0, 15.0, params.beta);
-        dimParams.emplace_back(1.0, 15.0, params.beta);
-        BiasGrid   grid(dimParams, awhBiasParams.dimParams);
-        BiasParams biasParams(awhParams, awhBiasParams, dimParams, 1.0, 1.0,
-                              BiasParams::DisableUpdateSkips::no, 1, grid.axis(), 0);
-        biasState_ = std::make_unique<BiasState>(awhBiasParams, 1.0, dimParams, grid);
+        AwhTestParameters    params        = getAwhTestParameters();
+        const AwhParams&     awhParams     = params.awhParams;
+        const AwhBiasParams& awhBiasParams = awhParams.awhBiasParams[0];
+        dimParams_.emplace_back(1.0, 15.0, params.beta);
+        dimParams_.emplace_back(1.0, 15.0, params.beta);
+        grid_ = std::make_unique<BiasGrid>(dimParams_, awhBiasParams.dimParams);
+        BiasParams biasParams(awhParams, awhBiasParams, dimParams_, 1.0, 1.0,
+                              BiasParams::DisableUpdateSkips::no, 1, grid_->axis(), 0);
+        biasState_ = std::make_unique<BiasState>(awhBiasParams, 1.0, dimParams_, *grid_);
 
         // Here we initialize the grid point state using the input file
         std::string filename = gmx::test::TestFileManager::getInputFilePath(GetParam());
-        biasState_->initGridPointState(awhBiasParams, dimParams, grid, biasParams, filename,
+        biasState_->initGridPointState(awhBiasParams, dimParams_, *grid_, biasParams, filename,
                                        params.awhParams.numBias);
 
         sfree(params.awhParams.awhBiasParams[0].dimParams);
@@ -171,11 +175,127 @@ TEST_P(BiasStateTest, InitializesFromFile)
     EXPECT_NEAR(0.0, msdPmf, 1e-31);
 }
 
+TEST_P(BiasStateTest, ConvolvedBiasMatchesNeighborSum)
+{
+    gmx::ArrayRef<const PointState> points = biasState_->points();
+
+    /* Compare with a direct sum over the neighbors of the nearest point */
+    const awh_dvec coordValues[] = { { 0.5, 0.8 }, { 0.93, 1.07 }, { 1.5, 1.3 } };
+    for (const awh_dvec& coordValue : coordValues)
+    {
+        const GridPoint& nearestPoint = grid_->point(grid_->nearestIndex(coordValue));
+        double           weightSum    = 0;
+        for (int neighbor : nearestPoint.neighbor)
+        {
+            double logWeight = points[neighbor].bias();
+            for (size_t d = 0; d < dimParams_.size(); d++)
+            {
+                double dev = getDeviationFromPointAlongGridAxis(*grid_, d, neighbor, coordValue[d]);
+                logWeight -= 0.5 * dimParams_[d].betak * dev * dev;
+            }
+            weightSum += std::exp(logWeight);
+        }
+
+        EXPECT_DOUBLE_EQ_TOL(std::log(weightSum),
+                             biasState_->calcConvolvedBias(dimParams_, *grid_, coordValue),
+                             gmx::test::relativeToleranceAsFloatingPoint(std::log(weightSum), 1e-12));
+    }
+}
+
 // Test that Bias initialization open and reads the correct initialization
 // files and the correct PMF and target distribution is set.
 INSTANTIATE_TEST_CASE_P(WithParameters,
                         BiasStateTest,
                         ::testing::Values("pmf_target_format0.xvg", "pmf_target_format1.xvg"));
 
+//! The state of all bias points and the histogram size after an AWH run
+struct BiasRunResult
+{
+    std::vector<double> bias;           //!< The bias per point
+    std::vector<double> freeEnergy;     //!< The free energy per point
+    std::vector<double> target;         //!< The target distribution per point
+    std::vector<double> logPmfSum;      //!< The log PMF sum per point
+    std::vector<double> weightSumTot;   //!< The accumulated weight per point
+    std::vector<double> numVisitsTot;   //!< The accumulated visits per point
+    double              histogramSize;  //!< The histogram size
+    bool                inInitialStage; //!< Whether we are still in the initial stage
+};
+
+/*! \brief Runs a 2D AWH bias with \p numThreads OpenMP threads and returns the final state
+ *
+ * The grid has more than two blocks of points, so the loops over all points
+ * are run with multiple threads.
+ */
+static BiasRunResult runBiasWithThreads(int numThreads)
+{
+    AwhTestParameters params        = getAwhTestParameters();
+    AwhBiasParams&    awhBiasParams = params.awhParams.awhBiasParams[0];
+    awhBiasParams.bUserData         = FALSE;
+    awhBiasParams.eTarget           = eawhtargetCUTOFF;
+    awhBiasParams.targetCutoff      = 2;
+    awhBiasParams.eGrowth           = eawhgrowthEXP_LINEAR;
+
+    std::vector<DimParams> dimParams;
+    dimParams.emplace_back(1.0, 15000.0, params.beta);
+    dimParams.emplace_back(1.0, 15000.0, params.beta);
+
+    const int numThreadsSaved = gmx_omp_nthreads_get(emntDefault);
+    gmx_omp_nthreads_set(emntDefault, numThreads);
+
+    const double mdTimeStep = 0.1;
+    Bias bias(-1, params.awhParams, awhBiasParams, dimParams, params.beta, mdTimeStep, 1, "",
+              Bias::ThisRankWillDoIO::No, BiasParams::DisableUpdateSkips::yes);
+    EXPECT_GT(bias.state().points().size(), 2U * 1024U);
+
+    /* A trajectory that covers part of the sampling interval */
+    for (int64_t step = 0; step < 400; step++)
+    {
+        const double t             = step * mdTimeStep;
+        const double coord0        = 1.0 + 0.45 * std::sin(t);
+        const double coord1        = 1.05 + 0.2 * std::sin(0.7 * t);
+        awh_dvec     coordValue    = { coord0, coord1, 0, 0 };
+        double       potential     = 0;
+        double       potentialJump = 0;
+        bias.calcForceAndUpdateBias(coordValue, &potential, &potentialJump, nullptr, nullptr, t,
+                                    step, params.awhParams.seed, nullptr);
+    }
+
+    gmx_omp_nthreads_set(emntDefault, numThreadsSaved);
+
+    BiasRunResult result;
+    for (const PointState& point : bias.state().points())
+    {
+        result.bias.push_back(point.bias());
+        result.freeEnergy.push_back(point.freeEnergy());
+        result.target.push_back(point.target());
+        result.logPmfSum.push_back(point.logPmfSum());
+        result.weightSumTot.push_back(point.weightSumTot());
+        result.numVisitsTot.push_back(point.numVisitsTot());
+    }
+    result.histogramSize  = bias.state().histogramSize().histogramSize();
+    result.inInitialStage = bias.state().inInitialStage();
+
+    sfree(params.awhParams.awhBiasParams[0].dimParams);
+    sfree(params.awhParams.awhBiasParams);
+
+    return result;
+}
+
+// The blocked loops over the grid points should give bitwise identical results
+TEST(BiasStateThreadingTest, UpdatesIndependentlyOfTheNumberOfThreads)
+{
+    const BiasRunResult serial   = runBiasWithThreads(1);
+    const BiasRunResult parallel = runBiasWithThreads(4);
+
+    EXPECT_EQ(serial.bias, parallel.bias);
+    EXPECT_EQ(serial.freeEnergy, parallel.freeEnergy);
+    EXPECT_EQ(serial.target, parallel.target);
+    EXPECT_EQ(serial.logPmfSum, parallel.logPmfSum);
+    EXPECT_EQ(serial.weightSumTot, parallel.weightSumTot);
+    EXPECT_EQ(serial.numVisitsTot, parallel.numVisitsTot);
+    EXPECT_EQ(serial.histogramSize, parallel.histogramSize);
+    EXPECT_EQ(serial.inInitialStage, parallel.inInitialStage);
+}
+
 } // namespace test
 } // namespace gmx
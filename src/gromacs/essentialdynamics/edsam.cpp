@@ -44,7 +44,9 @@
 #include <cstring>
 #include <ctime>
 
+#include <algorithm>
 #include <memory>
+#include <utility>
 
 #include "gromacs/commandline/filenm.h"
 #include "gromacs/domdec/domdec_struct.h"
@@ -59,6 +61,7 @@
 #include "gromacs/math/vectypes.h"
 #include "gromacs/mdlib/broadcaststructs.h"
 #include "gromacs/mdlib/constr.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdlib/groupcoord.h"
 #include "gromacs/mdlib/stat.h"
 #include "gromacs/mdlib/update.h"
@@ -73,6 +76,7 @@
 #include "gromacs/topology/mtop_lookup.h"
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/gmxassert.h"
 #include "gromacs/utility/logger.h"
@@ -285,6 +289,8 @@ struct t_do_edsam
     gmx_bool bUpdateShifts;       /* TRUE in NS steps to indicate that the
                                      ED shifts for this ED group need to
                                      be updated */
+    GroupCollectionPlan xcollPlan;  /* Gather setup for xcoll with DD */
+    GroupCollectionPlan xc_refPlan; /* Gather setup for xc_ref with DD */
 };
 
 
@@ -315,7 +321,11 @@ gmx_edsam* EssentialDynamics::getLegacyED()
 } // namespace gmx
 
 /* Function declarations */
-static void fit_to_reference(rvec* xcoll, rvec transvec, matrix rotmat, t_edpar* edi);
+static void fit_to_reference(rvec*            xcoll,
+                             rvec             transvec,
+                             matrix           rotmat,
+                             t_edpar*         edi,
+                             const t_commrec* cr);
 static void translate_and_rotate(rvec* x, int nat, rvec transvec, matrix rotmat);
 static real rmsd_from_structure(rvec* x, struct gmx_edx* s);
 namespace
@@ -398,84 +408,158 @@ real projectx(const t_edpar& edi, rvec* xcoll, rvec* vec)
 
     return proj;
 }
+//! The number of eigenvectors that are projected onto in one pass over the atoms
+constexpr int c_eigenvectorBlockSize = 4;
+
+//! The minimum number of atom-eigenvector pairs per thread for which threading pays off
+constexpr int c_minAtomEigenvectorPairsPerThread = 8192;
+
+/*!\brief Returns the number of threads for a loop over \p numItems items.
+ * \param[in] numItems the number of items to distribute over the threads
+ * \param[in] numAtomEigenvectorPairs the total amount of work
+ */
+int numThreadsForEdLoop(int numItems, int64_t numAtomEigenvectorPairs)
+{
+    const int64_t maxNumThreads = numAtomEigenvectorPairs / c_minAtomEigenvectorPairsPerThread;
+    return std::max(1, std::min({ gmx_omp_nthreads_get(emntDefault), numItems,
+                                  static_cast<int>(std::min<int64_t>(maxNumThreads, numItems)) }));
+}
+
+/*!\brief Returns whether the collective atoms are split over the PP ranks.
+ *
+ * This depends only on the run setup, so all ranks agree on it and on
+ * whether the partial sums need to be reduced, also when a rank gets no atoms.
+ * \param[in] cr communication record, nullptr when not called on all PP ranks
+ */
+bool haveAtomsSplitOverRanks(const t_commrec* cr)
+{
+    return cr != nullptr && havePPDomainDecomposition(cr);
+}
+
+/*!\brief Returns the range of collective atoms that this rank works on.
+ * With domain decomposition the atoms are split over the PP ranks,
+ * otherwise this rank works on all atoms.
+ * \param[in] numAtoms the number of collective atoms
+ * \param[in] cr communication record, nullptr when not called on all PP ranks
+ * \returns begin and end of the atom range
+ */
+std::pair<int, int> atomRangeOfRank(int numAtoms, const t_commrec* cr)
+{
+    if (!haveAtomsSplitOverRanks(cr))
+    {
+        return { 0, numAtoms };
+    }
+    const int64_t numRanks = cr->nnodes - cr->npmenodes;
+    return { static_cast<int>((numAtoms * static_cast<int64_t>(cr->nodeid)) / numRanks),
+             static_cast<int>((numAtoms * static_cast<int64_t>(cr->nodeid + 1)) / numRanks) };
+}
+
+/*!\brief Mass-weighted projections of the deviation from the average positions onto eigenvectors.
+ *
+ * Evaluated as a blocked matrix-vector product: every pass over the atoms
+ * projects onto a block of eigenvectors, so that the deviation of each atom
+ * is computed once per block. Blocks are distributed over OpenMP threads.
+ * With domain decomposition each PP rank only sums over its share of the
+ * atoms and the projections are summed over the ranks.
+ *
+ * \param[in]  edi  essential dynamics parameters with average positions and masses
+ * \param[in]  x    the collective positions to project
+ * \param[in]  vec  the eigenvectors to project onto
+ * \param[out] proj the projections, one per eigenvector
+ * \param[in]  cr   communication record, nullptr when not called on all PP ranks
+ */
+void projectDeviationOntoEigenvectors(const t_edpar&   edi,
+                                      const rvec*      x,
+                                      const t_eigvec&  vec,
+                                      real*            proj,
+                                      const t_commrec* cr)
+{
+    const auto [atomBegin, atomEnd] = atomRangeOfRank(edi.sav.nr, cr);
+    const int  numBlocks = (vec.neig + c_eigenvectorBlockSize - 1) / c_eigenvectorBlockSize;
+    const int  numThreads =
+            numThreadsForEdLoop(numBlocks, static_cast<int64_t>(atomEnd - atomBegin) * vec.neig);
+
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int block = 0; block < numBlocks; block++)
+    {
+        try
+        {
+            const int eigBegin = block * c_eigenvectorBlockSize;
+            const int numEig   = std::min(c_eigenvectorBlockSize, vec.neig - eigBegin);
+            real      blockProj[c_eigenvectorBlockSize] = { 0 };
+            for (int i = atomBegin; i < atomEnd; i++)
+            {
+                rvec deviation;
+                rvec_sub(x[i], edi.sav.x[i], deviation);
+                for (int k = 0; k < numEig; k++)
+                {
+                    blockProj[k] += edi.sav.sqrtm[i] * iprod(vec.vec[eigBegin + k][i], deviation);
+                }
+            }
+            for (int k = 0; k < numEig; k++)
+            {
+                proj[eigBegin + k] = blockProj[k];
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
+
+    if (haveAtomsSplitOverRanks(cr))
+    {
+        gmx_sum(vec.neig, proj, cr);
+    }
+}
+
 /*!\brief Project coordinates onto vector after substracting average position.
  * projection is stored in vec->refproj which is used for radacc, radfix,
  * radcon and center of flooding potential.
- * Average positions are first substracted from x, then added back again.
  * \param[in] edi essential dynamics parameters with average position
  * \param[in] x Coordinates to be projected
  * \param[out] vec eigenvector, radius and refproj are overwritten here
+ * \param[in] cr communication record, nullptr when not called on all PP ranks
  */
-void rad_project(const t_edpar& edi, rvec* x, t_eigvec* vec)
+void rad_project(const t_edpar& edi, const rvec* x, t_eigvec* vec, const t_commrec* cr)
 {
-    int  i;
     real rad = 0.0;
 
-    /* Subtract average positions */
-    for (i = 0; i < edi.sav.nr; i++)
-    {
-        rvec_dec(x[i], edi.sav.x[i]);
-    }
+    projectDeviationOntoEigenvectors(edi, x, *vec, vec->refproj, cr);
 
-    for (i = 0; i < vec->neig; i++)
+    for (int i = 0; i < vec->neig; i++)
     {
-        vec->refproj[i] = projectx(edi, x, vec->vec[i]);
         rad += gmx::square((vec->refproj[i] - vec->xproj[i]));
     }
     vec->radius = sqrt(rad);
-
-    /* Add average positions */
-    for (i = 0; i < edi.sav.nr; i++)
-    {
-        rvec_inc(x[i], edi.sav.x[i]);
-    }
 }
 
 /*!\brief Projects coordinates onto eigenvectors and stores result in vec->xproj.
- * Mass-weighting is applied. Subtracts average positions prior to projection and add
- * them afterwards to retain the unchanged vector.
+ * Mass-weighting is applied. Average positions are subtracted prior to projection.
  * \param[in] x The coordinates to project to an eigenvector
  * \param[in,out] vec The eigenvectors
  * \param[in] edi essential dynamics parameters holding average structure and masses
+ * \param[in] cr communication record, nullptr when not called on all PP ranks
  */
-void project_to_eigvectors(rvec* x, t_eigvec* vec, const t_edpar& edi)
+void project_to_eigvectors(const rvec* x, t_eigvec* vec, const t_edpar& edi, const t_commrec* cr)
 {
     if (!vec->neig)
     {
         return;
     }
 
-    /* Subtract average positions */
-    for (int i = 0; i < edi.sav.nr; i++)
-    {
-        rvec_dec(x[i], edi.sav.x[i]);
-    }
-
-    for (int i = 0; i < vec->neig; i++)
-    {
-        vec->xproj[i] = projectx(edi, x, vec->vec[i]);
-    }
-
-    /* Add average positions */
-    for (int i = 0; i < edi.sav.nr; i++)
-    {
-        rvec_inc(x[i], edi.sav.x[i]);
-    }
+    projectDeviationOntoEigenvectors(edi, x, *vec, vec->xproj, cr);
 }
 } // namespace
 
 /* Project vector x onto all edi->vecs (mon, linfix,...) */
-static void project(rvec*    x,   /* positions to project */
-                    t_edpar* edi) /* edi data set */
+static void project(const rvec*      x,   /* positions to project */
+                    t_edpar*         edi, /* edi data set */
+                    const t_commrec* cr)  /* nullptr when not called on all PP ranks */
 {
-    /* It is not more work to subtract the average position in every
-     * subroutine again, because these routines are rarely used simultaneously */
-    project_to_eigvectors(x, &edi->vecs.mon, *edi);
-    project_to_eigvectors(x, &edi->vecs.linfix, *edi);
-    project_to_eigvectors(x, &edi->vecs.linacc, *edi);
-    project_to_eigvectors(x, &edi->vecs.radfix, *edi);
-    project_to_eigvectors(x, &edi->vecs.radacc, *edi);
-    project_to_eigvectors(x, &edi->vecs.radcon, *edi);
+    project_to_eigvectors(x, &edi->vecs.mon, *edi, cr);
+    project_to_eigvectors(x, &edi->vecs.linfix, *edi, cr);
+    project_to_eigvectors(x, &edi->vecs.linacc, *edi, cr);
+    project_to_eigvectors(x, &edi->vecs.radfix, *edi, cr);
+    project_to_eigvectors(x, &edi->vecs.radacc, *edi, cr);
+    project_to_eigvectors(x, &edi->vecs.radcon, *edi, cr);
 }
 
 namespace
@@ -503,7 +587,7 @@ struct t_do_edfit
     double** om;
 };
 
-static void do_edfit(int natoms, rvec* xp, rvec* x, matrix R, t_edpar* edi)
+static void do_edfit(int natoms, rvec* xp, rvec* x, matrix R, t_edpar* edi, const t_commrec* cr)
 {
     /* this is a copy of do_fit with some modifications */
     int    c, r, n, j, i, irot;
@@ -547,9 +631,10 @@ static void do_edfit(int natoms, rvec* xp, rvec* x, matrix R, t_edpar* edi)
         }
     }
 
-    /* calculate the matrix U */
-    clear_mat(u);
-    for (n = 0; (n < natoms); n++)
+    /* calculate the matrix U, with domain decomposition every rank sums over a part of the atoms */
+    const auto [atomBegin, atomEnd] = atomRangeOfRank(natoms, cr);
+    double     usum[DIM * DIM]      = { 0 };
+    for (n = atomBegin; n < atomEnd; n++)
     {
         for (c = 0; (c < DIM); c++)
         {
@@ -557,10 +642,21 @@ static void do_edfit(int natoms, rvec* xp, rvec* x, matrix R, t_edpar* edi)
             for (r = 0; (r < DIM); r++)
             {
                 xnr = x[n][r];
-                u[c][r] += xnr * xpc;
+                usum[c * DIM + r] += xnr * xpc;
             }
         }
     }
+    if (haveAtomsSplitOverRanks(cr))
+    {
+        gmx_sumd(DIM * DIM, usum, cr);
+    }
+    for (c = 0; (c < DIM); c++)
+    {
+        for (r = 0; (r < DIM); r++)
+        {
+            u[c][r] = usum[c * DIM + r];
+        }
+    }
 
     /* construct loc->omega */
     /* loc->omega is symmetric -> loc->omega==loc->omega' */
@@ -854,26 +950,25 @@ namespace
 void flood_blowup(const t_edpar& edi, rvec* forces_cart)
 {
     const real* forces_sub = edi.flood.vecs.fproj;
-    /* Calculate the cartesian forces for the local atoms */
-
-    /* Clear forces first */
-    for (int j = 0; j < edi.sav.nr_loc; j++)
-    {
-        clear_rvec(forces_cart[j]);
-    }
+    /* Calculate the cartesian forces for the local atoms, distributed over the threads */
+    const int numThreads = numThreadsForEdLoop(
+            edi.sav.nr_loc, static_cast<int64_t>(edi.sav.nr_loc) * edi.flood.vecs.neig);
 
-    /* Now compute atomwise */
+    /* Compute atomwise */
+#pragma omp parallel for num_threads(numThreads) schedule(static)
     for (int j = 0; j < edi.sav.nr_loc; j++)
     {
         /* Compute forces_cart[edi.sav.anrs[j]] */
+        rvec force = { 0, 0, 0 };
         for (int eig = 0; eig < edi.flood.vecs.neig; eig++)
         {
             rvec addedForce;
             /* Force vector is force * eigenvector (compute only atom j) */
             svmul(forces_sub[eig], edi.flood.vecs.vec[eig][edi.sav.c_ind[j]], addedForce);
             /* Add this vector to the cartesian forces */
-            rvec_inc(forces_cart[j], addedForce);
+            rvec_inc(force, addedForce);
         }
+        copy_rvec(force, forces_cart[j]);
     }
 }
 
@@ -928,14 +1023,14 @@ static void do_single_flood(FILE*            edo,
      * the collective ED array buf->xcoll */
     communicate_group_positions(cr, buf->xcoll, buf->shifts_xcoll, buf->extra_shifts_xcoll, bNS, x,
                                 edi->sav.nr, edi->sav.nr_loc, edi->sav.anrs_loc, edi->sav.c_ind,
-                                edi->sav.x_old, box);
+                                edi->sav.x_old, box, &buf->xcollPlan);
 
     /* Only assembly REFERENCE positions if their indices differ from the average ones */
     if (!edi->bRefEqAv)
     {
         communicate_group_positions(cr, buf->xc_ref, buf->shifts_xc_ref, buf->extra_shifts_xc_ref,
                                     bNS, x, edi->sref.nr, edi->sref.nr_loc, edi->sref.anrs_loc,
-                                    edi->sref.c_ind, edi->sref.x_old, box);
+                                    edi->sref.c_ind, edi->sref.x_old, box, &buf->xc_refPlan);
     }
 
     /* If bUpdateShifts was TRUE, the shifts have just been updated in get_positions.
@@ -948,18 +1043,18 @@ static void do_single_flood(FILE*            edo,
     /* Fit the reference indices to the reference structure */
     if (edi->bRefEqAv)
     {
-        fit_to_reference(buf->xcoll, transvec, rotmat, edi);
+        fit_to_reference(buf->xcoll, transvec, rotmat, edi, cr);
     }
     else
     {
-        fit_to_reference(buf->xc_ref, transvec, rotmat, edi);
+        fit_to_reference(buf->xc_ref, transvec, rotmat, edi, cr);
     }
 
     /* Now apply the translation and rotation to the ED structure */
     translate_and_rotate(buf->xcoll, edi->sav.nr, transvec, rotmat);
 
     /* Project fitted structure onto supbspace -> store in edi->flood.vecs.xproj */
-    project_to_eigvectors(buf->xcoll, &edi->flood.vecs, *edi);
+    project_to_eigvectors(buf->xcoll, &edi->flood.vecs, *edi, cr);
 
     if (!edi->flood.bConstForce)
     {
@@ -1875,10 +1970,11 @@ struct t_fit_to_ref
  * Do not actually do the fit, just return rotation and translation.
  * Note that the COM of the reference structure was already put into
  * the origin by init_edi. */
-static void fit_to_reference(rvec*    xcoll,    /* The positions to be fitted */
-                             rvec     transvec, /* The translation vector */
-                             matrix   rotmat,   /* The rotation matrix */
-                             t_edpar* edi)      /* Just needed for do_edfit */
+static void fit_to_reference(rvec*            xcoll,    /* The positions to be fitted */
+                             rvec             transvec, /* The translation vector */
+                             matrix           rotmat,   /* The rotation matrix */
+                             t_edpar*         edi,      /* Just needed for do_edfit */
+                             const t_commrec* cr) /* nullptr when not called on all PP ranks */
 {
     rvec                 com; /* center of mass */
     int                  i;
@@ -1910,7 +2006,7 @@ static void fit_to_reference(rvec*    xcoll,    /* The positions to be fitted */
     translate_x(loc->xcopy, edi->sref.nr, transvec);
 
     /* Determine the rotation matrix */
-    do_edfit(edi->sref.nr, edi->sref.x, loc->xcopy, rotmat, edi);
+    do_edfit(edi->sref.nr, edi->sref.x, loc->xcopy, rotmat, edi, cr);
 }
 
 
@@ -2828,7 +2924,7 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
             copy_rvecn(edi->sav.x_old, xstart, 0, edi->sav.nr);
 
             /* Make the fit to the REFERENCE structure, get translation and rotation */
-            fit_to_reference(xfit, fit_transvec, fit_rotmat, &(*edi));
+            fit_to_reference(xfit, fit_transvec, fit_rotmat, &(*edi), nullptr);
 
             /* Output how well we fit to the reference at the start */
             translate_and_rotate(xfit, edi->sref.nr, fit_transvec, fit_rotmat);
@@ -2844,7 +2940,7 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
             translate_and_rotate(xstart, edi->sav.nr, fit_transvec, fit_rotmat);
 
             /* calculate initial projections */
-            project(xstart, &(*edi));
+            project(xstart, &(*edi), nullptr);
 
             /* For the target and origin structure both a reference (fit) and an
              * average structure can be provided in make_edi. If both structures
@@ -2860,7 +2956,7 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
                 fprintf(stderr, "ED: Fitting target structure to reference structure\n");
 
                 /* get translation & rotation for fit of target structure to reference structure */
-                fit_to_reference(edi->star.x, fit_transvec, fit_rotmat, &(*edi));
+                fit_to_reference(edi->star.x, fit_transvec, fit_rotmat, &(*edi), nullptr);
                 /* do the fit */
                 translate_and_rotate(edi->star.x, edi->star.nr, fit_transvec, fit_rotmat);
                 if (edi->star.nr == edi->sav.nr)
@@ -2873,11 +2969,11 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
                      * the average structure, which must be projected */
                     avindex = edi->star.nr - edi->sav.nr;
                 }
-                rad_project(*edi, &edi->star.x[avindex], &edi->vecs.radcon);
+                rad_project(*edi, &edi->star.x[avindex], &edi->vecs.radcon, nullptr);
             }
             else
             {
-                rad_project(*edi, xstart, &edi->vecs.radcon);
+                rad_project(*edi, xstart, &edi->vecs.radcon, nullptr);
             }
 
             /* process structure that will serve as origin of expansion circle */
@@ -2892,7 +2988,7 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
                 fprintf(stderr, "ED: Fitting origin structure to reference structure\n");
 
                 /* fit this structure to reference structure */
-                fit_to_reference(edi->sori.x, fit_transvec, fit_rotmat, &(*edi));
+                fit_to_reference(edi->sori.x, fit_transvec, fit_rotmat, &(*edi), nullptr);
                 /* do the fit */
                 translate_and_rotate(edi->sori.x, edi->sori.nr, fit_transvec, fit_rotmat);
                 if (edi->sori.nr == edi->sav.nr)
@@ -2905,15 +3001,15 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
                     avindex = edi->sori.nr - edi->sav.nr;
                 }
 
-                rad_project(*edi, &edi->sori.x[avindex], &edi->vecs.radacc);
-                rad_project(*edi, &edi->sori.x[avindex], &edi->vecs.radfix);
+                rad_project(*edi, &edi->sori.x[avindex], &edi->vecs.radacc, nullptr);
+                rad_project(*edi, &edi->sori.x[avindex], &edi->vecs.radfix, nullptr);
                 if ((EssentialDynamicsType::Flooding == ed->eEDtype) && (!edi->flood.bConstForce))
                 {
                     fprintf(stderr,
                             "ED: The ORIGIN structure will define the flooding potential "
                             "center.\n");
                     /* Set center of flooding potential to the ORIGIN structure */
-                    rad_project(*edi, &edi->sori.x[avindex], &edi->flood.vecs);
+                    rad_project(*edi, &edi->sori.x[avindex], &edi->flood.vecs, nullptr);
                     /* We already know that no (moving) reference position was provided,
                      * therefore we can overwrite refproj[0]*/
                     copyEvecReference(&edi->flood.vecs, edi->flood.initialReferenceProjection);
@@ -2921,8 +3017,8 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
             }
             else /* No origin structure given */
             {
-                rad_project(*edi, xstart, &edi->vecs.radacc);
-                rad_project(*edi, xstart, &edi->vecs.radfix);
+                rad_project(*edi, xstart, &edi->vecs.radacc, nullptr);
+                rad_project(*edi, xstart, &edi->vecs.radfix, nullptr);
                 if ((EssentialDynamicsType::Flooding == ed->eEDtype) && (!edi->flood.bConstForce))
                 {
                     if (edi->flood.bHarmonic)
@@ -2966,8 +3062,8 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
             }
 
             /* set starting projections for linsam */
-            rad_project(*edi, xstart, &edi->vecs.linacc);
-            rad_project(*edi, xstart, &edi->vecs.linfix);
+            rad_project(*edi, xstart, &edi->vecs.linacc, nullptr);
+            rad_project(*edi, xstart, &edi->vecs.linfix, nullptr);
 
             /* Prepare for the next edi data set: */
             ++edi;
@@ -3031,7 +3127,7 @@ std::unique_ptr<gmx::EssentialDynamics> init_edsam(const gmx::MDLogger&        m
     {
         /* Allocate space for ED buffer variables */
         snew_bc(MASTER(cr), edi->buf, 1); /* MASTER has already allocated edi->buf in init_edi() */
-        snew(edi->buf->do_edsam, 1);
+        edi->buf->do_edsam = new t_do_edsam();
 
         /* Space for collective ED buffer variables */
 
@@ -3108,7 +3204,8 @@ void do_edsam(const t_inputrec* ir, int64_t step, const t_commrec* cr, rvec xs[]
 
             communicate_group_positions(cr, buf->xcoll, buf->shifts_xcoll, buf->extra_shifts_xcoll,
                                         PAR(cr) ? buf->bUpdateShifts : TRUE, xs, edi.sav.nr, edi.sav.nr_loc,
-                                        edi.sav.anrs_loc, edi.sav.c_ind, edi.sav.x_old, box);
+                                        edi.sav.anrs_loc, edi.sav.c_ind, edi.sav.x_old, box,
+                                        &buf->xcollPlan);
 
             /* Only assembly reference positions if their indices differ from the average ones */
             if (!edi.bRefEqAv)
@@ -3116,7 +3213,7 @@ void do_edsam(const t_inputrec* ir, int64_t step, const t_commrec* cr, rvec xs[]
                 communicate_group_positions(
                         cr, buf->xc_ref, buf->shifts_xc_ref, buf->extra_shifts_xc_ref,
                         PAR(cr) ? buf->bUpdateShifts : TRUE, xs, edi.sref.nr, edi.sref.nr_loc,
-                        edi.sref.anrs_loc, edi.sref.c_ind, edi.sref.x_old, box);
+                        edi.sref.anrs_loc, edi.sref.c_ind, edi.sref.x_old, box, &buf->xc_refPlan);
             }
 
             /* If bUpdateShifts was TRUE then the shifts have just been updated in communicate_group_positions.
@@ -3130,11 +3227,11 @@ void do_edsam(const t_inputrec* ir, int64_t step, const t_commrec* cr, rvec xs[]
             /* Fit the reference indices to the reference structure */
             if (edi.bRefEqAv)
             {
-                fit_to_reference(buf->xcoll, transvec, rotmat, &edi);
+                fit_to_reference(buf->xcoll, transvec, rotmat, &edi, cr);
             }
             else
             {
-                fit_to_reference(buf->xc_ref, transvec, rotmat, &edi);
+                fit_to_reference(buf->xc_ref, transvec, rotmat, &edi, cr);
             }
 
             /* Now apply the translation and rotation to the ED structure */
@@ -3160,9 +3257,9 @@ void do_edsam(const t_inputrec* ir, int64_t step, const t_commrec* cr, rvec xs[]
             /* update radsam references, when required */
             if (do_per_step(step, edi.maxedsteps) && step >= edi.presteps)
             {
-                project(buf->xcoll, &edi);
-                rad_project(edi, buf->xcoll, &edi.vecs.radacc);
-                rad_project(edi, buf->xcoll, &edi.vecs.radfix);
+                project(buf->xcoll, &edi, cr);
+                rad_project(edi, buf->xcoll, &edi.vecs.radacc, cr);
+                rad_project(edi, buf->xcoll, &edi.vecs.radfix, cr);
                 buf->oldrad = -1.e5;
             }
 
@@ -3172,8 +3269,8 @@ void do_edsam(const t_inputrec* ir, int64_t step, const t_commrec* cr, rvec xs[]
                 edi.vecs.radacc.radius = calc_radius(edi.vecs.radacc);
                 if (edi.vecs.radacc.radius - buf->oldrad < edi.slope)
                 {
-                    project(buf->xcoll, &edi);
-                    rad_project(edi, buf->xcoll, &edi.vecs.radacc);
+                    project(buf->xcoll, &edi, cr);
+                    rad_project(edi, buf->xcoll, &edi.vecs.radacc, cr);
                     buf->oldrad = 0.0;
                 }
                 else
@@ -3193,7 +3290,7 @@ void do_edsam(const t_inputrec* ir, int64_t step, const t_commrec* cr, rvec xs[]
             /* write to edo, when required */
             if (do_per_step(step, edi.outfrq))
             {
-                project(buf->xcoll, &edi);
+                project(buf->xcoll, &edi, cr);
                 if (MASTER(cr) && !bSuppress)
                 {
                     write_edo(edi, ed->edo, rmsdev);
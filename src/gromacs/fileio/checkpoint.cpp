@@ -523,20 +523,6 @@ static inline unsigned int sizeOfXdrType(int xdrType)
     return 0;
 }
 
-//! \brief Returns the XDR process function for i/o of an XDR type
-static inline xdrproc_t xdrProc(int xdrType)
-{
-    switch (xdrType)
-    {
-        case xdr_datatype_int: return reinterpret_cast<xdrproc_t>(xdr_int);
-        case xdr_datatype_float: return reinterpret_cast<xdrproc_t>(xdr_float);
-        case xdr_datatype_double: return reinterpret_cast<xdrproc_t>(xdr_double);
-        default: GMX_RELEASE_ASSERT(false, "XDR data type not implemented");
-    }
-
-    return nullptr;
-}
-
 /*! \brief Lists or only reads an xdr vector from checkpoint file
  *
  * When list!=NULL reads and lists the \p nf vector elements of type \p xdrType.
@@ -550,7 +536,7 @@ static bool_t listXdrVector(XDR* xd, StatePart part, int ecpt, int nf, int xdrTy
 
     const unsigned int elemSize = sizeOfXdrType(xdrType);
     std::vector<char>  data(nf * elemSize);
-    res = xdr_vector(xd, data.data(), nf, elemSize, xdrProc(xdrType));
+    res = xdr_vector_bulk(xd, data.data(), nf, elemSize);
 
     if (list != nullptr)
     {
@@ -760,8 +746,7 @@ static int doVectorLow(XDR*                           xd,
         {
             snew(vChar, numElemInTheFile * sizeOfXdrType(xdrTypeInTheFile));
         }
-        res = xdr_vector(xd, vChar, numElemInTheFile, sizeOfXdrType(xdrTypeInTheFile),
-                         xdrProc(xdrTypeInTheFile));
+        res = xdr_vector_bulk(xd, vChar, numElemInTheFile, sizeOfXdrType(xdrTypeInTheFile));
         if (res == 0)
         {
             return -1;
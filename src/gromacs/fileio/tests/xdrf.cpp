@@ -0,0 +1,171 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2020, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for bulk XDR i/o of arrays.
+ *
+ * \ingroup module_fileio
+ */
+#include "gmxpre.h"
+
+#include "gromacs/fileio/xdrf.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/fileio/gmxfio.h"
+#include "gromacs/fileio/gmxfio_xdr.h"
+
+#include "testutils/testfilemanager.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+//! Returns the per-element XDR routine for type T.
+template<typename T>
+xdrproc_t xdrElementProc();
+
+template<>
+xdrproc_t xdrElementProc<int>()
+{
+    return reinterpret_cast<xdrproc_t>(xdr_int);
+}
+
+template<>
+xdrproc_t xdrElementProc<float>()
+{
+    return reinterpret_cast<xdrproc_t>(xdr_float);
+}
+
+template<>
+xdrproc_t xdrElementProc<double>()
+{
+    return reinterpret_cast<xdrproc_t>(xdr_double);
+}
+
+//! Returns test values that differ in all bytes of the elements.
+template<typename T>
+std::vector<T> makeTestValues(int count)
+{
+    std::vector<T> values(count);
+    for (int i = 0; i < count; ++i)
+    {
+        values[i] = static_cast<T>((i % 2 == 0 ? 1 : -1) * (37 * i + 89)) / 7;
+    }
+    return values;
+}
+
+//! Test fixture for bulk XDR i/o.
+class XdrVectorBulkTest : public ::testing::TestWithParam<int>
+{
+public:
+    ~XdrVectorBulkTest() override
+    {
+        if (file_)
+        {
+            gmx_fio_close(file_);
+        }
+    }
+
+    /*! \brief Writes values in bulk and checks that reading them back
+     * element by element and in bulk gives the same values.
+     */
+    template<typename T>
+    void runRoundTrip(int count)
+    {
+        std::vector<T> values = makeTestValues<T>(count);
+        file_                 = gmx_fio_open(filename_.c_str(), "w");
+        EXPECT_NE(0, xdr_vector_bulk(gmx_fio_getxdr(file_), reinterpret_cast<char*>(values.data()),
+                                     count, sizeof(T)));
+        // Writing must leave the values in memory untouched.
+        EXPECT_EQ(makeTestValues<T>(count), values);
+        gmx_fio_close(file_);
+
+        std::vector<T> perElement(count);
+        file_ = gmx_fio_open(filename_.c_str(), "r");
+        EXPECT_NE(0, xdr_vector(gmx_fio_getxdr(file_), reinterpret_cast<char*>(perElement.data()),
+                                count, sizeof(T), xdrElementProc<T>()));
+        gmx_fio_close(file_);
+        EXPECT_EQ(values, perElement);
+
+        std::vector<T> bulk(count);
+        file_ = gmx_fio_open(filename_.c_str(), "r");
+        EXPECT_NE(0, xdr_vector_bulk(gmx_fio_getxdr(file_), reinterpret_cast<char*>(bulk.data()),
+                                     count, sizeof(T)));
+        gmx_fio_close(file_);
+        file_ = nullptr;
+        EXPECT_EQ(values, bulk);
+    }
+
+    TestFileManager fileManager_;
+    // Use an extension that gmx_fio_open() opens as binary XDR.
+    std::string filename_ = fileManager_.getTemporaryFilePath("data.edr");
+    t_fileio*   file_     = nullptr;
+};
+
+TEST_P(XdrVectorBulkTest, RoundTripsInts)
+{
+    runRoundTrip<int>(GetParam());
+}
+
+TEST_P(XdrVectorBulkTest, RoundTripsFloats)
+{
+    runRoundTrip<float>(GetParam());
+}
+
+TEST_P(XdrVectorBulkTest, RoundTripsDoubles)
+{
+    runRoundTrip<double>(GetParam());
+}
+
+/*! \brief Element counts to test
+ *
+ * The bulk routine converts 64 KiB at a time, i.e., 16384 elements of
+ * 4 bytes or 8192 elements of 8 bytes. The counts cover less than one
+ * buffer, exact multiples and counts with a partial last buffer.
+ */
+const int c_elementCounts[] = { 0, 1, 1001, 8192, 16384, 16391, 3 * 16384 + 5 };
+
+INSTANTIATE_TEST_CASE_P(WithCounts, XdrVectorBulkTest, ::testing::ValuesIn(c_elementCounts));
+
+} // namespace
+} // namespace test
+} // namespace gmx
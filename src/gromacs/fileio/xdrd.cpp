@@ -36,9 +36,13 @@
  */
 #include "gmxpre.h"
 
+#include <algorithm>
+#include <vector>
+
 #include "gromacs/fileio/xdrf.h"
 #include "gromacs/math/vectypes.h"
 #include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/gmxassert.h"
 #include "gromacs/utility/smalloc.h"
 
 int xdr_real(XDR* xdrs, real* r)
@@ -131,3 +135,63 @@ int xdr_int64(XDR* xdrs, int64_t* i)
 
     return ret;
 }
+
+//! Number of bytes converted at a time by xdr_vector_bulk()
+static constexpr int c_xdrBulkBufferSize = 65536;
+
+int xdr_vector_bulk(XDR* xdrs, char* data, int count, unsigned int elemSize)
+{
+    GMX_RELEASE_ASSERT(elemSize == 4 || elemSize == 8,
+                       "Bulk xdr i/o requires element sizes without padding");
+    if (xdrs->x_op == XDR_FREE)
+    {
+        return 1;
+    }
+    const bool bSwap          = !GMX_INTEGER_BIG_ENDIAN;
+    const int  elemPerBuffer  = c_xdrBulkBufferSize / elemSize;
+    const int  bufferElements = std::min(count, elemPerBuffer);
+    /* Only writing needs a buffer, since the data should not be modified.
+     * It is allocated on the heap and reused for all blocks.
+     */
+    std::vector<char> buffer;
+    if (xdrs->x_op == XDR_ENCODE && bufferElements > 0)
+    {
+        buffer.resize(bufferElements * elemSize);
+    }
+    for (int start = 0; start < count; start += elemPerBuffer)
+    {
+        const unsigned int n        = std::min(elemPerBuffer, count - start);
+        const unsigned int numBytes = n * elemSize;
+        char*              elem     = data + static_cast<size_t>(start) * elemSize;
+        if (xdrs->x_op == XDR_ENCODE)
+        {
+            std::copy(elem, elem + numBytes, buffer.begin());
+            if (bSwap)
+            {
+                for (unsigned int i = 0; i < numBytes; i += elemSize)
+                {
+                    std::reverse(buffer.begin() + i, buffer.begin() + i + elemSize);
+                }
+            }
+            if (xdr_opaque(xdrs, buffer.data(), numBytes) == 0)
+            {
+                return 0;
+            }
+        }
+        else
+        {
+            if (xdr_opaque(xdrs, elem, numBytes) == 0)
+            {
+                return 0;
+            }
+            if (bSwap)
+            {
+                for (unsigned int i = 0; i < numBytes; i += elemSize)
+                {
+                    std::reverse(elem + i, elem + i + elemSize);
+                }
+            }
+        }
+    }
+    return 1;
+}
@@ -73,6 +73,17 @@ int xdr_int32(XDR* xdrs, int32_t* i);
 //! Read or write a int64_t value.
 int xdr_int64(XDR* xdrs, int64_t* i);
 
+/*! \brief Read or write \p count elements of \p elemSize bytes in bulk.
+ *
+ * Gives exactly the same stream contents as xdr_vector() with xdr_int,
+ * xdr_float or xdr_double, i.e., the elements in big-endian byte order
+ * without padding, but converts the byte order in memory and transfers
+ * the data with one xdr_opaque() call per buffer instead of a stream call
+ * per element. \p elemSize must be 4 or 8, and the elements must have
+ * two's complement or IEEE representation.
+ */
+int xdr_vector_bulk(XDR* xdrs, char* data, int count, unsigned int elemSize);
+
 int xdr_xtc_seek_time(real time, FILE* fp, XDR* xdrs, int natoms, gmx_bool bSeekForwardOnly);
 
 
@@ -66,6 +66,25 @@ struct t_define
     std::string def;
 };
 
+/*! \brief Macro definitions, shared by a handle and the handles of all files it includes
+ *
+ * Next to the definitions themselves, the table keeps the names in hash sets,
+ * so that lines without any macro to substitute, which are by far the most
+ * common ones, can be passed on after a single scan over their words,
+ * instead of after a search for each defined macro.
+ */
+struct DefineTable
+{
+    //! The definitions, in the order in which they were first defined
+    std::vector<t_define> defines;
+    //! The names of all definitions
+    std::unordered_set<std::string> names;
+    //! The names of the definitions with a non-empty value, these are substituted
+    std::unordered_set<std::string> substitutedNames;
+    //! The number of names in \p substitutedNames that are not a single word
+    int numNonWordSubstitutedNames = 0;
+};
+
 /* enum used for handling ifdefs */
 enum
 {
@@ -77,7 +96,7 @@ enum
 
 struct gmx_cpp
 {
-    std::shared_ptr<std::vector<t_define>>    defines;
+    std::shared_ptr<DefineTable>              defines;
     std::shared_ptr<std::vector<std::string>> includes;
     std::unordered_set<std::string>           unmatched_defines;
     FILE*                                     fp = nullptr;
@@ -96,24 +115,66 @@ static bool is_word_end(char c)
     return !((isalnum(c) != 0) || c == '_');
 }
 
+static bool is_single_word(const std::string& s)
+{
+    return !s.empty() && std::none_of(s.begin(), s.end(), is_word_end);
+}
+
 static const char* strstrw(const char* buf, const char* word)
 {
-    const char* ptr;
+    const size_t wordLength = strlen(word);
+    const char*  ptr        = buf;
 
-    while ((ptr = strstr(buf, word)) != nullptr)
+    while ((ptr = strstr(ptr, word)) != nullptr)
     {
         /* Check if we did not find part of a longer word */
-        if (ptr && is_word_end(ptr[strlen(word)])
-            && (((ptr > buf) && is_word_end(ptr[-1])) || (ptr == buf)))
+        if (is_word_end(ptr[wordLength]) && ((ptr == buf) || is_word_end(ptr[-1])))
         {
             return ptr;
         }
 
-        buf = ptr + strlen(word);
+        ptr += wordLength;
     }
     return nullptr;
 }
 
+/* Returns whether buf might contain a macro that should be substituted.
+ * Only returns false when it is certain that no substitution is needed.
+ */
+static bool hasDefineToSubstitute(const char* buf, const DefineTable& defines)
+{
+    if (defines.substitutedNames.empty())
+    {
+        return false;
+    }
+    if (defines.numNonWordSubstitutedNames > 0)
+    {
+        return true;
+    }
+    /* Look up each word of the line, since only whole words are substituted */
+    std::string word;
+    const char* ptr = buf;
+    while (*ptr != '\0')
+    {
+        if (is_word_end(*ptr))
+        {
+            ptr++;
+            continue;
+        }
+        const char* wordStart = ptr;
+        while (!is_word_end(*ptr))
+        {
+            ptr++;
+        }
+        word.assign(wordStart, ptr - wordStart);
+        if (defines.substitutedNames.count(word) > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Finds a preprocessor directive, whose name (after the '#') is
  * returned in *name, and the remainder of the line after leading
  * whitespace, without trailing whitespace, is returned in *val
@@ -191,21 +252,65 @@ static void add_include(std::vector<std::string>* includes, const char* includeP
     includes->push_back(includePath);
 }
 
-static void add_define(std::vector<t_define>* defines, const std::string& name, const char* value)
+static void set_substituted(DefineTable* defines, const std::string& name, bool bSubstituted)
+{
+    const bool bWasSubstituted = (defines->substitutedNames.count(name) > 0);
+    if (bSubstituted == bWasSubstituted)
+    {
+        return;
+    }
+    if (bSubstituted)
+    {
+        defines->substitutedNames.insert(name);
+    }
+    else
+    {
+        defines->substitutedNames.erase(name);
+    }
+    if (!is_single_word(name))
+    {
+        defines->numNonWordSubstitutedNames += (bSubstituted ? 1 : -1);
+    }
+}
+
+static void add_define(DefineTable* defines, const std::string& name, const char* value)
 {
     GMX_RELEASE_ASSERT(defines, "Need defines");
     GMX_RELEASE_ASSERT(value, "Need a value");
 
-    for (t_define& define : *defines)
+    set_substituted(defines, name, value[0] != '\0');
+
+    if (defines->names.count(name) > 0)
     {
-        if (define.name == name)
+        for (t_define& define : defines->defines)
         {
-            define.def = value;
-            return;
+            if (define.name == name)
+            {
+                define.def = value;
+                return;
+            }
         }
     }
 
-    defines->push_back({ name, value });
+    defines->names.insert(name);
+    defines->defines.push_back({ name, value });
+}
+
+static void remove_define(DefineTable* defines, const std::string& name)
+{
+    if (defines->names.erase(name) == 0)
+    {
+        return;
+    }
+    set_substituted(defines, name, false);
+    for (size_t i = 0; i < defines->defines.size(); i++)
+    {
+        if (defines->defines[i].name == name)
+        {
+            defines->defines.erase(defines->defines.begin() + i);
+            break;
+        }
+    }
 }
 
 /* Open the file to be processed. The handle variable holds internal
@@ -213,7 +318,7 @@ static void add_define(std::vector<t_define>* defines, const std::string& name,
 static int cpp_open_file(const char*                                filenm,
                          gmx_cpp_t*                                 handle,
                          char**                                     cppopts,
-                         std::shared_ptr<std::vector<t_define>>*    definesFromParent,
+                         std::shared_ptr<DefineTable>*              definesFromParent,
                          std::shared_ptr<std::vector<std::string>>* includesFromParent)
 {
     // TODO: We should avoid new/delete, we should use Pimpl instead
@@ -226,7 +331,7 @@ static int cpp_open_file(const char*                                filenm,
     }
     else
     {
-        cpp->defines = std::make_shared<std::vector<t_define>>();
+        cpp->defines = std::make_shared<DefineTable>();
     }
 
     if (includesFromParent)
@@ -370,22 +475,16 @@ static int process_directive(gmx_cpp_t* handlep, const std::string& dname, const
             {
                 return eCPP_SYNTAX;
             }
-            bool found = false;
-            for (const t_define& define : *handle->defines)
+            bool found = (handle->defines->names.count(dval) > 0);
+            if (found)
             {
-                if (define.name == dval)
+                // erase from unmatched_defines in original handle
+                gmx_cpp_t root = handle;
+                while (root->parent != nullptr)
                 {
-                    // erase from unmatched_defines in original handle
-                    gmx_cpp_t root = handle;
-                    while (root->parent != nullptr)
-                    {
-                        root = root->parent;
-                    }
-                    root->unmatched_defines.erase(dval);
-
-                    found = true;
-                    break;
+                    root = root->parent;
                 }
+                root->unmatched_defines.erase(dval);
             }
             if ((bIfdef && found) || (bIfndef && !found))
             {
@@ -523,15 +622,7 @@ static int process_directive(gmx_cpp_t* handlep, const std::string& dname, const
         {
             return eCPP_SYNTAX;
         }
-        std::vector<t_define>& defines = *handle->defines;
-        for (size_t i = 0; i < defines.size(); i++)
-        {
-            if (defines[i].name == dval)
-            {
-                defines.erase(defines.begin() + i);
-                break;
-            }
-        }
+        remove_define(handle->defines.get(), dval);
 
         return eCPP_OK;
     }
@@ -623,7 +714,11 @@ int cpp_read_line(gmx_cpp_t* handlep, int n, char buf[])
        that we have to use a best fit algorithm, rather than first come
        first go. We do this by sorting the defines on length first, and
        then on alphabetical order. */
-    for (t_define& define : *handle->defines)
+    if (!hasDefineToSubstitute(buf, *handle->defines))
+    {
+        return eCPP_OK;
+    }
+    for (t_define& define : handle->defines->defines)
     {
         if (!define.def.empty())
         {
@@ -703,7 +798,7 @@ int cpp_close_file(gmx_cpp_t* handlep)
 
 const std::string* cpp_find_define(const gmx_cpp_t* handlep, const std::string& defineName)
 {
-    for (const t_define& define : *(*handlep)->defines)
+    for (const t_define& define : (*handlep)->defines->defines)
     {
         if (define.name == defineName)
         {
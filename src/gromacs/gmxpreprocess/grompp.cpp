@@ -260,7 +260,7 @@ static int rm_interactions(int ifunc, gmx::ArrayRef<MoleculeInformation> mols)
     for (auto& mol : mols)
     {
         n += mol.interactions[ifunc].size();
-        mol.interactions[ifunc].interactionTypes.clear();
+        mol.interactions[ifunc].clearInteractionTypes();
     }
     return n;
 }
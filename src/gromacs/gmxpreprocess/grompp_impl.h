@@ -39,7 +39,9 @@
 #ifndef GMX_GMXPREPROCESS_GROMPP_IMPL_H
 #define GMX_GMXPREPROCESS_GROMPP_IMPL_H
 
+#include <array>
 #include <string>
+#include <unordered_map>
 
 #include "gromacs/gmxpreprocess/notset.h"
 #include "gromacs/topology/atoms.h"
@@ -128,6 +130,45 @@ private:
     std::string interactionTypeName_;
 };
 
+/*! \libinternal \brief
+ * Lookup of interaction types by the bonded atom types of their atoms.
+ *
+ * Maps the atom types of an interaction type with at most four atoms,
+ * with -1 for wildcards, to the first interaction type in the list
+ * with exactly those atom types. It is filled on demand by the
+ * parameter assignment in toppush.cpp, which extends it when types
+ * have been appended to the list since the last lookup. Any other change
+ * to the list has to reset the lookup, see
+ * InteractionsOfType::invalidateTypeLookup(). Only the lists of
+ * force-field types get a lookup, the lists of a molecule type never do.
+ */
+struct InteractionTypeLookup
+{
+    //! Atom types of an interaction type, padded with -2.
+    using Key = std::array<int, 4>;
+    //! Hash for a Key.
+    struct KeyHash
+    {
+        //! Combines the hashes of the atom types.
+        size_t operator()(const Key& key) const
+        {
+            size_t hash = 0;
+            for (int type : key)
+            {
+                hash = hash * 1000003 + static_cast<size_t>(type + 2);
+            }
+            return hash;
+        }
+    };
+
+    //! The index of the first interaction type for each set of atom types.
+    std::unordered_map<Key, int, KeyHash> firstIndex;
+    //! Which combinations of wildcard positions are present, as bit masks.
+    std::array<bool, 16> haveWildcardMask = {};
+    //! The number of interaction types in the list that are in the lookup.
+    int numIndexed = 0;
+};
+
 /*! \libinternal \brief
  * A set of interactions of a given type
  * (found in the enumeration in ifunc.h), complete with
@@ -149,9 +190,23 @@ struct InteractionsOfType
     std::vector<real> cmap;
     //! The five atomtypes followed by a number that identifies the type.
     std::vector<int> cmapAtomTypes;
+    //! Lookup of the types by atom types, used for assigning default parameters.
+    InteractionTypeLookup typeLookup;
 
     //! Number of parameters.
     size_t size() const { return interactionTypes.size(); }
+    /*! \brief Resets the lookup of the types by atom types.
+     *
+     * Needs to be called after any change to interactionTypes other than
+     * appending types or changing their force parameters.
+     */
+    void invalidateTypeLookup() { typeLookup = InteractionTypeLookup(); }
+    //! Removes all types, together with the lookup of the types by atom types.
+    void clearInteractionTypes()
+    {
+        interactionTypes.clear();
+        invalidateTypeLookup();
+    }
     //! Elements in cmap grid data.
     int ncmap() const { return cmap.size(); }
     //! Number of elements in cmapAtomTypes.
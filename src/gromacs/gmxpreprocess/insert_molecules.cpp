@@ -76,6 +76,7 @@
 #include "gromacs/utility/enumerationhelpers.h"
 #include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 using gmx::RVec;
@@ -139,16 +140,23 @@ static void generate_trial_conf(gmx::ArrayRef<RVec>       xin,
     }
 }
 
-static bool isInsertionAllowed(gmx::AnalysisNeighborhoodSearch* search,
-                               const std::vector<real>&         exclusionDistances,
-                               const std::vector<RVec>&         x,
-                               const std::vector<real>&         exclusionDistances_insrt,
-                               const t_atoms&                   atoms,
-                               const std::set<int>&             removableAtoms,
-                               gmx::AtomsRemover*               remover)
+/*! \brief
+ * Checks whether a trial configuration can be inserted.
+ *
+ * Overlapping atoms that are in \p removableAtoms are appended to
+ * \p replacedAtoms in the order they are found, also if the insertion
+ * turns out not to be allowed.  Does not modify any shared state, so
+ * multiple trials can be checked concurrently.
+ */
+static bool isInsertionAllowed(const gmx::AnalysisNeighborhoodSearch& search,
+                               const std::vector<real>&               exclusionDistances,
+                               const std::vector<RVec>&               x,
+                               const std::vector<real>&               exclusionDistances_insrt,
+                               const std::set<int>&                   removableAtoms,
+                               std::vector<int>*                      replacedAtoms)
 {
     gmx::AnalysisNeighborhoodPositions  pos(x);
-    gmx::AnalysisNeighborhoodPairSearch pairSearch = search->startPairSearch(pos);
+    gmx::AnalysisNeighborhoodPairSearch pairSearch = search.startPairSearch(pos);
     gmx::AnalysisNeighborhoodPair       pair;
     while (pairSearch.findNextPair(&pair))
     {
@@ -160,14 +168,23 @@ static bool isInsertionAllowed(gmx::AnalysisNeighborhoodSearch* search,
             {
                 return false;
             }
-            // TODO: If molecule information is available, this should ideally
-            // use it to remove whole molecules.
-            remover->markResidue(atoms, pair.refIndex(), true);
+            replacedAtoms->push_back(pair.refIndex());
         }
     }
     return true;
 }
 
+//! Trial configuration for a molecule to insert.
+struct InsertionTrial
+{
+    //! Positions of the inserted atoms.
+    std::vector<RVec> x;
+    //! Whether the insertion is allowed.
+    bool bAllowed = false;
+    //! Removable atoms that overlap with the inserted atoms.
+    std::vector<int> replacedAtoms;
+};
+
 static void insert_mols(int                  nmol_insrt,
                         int                  ntry,
                         int                  seed,
@@ -241,7 +258,16 @@ static void insert_mols(int                  nmol_insrt,
         exclusionDistances.reserve(finalAtomCount);
     }
 
-    std::vector<RVec> x_n(x_insrt.size());
+    // With random positions, the trial configurations do not depend on
+    // whether earlier trials succeeded, so a batch of them can be generated
+    // in the same order as they would be tried one by one, and then checked
+    // in parallel against the current configuration.  The trials are then
+    // processed in order; after a successful insertion, the remaining trials
+    // in the batch are checked again against the new configuration.  This
+    // gives the same result as checking the trials one at a time.
+    // With -ip, the next trial depends on the outcome, so no batching is done.
+    const int                   batchSize = insertAtPositions ? 1 : gmx_omp_get_max_threads();
+    std::vector<InsertionTrial> trials(batchSize);
 
     int                                mol        = 0;
     int                                trial      = 0;
@@ -249,49 +275,82 @@ static void insert_mols(int                  nmol_insrt,
     int                                failed     = 0;
     gmx::UniformRealDistribution<real> dist;
 
+    // The search only needs to be reinitialized when atoms are inserted.
+    gmx::AnalysisNeighborhoodSearch search = nb.initSearch(&pbc, gmx::AnalysisNeighborhoodPositions(*x));
     while (mol < nmol_insrt && trial < ntry * nmol_insrt)
     {
-        rvec offset_x;
-        if (!insertAtPositions)
+        // Skip a position if ntry trials were not successful.
+        if (insertAtPositions && trial >= firstTrial + ntry)
         {
-            // Insert at random positions.
-            offset_x[XX] = box[XX][XX] * dist(rng);
-            offset_x[YY] = box[YY][YY] * dist(rng);
-            offset_x[ZZ] = box[ZZ][ZZ] * dist(rng);
+            fprintf(stderr, " skipped position (%.3f, %.3f, %.3f)\n", rpos[XX][mol], rpos[YY][mol],
+                    rpos[ZZ][mol]);
+            ++mol;
+            ++failed;
+            firstTrial = trial;
+            continue;
         }
-        else
+        const int trialCount = std::min(batchSize, ntry * nmol_insrt - trial);
+        for (int t = 0; t < trialCount; ++t)
         {
-            // Skip a position if ntry trials were not successful.
-            if (trial >= firstTrial + ntry)
+            rvec offset_x;
+            if (!insertAtPositions)
+            {
+                // Insert at random positions.
+                offset_x[XX] = box[XX][XX] * dist(rng);
+                offset_x[YY] = box[YY][YY] * dist(rng);
+                offset_x[ZZ] = box[ZZ][ZZ] * dist(rng);
+            }
+            else
             {
-                fprintf(stderr, " skipped position (%.3f, %.3f, %.3f)\n", rpos[XX][mol],
-                        rpos[YY][mol], rpos[ZZ][mol]);
-                ++mol;
-                ++failed;
-                firstTrial = trial;
-                continue;
+                // Insert at positions taken from option -ip file.
+                offset_x[XX] = rpos[XX][mol] + deltaR[XX] * (2 * dist(rng) - 1);
+                offset_x[YY] = rpos[YY][mol] + deltaR[YY] * (2 * dist(rng) - 1);
+                offset_x[ZZ] = rpos[ZZ][mol] + deltaR[ZZ] * (2 * dist(rng) - 1);
             }
-            // Insert at positions taken from option -ip file.
-            offset_x[XX] = rpos[XX][mol] + deltaR[XX] * (2 * dist(rng) - 1);
-            offset_x[YY] = rpos[YY][mol] + deltaR[YY] * (2 * dist(rng) - 1);
-            offset_x[ZZ] = rpos[ZZ][mol] + deltaR[ZZ] * (2 * dist(rng) - 1);
+            generate_trial_conf(x_insrt, offset_x, enum_rot, &rng, &trials[t].x);
         }
-        fprintf(stderr, "\rTry %d", ++trial);
-        fflush(stderr);
-
-        generate_trial_conf(x_insrt, offset_x, enum_rot, &rng, &x_n);
-        gmx::AnalysisNeighborhoodPositions pos(*x);
-        gmx::AnalysisNeighborhoodSearch    search = nb.initSearch(&pbc, pos);
-        if (isInsertionAllowed(&search, exclusionDistances, x_n, exclusionDistances_insrt, *atoms,
-                               removableAtoms, &remover))
+
+        int firstUnchecked = 0;
+        while (firstUnchecked < trialCount && mol < nmol_insrt)
         {
-            x->insert(x->end(), x_n.begin(), x_n.end());
-            exclusionDistances.insert(exclusionDistances.end(), exclusionDistances_insrt.begin(),
-                                      exclusionDistances_insrt.end());
-            builder.mergeAtoms(atoms_insrt);
-            ++mol;
-            firstTrial = trial;
-            fprintf(stderr, " success (now %d atoms)!\n", builder.currentAtomCount());
+#pragma omp parallel for num_threads(batchSize) schedule(static, 1)
+            for (int t = firstUnchecked; t < trialCount; ++t)
+            {
+                try
+                {
+                    trials[t].replacedAtoms.clear();
+                    trials[t].bAllowed =
+                            isInsertionAllowed(search, exclusionDistances, trials[t].x, exclusionDistances_insrt,
+                                               removableAtoms, &trials[t].replacedAtoms);
+                }
+                GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+            }
+            int t = firstUnchecked;
+            while (t < trialCount && mol < nmol_insrt)
+            {
+                InsertionTrial& current = trials[t++];
+                fprintf(stderr, "\rTry %d", ++trial);
+                fflush(stderr);
+                // TODO: If molecule information is available, this should ideally
+                // use it to remove whole molecules.
+                for (const int atomIndex : current.replacedAtoms)
+                {
+                    remover.markResidue(*atoms, atomIndex, true);
+                }
+                if (current.bAllowed)
+                {
+                    x->insert(x->end(), current.x.begin(), current.x.end());
+                    exclusionDistances.insert(exclusionDistances.end(), exclusionDistances_insrt.begin(),
+                                              exclusionDistances_insrt.end());
+                    builder.mergeAtoms(atoms_insrt);
+                    ++mol;
+                    firstTrial = trial;
+                    fprintf(stderr, " success (now %d atoms)!\n", builder.currentAtomCount());
+                    search = nb.initSearch(&pbc, gmx::AnalysisNeighborhoodPositions(*x));
+                    break;
+                }
+            }
+            firstUnchecked = t;
         }
     }
 
@@ -63,9 +63,11 @@
 #include "gromacs/topology/topology.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 using gmx::RVec;
@@ -280,17 +282,6 @@ static void replicateSolventBox(t_atoms*           atoms,
     fprintf(stderr, "Will generate new solvent configuration of %dx%dx%d boxes\n", n_box[XX],
             n_box[YY], n_box[ZZ]);
 
-    // Create arrays for storing the generated system (cannot be done in-place
-    // in case the target box is smaller than the original in one dimension,
-    // but not in all).
-    t_atoms newAtoms;
-    init_t_atoms(&newAtoms, 0, FALSE);
-    gmx::AtomsBuilder builder(&newAtoms, nullptr);
-    builder.reserve(atoms->nr * nmol, atoms->nres * nmol);
-    std::vector<RVec> newX(atoms->nr * nmol);
-    std::vector<RVec> newV(!v->empty() ? atoms->nr * nmol : 0);
-    std::vector<real> newR(atoms->nr * nmol);
-
     const real maxRadius = *std::max_element(r->begin(), r->end());
     rvec       boxWithMargin;
     for (int i = 0; i < DIM; ++i)
@@ -299,47 +290,109 @@ static void replicateSolventBox(t_atoms*           atoms,
         boxWithMargin[i] = boxTarget[i][i] + 3 * maxRadius;
     }
 
-    for (int ix = 0; ix < n_box[XX]; ++ix)
+    // Find the atom ranges of the residues in the original box.
+    std::vector<int> residueStart;
+    for (int i = 0; i < atoms->nr; ++i)
     {
-        rvec delta;
+        if (i == 0 || atoms->atom[i].resind != atoms->atom[i - 1].resind)
+        {
+            residueStart.push_back(i);
+        }
+    }
+    const int residueCount = residueStart.size();
+    residueStart.push_back(atoms->nr);
+
+    // A residue is kept if any of its atoms is within the target box.
+    auto isResidueKept = [&](const rvec delta, int residue) {
+        for (int i = residueStart[residue]; i < residueStart[residue + 1]; ++i)
+        {
+            bool bKeepAtom = true;
+            for (int m = 0; m < DIM; ++m)
+            {
+                const real newCoord = delta[m] + (*x)[i][m];
+                bKeepAtom           = bKeepAtom && (newCoord < boxWithMargin[m]);
+            }
+            if (bKeepAtom)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+    auto boxShift = [&](int ix, int iy, int iz, rvec delta) {
         delta[XX] = ix * box[XX][XX];
+        delta[YY] = iy * box[YY][YY];
+        delta[ZZ] = iz * box[ZZ][ZZ];
+    };
+
+    // Count the kept atoms first, so that only the generated system needs
+    // to be stored, instead of all the replicated copies.
+    int keptAtomCount    = 0;
+    int keptResidueCount = 0;
+    for (int ix = 0; ix < n_box[XX]; ++ix)
+    {
         for (int iy = 0; iy < n_box[YY]; ++iy)
         {
-            delta[YY] = iy * box[YY][YY];
             for (int iz = 0; iz < n_box[ZZ]; ++iz)
             {
-                delta[ZZ]         = iz * box[ZZ][ZZ];
-                bool bKeepResidue = false;
-                for (int i = 0; i < atoms->nr; ++i)
+                rvec delta;
+                boxShift(ix, iy, iz, delta);
+                for (int res = 0; res < residueCount; ++res)
                 {
-                    const int newIndex  = builder.currentAtomCount();
-                    bool      bKeepAtom = true;
-                    for (int m = 0; m < DIM; ++m)
+                    if (isResidueKept(delta, res))
                     {
-                        const real newCoord = delta[m] + (*x)[i][m];
-                        bKeepAtom           = bKeepAtom && (newCoord < boxWithMargin[m]);
-                        newX[newIndex][m]   = newCoord;
+                        keptAtomCount += residueStart[res + 1] - residueStart[res];
+                        ++keptResidueCount;
                     }
-                    bKeepResidue = bKeepResidue || bKeepAtom;
-                    if (!v->empty())
+                }
+            }
+        }
+    }
+
+    // Create arrays for storing the generated system (cannot be done in-place
+    // in case the target box is smaller than the original in one dimension,
+    // but not in all).
+    t_atoms newAtoms;
+    init_t_atoms(&newAtoms, 0, FALSE);
+    gmx::AtomsBuilder builder(&newAtoms, nullptr);
+    builder.reserve(keptAtomCount, keptResidueCount);
+    std::vector<RVec> newX;
+    std::vector<RVec> newV;
+    std::vector<real> newR;
+    newX.reserve(keptAtomCount);
+    newV.reserve(!v->empty() ? keptAtomCount : 0);
+    newR.reserve(keptAtomCount);
+
+    for (int ix = 0; ix < n_box[XX]; ++ix)
+    {
+        for (int iy = 0; iy < n_box[YY]; ++iy)
+        {
+            for (int iz = 0; iz < n_box[ZZ]; ++iz)
+            {
+                rvec delta;
+                boxShift(ix, iy, iz, delta);
+                for (int res = 0; res < residueCount; ++res)
+                {
+                    if (!isResidueKept(delta, res))
                     {
-                        copy_rvec((*v)[i], newV[newIndex]);
+                        continue;
                     }
-                    newR[newIndex] = (*r)[i];
-                    builder.addAtom(*atoms, i);
-                    if (i == atoms->nr - 1 || atoms->atom[i + 1].resind != atoms->atom[i].resind)
+                    for (int i = residueStart[res]; i < residueStart[res + 1]; ++i)
                     {
-                        if (bKeepResidue)
+                        RVec newCoord;
+                        for (int m = 0; m < DIM; ++m)
                         {
-                            builder.finishResidue(atoms->resinfo[atoms->atom[i].resind]);
+                            newCoord[m] = delta[m] + (*x)[i][m];
                         }
-                        else
+                        newX.push_back(newCoord);
+                        if (!v->empty())
                         {
-                            builder.discardCurrentResidue();
+                            newV.push_back((*v)[i]);
                         }
-                        // Reset state for the next residue.
-                        bKeepResidue = false;
+                        newR.push_back((*r)[i]);
+                        builder.addAtom(*atoms, i);
                     }
+                    builder.finishResidue(atoms->resinfo[atoms->atom[residueStart[res]].resind]);
                 }
             }
         }
@@ -353,19 +406,65 @@ static void replicateSolventBox(t_atoms*           atoms,
     atoms->atomname = newAtoms.atomname;
     atoms->resinfo  = newAtoms.resinfo;
 
-    newX.resize(atoms->nr);
     std::swap(*x, newX);
     if (!v->empty())
     {
-        newV.resize(atoms->nr);
         std::swap(*v, newV);
     }
-    newR.resize(atoms->nr);
     std::swap(*r, newR);
 
     fprintf(stderr, "Solvent box contains %d atoms in %d residues\n", atoms->nr, atoms->nres);
 }
 
+//! Number of solvent atoms searched at a time in findSolventAtomsNearSolute().
+static const int c_solventSearchBlockSize = 1024;
+
+/*! \brief
+ * Finds solvent atoms that have a solute neighbor fulfilling a condition.
+ *
+ * \param[in] search  Neighborhood search initialized with solute positions.
+ * \param[in] x       Solvent positions.
+ * \param[in] isMatch Called as `isMatch(i, pair)` for solvent atom `i` and
+ *     each pair within the cutoff, until it returns true.
+ * \returns   Flag for each solvent atom that has a matching pair.
+ *
+ * The solvent atoms are searched in blocks that are processed in parallel.
+ * The result does not depend on the number of threads.
+ */
+template<typename PairCondition>
+static std::vector<char> findSolventAtomsNearSolute(const gmx::AnalysisNeighborhoodSearch& search,
+                                                    const std::vector<RVec>&               x,
+                                                    PairCondition                          isMatch)
+{
+    const int         atomCount  = x.size();
+    const int         blockCount =
+            (atomCount + c_solventSearchBlockSize - 1) / c_solventSearchBlockSize;
+    std::vector<char> bMatch(atomCount, 0);
+#pragma omp parallel for num_threads(gmx_omp_get_max_threads()) schedule(dynamic)
+    for (int block = 0; block < blockCount; ++block)
+    {
+        try
+        {
+            const int begin = block * c_solventSearchBlockSize;
+            const int count = std::min(c_solventSearchBlockSize, atomCount - begin);
+            gmx::AnalysisNeighborhoodPositions  pos(as_rvec_array(x.data()) + begin, count);
+            gmx::AnalysisNeighborhoodPairSearch pairSearch = search.startPairSearch(pos);
+            gmx::AnalysisNeighborhoodPair       pair;
+            while (pairSearch.findNextPair(&pair))
+            {
+                const int i = begin + pair.testIndex();
+                if (isMatch(i, pair))
+                {
+                    bMatch[i] = 1;
+                    pairSearch.skipRemainingPairsForTestPosition();
+                }
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
+    return bMatch;
+}
+
 /*! \brief
  * Removes overlap of solvent atoms across the edges.
  *
@@ -486,19 +585,21 @@ static void removeSolventOutsideShell(t_atoms*                 atoms,
     gmx::AtomsRemover         remover(*atoms);
     gmx::AnalysisNeighborhood nb;
     nb.setCutoff(rshell);
-    gmx::AnalysisNeighborhoodPositions  posSolute(x_solute);
-    gmx::AnalysisNeighborhoodSearch     search = nb.initSearch(&pbc, posSolute);
-    gmx::AnalysisNeighborhoodPositions  pos(*x_solvent);
-    gmx::AnalysisNeighborhoodPairSearch pairSearch = search.startPairSearch(pos);
-    gmx::AnalysisNeighborhoodPair       pair;
+    gmx::AnalysisNeighborhoodPositions posSolute(x_solute);
+    gmx::AnalysisNeighborhoodSearch    search = nb.initSearch(&pbc, posSolute);
+    const std::vector<char>            bWithinShell = findSolventAtomsNearSolute(
+            search, *x_solvent,
+            [](int /*i*/, const gmx::AnalysisNeighborhoodPair& /*pair*/) { return true; });
 
     // Remove everything
     remover.markAll();
     // Now put back those within the shell without checking for overlap
-    while (pairSearch.findNextPair(&pair))
+    for (int i = 0; i < atoms->nr; ++i)
     {
-        remover.markResidue(*atoms, pair.testIndex(), false);
-        pairSearch.skipRemainingPairsForTestPosition();
+        if (bWithinShell[i])
+        {
+            remover.markResidue(*atoms, i, false);
+        }
     }
     remover.removeMarkedElements(x_solvent);
     if (!v_solvent->empty())
@@ -535,25 +636,24 @@ static void removeSolventOverlappingWithSolute(t_atoms*                 atoms,
     const real        maxRadius1 = *std::max_element(r->begin(), r->end());
     const real        maxRadius2 = *std::max_element(r_solute.begin(), r_solute.end());
 
-    // Now check for overlap.
-    gmx::AnalysisNeighborhood     nb;
-    gmx::AnalysisNeighborhoodPair pair;
+    // Now check for overlap.  A residue is removed if any of its atoms
+    // overlaps with the solute.
+    gmx::AnalysisNeighborhood nb;
     nb.setCutoff(maxRadius1 + maxRadius2);
-    gmx::AnalysisNeighborhoodPositions  posSolute(x_solute);
-    gmx::AnalysisNeighborhoodSearch     search = nb.initSearch(&pbc, posSolute);
-    gmx::AnalysisNeighborhoodPositions  pos(*x);
-    gmx::AnalysisNeighborhoodPairSearch pairSearch = search.startPairSearch(pos);
-    while (pairSearch.findNextPair(&pair))
+    gmx::AnalysisNeighborhoodPositions posSolute(x_solute);
+    gmx::AnalysisNeighborhoodSearch    search   = nb.initSearch(&pbc, posSolute);
+    const std::vector<char>            bOverlap = findSolventAtomsNearSolute(
+            search, *x, [&](int i, const gmx::AnalysisNeighborhoodPair& pair) {
+                const real r1 = r_solute[pair.refIndex()];
+                const real r2 = (*r)[i];
+                return pair.distance2() < gmx::square(r1 + r2);
+            });
+    for (int i = 0; i < atoms->nr; ++i)
     {
-        if (remover.isMarked(pair.testIndex()))
+        if (bOverlap[i])
         {
-            pairSearch.skipRemainingPairsForTestPosition();
-            continue;
+            remover.markResidue(*atoms, i, true);
         }
-        const real r1      = r_solute[pair.refIndex()];
-        const real r2      = (*r)[pair.testIndex()];
-        const bool bRemove = (pair.distance2() < gmx::square(r1 + r2));
-        remover.markResidue(*atoms, pair.testIndex(), bRemove);
     }
 
     remover.removeMarkedElements(x);
@@ -0,0 +1,128 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2020, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the topology preprocessor.
+ *
+ * \ingroup module_gmxpreprocess
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxpreprocess/gmxcpp.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/textwriter.h"
+
+#include "testutils/testfilemanager.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+class GmxCppTest : public ::testing::Test
+{
+public:
+    //! Returns the lines that the preprocessor produces for \p contents
+    std::vector<std::string> preprocess(const std::string& contents)
+    {
+        std::string fileName = fileManager_.getTemporaryFilePath("input.top");
+        TextWriter::writeFileFromString(fileName, contents);
+
+        std::vector<std::string> lines;
+        gmx_cpp_t                handle;
+        int                      status = cpp_open_file(fileName.c_str(), &handle, nullptr);
+        EXPECT_EQ(eCPP_OK, status);
+        char line[STRLEN];
+        while ((status = cpp_read_line(&handle, STRLEN, line)) == eCPP_OK)
+        {
+            lines.emplace_back(line);
+        }
+        EXPECT_EQ(eCPP_EOF, status);
+        cpp_done(handle);
+        return lines;
+    }
+
+    TestFileManager fileManager_;
+};
+
+TEST_F(GmxCppTest, SubstitutesWholeWordsOnly)
+{
+    auto lines = preprocess(
+            "#define gb_1 0.1000 1.5700e+07\n"
+            "#define EMPTY\n"
+            "1 2 2 gb_1\n"
+            "1 2 2 gb_10 xgb_1 gb_1gb_1 EMPTY\n"
+            "gb_1,gb_1\n");
+    ASSERT_EQ(3U, lines.size());
+    EXPECT_EQ("1 2 2 0.1000 1.5700e+07", lines[0]);
+    EXPECT_EQ("1 2 2 gb_10 xgb_1 gb_1gb_1 EMPTY", lines[1]);
+    EXPECT_EQ("0.1000 1.5700e+07,0.1000 1.5700e+07", lines[2]);
+}
+
+TEST_F(GmxCppTest, HandlesRedefinitionAndUndef)
+{
+    auto lines = preprocess(
+            "#define A 1\n"
+            "A B\n"
+            "#define B 2\n"
+            "#define A\n"
+            "A B\n"
+            "#undef B\n"
+            "#define A 3\n"
+            "A B\n"
+            "#ifdef A\n"
+            "defined\n"
+            "#endif\n"
+            "#ifdef B\n"
+            "undefined\n"
+            "#endif\n");
+    ASSERT_EQ(4U, lines.size());
+    EXPECT_EQ("1 B", lines[0]);
+    EXPECT_EQ("A 2", lines[1]);
+    EXPECT_EQ("3 B", lines[2]);
+    EXPECT_EQ("defined", lines[3]);
+}
+
+} // namespace
+} // namespace test
+} // namespace gmx
@@ -0,0 +1,204 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2020, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for assigning default bonded parameters from force-field types.
+ *
+ * \ingroup module_gmxpreprocess
+ */
+#include "gmxpre.h"
+
+#include "gromacs/gmxpreprocess/toppush.h"
+
+#include <array>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/fileio/warninp.h"
+#include "gromacs/gmxpreprocess/gpp_atomtype.h"
+#include "gromacs/gmxpreprocess/gpp_bond_atomtype.h"
+#include "gromacs/gmxpreprocess/grompp_impl.h"
+#include "gromacs/gmxpreprocess/topdirs.h"
+#include "gromacs/topology/atoms.h"
+#include "gromacs/topology/ifunc.h"
+#include "gromacs/topology/symtab.h"
+
+#include "testutils/testasserts.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+//! Names of the atom types used in the tests, each is also its own bonded type
+const std::array<const char*, 3> c_typeNames = { "CA", "CB", "CC" };
+
+class DefaultBondedParametersTest : public ::testing::Test
+{
+public:
+    DefaultBondedParametersTest() : nb_({}, {}), wi_(init_warning(TRUE, 0))
+    {
+        open_symtab(&symtab_);
+        t_atom atom = {};
+        for (const char* name : c_typeNames)
+        {
+            const int bondAtomType = bondAtomTypes_.addBondAtomType(&symtab_, name);
+            atomTypes_.addType(&symtab_, atom, name, nb_, bondAtomType, 6);
+        }
+        init_t_atoms(&atoms_, 4, FALSE);
+        atoms_.nr = 4;
+        // The atoms of the molecule have types CA, CB, CC and CA
+        const std::array<int, 4> types = { 0, 1, 2, 0 };
+        for (int i = 0; i < atoms_.nr; i++)
+        {
+            atoms_.atom[i].type  = types[i];
+            atoms_.atom[i].typeB = types[i];
+        }
+    }
+
+    ~DefaultBondedParametersTest() override
+    {
+        free_warning(wi_);
+        done_atom(&atoms_);
+        done_symtab(&symtab_);
+    }
+
+    //! Adds a force-field type from a line of a [ bondtypes ] like directive
+    void pushType(Directive d, int numAtoms, std::string line)
+    {
+        push_bt(d, forceFieldTypes_, numAtoms, nullptr, &bondAtomTypes_, &line[0], wi_);
+    }
+
+    //! Adds a force-field type from a line of [ dihedraltypes ]
+    void pushDihedralType(std::string line)
+    {
+        push_dihedraltype(Directive::d_dihedraltypes, forceFieldTypes_, &bondAtomTypes_, &line[0],
+                          wi_);
+    }
+
+    //! Adds an interaction to the molecule with default parameters and returns the parameters
+    const InteractionOfType& pushInteraction(Directive d, int ftype, std::string line)
+    {
+        bool bWarnCopyAToB = true;
+        push_bond(d, forceFieldTypes_, interactions_, &atoms_, &atomTypes_, &line[0], true, false,
+                  1.0, false, &bWarnCopyAToB, wi_);
+        EXPECT_FALSE(warning_errors_exist(wi_));
+        return interactions_[ftype].interactionTypes.back();
+    }
+
+protected:
+    t_symtab                              symtab_;
+    InteractionOfType                     nb_;
+    PreprocessingAtomTypes                atomTypes_;
+    PreprocessingBondAtomType             bondAtomTypes_;
+    t_atoms                               atoms_;
+    std::array<InteractionsOfType, F_NRE> forceFieldTypes_;
+    std::array<InteractionsOfType, F_NRE> interactions_;
+    warninp_t                             wi_;
+};
+
+TEST_F(DefaultBondedParametersTest, UsesBondTypeInEitherOrder)
+{
+    pushType(Directive::d_bondtypes, 2, "CB CC 1 0.15 2000");
+    pushType(Directive::d_bondtypes, 2, "CA CB 1 0.1 1000");
+
+    EXPECT_REAL_EQ(0.1, pushInteraction(Directive::d_bonds, F_BONDS, "1 2 1").c0());
+    EXPECT_REAL_EQ(0.1, pushInteraction(Directive::d_bonds, F_BONDS, "2 1 1").c0());
+    EXPECT_REAL_EQ(0.15, pushInteraction(Directive::d_bonds, F_BONDS, "3 2 1").c0());
+}
+
+TEST_F(DefaultBondedParametersTest, UsesOverridingBondType)
+{
+    pushType(Directive::d_bondtypes, 2, "CA CB 1 0.1 1000");
+    EXPECT_REAL_EQ(0.1, pushInteraction(Directive::d_bonds, F_BONDS, "1 2 1").c0());
+
+    // A duplicate with the same parameters is ignored
+    pushType(Directive::d_bondtypes, 2, "CB CA 1 0.1 1000");
+    EXPECT_EQ(2U, forceFieldTypes_[F_BONDS].size());
+
+    // A later definition overrides the parameters of the earlier one
+    pushType(Directive::d_bondtypes, 2, "CB CA 1 0.2 2000");
+    EXPECT_EQ(2U, forceFieldTypes_[F_BONDS].size());
+    const InteractionOfType& bond = pushInteraction(Directive::d_bonds, F_BONDS, "1 2 1");
+    EXPECT_REAL_EQ(0.2, bond.c0());
+    EXPECT_REAL_EQ(2000, bond.c1());
+    EXPECT_REAL_EQ(0.2, pushInteraction(Directive::d_bonds, F_BONDS, "2 1 1").c0());
+}
+
+TEST_F(DefaultBondedParametersTest, UsesTypeAddedAfterEarlierLookup)
+{
+    pushType(Directive::d_bondtypes, 2, "CA CB 1 0.1 1000");
+    EXPECT_REAL_EQ(0.1, pushInteraction(Directive::d_bonds, F_BONDS, "1 2 1").c0());
+
+    pushType(Directive::d_bondtypes, 2, "CB CC 1 0.15 2000");
+    EXPECT_REAL_EQ(0.15, pushInteraction(Directive::d_bonds, F_BONDS, "2 3 1").c0());
+}
+
+TEST_F(DefaultBondedParametersTest, UsesClearedAndRefilledTypes)
+{
+    pushType(Directive::d_bondtypes, 2, "CA CB 1 0.1 1000");
+    pushType(Directive::d_bondtypes, 2, "CB CC 1 0.15 2000");
+    EXPECT_REAL_EQ(0.1, pushInteraction(Directive::d_bonds, F_BONDS, "1 2 1").c0());
+
+    // Refill with the same number of types, in a different order
+    forceFieldTypes_[F_BONDS].clearInteractionTypes();
+    pushType(Directive::d_bondtypes, 2, "CB CC 1 0.25 3000");
+    pushType(Directive::d_bondtypes, 2, "CA CB 1 0.2 2000");
+    ASSERT_EQ(4U, forceFieldTypes_[F_BONDS].size());
+    EXPECT_REAL_EQ(0.2, pushInteraction(Directive::d_bonds, F_BONDS, "1 2 1").c0());
+    EXPECT_REAL_EQ(0.25, pushInteraction(Directive::d_bonds, F_BONDS, "2 3 1").c0());
+}
+
+TEST_F(DefaultBondedParametersTest, UsesMostSpecificDihedralType)
+{
+    pushDihedralType("X CB CC X 1 0 10 3");
+    pushDihedralType("CA CB CC X 1 0 20 3");
+    pushDihedralType("X CB X CA 1 0 30 3");
+    EXPECT_REAL_EQ(20, pushInteraction(Directive::d_dihedrals, F_PDIHS, "1 2 3 4 1").c1());
+
+    // Matches with the same number of atom types go to the earliest type
+    pushDihedralType("X CB CC CA 1 0 40 3");
+    EXPECT_REAL_EQ(20, pushInteraction(Directive::d_dihedrals, F_PDIHS, "1 2 3 4 1").c1());
+
+    pushDihedralType("CA CC CB CA 1 0 50 3");
+    EXPECT_REAL_EQ(50, pushInteraction(Directive::d_dihedrals, F_PDIHS, "4 3 2 1 1").c1());
+}
+
+} // namespace
+} // namespace test
+} // namespace gmx
@@ -104,7 +104,7 @@ static void gen_pairs(const InteractionsOfType& nbs, InteractionsOfType* pairs,
     }
 
     fprintf(stderr, "Generating 1-4 interactions: fudge = %g\n", fudge);
-    pairs->interactionTypes.clear();
+    pairs->clearInteractionTypes();
     int                             i = 0;
     std::array<int, 2>              atomNumbers;
     std::array<real, MAXFORCEPARAM> forceParam = { NOTSET };
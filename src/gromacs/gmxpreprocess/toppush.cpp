@@ -79,7 +79,7 @@ void generate_nbparams(int                     comb,
     /* Lean mean shortcuts */
     nr   = atypes->size();
     nrfp = NRFP(ftype);
-    interactions->interactionTypes.clear();
+    interactions->clearInteractionTypes();
 
     std::array<real, MAXFORCEPARAM> forceParam = { NOTSET };
     /* Fill the matrix with force parameters */
@@ -1752,6 +1752,75 @@ static bool findIfAllParameterAtomsMatch(gmx::ArrayRef<const int>      atomsFrom
     }
 }
 
+//! Value for the unused positions in a InteractionTypeLookup::Key
+static constexpr int c_unusedLookupType = -2;
+
+/*! \brief Brings the lookup of \p bt up to date with its list of types
+ *
+ * The lookup is extended with the types appended since the last call.
+ * All other changes to the list reset the lookup, see
+ * InteractionsOfType::invalidateTypeLookup().
+ */
+static void updateInteractionTypeLookup(InteractionsOfType* bt)
+{
+    InteractionTypeLookup& lookup   = bt->typeLookup;
+    const int              numTypes = bt->size();
+    GMX_RELEASE_ASSERT(numTypes >= lookup.numIndexed,
+                       "The type lookup should be invalidated when types are removed");
+    for (int i = lookup.numIndexed; i < numTypes; i++)
+    {
+        gmx::ArrayRef<const int> atoms = bt->interactionTypes[i].atoms();
+        if (atoms.size() > std::tuple_size<InteractionTypeLookup::Key>::value)
+        {
+            continue;
+        }
+        InteractionTypeLookup::Key key;
+        key.fill(c_unusedLookupType);
+        int wildcardMask = 0;
+        for (gmx::index j = 0; j < atoms.ssize(); j++)
+        {
+            key[j] = atoms[j];
+            if (atoms[j] == -1)
+            {
+                wildcardMask |= (1 << j);
+            }
+        }
+        /* Only the first type with these atom types is stored */
+        lookup.firstIndex.emplace(key, i);
+        lookup.haveWildcardMask[wildcardMask] = true;
+    }
+    lookup.numIndexed = numTypes;
+}
+
+/*! \brief Returns the first type in \p bt with bonded atom types \p key, or the end */
+static std::vector<InteractionOfType>::iterator findInteractionType(InteractionsOfType* bt,
+                                                                    const InteractionTypeLookup::Key& key)
+{
+    const auto found = bt->typeLookup.firstIndex.find(key);
+    if (found == bt->typeLookup.firstIndex.end())
+    {
+        return bt->interactionTypes.end();
+    }
+    return bt->interactionTypes.begin() + found->second;
+}
+
+/*! \brief Returns the bonded atom types of the atoms of \p p for the lookup */
+static InteractionTypeLookup::Key lookupKeyFromAtoms(const InteractionOfType&      p,
+                                                     const t_atoms*                at,
+                                                     const PreprocessingAtomTypes* atypes,
+                                                     bool                          bB)
+{
+    gmx::ArrayRef<const int>   atoms = p.atoms();
+    InteractionTypeLookup::Key key;
+    key.fill(c_unusedLookupType);
+    for (gmx::index i = 0; i < atoms.ssize(); i++)
+    {
+        const int type = bB ? at->atom[atoms[i]].typeB : at->atom[atoms[i]].type;
+        key[i]         = atypes->bondAtomTypeFromAtomType(type);
+    }
+    return key;
+}
+
 static std::vector<InteractionOfType>::iterator defaultInteractionsOfType(int ftype,
                                                                           gmx::ArrayRef<InteractionsOfType> bt,
                                                                           t_atoms* at,
@@ -1777,20 +1846,58 @@ static std::vector<InteractionOfType>::iterator defaultInteractionsOfType(int ft
 
         /* For dihedrals we allow wildcards. We choose the first type
          * that has the most real matches, i.e. non-wildcard matches.
+         * A type with wildcards at the positions given by a mask matches
+         * when it has the atom types of the dihedral at all other
+         * positions, so we look up the dihedral for each wildcard mask
+         * that occurs in the list.
          */
         auto prevPos = bt[ftype].interactionTypes.end();
-        auto pos     = bt[ftype].interactionTypes.begin();
-        while (pos != bt[ftype].interactionTypes.end() && nmatch_max < 4)
-        {
-            pos = std::find_if(bt[ftype].interactionTypes.begin(), bt[ftype].interactionTypes.end(),
-                               [&p, &at, &atypes, &bB, &nmatch_max](const auto& param) {
-                                   return (findNumberOfDihedralAtomMatches(param, p, at, atypes, bB)
-                                           > nmatch_max);
-                               });
-            if (pos != bt[ftype].interactionTypes.end())
+        if (p.atoms().ssize() == 4)
+        {
+            updateInteractionTypeLookup(&bt[ftype]);
+            const InteractionTypeLookup&     lookup = bt[ftype].typeLookup;
+            const InteractionTypeLookup::Key types  = lookupKeyFromAtoms(p, at, atypes, bB);
+            for (int wildcardMask = 0; wildcardMask < 16; wildcardMask++)
+            {
+                if (!lookup.haveWildcardMask[wildcardMask])
+                {
+                    continue;
+                }
+                InteractionTypeLookup::Key key    = types;
+                int                        nmatch = 4;
+                for (int j = 0; j < 4; j++)
+                {
+                    if (wildcardMask & (1 << j))
+                    {
+                        key[j] = -1;
+                        nmatch--;
+                    }
+                }
+                auto pos = findInteractionType(&bt[ftype], key);
+                if (pos != bt[ftype].interactionTypes.end()
+                    && (nmatch > nmatch_max || (nmatch == nmatch_max && pos < prevPos)))
+                {
+                    prevPos    = pos;
+                    nmatch_max = nmatch;
+                }
+            }
+        }
+        else
+        {
+            auto pos = bt[ftype].interactionTypes.begin();
+            while (pos != bt[ftype].interactionTypes.end() && nmatch_max < 4)
             {
-                prevPos    = pos;
-                nmatch_max = findNumberOfDihedralAtomMatches(*pos, p, at, atypes, bB);
+                pos = std::find_if(bt[ftype].interactionTypes.begin(),
+                                   bt[ftype].interactionTypes.end(),
+                                   [&p, &at, &atypes, &bB, &nmatch_max](const auto& param) {
+                                       return (findNumberOfDihedralAtomMatches(param, p, at, atypes, bB)
+                                               > nmatch_max);
+                                   });
+                if (pos != bt[ftype].interactionTypes.end())
+                {
+                    prevPos    = pos;
+                    nmatch_max = findNumberOfDihedralAtomMatches(*pos, p, at, atypes, bB);
+                }
             }
         }
 
@@ -1829,11 +1936,20 @@ static std::vector<InteractionOfType>::iterator defaultInteractionsOfType(int ft
     else /* Not a dihedral */
     {
         gmx::ArrayRef<const int> atomParam = p.atoms();
-        auto                     found     = std::find_if(
-                bt[ftype].interactionTypes.begin(), bt[ftype].interactionTypes.end(),
-                [&atomParam, &at, &atypes, &bB](const auto& param) {
-                    return findIfAllParameterAtomsMatch(param.atoms(), atomParam, at, atypes, bB);
-                });
+        auto                     found     = bt[ftype].interactionTypes.end();
+        if (atomParam.size() <= std::tuple_size<InteractionTypeLookup::Key>::value)
+        {
+            updateInteractionTypeLookup(&bt[ftype]);
+            found = findInteractionType(&bt[ftype], lookupKeyFromAtoms(p, at, atypes, bB));
+        }
+        else
+        {
+            found = std::find_if(bt[ftype].interactionTypes.begin(), bt[ftype].interactionTypes.end(),
+                                 [&atomParam, &at, &atypes, &bB](const auto& param) {
+                                     return findIfAllParameterAtomsMatch(param.atoms(), atomParam,
+                                                                         at, atypes, bB);
+                                 });
+        }
         if (found != bt[ftype].interactionTypes.end())
         {
             nparam_found = 1;
@@ -2609,9 +2725,10 @@ static void convert_pairs_to_pairsQ(gmx::ArrayRef<InteractionsOfType> interactio
 
     /* now assign the new data to the F_LJC14_Q structure */
     interactions[F_LJC14_Q].interactionTypes = paramnew;
+    interactions[F_LJC14_Q].invalidateTypeLookup();
 
     /* Empty the LJ14 pairlist */
-    interactions[F_LJ14].interactionTypes.clear();
+    interactions[F_LJ14].clearInteractionTypes();
 }
 
 static void generate_LJCpairsNB(MoleculeInformation* mol, int nb_funct, InteractionsOfType* nbp, warninp* wi)
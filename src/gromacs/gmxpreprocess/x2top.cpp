@@ -538,7 +538,7 @@ int gmx_x2top(int argc, char* argv[])
 
     if (!bPairs)
     {
-        plist[F_LJ14].interactionTypes.clear();
+        plist[F_LJ14].clearInteractionTypes();
     }
     GMX_LOG(logger.info)
             .asParagraph()
@@ -45,7 +45,9 @@
 
 #include <algorithm>
 #include <numeric>
+#include <vector>
 
+#include "gromacs/math/gausstransform.h"
 #include "gromacs/math/multidimarray.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/utility/exceptions.h"
@@ -59,10 +61,18 @@ public:
     virtual ~DensitySimilarityMeasureImpl();
     //! convenience typedef
     using density = DensitySimilarityMeasure::density;
-    //! \copydoc DensitySimilarityMeasure::gradient(DensitySimilarityMeasure::density comparedDensity)
-    virtual density gradient(density comparedDensity) = 0;
-    //! \copydoc DensitySimilarityMeasure::similarity(density comparedDensity)
-    virtual real similarity(density comparedDensity) = 0;
+    //! convenience typedef
+    using PartialSums = DensitySimilarityMeasure::PartialSums;
+    //! \copydoc DensitySimilarityMeasure::gradient(DensitySimilarityMeasure::density comparedDensity, int numThreads)
+    virtual density gradient(density comparedDensity, int numThreads) = 0;
+    //! \copydoc DensitySimilarityMeasure::similarity(density comparedDensity, int numThreads)
+    virtual real similarity(density comparedDensity, int numThreads) = 0;
+    //! \copydoc DensitySimilarityMeasure::partialSums(density comparedDensity, const IntegerBox& box, int numThreads)
+    virtual PartialSums partialSums(density comparedDensity, const IntegerBox& box, int numThreads) = 0;
+    //! \copydoc DensitySimilarityMeasure::similarityFromSums(const PartialSums& sums)
+    virtual real similarityFromSums(const PartialSums& sums) = 0;
+    //! \copydoc DensitySimilarityMeasure::gradientWithinBox(density comparedDensity, const PartialSums& sums, const IntegerBox& box, int numThreads)
+    virtual density gradientWithinBox(density comparedDensity, const PartialSums& sums, const IntegerBox& box, int numThreads) = 0;
     //! clone to allow copy operations
     virtual std::unique_ptr<DensitySimilarityMeasureImpl> clone() = 0;
 };
@@ -71,6 +81,116 @@ DensitySimilarityMeasureImpl::~DensitySimilarityMeasureImpl() = default;
 namespace
 {
 
+//! The minimum number of voxels per thread for which threading the voxel loops pays off
+constexpr index c_minNumVoxelsPerThread = 16384;
+
+//! Returns the number of voxel blocks to use for a loop over \p numVoxels voxels
+int numVoxelBlocks(index numVoxels, int numThreads)
+{
+    return static_cast<int>(
+            std::max<index>(1, std::min<index>(numThreads, numVoxels / c_minNumVoxelsPerThread)));
+}
+
+/*! \brief Calls \p blockFunction for contiguous blocks of voxels in parallel.
+ *
+ * \param[in] numVoxels     the number of voxels
+ * \param[in] numBlocks     the number of blocks, one per thread
+ * \param[in] blockFunction called as blockFunction(block, begin, end)
+ */
+template<typename BlockFunction>
+void forEachVoxelBlock(index numVoxels, int numBlocks, BlockFunction blockFunction)
+{
+#pragma omp parallel for num_threads(numBlocks) schedule(static)
+    for (int block = 0; block < numBlocks; ++block)
+    {
+        try
+        {
+            blockFunction(block, (numVoxels * block) / numBlocks, (numVoxels * (block + 1)) / numBlocks);
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
+}
+
+/*! \brief Sums the values that \p blockSum returns for contiguous blocks of voxels.
+ *
+ * The block sums are added in a fixed order, so the result only depends
+ * on the number of blocks, not on the thread scheduling.
+ */
+template<typename BlockSum>
+double sumOverVoxelBlocks(index numVoxels, int numThreads, BlockSum blockSum)
+{
+    const int           numBlocks = numVoxelBlocks(numVoxels, numThreads);
+    std::vector<double> blockSums(numBlocks);
+    forEachVoxelBlock(numVoxels, numBlocks, [&blockSums, &blockSum](int block, index begin, index end) {
+        blockSums[block] = blockSum(begin, end);
+    });
+    return std::accumulate(std::begin(blockSums), std::end(blockSums), 0.);
+}
+
+/*! \brief Calls \p rowFunction for the rows of voxels within a box in parallel.
+ *
+ * Rows are contiguous in memory and run along the last density dimension,
+ * which is x in lattice coordinates.
+ *
+ * \param[in] extents     the extents of the density
+ * \param[in] box         the voxels to loop over
+ * \param[in] numThreads  the maximum number of OpenMP threads to use
+ * \param[in] rowFunction called as rowFunction(block, offset, length) for
+ *                        the \p length voxels starting at \p offset
+ * \returns the number of blocks, i.e., threads, that the rows were distributed over
+ */
+template<typename RowFunction>
+int forEachRowInBox(const dynamicExtents3D& extents, const IntegerBox& box, int numThreads, RowFunction rowFunction)
+{
+    if (box.empty())
+    {
+        return 0;
+    }
+    const index rowLength = box.end()[XX] - box.begin()[XX];
+    const index numY      = box.end()[YY] - box.begin()[YY];
+    const index numRows   = numY * (box.end()[ZZ] - box.begin()[ZZ]);
+    const int   numBlocks = numVoxelBlocks(numRows * rowLength, numThreads);
+    forEachVoxelBlock(numRows, numBlocks, [&](int block, index rowBegin, index rowEnd) {
+        for (index row = rowBegin; row < rowEnd; ++row)
+        {
+            const index z = box.begin()[ZZ] + row / numY;
+            const index y = box.begin()[YY] + row % numY;
+            rowFunction(block, (z * extents.extent(YY) + y) * extents.extent(ZZ) + box.begin()[XX], rowLength);
+        }
+    });
+    return numBlocks;
+}
+
+/*! \brief Sums the partial sums that \p rowSums adds up for rows of voxels within a box.
+ *
+ * \param[in] extents    the extents of the density
+ * \param[in] box        the voxels to sum over
+ * \param[in] numThreads the maximum number of OpenMP threads to use
+ * \param[in] rowSums    called as rowSums(offset, length, &sums) to add the sums
+ *                       over the \p length voxels starting at \p offset
+ */
+template<typename RowSums>
+DensitySimilarityMeasure::PartialSums sumOverRowsInBox(const dynamicExtents3D& extents,
+                                                       const IntegerBox&       box,
+                                                       int                     numThreads,
+                                                       RowSums                 rowSums)
+{
+    std::vector<DensitySimilarityMeasure::PartialSums> blockSums(std::max(1, numThreads));
+    const int numBlocks = forEachRowInBox(
+            extents, box, numThreads, [&blockSums, &rowSums](int block, index offset, index length) {
+                rowSums(offset, length, &blockSums[block]);
+            });
+    DensitySimilarityMeasure::PartialSums sums = {};
+    for (int block = 0; block < numBlocks; ++block)
+    {
+        for (size_t i = 0; i < sums.size(); ++i)
+        {
+            sums[i] += blockSums[block][i];
+        }
+    }
+    return sums;
+}
+
 /****************** Inner Product *********************************************/
 
 /*! \internal
@@ -84,11 +204,17 @@ public:
     //! Construct similarity measure by setting the reference density
     DensitySimilarityInnerProduct(density referenceDensity);
     //! The gradient for the inner product similarity measure is the reference density divided by the number of voxels
-    density gradient(density comparedDensity) override;
+    density gradient(density comparedDensity, int numThreads) override;
     //! Clone this
     std::unique_ptr<DensitySimilarityMeasureImpl> clone() override;
     //! The similarity between reference density and compared density
-    real similarity(density comparedDensity) override;
+    real similarity(density comparedDensity, int numThreads) override;
+    //! Sums over voxels in a box
+    PartialSums partialSums(density comparedDensity, const IntegerBox& box, int numThreads) override;
+    //! The similarity from sums over all voxels with non-zero compared density
+    real similarityFromSums(const PartialSums& sums) override;
+    //! The gradient within a box
+    density gradientWithinBox(density comparedDensity, const PartialSums& sums, const IntegerBox& box, int numThreads) override;
 
 private:
     //! A view on the reference density
@@ -108,7 +234,7 @@ DensitySimilarityInnerProduct::DensitySimilarityInnerProduct(density referenceDe
                    [numVoxels](float x) { return x / numVoxels; });
 }
 
-real DensitySimilarityInnerProduct::similarity(density comparedDensity)
+real DensitySimilarityInnerProduct::similarity(density comparedDensity, int numThreads)
 {
     if (comparedDensity.extents() != referenceDensity_.extents())
     {
@@ -116,10 +242,17 @@ real DensitySimilarityInnerProduct::similarity(density comparedDensity)
     }
     /* the similarity measure uses the gradient instead of the reference,
      * here, because it is the reference density divided by the number of voxels */
-    return std::inner_product(begin(gradient_), end(gradient_), begin(comparedDensity), 0.);
+    const float* gradient = gradient_.asConstView().data();
+    const float* compared = comparedDensity.data();
+    return sumOverVoxelBlocks(comparedDensity.mapping().required_span_size(), numThreads,
+                              [gradient, compared](index begin, index end) {
+                                  return std::inner_product(gradient + begin, gradient + end,
+                                                            compared + begin, 0.);
+                              });
 }
 
-DensitySimilarityMeasure::density DensitySimilarityInnerProduct::gradient(density comparedDensity)
+DensitySimilarityMeasure::density DensitySimilarityInnerProduct::gradient(density comparedDensity,
+                                                                          int /*numThreads*/)
 {
     /* even though the gradient density does not depend on the compad density,
      * still checking the extents to make sure we're consistent */
@@ -131,6 +264,36 @@ DensitySimilarityMeasure::density DensitySimilarityInnerProduct::gradient(densit
     return gradient_.asConstView();
 }
 
+DensitySimilarityMeasure::PartialSums DensitySimilarityInnerProduct::partialSums(density comparedDensity,
+                                                                                const IntegerBox& box,
+                                                                                int numThreads)
+{
+    if (comparedDensity.extents() != referenceDensity_.extents())
+    {
+        GMX_THROW(RangeError("Reference density and compared density need to have same extents."));
+    }
+    const float* gradient = gradient_.asConstView().data();
+    const float* compared = comparedDensity.data();
+    return sumOverRowsInBox(comparedDensity.extents(), box, numThreads,
+                            [gradient, compared](index offset, index length, PartialSums* sums) {
+                                (*sums)[0] = std::inner_product(gradient + offset, gradient + offset + length,
+                                                                compared + offset, (*sums)[0]);
+                            });
+}
+
+real DensitySimilarityInnerProduct::similarityFromSums(const PartialSums& sums)
+{
+    return sums[0];
+}
+
+DensitySimilarityMeasure::density DensitySimilarityInnerProduct::gradientWithinBox(density comparedDensity,
+                                                                                   const PartialSums& /*sums*/,
+                                                                                   const IntegerBox& /*box*/,
+                                                                                   int numThreads)
+{
+    return gradient(comparedDensity, numThreads);
+}
+
 std::unique_ptr<DensitySimilarityMeasureImpl> DensitySimilarityInnerProduct::clone()
 {
     return std::make_unique<DensitySimilarityInnerProduct>(referenceDensity_);
@@ -169,11 +332,17 @@ public:
     //! Construct similarity measure by setting the reference density
     DensitySimilarityRelativeEntropy(density referenceDensity);
     //! The gradient for the relative entropy similarity measure
-    density gradient(density comparedDensity) override;
+    density gradient(density comparedDensity, int numThreads) override;
     //! Clone this
     std::unique_ptr<DensitySimilarityMeasureImpl> clone() override;
     //! The similarity between reference density and compared density
-    real similarity(density comparedDensity) override;
+    real similarity(density comparedDensity, int numThreads) override;
+    //! Sums over voxels in a box
+    PartialSums partialSums(density comparedDensity, const IntegerBox& box, int numThreads) override;
+    //! The similarity from sums over all voxels with non-zero compared density
+    real similarityFromSums(const PartialSums& sums) override;
+    //! The gradient within a box
+    density gradientWithinBox(density comparedDensity, const PartialSums& sums, const IntegerBox& box, int numThreads) override;
 
 private:
     //! A view on the reference density
@@ -188,24 +357,81 @@ DensitySimilarityRelativeEntropy::DensitySimilarityRelativeEntropy(density refer
 {
 }
 
-real DensitySimilarityRelativeEntropy::similarity(density comparedDensity)
+real DensitySimilarityRelativeEntropy::similarity(density comparedDensity, int numThreads)
+{
+    if (comparedDensity.extents() != referenceDensity_.extents())
+    {
+        GMX_THROW(RangeError("Reference density and compared density need to have same extents."));
+    }
+    const float* reference = referenceDensity_.data();
+    const float* compared  = comparedDensity.data();
+    return sumOverVoxelBlocks(comparedDensity.mapping().required_span_size(), numThreads,
+                              [reference, compared](index begin, index end) {
+                                  return std::inner_product(reference + begin, reference + end,
+                                                            compared + begin, 0., std::plus<>(),
+                                                            relativeEntropyAtVoxel);
+                              });
+}
+
+DensitySimilarityMeasure::density DensitySimilarityRelativeEntropy::gradient(density comparedDensity,
+                                                                             int numThreads)
+{
+    if (comparedDensity.extents() != referenceDensity_.extents())
+    {
+        GMX_THROW(RangeError("Reference density and compared density need to have same extents."));
+    }
+    const float* reference = referenceDensity_.data();
+    const float* compared  = comparedDensity.data();
+    float*       gradient  = gradient_.asView().data();
+    const index  numVoxels = comparedDensity.mapping().required_span_size();
+    forEachVoxelBlock(numVoxels, numVoxelBlocks(numVoxels, numThreads),
+                      [reference, compared, gradient](int /*block*/, index begin, index end) {
+                          std::transform(reference + begin, reference + end, compared + begin,
+                                         gradient + begin, relativeEntropyGradientAtVoxel);
+                      });
+    return gradient_.asConstView();
+}
+
+DensitySimilarityMeasure::PartialSums DensitySimilarityRelativeEntropy::partialSums(density comparedDensity,
+                                                                                   const IntegerBox& box,
+                                                                                   int numThreads)
 {
     if (comparedDensity.extents() != referenceDensity_.extents())
     {
         GMX_THROW(RangeError("Reference density and compared density need to have same extents."));
     }
-    return std::inner_product(begin(referenceDensity_), end(referenceDensity_),
-                              begin(comparedDensity), 0., std::plus<>(), relativeEntropyAtVoxel);
+    const float* reference = referenceDensity_.data();
+    const float* compared  = comparedDensity.data();
+    return sumOverRowsInBox(comparedDensity.extents(), box, numThreads,
+                            [reference, compared](index offset, index length, PartialSums* sums) {
+                                (*sums)[0] = std::inner_product(
+                                        reference + offset, reference + offset + length, compared + offset,
+                                        (*sums)[0], std::plus<>(), relativeEntropyAtVoxel);
+                            });
 }
 
-DensitySimilarityMeasure::density DensitySimilarityRelativeEntropy::gradient(density comparedDensity)
+real DensitySimilarityRelativeEntropy::similarityFromSums(const PartialSums& sums)
+{
+    return sums[0];
+}
+
+DensitySimilarityMeasure::density DensitySimilarityRelativeEntropy::gradientWithinBox(density comparedDensity,
+                                                                                      const PartialSums& /*sums*/,
+                                                                                      const IntegerBox& box,
+                                                                                      int numThreads)
 {
     if (comparedDensity.extents() != referenceDensity_.extents())
     {
         GMX_THROW(RangeError("Reference density and compared density need to have same extents."));
     }
-    std::transform(begin(referenceDensity_), end(referenceDensity_), begin(comparedDensity),
-                   begin(gradient_), relativeEntropyGradientAtVoxel);
+    const float* reference = referenceDensity_.data();
+    const float* compared  = comparedDensity.data();
+    float*       gradient  = gradient_.asView().data();
+    forEachRowInBox(comparedDensity.extents(), box, numThreads,
+                    [reference, compared, gradient](int /*block*/, index offset, index length) {
+                        std::transform(reference + offset, reference + offset + length, compared + offset,
+                                       gradient + offset, relativeEntropyGradientAtVoxel);
+                    });
     return gradient_.asConstView();
 }
 
@@ -229,6 +455,8 @@ struct CrossCorrelationEvaluationHelperValues
     real comparisonSquaredSum = 0;
     //! The covariance of the refernce and the compared density
     real covariance = 0;
+    //! The number of voxels these values were accumulated over
+    index numValues = 0;
 };
 
 /*! \brief Calculate helper values for the cross-correlation.
@@ -238,31 +466,77 @@ struct CrossCorrelationEvaluationHelperValues
  * "Numerically Stable, Single-Pass, Parallel Statistics Algorithms"
  * and implemented in boost's correlation coefficient
  */
-CrossCorrelationEvaluationHelperValues evaluateHelperValues(DensitySimilarityMeasure::density reference,
-                                                            DensitySimilarityMeasure::density compared)
+CrossCorrelationEvaluationHelperValues evaluateHelperValues(const float* reference,
+                                                            const float* compared,
+                                                            index        numValues)
 {
     CrossCorrelationEvaluationHelperValues helperValues;
 
-    index i = 0;
-
-    auto referenceIterator = begin(reference);
-    for (const real comp : compared)
+    for (index i = 0; i < numValues; ++i)
     {
-        const real refHelper        = *referenceIterator - helperValues.meanReference;
-        const real comparisonHelper = comp - helperValues.meanComparison;
+        const real refHelper        = reference[i] - helperValues.meanReference;
+        const real comparisonHelper = compared[i] - helperValues.meanComparison;
         helperValues.referenceSquaredSum += (i * square(refHelper)) / (i + 1);
         helperValues.comparisonSquaredSum += (i * square(comparisonHelper)) / (i + 1);
         helperValues.covariance += i * refHelper * comparisonHelper / (i + 1);
         helperValues.meanReference += refHelper / (i + 1);
         helperValues.meanComparison += comparisonHelper / (i + 1);
+    }
+    helperValues.numValues = numValues;
 
-        ++referenceIterator;
-        ++i;
+    return helperValues;
+}
+
+/*! \brief Combine helper values of two disjoint sets of voxels.
+ *
+ * Uses the pairwise update formulas from the reference above.
+ */
+CrossCorrelationEvaluationHelperValues combineHelperValues(const CrossCorrelationEvaluationHelperValues& a,
+                                                           const CrossCorrelationEvaluationHelperValues& b)
+{
+    if (a.numValues == 0)
+    {
+        return b;
+    }
+    if (b.numValues == 0)
+    {
+        return a;
     }
+    const index numValues            = a.numValues + b.numValues;
+    const real  referenceDifference  = b.meanReference - a.meanReference;
+    const real  comparisonDifference = b.meanComparison - a.meanComparison;
+    const real  weight = (real(a.numValues) / numValues) * b.numValues;
 
+    CrossCorrelationEvaluationHelperValues helperValues;
+    helperValues.meanReference = a.meanReference + referenceDifference * b.numValues / numValues;
+    helperValues.meanComparison = a.meanComparison + comparisonDifference * b.numValues / numValues;
+    helperValues.referenceSquaredSum =
+            a.referenceSquaredSum + b.referenceSquaredSum + square(referenceDifference) * weight;
+    helperValues.comparisonSquaredSum =
+            a.comparisonSquaredSum + b.comparisonSquaredSum + square(comparisonDifference) * weight;
+    helperValues.covariance =
+            a.covariance + b.covariance + referenceDifference * comparisonDifference * weight;
+    helperValues.numValues = numValues;
     return helperValues;
 }
 
+//! Calculate helper values for the cross-correlation over blocks of voxels in parallel.
+CrossCorrelationEvaluationHelperValues evaluateHelperValues(DensitySimilarityMeasure::density reference,
+                                                            DensitySimilarityMeasure::density compared,
+                                                            int numThreads)
+{
+    const index numVoxels = compared.mapping().required_span_size();
+    const int   numBlocks = numVoxelBlocks(numVoxels, numThreads);
+    std::vector<CrossCorrelationEvaluationHelperValues> blockValues(numBlocks);
+    forEachVoxelBlock(numVoxels, numBlocks,
+                      [&blockValues, reference, compared](int block, index begin, index end) {
+                          blockValues[block] = evaluateHelperValues(
+                                  reference.data() + begin, compared.data() + begin, end - begin);
+                      });
+    return std::accumulate(std::begin(blockValues), std::end(blockValues),
+                           CrossCorrelationEvaluationHelperValues(), combineHelperValues);
+}
+
 //! Calculate a single cross correlation gradient entry at a voxel.
 class CrossCorrelationGradientAtVoxel
 {
@@ -308,26 +582,49 @@ public:
     //! Construct similarity measure by setting the reference density
     DensitySimilarityCrossCorrelation(density referenceDensity);
     //! The gradient for the cross correlation similarity measure
-    density gradient(density comparedDensity) override;
+    density gradient(density comparedDensity, int numThreads) override;
     //! Clone this
     std::unique_ptr<DensitySimilarityMeasureImpl> clone() override;
     //! The similarity between reference density and compared density
-    real similarity(density comparedDensity) override;
+    real similarity(density comparedDensity, int numThreads) override;
+    //! Sums over voxels in a box
+    PartialSums partialSums(density comparedDensity, const IntegerBox& box, int numThreads) override;
+    //! The similarity from sums over all voxels with non-zero compared density
+    real similarityFromSums(const PartialSums& sums) override;
+    //! The gradient within a box
+    density gradientWithinBox(density comparedDensity, const PartialSums& sums, const IntegerBox& box, int numThreads) override;
 
 private:
     //! A view on the reference density
     const density referenceDensity_;
     //! Stores the gradient of the similarity measure in memory
     MultiDimArray<std::vector<float>, dynamicExtents3D> gradient_;
+    //! The number of voxels
+    index numVoxels_;
+    //! The mean of the reference density
+    double meanReference_ = 0;
+    //! The sum of the squared deviations of the reference density from its mean
+    double referenceSquaredSum_ = 0;
 };
 
 DensitySimilarityCrossCorrelation::DensitySimilarityCrossCorrelation(density referenceDensity) :
     referenceDensity_{ referenceDensity },
-    gradient_(referenceDensity.extents())
+    gradient_(referenceDensity.extents()),
+    numVoxels_(referenceDensity.mapping().required_span_size())
 {
+    /* The reference terms are the same for every evaluation from partial sums,
+     * so they are pre-computed here */
+    if (numVoxels_ > 0)
+    {
+        meanReference_ = std::accumulate(begin(referenceDensity_), end(referenceDensity_), 0.) / numVoxels_;
+        for (const float reference : referenceDensity_)
+        {
+            referenceSquaredSum_ += square(reference - meanReference_);
+        }
+    }
 }
 
-real DensitySimilarityCrossCorrelation::similarity(density comparedDensity)
+real DensitySimilarityCrossCorrelation::similarity(density comparedDensity, int numThreads)
 {
     if (comparedDensity.extents() != referenceDensity_.extents())
     {
@@ -335,7 +632,7 @@ real DensitySimilarityCrossCorrelation::similarity(density comparedDensity)
     }
 
     CrossCorrelationEvaluationHelperValues helperValues =
-            evaluateHelperValues(referenceDensity_, comparedDensity);
+            evaluateHelperValues(referenceDensity_, comparedDensity, numThreads);
 
     if ((helperValues.referenceSquaredSum == 0) || (helperValues.comparisonSquaredSum == 0))
     {
@@ -351,7 +648,8 @@ real DensitySimilarityCrossCorrelation::similarity(density comparedDensity)
            * (covarianceSqrt / sqrt(helperValues.comparisonSquaredSum));
 }
 
-DensitySimilarityMeasure::density DensitySimilarityCrossCorrelation::gradient(density comparedDensity)
+DensitySimilarityMeasure::density DensitySimilarityCrossCorrelation::gradient(density comparedDensity,
+                                                                              int numThreads)
 {
     if (comparedDensity.extents() != referenceDensity_.extents())
     {
@@ -359,11 +657,90 @@ DensitySimilarityMeasure::density DensitySimilarityCrossCorrelation::gradient(de
     }
 
     CrossCorrelationEvaluationHelperValues helperValues =
-            evaluateHelperValues(referenceDensity_, comparedDensity);
+            evaluateHelperValues(referenceDensity_, comparedDensity, numThreads);
+
+    const float* reference = referenceDensity_.data();
+    const float* compared  = comparedDensity.data();
+    float*       gradient  = gradient_.asView().data();
+    const index  numVoxels = comparedDensity.mapping().required_span_size();
+    forEachVoxelBlock(numVoxels, numVoxelBlocks(numVoxels, numThreads),
+                      [reference, compared, gradient, &helperValues](int /*block*/, index begin, index end) {
+                          std::transform(reference + begin, reference + end, compared + begin,
+                                         gradient + begin, CrossCorrelationGradientAtVoxel(helperValues));
+                      });
 
-    std::transform(begin(referenceDensity_), end(referenceDensity_), begin(comparedDensity),
-                   begin(gradient_), CrossCorrelationGradientAtVoxel(helperValues));
+    return gradient_.asConstView();
+}
+
+/* The partial sums are the covariance sum with the reference deviation from its
+ * mean, which is zero on average, as well as the sum of the compared values and
+ * their squares. All three vanish where the compared density is zero. */
+DensitySimilarityMeasure::PartialSums DensitySimilarityCrossCorrelation::partialSums(density comparedDensity,
+                                                                                    const IntegerBox& box,
+                                                                                    int numThreads)
+{
+    if (comparedDensity.extents() != referenceDensity_.extents())
+    {
+        GMX_THROW(RangeError("Reference density and compared density need to have same extents."));
+    }
+    const float* reference     = referenceDensity_.data();
+    const float* compared      = comparedDensity.data();
+    const double meanReference = meanReference_;
+    return sumOverRowsInBox(comparedDensity.extents(), box, numThreads,
+                            [reference, compared, meanReference](index offset, index length, PartialSums* sums) {
+                                double covariance         = 0;
+                                double comparisonSum      = 0;
+                                double comparisonSquareSum = 0;
+                                for (index i = offset; i < offset + length; ++i)
+                                {
+                                    covariance += (reference[i] - meanReference) * compared[i];
+                                    comparisonSum += compared[i];
+                                    comparisonSquareSum += square(double(compared[i]));
+                                }
+                                (*sums)[0] += covariance;
+                                (*sums)[1] += comparisonSum;
+                                (*sums)[2] += comparisonSquareSum;
+                            });
+}
+
+real DensitySimilarityCrossCorrelation::similarityFromSums(const PartialSums& sums)
+{
+    const double comparisonSquaredSum = sums[2] - square(sums[1]) / numVoxels_;
+    if ((referenceSquaredSum_ <= 0) || (comparisonSquaredSum <= 0))
+    {
+        return 0;
+    }
+    return sums[0] / (std::sqrt(referenceSquaredSum_) * std::sqrt(comparisonSquaredSum));
+}
 
+DensitySimilarityMeasure::density DensitySimilarityCrossCorrelation::gradientWithinBox(density comparedDensity,
+                                                                                       const PartialSums& sums,
+                                                                                       const IntegerBox& box,
+                                                                                       int numThreads)
+{
+    if (comparedDensity.extents() != referenceDensity_.extents())
+    {
+        GMX_THROW(RangeError("Reference density and compared density need to have same extents."));
+    }
+    const double comparisonSquaredSum = sums[2] - square(sums[1]) / numVoxels_;
+    const bool   isDefined = (referenceSquaredSum_ > 0) && (comparisonSquaredSum > 0);
+    const real   prefactor =
+            isDefined ? 1.0 / (std::sqrt(comparisonSquaredSum) * std::sqrt(referenceSquaredSum_)) : 0;
+    const real comparisonPrefactor = isDefined ? sums[0] / comparisonSquaredSum : 0;
+    const real meanReference       = meanReference_;
+    const real meanComparison      = sums[1] / numVoxels_;
+
+    const float* reference = referenceDensity_.data();
+    const float* compared  = comparedDensity.data();
+    float*       gradient  = gradient_.asView().data();
+    forEachRowInBox(comparedDensity.extents(), box, numThreads, [=](int /*block*/, index offset, index length) {
+        for (index i = offset; i < offset + length; ++i)
+        {
+            gradient[i] = prefactor
+                          * (reference[i] - meanReference
+                             - comparisonPrefactor * (compared[i] - meanComparison));
+        }
+    });
     return gradient_.asConstView();
 }
 
@@ -396,14 +773,34 @@ DensitySimilarityMeasure::DensitySimilarityMeasure(DensitySimilarityMeasureMetho
     }
 }
 
-DensitySimilarityMeasure::density DensitySimilarityMeasure::gradient(density comparedDensity)
+DensitySimilarityMeasure::density DensitySimilarityMeasure::gradient(density comparedDensity, int numThreads)
+{
+    return impl_->gradient(comparedDensity, numThreads);
+}
+
+real DensitySimilarityMeasure::similarity(density comparedDensity, int numThreads)
+{
+    return impl_->similarity(comparedDensity, numThreads);
+}
+
+DensitySimilarityMeasure::PartialSums DensitySimilarityMeasure::partialSums(density comparedDensity,
+                                                                           const IntegerBox& box,
+                                                                           int numThreads)
+{
+    return impl_->partialSums(comparedDensity, box, numThreads);
+}
+
+real DensitySimilarityMeasure::similarityFromSums(const PartialSums& sums)
 {
-    return impl_->gradient(comparedDensity);
+    return impl_->similarityFromSums(sums);
 }
 
-real DensitySimilarityMeasure::similarity(density comparedDensity)
+DensitySimilarityMeasure::density DensitySimilarityMeasure::gradientWithinBox(density comparedDensity,
+                                                                              const PartialSums& sums,
+                                                                              const IntegerBox& box,
+                                                                              int numThreads)
 {
-    return impl_->similarity(comparedDensity);
+    return impl_->gradientWithinBox(comparedDensity, sums, box, numThreads);
 }
 
 DensitySimilarityMeasure::~DensitySimilarityMeasure() = default;
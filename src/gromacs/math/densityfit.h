@@ -43,6 +43,8 @@
 #ifndef GMX_MATH_DENSITYFIT_H
 #define GMX_MATH_DENSITYFIT_H
 
+#include <array>
+
 #include "gromacs/mdspan/extensions.h"
 #include "gromacs/utility/classhelpers.h"
 #include "gromacs/utility/real.h"
@@ -88,6 +90,8 @@ enum class DensitySimilarityMeasureMethod : int
     Count,
 };
 
+class IntegerBox;
+
 /* Forward declaration of implementation class outside class to allow
  * choose implementation class during construction of the DensitySimilarityMeasure*/
 class DensitySimilarityMeasureImpl;
@@ -100,6 +104,12 @@ class DensitySimilarityMeasure
 public:
     //! a three-dimensional const view into density data
     using density = basic_mdspan<const float, dynamicExtents3D>;
+    /*! \brief Sums over voxels from which the similarity and its gradient are evaluated.
+     *
+     * Sums over disjoint sets of voxels add up to the sums over their union,
+     * so they can be evaluated in parts, e.g., on different ranks, and reduced.
+     */
+    using PartialSums = std::array<double, 3>;
     /*! \brief Chose comparison method and set reference density.
      * \param[in] method defines how densities are compared to one another
      * \param[in] referenceDensity
@@ -118,14 +128,41 @@ public:
 
     /*! \brief Derivative of the density similarity measure at all voxels.
      * \param[in] comparedDensity the variable density
+     * \param[in] numThreads the maximum number of OpenMP threads to use
      * \returns density similarity measure derivative
      */
-    density gradient(density comparedDensity);
+    density gradient(density comparedDensity, int numThreads = 1);
     /*! \brief Similarity between reference and compared density.
      * \param[in] comparedDensity the variable density
+     * \param[in] numThreads the maximum number of OpenMP threads to use
      * \returns density similarity
      */
-    real similarity(density comparedDensity);
+    real similarity(density comparedDensity, int numThreads = 1);
+    /*! \brief Sums for evaluating the similarity over the voxels in a box.
+     *
+     * Voxels where the compared density is zero do not contribute,
+     * so the boxes only need to cover the non-zero compared density.
+     * \param[in] comparedDensity the variable density
+     * \param[in] box the voxels to sum over
+     * \param[in] numThreads the maximum number of OpenMP threads to use
+     * \returns the partial sums over the voxels in \p box
+     */
+    PartialSums partialSums(density comparedDensity, const IntegerBox& box, int numThreads = 1);
+    /*! \brief Similarity from the sums over all voxels with non-zero compared density.
+     * \param[in] sums the partial sums added up over all voxels
+     * \returns density similarity
+     */
+    real similarityFromSums(const PartialSums& sums);
+    /*! \brief Derivative of the density similarity measure at the voxels in a box.
+     *
+     * Values outside \p box are not updated and thus not meaningful.
+     * \param[in] comparedDensity the variable density
+     * \param[in] sums the partial sums added up over all voxels
+     * \param[in] box the voxels to evaluate the derivative at
+     * \param[in] numThreads the maximum number of OpenMP threads to use
+     * \returns density similarity measure derivative
+     */
+    density gradientWithinBox(density comparedDensity, const PartialSums& sums, const IntegerBox& box, int numThreads = 1);
 
 private:
     std::unique_ptr<DensitySimilarityMeasureImpl> impl_;
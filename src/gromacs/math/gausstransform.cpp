@@ -52,6 +52,8 @@
 #include "gromacs/math/functions.h"
 #include "gromacs/math/multidimarray.h"
 #include "gromacs/math/utilities.h"
+#include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/gmxomp.h"
 
 namespace gmx
 {
@@ -240,6 +242,62 @@ IVec rangeEndWithinLattice(const IVec& index, const dynamicExtents3D& extents, c
     return elementWiseMin(extentAsIvec, index + range);
 }
 
+//! Returns the number of lattice points along x, y and z of a lattice with \p extents
+IVec latticeSizeFromExtents(const dynamicExtents3D& extents)
+{
+    return { static_cast<int>(extents.extent(ZZ)), static_cast<int>(extents.extent(YY)),
+             static_cast<int>(extents.extent(XX)) };
+}
+
+/*! \brief Adds the outer product of three one-dimensional Gaussians to the lattice.
+ *
+ * The lattice is stored with x contiguous in memory, followed by y and z.
+ * The innermost loop is a contiguous multiply-add that the compiler vectorizes.
+ *
+ * \param[in,out] lattice          the values to add the Gaussian to
+ * \param[in]     latticeSize      number of lattice points along x, y and z
+ * \param[in]     spreadRange      lattice indices to add to
+ * \param[in]     spreadGridOffset offset from lattice indices to indices into the Gaussians
+ * \param[in]     gauss1d          the Gaussians along x, y and z
+ */
+void addOuterProductToLattice(float*                                lattice,
+                              const IVec&                           latticeSize,
+                              const IntegerBox&                     spreadRange,
+                              const IVec&                           spreadGridOffset,
+                              std::array<GaussianOn1DLattice, DIM>* gauss1d)
+{
+    const ArrayRef<const float> gaussX = (*gauss1d)[XX].view();
+    const ArrayRef<const float> gaussY = (*gauss1d)[YY].view();
+    const ArrayRef<const float> gaussZ = (*gauss1d)[ZZ].view();
+
+    const int    numX        = spreadRange.end()[XX] - spreadRange.begin()[XX];
+    const float* gaussXBegin = gaussX.data() + spreadRange.begin()[XX] + spreadGridOffset[XX];
+
+    for (int zLatticeIndex = spreadRange.begin()[ZZ]; zLatticeIndex < spreadRange.end()[ZZ];
+         ++zLatticeIndex)
+    {
+        const float zPrefactor = gaussZ[zLatticeIndex + spreadGridOffset[ZZ]];
+
+        for (int yLatticeIndex = spreadRange.begin()[YY]; yLatticeIndex < spreadRange.end()[YY];
+             ++yLatticeIndex)
+        {
+            const float zyPrefactor = zPrefactor * gaussY[yLatticeIndex + spreadGridOffset[YY]];
+            float*      row = lattice
+                         + (static_cast<index>(zLatticeIndex) * latticeSize[YY] + yLatticeIndex)
+                                   * latticeSize[XX]
+                         + spreadRange.begin()[XX];
+
+            for (int i = 0; i < numX; ++i)
+            {
+                row[i] += zyPrefactor * gaussXBegin[i];
+            }
+        }
+    }
+}
+
+//! The minimum number of Gaussians per thread for which threaded spreading pays off
+constexpr int c_minNumGaussiansPerThread = 64;
+
 
 } // namespace
 
@@ -317,16 +375,42 @@ public:
     Impl& operator=(const Impl& other) = default;
     //! Add another gaussian
     void add(const GaussianSpreadKernelParameters::PositionAndAmplitude& localParamters);
+    //! Add many gaussians using several threads
+    void add(ArrayRef<const RVec> coordinates, ArrayRef<const real> amplitudes, int numThreads);
+    //! Set the values within the spread bounding box to zero
+    void setZero();
+    //! Extend the spread bounding box to the whole lattice
+    void extendSpreadBoundingBoxToLattice();
+    //! The lattice range that a Gaussian at \p coordinate spreads onto
+    IntegerBox spreadRange(const RVec& coordinate) const;
+    //! Extend the spread bounding box by \p begin and \p end
+    void extendSpreadBoundingBox(const IVec& begin, const IVec& end);
+    /*! \brief Spread a single Gaussian onto part of the lattice.
+     *
+     * \param[in]     localParameters position and amplitude of the Gaussian
+     * \param[in]     range           the lattice points to spread onto, a part of the
+     *                                spread range of the Gaussian
+     * \param[in,out] gauss1d         buffers for the one-dimensional Gaussians
+     */
+    void spreadOnto(const GaussianSpreadKernelParameters::PositionAndAmplitude& localParameters,
+                    const IntegerBox&                                           range,
+                    std::array<GaussianOn1DLattice, DIM>*                       gauss1d);
     //! The width of the Gaussian in lattice spacing units
     BasicVector<double> sigma_;
     //! The spread range in lattice points
     IVec spreadRange_;
     //! The result of the Gauss transform
     MultiDimArray<std::vector<float>, dynamicExtents3D> data_;
-    //! The outer product of a Gaussian along the z and y dimension
-    OuterProductEvaluator outerProductZY_;
+    //! The number of lattice points along x, y and z
+    IVec latticeSize_;
     //! The three one-dimensional Gaussians, whose outer product is added to the Gauss transform
     std::array<GaussianOn1DLattice, DIM> gauss1d_;
+    //! Begin of the box of lattice points that may be non-zero
+    IVec spreadBoxBegin_;
+    //! End of the box of lattice points that may be non-zero
+    IVec spreadBoxEnd_;
+    //! The one-dimensional Gaussians of the threads, only used for threaded spreading
+    std::vector<std::array<GaussianOn1DLattice, DIM>> threadGauss1d_;
 };
 
 GaussTransform3D::Impl::Impl(const dynamicExtents3D&                      extent,
@@ -334,56 +418,155 @@ GaussTransform3D::Impl::Impl(const dynamicExtents3D&                      extent
     sigma_{ kernelShapeParameters.sigma_ },
     spreadRange_{ kernelShapeParameters.latticeSpreadRange() },
     data_{ extent },
+    latticeSize_{ latticeSizeFromExtents(extent) },
     gauss1d_({ GaussianOn1DLattice(spreadRange_[XX], sigma_[XX]),
                GaussianOn1DLattice(spreadRange_[YY], sigma_[YY]),
-               GaussianOn1DLattice(spreadRange_[ZZ], sigma_[ZZ]) })
+               GaussianOn1DLattice(spreadRange_[ZZ], sigma_[ZZ]) }),
+    spreadBoxBegin_{ latticeSize_ },
+    spreadBoxEnd_{ 0, 0, 0 }
 {
 }
 
-void GaussTransform3D::Impl::add(const GaussianSpreadKernelParameters::PositionAndAmplitude& localParameters)
+IntegerBox GaussTransform3D::Impl::spreadRange(const RVec& coordinate) const
+{
+    return spreadRangeWithinLattice(closestIntegerPoint(coordinate), data_.asConstView().extents(),
+                                    spreadRange_);
+}
+
+void GaussTransform3D::Impl::extendSpreadBoundingBox(const IVec& begin, const IVec& end)
+{
+    spreadBoxBegin_ = elementWiseMin(spreadBoxBegin_, begin);
+    spreadBoxEnd_   = elementWiseMax(spreadBoxEnd_, end);
+}
+
+void GaussTransform3D::Impl::extendSpreadBoundingBoxToLattice()
+{
+    spreadBoxBegin_ = { 0, 0, 0 };
+    spreadBoxEnd_   = latticeSize_;
+}
+
+void GaussTransform3D::Impl::spreadOnto(const GaussianSpreadKernelParameters::PositionAndAmplitude& localParameters,
+                                        const IntegerBox&                     range,
+                                        std::array<GaussianOn1DLattice, DIM>* gauss1d)
 {
     const IVec closestLatticePoint = closestIntegerPoint(localParameters.coordinate_);
-    const auto spreadRange =
-            spreadRangeWithinLattice(closestLatticePoint, data_.asView().extents(), spreadRange_);
 
+    for (int dimension = XX; dimension <= ZZ; ++dimension)
+    {
+        // multiply with amplitude so that Gauss3D = (amplitude * Gauss_x) * Gauss_y * Gauss_z
+        const float gauss1DAmplitude = dimension > XX ? 1.0 : localParameters.amplitude_;
+        (*gauss1d)[dimension].spread(gauss1DAmplitude, localParameters.coordinate_[dimension]
+                                                               - closestLatticePoint[dimension]);
+    }
+
+    addOuterProductToLattice(data_.asView().data(), latticeSize_, range,
+                             spreadRange_ - closestLatticePoint, gauss1d);
+}
+
+void GaussTransform3D::Impl::add(const GaussianSpreadKernelParameters::PositionAndAmplitude& localParameters)
+{
     // do nothing if the added Gaussian will never reach the lattice
-    if (spreadRange.empty())
+    const auto range = spreadRange(localParameters.coordinate_);
+    if (range.empty())
     {
         return;
     }
+    extendSpreadBoundingBox(range.begin(), range.end());
+    spreadOnto(localParameters, range, &gauss1d_);
+}
 
-    for (int dimension = XX; dimension <= ZZ; ++dimension)
+void GaussTransform3D::Impl::add(ArrayRef<const RVec> coordinates, ArrayRef<const real> amplitudes, int numThreads)
+{
+    GMX_ASSERT(coordinates.size() == amplitudes.size(),
+               "Need as many amplitudes as coordinates for spreading.");
+
+    const int numGaussians = coordinates.ssize();
+    numThreads = std::max(1, std::min(numThreads, numGaussians / c_minNumGaussiansPerThread));
+
+    if (numThreads == 1)
     {
-        // multiply with amplitude so that Gauss3D = (amplitude * Gauss_x) * Gauss_y * Gauss_z
-        const float gauss1DAmplitude = dimension > XX ? 1.0 : localParameters.amplitude_;
-        gauss1d_[dimension].spread(gauss1DAmplitude, localParameters.coordinate_[dimension]
-                                                             - closestLatticePoint[dimension]);
+        for (int i = 0; i < numGaussians; ++i)
+        {
+            add({ coordinates[i], amplitudes[i] });
+        }
+        return;
     }
 
-    const auto spreadZY         = outerProductZY_(gauss1d_[ZZ].view(), gauss1d_[YY].view());
-    const auto spreadX          = gauss1d_[XX].view();
-    const IVec spreadGridOffset = spreadRange_ - closestLatticePoint;
+    IVec begin = latticeSize_;
+    IVec end   = { 0, 0, 0 };
+    for (int i = 0; i < numGaussians; ++i)
+    {
+        const auto range = spreadRange(coordinates[i]);
+        if (!range.empty())
+        {
+            begin = elementWiseMin(begin, range.begin());
+            end   = elementWiseMax(end, range.end());
+        }
+    }
+    if (IntegerBox(begin, end).empty())
+    {
+        return;
+    }
+    extendSpreadBoundingBox(begin, end);
 
-    // \todo optimize these loops if performance critical
-    // The looping strategy uses that the last, x-dimension is contiguous in the memory layout
-    for (int zLatticeIndex = spreadRange.begin()[ZZ]; zLatticeIndex < spreadRange.end()[ZZ]; ++zLatticeIndex)
+    const int numPlanes = end[ZZ] - begin[ZZ];
+    numThreads          = std::min(numThreads, numPlanes);
+    while (threadGauss1d_.size() < static_cast<size_t>(numThreads))
     {
-        const auto zSlice = data_.asView()[zLatticeIndex];
+        threadGauss1d_.push_back(gauss1d_);
+    }
 
-        for (int yLatticeIndex = spreadRange.begin()[YY]; yLatticeIndex < spreadRange.end()[YY]; ++yLatticeIndex)
+    /* Every thread spreads onto its own slab of z-planes of the lattice,
+     * so no thread-local lattices or reduction are needed. The Gaussians
+     * that reach a slab are added to it in the original order, which gives
+     * the same result as serial spreading. A Gaussian that crosses a slab
+     * boundary is evaluated by the threads of both slabs.
+     */
+#pragma omp parallel num_threads(numThreads)
+    {
+        try
         {
-            const auto  ySlice      = zSlice[yLatticeIndex];
-            const float zyPrefactor = spreadZY(zLatticeIndex + spreadGridOffset[ZZ],
-                                               yLatticeIndex + spreadGridOffset[YY]);
-
-            for (int xLatticeIndex = spreadRange.begin()[XX]; xLatticeIndex < spreadRange.end()[XX];
-                 ++xLatticeIndex)
+            const int thread = gmx_omp_get_thread_num();
+            const int zBegin = begin[ZZ] + (numPlanes * thread) / numThreads;
+            const int zEnd   = begin[ZZ] + (numPlanes * (thread + 1)) / numThreads;
+            for (int i = 0; i < numGaussians; ++i)
             {
-                const float xPrefactor = spreadX[xLatticeIndex + spreadGridOffset[XX]];
-                ySlice[xLatticeIndex] += zyPrefactor * xPrefactor;
+                const auto range = spreadRange(coordinates[i]);
+                if (range.empty() || range.end()[ZZ] <= zBegin || range.begin()[ZZ] >= zEnd)
+                {
+                    continue;
+                }
+                const IVec       slabBegin = { range.begin()[XX], range.begin()[YY],
+                                         std::max(range.begin()[ZZ], zBegin) };
+                const IVec       slabEnd   = { range.end()[XX], range.end()[YY],
+                                       std::min(range.end()[ZZ], zEnd) };
+                const IntegerBox slabRange(slabBegin, slabEnd);
+                spreadOnto({ coordinates[i], amplitudes[i] }, slabRange, &threadGauss1d_[thread]);
             }
         }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
+}
+
+void GaussTransform3D::Impl::setZero()
+{
+    if (IntegerBox(spreadBoxBegin_, spreadBoxEnd_).empty())
+    {
+        return;
+    }
+    float* lattice = data_.asView().data();
+    for (int zLatticeIndex = spreadBoxBegin_[ZZ]; zLatticeIndex < spreadBoxEnd_[ZZ]; ++zLatticeIndex)
+    {
+        for (int yLatticeIndex = spreadBoxBegin_[YY]; yLatticeIndex < spreadBoxEnd_[YY]; ++yLatticeIndex)
+        {
+            float* row = lattice
+                         + (static_cast<index>(zLatticeIndex) * latticeSize_[YY] + yLatticeIndex)
+                                   * latticeSize_[XX];
+            std::fill(row + spreadBoxBegin_[XX], row + spreadBoxEnd_[XX], 0.0F);
+        }
     }
+    spreadBoxBegin_ = latticeSize_;
+    spreadBoxEnd_   = { 0, 0, 0 };
 }
 
 /********************************************************************
@@ -401,13 +584,34 @@ void GaussTransform3D::add(const GaussianSpreadKernelParameters::PositionAndAmpl
     impl_->add(localParameters);
 }
 
+void GaussTransform3D::add(ArrayRef<const RVec> coordinates, ArrayRef<const real> amplitudes, int numThreads)
+{
+    impl_->add(coordinates, amplitudes, numThreads);
+}
+
 void GaussTransform3D::setZero()
 {
-    std::fill(begin(impl_->data_), end(impl_->data_), 0.);
+    impl_->setZero();
+}
+
+IntegerBox GaussTransform3D::spreadBoundingBox() const
+{
+    return { impl_->spreadBoxBegin_, impl_->spreadBoxEnd_ };
 }
 
 basic_mdspan<float, dynamicExtents3D> GaussTransform3D::view()
 {
+    // values may be changed anywhere through this view
+    impl_->extendSpreadBoundingBoxToLattice();
+    return impl_->data_.asView();
+}
+
+basic_mdspan<float, dynamicExtents3D> GaussTransform3D::view(const IntegerBox& changedBox)
+{
+    if (!changedBox.empty())
+    {
+        impl_->extendSpreadBoundingBox(changedBox.begin(), changedBox.end());
+    }
     return impl_->data_.asView();
 }
 
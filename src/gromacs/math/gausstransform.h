@@ -56,6 +56,7 @@ namespace gmx
 {
 template<typename>
 class ArrayRef;
+class IntegerBox;
 /*! \internal
  * \brief Provide result of Gaussian function evaluation on a one-dimensional lattice.
  *
@@ -193,12 +194,40 @@ public:
      */
     void add(const GaussianSpreadKernelParameters::PositionAndAmplitude& localParameters);
 
-    //! \brief Set all values on the lattice to zero.
+    /*! \brief Add three dimensional Gaussians with given amplitudes at coordinates.
+     *
+     * Each thread spreads onto its own slab of z-planes of the lattice,
+     * so the result is identical to spreading the Gaussians one by one.
+     *
+     * \param[in] coordinates of the Gaussians in lattice coordinates
+     * \param[in] amplitudes  of the Gaussians, one per coordinate
+     * \param[in] numThreads  the maximum number of OpenMP threads to use
+     */
+    void add(ArrayRef<const RVec> coordinates, ArrayRef<const real> amplitudes, int numThreads);
+
+    /*! \brief Set all values on the lattice to zero.
+     *
+     * Only the values within spreadBoundingBox() are reset.
+     */
     void setZero();
 
+    /*! \brief Return the box of lattice points that may be non-zero.
+     *
+     * This covers all points added to since the last call to setZero(),
+     * or the whole lattice when view() was called in the meantime.
+     */
+    IntegerBox spreadBoundingBox() const;
+
     //! Return a view on the spread lattice.
     basic_mdspan<float, dynamicExtents3D> view();
 
+    /*! \brief Return a view on the spread lattice for changing values within a box.
+     *
+     * Unlike view(), this only extends the spread bounding box by \p changedBox.
+     * \param[in] changedBox the only lattice points whose values may be changed
+     */
+    basic_mdspan<float, dynamicExtents3D> view(const IntegerBox& changedBox);
+
     //! Return a const view on the spread lattice.
     basic_mdspan<const float, dynamicExtents3D> constView() const;
 
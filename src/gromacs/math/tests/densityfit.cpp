@@ -43,10 +43,14 @@
 
 #include "gromacs/math/densityfit.h"
 
+#include <cmath>
+
 #include <numeric>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include "gromacs/math/gausstransform.h"
 #include "gromacs/math/multidimarray.h"
 
 #include "testutils/refdata.h"
@@ -287,6 +291,110 @@ TEST(DensitySimilarityTest, CrossCorrelationGradientIsCorrect)
     checker.checkSequence(gradientView.begin(), gradientView.end(), "cross-correlation-gradient");
 }
 
+TEST(DensitySimilarityTest, ThreadedEvaluationMatchesSerial)
+{
+    MultiDimArray<std::vector<float>, dynamicExtents3D> referenceDensity(50, 50, 50);
+    MultiDimArray<std::vector<float>, dynamicExtents3D> comparedDensity(50, 50, 50);
+    int                                                 i = 0;
+    for (float& value : referenceDensity)
+    {
+        value = 1 + std::sin(0.01 * i++);
+    }
+    i = 0;
+    for (float& value : comparedDensity)
+    {
+        value = 1 + std::cos(0.013 * i++);
+    }
+
+    const int numThreads = 4;
+    for (const auto method : { DensitySimilarityMeasureMethod::innerProduct,
+                               DensitySimilarityMeasureMethod::relativeEntropy,
+                               DensitySimilarityMeasureMethod::crossCorrelation })
+    {
+        DensitySimilarityMeasure measure(method, referenceDensity.asConstView());
+
+        const real serialSimilarity = measure.similarity(comparedDensity.asConstView(), 1);
+        EXPECT_REAL_EQ_TOL(serialSimilarity,
+                           measure.similarity(comparedDensity.asConstView(), numThreads),
+                           relativeToleranceAsFloatingPoint(serialSimilarity, 1e-4));
+
+        const basic_mdspan<const float, dynamicExtents3D> serialGradient =
+                measure.gradient(comparedDensity.asConstView(), 1);
+        const std::vector<float> serialGradientValues(
+                serialGradient.data(), serialGradient.data() + serialGradient.mapping().required_span_size());
+        const basic_mdspan<const float, dynamicExtents3D> threadedGradient =
+                measure.gradient(comparedDensity.asConstView(), numThreads);
+        ArrayRef<const float> threadedGradientView(
+                threadedGradient.data(),
+                threadedGradient.data() + threadedGradient.mapping().required_span_size());
+        EXPECT_THAT(serialGradientValues,
+                    Pointwise(FloatEq(relativeToleranceAsFloatingPoint(1, 1e-4)), threadedGradientView));
+    }
+}
+
+TEST(DensitySimilarityTest, SimilarityFromPartialSumsOverBoxesMatchesFullEvaluation)
+{
+    MultiDimArray<std::vector<float>, dynamicExtents3D> referenceDensity(10, 12, 14);
+    MultiDimArray<std::vector<float>, dynamicExtents3D> comparedDensity(10, 12, 14);
+    int                                                 i = 0;
+    for (float& value : referenceDensity)
+    {
+        value = 1 + std::sin(0.1 * i++);
+    }
+
+    // the compared density is non-zero only within a box, split along z in two parts
+    const IntegerBox box({ 2, 3, 1 }, { 11, 9, 8 });
+    const IntegerBox lowerPart({ 2, 3, 1 }, { 11, 9, 4 });
+    const IntegerBox upperPart({ 2, 3, 4 }, { 11, 9, 8 });
+    for (int z = box.begin()[ZZ]; z < box.end()[ZZ]; ++z)
+    {
+        for (int y = box.begin()[YY]; y < box.end()[YY]; ++y)
+        {
+            for (int x = box.begin()[XX]; x < box.end()[XX]; ++x)
+            {
+                comparedDensity(z, y, x) = 1 + std::cos(0.3 * (x + 2 * y + 3 * z));
+            }
+        }
+    }
+
+    for (const auto method : { DensitySimilarityMeasureMethod::innerProduct,
+                               DensitySimilarityMeasureMethod::relativeEntropy,
+                               DensitySimilarityMeasureMethod::crossCorrelation })
+    {
+        DensitySimilarityMeasure measure(method, referenceDensity.asConstView());
+
+        const real expectedSimilarity = measure.similarity(comparedDensity.asConstView());
+        const std::vector<float> expectedGradient(
+                measure.gradient(comparedDensity.asConstView()).data(),
+                measure.gradient(comparedDensity.asConstView()).data()
+                        + comparedDensity.asConstView().mapping().required_span_size());
+
+        auto       sums      = measure.partialSums(comparedDensity.asConstView(), lowerPart, 2);
+        const auto upperSums = measure.partialSums(comparedDensity.asConstView(), upperPart, 2);
+        for (size_t sumIndex = 0; sumIndex < sums.size(); ++sumIndex)
+        {
+            sums[sumIndex] += upperSums[sumIndex];
+        }
+        EXPECT_REAL_EQ_TOL(expectedSimilarity, measure.similarityFromSums(sums),
+                           relativeToleranceAsFloatingPoint(expectedSimilarity, 1e-4));
+
+        const auto gradient = measure.gradientWithinBox(comparedDensity.asConstView(), sums, box, 2);
+        for (int z = box.begin()[ZZ]; z < box.end()[ZZ]; ++z)
+        {
+            for (int y = box.begin()[YY]; y < box.end()[YY]; ++y)
+            {
+                for (int x = box.begin()[XX]; x < box.end()[XX]; ++x)
+                {
+                    const float expected =
+                            expectedGradient[(z * comparedDensity.extent(1) + y) * comparedDensity.extent(2) + x];
+                    EXPECT_FLOAT_EQ_TOL(expected, gradient(z, y, x),
+                                        relativeToleranceAsFloatingPoint(expected, 1e-4));
+                }
+            }
+        }
+    }
+}
+
 } // namespace test
 
 } // namespace gmx
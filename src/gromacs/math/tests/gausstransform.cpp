@@ -44,6 +44,7 @@
 #include "gromacs/math/gausstransform.h"
 
 #include <array>
+#include <cmath>
 #include <numeric>
 #include <vector>
 
@@ -279,6 +280,82 @@ TEST_F(GaussTransformTest, view)
     EXPECT_THAT(expectedValues, testing::Pointwise(FloatEq(tolerance_), gaussTransformVector));
 }
 
+TEST_F(GaussTransformTest, spreadBoundingBoxCoversAddedGaussians)
+{
+    EXPECT_TRUE(gaussTransform_.spreadBoundingBox().empty());
+    gaussTransform_.add({ latticeCenter_, 1. });
+    EXPECT_FALSE(gaussTransform_.spreadBoundingBox().empty());
+    gaussTransform_.setZero();
+    EXPECT_TRUE(gaussTransform_.spreadBoundingBox().empty());
+}
+
+TEST_F(GaussTransformTest, viewWithinBoxOnlyExtendsSpreadBoundingBoxByBox)
+{
+    const IntegerBox changedBox({ 1, 1, 1 }, { 2, 2, 2 });
+    gaussTransform_.view(changedBox)(1, 1, 1) = 1;
+    for (int dimension = XX; dimension <= ZZ; ++dimension)
+    {
+        EXPECT_EQ(changedBox.begin()[dimension], gaussTransform_.spreadBoundingBox().begin()[dimension]);
+        EXPECT_EQ(changedBox.end()[dimension], gaussTransform_.spreadBoundingBox().end()[dimension]);
+    }
+    gaussTransform_.setZero();
+    isZeroWithinFloatTolerance();
+}
+
+TEST(GaussTransformThreadedTest, MatchesSerialSpreadingForSeveralLatticeSizes)
+{
+    const GaussianSpreadKernelParameters::Shape kernelShape    = { { 1.2, 1.2, 1.2 }, 4 };
+    const std::vector<dynamicExtents3D>         latticeExtents = { { 10, 10, 10 },
+                                                           { 20, 30, 40 },
+                                                           { 64, 64, 64 } };
+    const int                                   numGaussians   = 500;
+    const int                                   numThreads     = 4;
+
+    for (const auto& latticeExtent : latticeExtents)
+    {
+        // Deterministic coordinates inside and around the lattice, in no spatial order
+        std::vector<RVec> coordinates;
+        std::vector<real> amplitudes;
+        for (int i = 0; i < numGaussians; ++i)
+        {
+            const real fraction = real((37 * i) % numGaussians) / numGaussians;
+            coordinates.emplace_back(
+                    1.2 * fraction * latticeExtent.extent(ZZ) - 2 + std::sin(real(i)),
+                    fraction * latticeExtent.extent(YY) + std::cos(real(3 * i)),
+                    fraction * latticeExtent.extent(XX) + std::sin(real(7 * i)));
+            amplitudes.push_back(1 + 0.5 * std::cos(real(i)));
+        }
+
+        GaussTransform3D serial(latticeExtent, kernelShape);
+        GaussTransform3D threaded(latticeExtent, kernelShape);
+        serial.add(coordinates, amplitudes, 1);
+        threaded.add(coordinates, amplitudes, numThreads);
+
+        // Each lattice point receives the same contributions in the same order
+        const auto               serialView   = serial.constView();
+        const auto               threadedView = threaded.constView();
+        const std::vector<float> serialValues(
+                serialView.data(), serialView.data() + serialView.mapping().required_span_size());
+        const std::vector<float> threadedValues(
+                threadedView.data(),
+                threadedView.data() + threadedView.mapping().required_span_size());
+        EXPECT_EQ(serialValues, threadedValues);
+        for (int dimension = XX; dimension <= ZZ; ++dimension)
+        {
+            EXPECT_EQ(serial.spreadBoundingBox().begin()[dimension],
+                      threaded.spreadBoundingBox().begin()[dimension]);
+            EXPECT_EQ(serial.spreadBoundingBox().end()[dimension],
+                      threaded.spreadBoundingBox().end()[dimension]);
+        }
+
+        threaded.setZero();
+        for (const auto& x : threaded.constView())
+        {
+            EXPECT_EQ(0, x);
+        }
+    }
+}
+
 } // namespace
 
 } // namespace test
@@ -1082,6 +1082,8 @@ Constraints::Impl::Impl(const gmx_mtop_t&     mtop_p,
             }
 
             shaked = std::make_unique<shakedata>();
+            // SHAKE replaces LINCS, so it uses the LINCS thread count
+            shaked->numThreads = std::max(1, gmx_omp_nthreads_get(emntLINCS));
         }
     }
 
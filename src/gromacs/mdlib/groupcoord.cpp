@@ -39,11 +39,18 @@
 
 #include "groupcoord.h"
 
+#include "config.h"
+
+#include <numeric>
+
+#include "gromacs/domdec/domdec_struct.h"
 #include "gromacs/domdec/ga2la.h"
 #include "gromacs/gmxlib/network.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/mdtypes/commrec.h"
 #include "gromacs/pbcutil/pbc.h"
+#include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxmpi.h"
 #include "gromacs/utility/smalloc.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
@@ -186,6 +193,113 @@ static void shift_positions_group(const matrix box,
 }
 
 
+#if GMX_MPI
+/* Gathers sendCount elements from each rank into receiveBuffer on all ranks */
+static void gatherOnAllRanks(const void*  sendBuffer,
+                             int          sendCount,
+                             void*        receiveBuffer,
+                             const int*   countPerRank,
+                             const int*   offsetPerRank,
+                             int          totalCount,
+                             MPI_Datatype type,
+                             MPI_Comm     comm)
+{
+    if (totalCount == 0)
+    {
+        return;
+    }
+#    if GMX_LIB_MPI
+    MPI_Allgatherv(const_cast<void*>(sendBuffer), sendCount, type, receiveBuffer,
+                   const_cast<int*>(countPerRank), const_cast<int*>(offsetPerRank), type, comm);
+#    else
+    /* thread-MPI does not implement MPI_Allgatherv */
+    MPI_Gatherv(const_cast<void*>(sendBuffer), sendCount, type, receiveBuffer,
+                const_cast<int*>(countPerRank), const_cast<int*>(offsetPerRank), type, 0, comm);
+    MPI_Bcast(receiveBuffer, totalCount, type, 0, comm);
+#    endif
+}
+#endif
+
+
+/* Collect the positions of the group by gathering the home atoms of all
+ * DD ranks. The collective indices are only gathered after repartitioning. */
+static void gather_group_positions(const gmx_domdec_t*  dd,
+                                   rvec*                xcoll,
+                                   const rvec*          x_loc,
+                                   const int            nr,
+                                   const int            nr_loc,
+                                   const int*           anrs_loc,
+                                   const int*           coll_ind,
+                                   GroupCollectionPlan* plan)
+{
+#if GMX_MPI
+    const int numRanks = dd->nnodes;
+
+    if (plan->partitioningCount != dd->ddp_count)
+    {
+        /* Gather the number of atoms and the collective indices of all ranks */
+        std::vector<int> ones(numRanks, 1);
+        std::vector<int> rankIndices(numRanks);
+        std::iota(rankIndices.begin(), rankIndices.end(), 0);
+        std::vector<int> numAtomsPerRank(numRanks);
+        gatherOnAllRanks(&nr_loc, 1, numAtomsPerRank.data(), ones.data(), rankIndices.data(),
+                         numRanks, MPI_INT, dd->mpi_comm_all);
+
+        std::vector<int> atomOffsetPerRank(numRanks);
+        std::partial_sum(numAtomsPerRank.begin(), numAtomsPerRank.end() - 1,
+                         atomOffsetPerRank.begin() + 1);
+        GMX_RELEASE_ASSERT(atomOffsetPerRank.back() + numAtomsPerRank.back() == nr,
+                           "Each group atom should be a home atom on exactly one rank");
+
+        plan->collectiveIndex.resize(nr);
+        gatherOnAllRanks(coll_ind, nr_loc, plan->collectiveIndex.data(), numAtomsPerRank.data(),
+                         atomOffsetPerRank.data(), nr, MPI_INT, dd->mpi_comm_all);
+
+        plan->numRealsPerRank.resize(numRanks);
+        plan->offsetPerRank.resize(numRanks);
+        for (int rank = 0; rank < numRanks; rank++)
+        {
+            plan->numRealsPerRank[rank] = DIM * numAtomsPerRank[rank];
+            plan->offsetPerRank[rank]   = DIM * atomOffsetPerRank[rank];
+        }
+        plan->receiveBuffer.resize(DIM * nr);
+        plan->partitioningCount = dd->ddp_count;
+    }
+
+    plan->sendBuffer.resize(DIM * nr_loc);
+    for (int i = 0; i < nr_loc; i++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            plan->sendBuffer[DIM * i + d] = x_loc[anrs_loc[i]][d];
+        }
+    }
+
+    gatherOnAllRanks(plan->sendBuffer.data(), DIM * nr_loc, plan->receiveBuffer.data(),
+                     plan->numRealsPerRank.data(), plan->offsetPerRank.data(), DIM * nr,
+                     GMX_MPI_REAL, dd->mpi_comm_all);
+
+    for (int i = 0; i < nr; i++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            xcoll[plan->collectiveIndex[i]][d] = plan->receiveBuffer[DIM * i + d];
+        }
+    }
+#else
+    GMX_UNUSED_VALUE(dd);
+    GMX_UNUSED_VALUE(xcoll);
+    GMX_UNUSED_VALUE(x_loc);
+    GMX_UNUSED_VALUE(nr);
+    GMX_UNUSED_VALUE(nr_loc);
+    GMX_UNUSED_VALUE(anrs_loc);
+    GMX_UNUSED_VALUE(coll_ind);
+    GMX_UNUSED_VALUE(plan);
+    GMX_RELEASE_ASSERT(false, "Gathering group positions requires MPI");
+#endif
+}
+
+
 /* Assemble the positions of the group such that every node has all of them.
  * The atom indices are retrieved from anrs_loc[0..nr_loc]
  * Note that coll_ind[i] = i is needed in the serial case */
@@ -201,25 +315,34 @@ extern void communicate_group_positions(const t_commrec* cr, /* Pointer to MPI c
                                         const int*  coll_ind, /* Collective index */
                                         rvec* xcoll_old,  /* (optional) Positions from the last time
                                                              step,  used to make group whole */
-                                        const matrix box) /* (optional) The box */
+                                        const matrix box, /* (optional) The box */
+                                        GroupCollectionPlan* plan) /* (optional) Gather setup */
 {
     int i;
 
 
-    /* Zero out the groups' global position array */
-    clear_rvecs(nr, xcoll);
-
-    /* Put the local positions that this node has into the right place of
-     * the collective array. Note that in the serial case, coll_ind[i] = i */
-    for (i = 0; i < nr_loc; i++)
+    if (plan != nullptr && DOMAINDECOMP(cr))
     {
-        copy_rvec(x_loc[anrs_loc[i]], xcoll[coll_ind[i]]);
+        /* Only communicate the home atoms of each rank */
+        gather_group_positions(cr->dd, xcoll, x_loc, nr, nr_loc, anrs_loc, coll_ind, plan);
     }
-
-    if (PAR(cr))
+    else
     {
-        /* Add the arrays from all nodes together */
-        gmx_sum(nr * 3, xcoll[0], cr);
+        /* Zero out the groups' global position array */
+        clear_rvecs(nr, xcoll);
+
+        /* Put the local positions that this node has into the right place of
+         * the collective array. Note that in the serial case, coll_ind[i] = i */
+        for (i = 0; i < nr_loc; i++)
+        {
+            copy_rvec(x_loc[anrs_loc[i]], xcoll[coll_ind[i]]);
+        }
+
+        if (PAR(cr))
+        {
+            /* Add the arrays from all nodes together */
+            gmx_sum(nr * 3, xcoll[0], cr);
+        }
     }
     /* Now we have all the positions of the group in the xcoll array present on all
      * nodes.
@@ -49,12 +49,40 @@
 
 #include <stdio.h>
 
+#include <cstdint>
+#include <vector>
+
 #include "gromacs/math/vectypes.h"
 #include "gromacs/utility/basedefinitions.h"
+#include "gromacs/utility/real.h"
 
 class gmx_ga2la_t;
 struct t_commrec;
 
+/*! \libinternal \brief Communication setup for collecting group positions by gathering.
+ *
+ * With domain decomposition, communicate_group_positions() can collect the
+ * positions by gathering only the home atoms of each rank, instead of
+ * summing a full-size array over all ranks. For this it stores the
+ * collective indices of the group atoms on all ranks. These only change
+ * upon repartitioning, so they are only communicated again after that.
+ */
+struct GroupCollectionPlan
+{
+    //! The DD partitioning count the indices below are valid for, -1 when not set
+    int64_t partitioningCount = -1;
+    //! The number of reals each rank contributes
+    std::vector<int> numRealsPerRank;
+    //! The offset of the contribution of each rank in the receive buffer
+    std::vector<int> offsetPerRank;
+    //! The collective index of each received position
+    std::vector<int> collectiveIndex;
+    //! Send buffer for the local positions
+    std::vector<real> sendBuffer;
+    //! Receive buffer for the positions of all ranks
+    std::vector<real> receiveBuffer;
+};
+
 /*! \brief Select local atoms of a group.
  *
  * Selects the indices of local atoms of a group and stores them in anrs_loc[0..nr_loc].
@@ -125,19 +153,24 @@ extern void dd_make_local_group_indices(const gmx_ga2la_t* ga2la,
  *                             group whole (optional).
  * \param[in]     box          Simulation box matrix, needed to shift xcoll such that
  *                             the group becomes whole (optional).
+ * \param[in,out] plan         When not NULL and running with domain decomposition,
+ *                             the positions are gathered instead of summed, using
+ *                             the communication setup stored in \p plan
+ *                             (optional).
  */
-extern void communicate_group_positions(const t_commrec* cr,
-                                        rvec*            xcoll,
-                                        ivec*            shifts,
-                                        ivec*            extra_shifts,
-                                        gmx_bool         bNS,
-                                        const rvec*      x_loc,
-                                        int              nr,
-                                        int              nr_loc,
-                                        const int*       anrs_loc,
-                                        const int*       coll_ind,
-                                        rvec*            xcoll_old,
-                                        const matrix     box);
+extern void communicate_group_positions(const t_commrec*     cr,
+                                        rvec*                xcoll,
+                                        ivec*                shifts,
+                                        ivec*                extra_shifts,
+                                        gmx_bool             bNS,
+                                        const rvec*          x_loc,
+                                        int                  nr,
+                                        int                  nr_loc,
+                                        const int*           anrs_loc,
+                                        const int*           coll_ind,
+                                        rvec*                xcoll_old,
+                                        const matrix         box,
+                                        GroupCollectionPlan* plan = nullptr);
 
 /*! \brief Calculates the center of the positions x locally.
  *
@@ -400,14 +400,15 @@ static void settleTemplate(const SettleData& settled,
 
     TypeBool bError = TypeBool(false);
 
-    const SettleParameters* p    = &settled.parametersMassWeighted();
-    T                       wh   = T(p->wh);
-    T                       rc   = T(p->rc);
-    T                       ra   = T(p->ra);
-    T                       rb   = T(p->rb);
-    T                       irc2 = T(p->irc2);
-    T                       mO   = T(p->mO);
-    T                       mH   = T(p->mH);
+    const SettleParameters* p     = &settled.parametersMassWeighted();
+    T                       wh    = T(p->wh);
+    T                       rc    = T(p->rc);
+    T                       ra    = T(p->ra);
+    T                       rb    = T(p->rb);
+    T                       irc2  = T(p->irc2);
+    T                       mO    = T(p->mO);
+    T                       mH    = T(p->mH);
+    T                       invra = T(1.0 / p->ra);
 
     T almost_zero = T(1e-12);
 
@@ -497,8 +498,13 @@ static void settleTemplate(const SettleData& settled,
         T zaksyd = xakszd * yaksxd - yakszd * xaksxd;
         /* 27 flops */
 
-        T axlng = gmx::invsqrt(xaksxd * xaksxd + yaksxd * yaksxd + zaksxd * zaksxd);
-        T aylng = gmx::invsqrt(xaksyd * xaksyd + yaksyd * yaksyd + zaksyd * zaksyd);
+        /* In double precision, invsqrtPair does most of the Newton-Raphson
+         * iterations for two arguments at once in single precision SIMD,
+         * followed by a final correction in double precision.
+         */
+        T axlng, aylng;
+        gmx::invsqrtPair(xaksxd * xaksxd + yaksxd * yaksxd + zaksxd * zaksxd,
+                         xaksyd * xaksyd + yaksyd * yaksyd + zaksyd * zaksyd, &axlng, &aylng);
         T azlng = gmx::invsqrt(xakszd * xakszd + yakszd * yakszd + zakszd * zakszd);
 
         T trns1[DIM], trns2[DIM], trns3[DIM];
@@ -534,7 +540,7 @@ static void settleTemplate(const SettleData& settled,
 
         T tmp, tmp2;
 
-        T sinphi = a1d_z * gmx::invsqrt(ra * ra);
+        T sinphi = a1d_z * invra;
         tmp2     = 1.0 - sinphi * sinphi;
 
         /* If tmp2 gets close to or beyond zero we have severly distorted
@@ -566,7 +572,9 @@ static void settleTemplate(const SettleData& settled,
         T gamma  = b0d[XX] * b1d[YY] - b1d[XX] * b0d[YY] + c0d[XX] * c1d[YY] - c1d[XX] * c0d[YY];
         T al2be2 = alpha * alpha + beta * beta;
         tmp2     = (al2be2 - gamma * gamma);
-        T sinthe = (alpha * gamma - beta * tmp2 * gmx::invsqrt(tmp2)) * gmx::invsqrt(al2be2 * al2be2);
+        T invsqrtTmp2, invAl2be2;
+        gmx::invsqrtPair(tmp2, al2be2 * al2be2, &invsqrtTmp2, &invAl2be2);
+        T sinthe = (alpha * gamma - beta * tmp2 * invsqrtTmp2) * invAl2be2;
         /* 47 flops */
 
         /*  --- Step4  A3' --- */
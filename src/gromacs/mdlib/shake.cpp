@@ -60,12 +60,20 @@
 #include "gromacs/mdtypes/md_enums.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/topology/invblock.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 namespace gmx
 {
 
+//! The maximum number of SHAKE iterations per block
+static const int c_maxShakeIterations = 1000;
+
+//! The maximum number of block colours, blocks that do not fit go to a serial colour
+static const int c_maxNumShakeColors = 64;
+
 typedef struct
 {
     int iatom[3];
@@ -121,6 +129,74 @@ static void resizeLagrangianData(shakedata* shaked, int ncons)
     shaked->scaled_lagrange_multiplier.resize(ncons);
 }
 
+void colorShakeBlocks(shakedata* shaked, ArrayRef<const int> iatoms)
+{
+    const int numBlocks = shaked->numShakeBlocks();
+
+    int numAtoms = 0;
+    for (int c = 0; c < iatoms.ssize() / 3; c++)
+    {
+        numAtoms = std::max(numAtoms, std::max(iatoms[3 * c + 1], iatoms[3 * c + 2]) + 1);
+    }
+
+    /* Greedy colouring: each block gets the lowest colour that is not
+     * used by an earlier block with which it shares an atom. Blocks made
+     * without DD never share atoms, so they all get colour 0.
+     */
+    std::vector<uint64_t> atomColorMask(numAtoms, 0);
+    std::vector<int>      blockColor(numBlocks);
+    std::vector<int>      numBlocksPerColor(c_maxNumShakeColors + 1, 0);
+    for (int b = 0; b < numBlocks; b++)
+    {
+        uint64_t usedColors = 0;
+        for (int i = shaked->sblock[b]; i < shaked->sblock[b + 1]; i += 3)
+        {
+            usedColors |= atomColorMask[iatoms[i + 1]] | atomColorMask[iatoms[i + 2]];
+        }
+        int color = 0;
+        while (color < c_maxNumShakeColors && (usedColors & (uint64_t(1) << color)))
+        {
+            color++;
+        }
+        if (color < c_maxNumShakeColors)
+        {
+            for (int i = shaked->sblock[b]; i < shaked->sblock[b + 1]; i += 3)
+            {
+                atomColorMask[iatoms[i + 1]] |= uint64_t(1) << color;
+                atomColorMask[iatoms[i + 2]] |= uint64_t(1) << color;
+            }
+        }
+        blockColor[b] = color;
+        numBlocksPerColor[color]++;
+    }
+
+    int numColors = c_maxNumShakeColors + 1;
+    while (numColors > 0 && numBlocksPerColor[numColors - 1] == 0)
+    {
+        numColors--;
+    }
+    shaked->lastColorIsSerial = (numColors == c_maxNumShakeColors + 1);
+
+    shaked->colorStart.resize(numColors + 1);
+    shaked->colorStart[0] = 0;
+    for (int c = 0; c < numColors; c++)
+    {
+        shaked->colorStart[c + 1] = shaked->colorStart[c] + numBlocksPerColor[c];
+    }
+    /* Store the blocks in ascending order within each colour */
+    std::vector<int> fillIndex(shaked->colorStart.begin(), shaked->colorStart.end() - 1);
+    shaked->blocksByColor.resize(numBlocks);
+    for (int b = 0; b < numBlocks; b++)
+    {
+        shaked->blocksByColor[fillIndex[blockColor[b]]++] = b;
+    }
+
+    if (debug)
+    {
+        fprintf(debug, "SHAKE: %d blocks in %d colours\n", numBlocks, numColors);
+    }
+}
+
 void make_shake_sblock_serial(shakedata* shaked, InteractionDefinitions* idef, const int numAtoms)
 {
     int          i, m, ncons;
@@ -207,6 +283,7 @@ void make_shake_sblock_serial(shakedata* shaked, InteractionDefinitions* idef, c
     sfree(sb);
     sfree(inv_sblock);
     resizeLagrangianData(shaked, ncons);
+    colorShakeBlocks(shaked, idef->il[F_CONSTR].iatoms);
 }
 
 void make_shake_sblock_dd(shakedata* shaked, const InteractionList& ilcon)
@@ -231,6 +308,7 @@ void make_shake_sblock_dd(shakedata* shaked, const InteractionList& ilcon)
     }
     shaked->sblock.push_back(3 * ncons);
     resizeLagrangianData(shaked, ncons);
+    colorShakeBlocks(shaked, ilcon.iatoms);
 }
 
 /*! \brief Inner kernel for SHAKE constraints
@@ -431,10 +509,16 @@ static void crattle(const int            iatom[],
     *nerror = error;
 }
 
-//! Applies SHAKE
-static int vec_shakef(FILE*                     fplog,
-                      shakedata*                shaked,
+/*! \brief Applies SHAKE to the \p ncon constraints of one block starting at constraint \p blockStart
+ *
+ * Returns the number of iterations, which is zero when SHAKE failed
+ * to converge or the input was malformed, and sets \p error to one more
+ * than the index of the problematic constraint in the latter case.
+ * Can be called concurrently for blocks that do not share atoms.
+ */
+static int vec_shakef(shakedata*                shaked,
                       const real                invmass[],
+                      int                       blockStart,
                       int                       ncon,
                       ArrayRef<const t_iparams> ip,
                       const int*                iatom,
@@ -445,28 +529,26 @@ static int vec_shakef(FILE*                     fplog,
                       real                      omega,
                       bool                      bFEP,
                       real                      lambda,
-                      ArrayRef<real>            scaled_lagrange_multiplier,
                       real                      invdt,
                       ArrayRef<RVec>            v,
                       bool                      bCalcVir,
                       tensor                    vir_r_m_dr,
-                      ConstraintVariable        econq)
+                      ConstraintVariable        econq,
+                      int*                      error)
 {
-    int  maxnit = 1000;
-    int  nit    = 0, ll, i, j, d, d2, type;
+    int  nit = 0, ll, i, j, d, d2, type;
     real L1;
-    int  error = 0;
     real constraint_distance;
 
-    shaked->rij.resize(ncon);
-    shaked->half_of_reduced_mass.resize(ncon);
-    shaked->distance_squared_tolerance.resize(ncon);
-    shaked->constraint_distance_squared.resize(ncon);
-
-    ArrayRef<RVec> rij                         = shaked->rij;
-    ArrayRef<real> half_of_reduced_mass        = shaked->half_of_reduced_mass;
-    ArrayRef<real> distance_squared_tolerance  = shaked->distance_squared_tolerance;
-    ArrayRef<real> constraint_distance_squared = shaked->constraint_distance_squared;
+    ArrayRef<RVec> rij = ArrayRef<RVec>(shaked->rij).subArray(blockStart, ncon);
+    ArrayRef<real> half_of_reduced_mass =
+            ArrayRef<real>(shaked->half_of_reduced_mass).subArray(blockStart, ncon);
+    ArrayRef<real> distance_squared_tolerance =
+            ArrayRef<real>(shaked->distance_squared_tolerance).subArray(blockStart, ncon);
+    ArrayRef<real> constraint_distance_squared =
+            ArrayRef<real>(shaked->constraint_distance_squared).subArray(blockStart, ncon);
+    ArrayRef<real> scaled_lagrange_multiplier =
+            ArrayRef<real>(shaked->scaled_lagrange_multiplier).subArray(blockStart, ncon);
 
     L1            = 1.0_real - lambda;
     const int* ia = iatom;
@@ -498,43 +580,24 @@ static int vec_shakef(FILE*                     fplog,
         distance_squared_tolerance[ll]  = 0.5 / (constraint_distance_squared[ll] * tol);
     }
 
+    *error = 0;
     switch (econq)
     {
         case ConstraintVariable::Positions:
-            cshake(iatom, ncon, &nit, maxnit, constraint_distance_squared, prime, pbc, rij,
-                   half_of_reduced_mass, omega, invmass, distance_squared_tolerance,
-                   scaled_lagrange_multiplier, &error);
+            cshake(iatom, ncon, &nit, c_maxShakeIterations, constraint_distance_squared, prime, pbc,
+                   rij, half_of_reduced_mass, omega, invmass, distance_squared_tolerance,
+                   scaled_lagrange_multiplier, error);
             break;
         case ConstraintVariable::Velocities:
-            crattle(iatom, ncon, &nit, maxnit, constraint_distance_squared, prime, rij,
+            crattle(iatom, ncon, &nit, c_maxShakeIterations, constraint_distance_squared, prime, rij,
                     half_of_reduced_mass, omega, invmass, distance_squared_tolerance,
-                    scaled_lagrange_multiplier, &error, invdt);
+                    scaled_lagrange_multiplier, error, invdt);
             break;
         default: gmx_incons("Unknown constraint quantity for SHAKE");
     }
 
-    if (nit >= maxnit)
+    if (nit >= c_maxShakeIterations || *error != 0)
     {
-        if (fplog)
-        {
-            fprintf(fplog, "Shake did not converge in %d steps\n", maxnit);
-        }
-        fprintf(stderr, "Shake did not converge in %d steps\n", maxnit);
-        nit = 0;
-    }
-    else if (error != 0)
-    {
-        if (fplog)
-        {
-            fprintf(fplog,
-                    "Inner product between old and new vector <= 0.0!\n"
-                    "constraint #%d atoms %d and %d\n",
-                    error - 1, iatom[3 * (error - 1) + 1] + 1, iatom[3 * (error - 1) + 2] + 1);
-        }
-        fprintf(stderr,
-                "Inner product between old and new vector <= 0.0!\n"
-                "constraint #%d atoms %d and %d\n",
-                error - 1, iatom[3 * (error - 1) + 1] + 1, iatom[3 * (error - 1) + 2] + 1);
         nit = 0;
     }
 
@@ -595,6 +658,29 @@ static int vec_shakef(FILE*                     fplog,
     return nit;
 }
 
+//! Reports why SHAKE failed for the block with constraint list \p iatom
+static void reportShakeFailure(FILE* fplog, int error, const int* iatom)
+{
+    for (FILE* fp : { fplog, stderr })
+    {
+        if (fp == nullptr)
+        {
+            continue;
+        }
+        if (error == 0)
+        {
+            fprintf(fp, "Shake did not converge in %d steps\n", c_maxShakeIterations);
+        }
+        else
+        {
+            fprintf(fp,
+                    "Inner product between old and new vector <= 0.0!\n"
+                    "constraint #%d atoms %d and %d\n",
+                    error - 1, iatom[3 * (error - 1) + 1] + 1, iatom[3 * (error - 1) + 2] + 1);
+        }
+    }
+}
+
 //! Check that constraints are satisfied.
 static void check_cons(FILE*                     log,
                        int                       nc,
@@ -670,7 +756,7 @@ static bool bshakef(FILE*                         log,
                     ConstraintVariable            econq)
 {
     real dt_2, dvdl;
-    int  i, n0, ncon, blen, type, ll;
+    int  ncon, blen, type, ll;
     int  tnit = 0, trij = 0;
 
     ncon = idef.il[F_CONSTR].size() / 3;
@@ -679,35 +765,105 @@ static bool bshakef(FILE*                         log,
     {
         shaked->scaled_lagrange_multiplier[ll] = 0;
     }
+    shaked->rij.resize(ncon);
+    shaked->half_of_reduced_mass.resize(ncon);
+    shaked->distance_squared_tolerance.resize(ncon);
+    shaked->constraint_distance_squared.resize(ncon);
+
+    const int numBlocks = shaked->numShakeBlocks();
+    shaked->blockNumIterations.resize(numBlocks);
+    shaked->blockError.resize(numBlocks);
 
-    // TODO Rewrite this block so that it is obvious that i, iatoms
-    // and lam are all iteration variables. Is this easier if the
-    // sblock data structure is organized differently?
-    const int*     iatoms = &(idef.il[F_CONSTR].iatoms[shaked->sblock[0]]);
-    ArrayRef<real> lam    = shaked->scaled_lagrange_multiplier;
-    for (i = 0; (i < shaked->numShakeBlocks());)
+    const int numThreads = std::max(1, std::min(shaked->numThreads, numBlocks));
+    if (bCalcVir)
     {
-        blen = (shaked->sblock[i + 1] - shaked->sblock[i]);
-        blen /= 3;
-        n0 = vec_shakef(log, shaked, invmass, blen, idef.iparams, iatoms, ir.shake_tol, x_s, prime,
-                        pbc, shaked->omega, ir.efep != efepNO, lambda, lam, invdt, v, bCalcVir,
-                        vir_r_m_dr, econq);
+        shaked->threadVirial.resize(numThreads);
+    }
 
-        if (n0 == 0)
+    /* Blocks of the same colour share no atoms, so we can constrain them
+     * in parallel, colour after colour. Within a block the iterations are
+     * the same as in serial, so the convergence is not affected.
+     */
+#pragma omp parallel num_threads(numThreads)
+    {
+        try
         {
-            if (bDumpOnError && log)
+            const int thread = gmx_omp_get_thread_num();
+            tensor    threadVir;
+            clear_mat(threadVir);
+
+            for (int color = 0; color < shaked->numColors(); color++)
+            {
+                const int colorBegin = shaked->colorStart[color];
+                const int colorSize  = shaked->colorStart[color + 1] - colorBegin;
+                int       kStart     = colorBegin + (colorSize * thread) / numThreads;
+                int       kEnd       = colorBegin + (colorSize * (thread + 1)) / numThreads;
+                if (shaked->lastColorIsSerial && color + 1 == shaked->numColors())
+                {
+                    /* The blocks in this colour might share atoms */
+                    kStart = colorBegin;
+                    kEnd   = (thread == 0 ? colorBegin + colorSize : colorBegin);
+                }
+                for (int k = kStart; k < kEnd; k++)
+                {
+                    const int b           = shaked->blocksByColor[k];
+                    const int blockStart  = shaked->sblock[b] / 3;
+                    const int blockLength = (shaked->sblock[b + 1] - shaked->sblock[b]) / 3;
+                    shaked->blockNumIterations[b] = vec_shakef(
+                            shaked, invmass, blockStart, blockLength, idef.iparams,
+                            &(idef.il[F_CONSTR].iatoms[shaked->sblock[b]]), ir.shake_tol, x_s,
+                            prime, pbc, shaked->omega, ir.efep != efepNO, lambda, invdt, v,
+                            bCalcVir, threadVir, econq, &shaked->blockError[b]);
+                }
+                if (color + 1 < shaked->numColors())
+                {
+#pragma omp barrier
+                }
+            }
+
+            if (bCalcVir)
             {
+                for (int d = 0; d < DIM; d++)
                 {
-                    check_cons(log, blen, x_s, prime, v, pbc, idef.iparams, iatoms, invmass, econq);
+                    for (int d2 = 0; d2 < DIM; d2++)
+                    {
+                        shaked->threadVirial[thread][d][d2] = threadVir[d][d2];
+                    }
                 }
             }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
+
+    /* Reduce in a fixed order, so the result does not depend on timing */
+    for (int b = 0; b < numBlocks; b++)
+    {
+        blen = (shaked->sblock[b + 1] - shaked->sblock[b]) / 3;
+        if (shaked->blockNumIterations[b] == 0)
+        {
+            const int* iatoms = &(idef.il[F_CONSTR].iatoms[shaked->sblock[b]]);
+            reportShakeFailure(log, shaked->blockError[b], iatoms);
+            if (bDumpOnError && log)
+            {
+                check_cons(log, blen, x_s, prime, v, pbc, idef.iparams, iatoms, invmass, econq);
+            }
             return FALSE;
         }
-        tnit += n0 * blen;
+        tnit += shaked->blockNumIterations[b] * blen;
         trij += blen;
-        iatoms += 3 * blen; /* Increment pointer! */
-        lam = lam.subArray(blen, lam.ssize() - blen);
-        i++;
+    }
+    if (bCalcVir)
+    {
+        for (int th = 0; th < numThreads; th++)
+        {
+            for (int d = 0; d < DIM; d++)
+            {
+                for (int d2 = 0; d2 < DIM; d2++)
+                {
+                    vir_r_m_dr[d][d2] += shaked->threadVirial[th][d][d2];
+                }
+            }
+        }
     }
     /* only for position part? */
     if (econq == ConstraintVariable::Positions)
@@ -45,6 +45,9 @@
 #ifndef GMX_MDLIB_SHAKE_H
 #define GMX_MDLIB_SHAKE_H
 
+#include <array>
+#include <vector>
+
 #include "gromacs/math/vec.h"
 #include "gromacs/topology/block.h"
 #include "gromacs/utility/real.h"
@@ -70,6 +73,9 @@ struct shakedata
     //! Returns the number of SHAKE blocks */
     int numShakeBlocks() const { return sblock.size() - 1; }
 
+    //! Returns the number of colours of SHAKE blocks
+    int numColors() const { return colorStart.size() - 1; }
+
     //! The reference constraint vectors
     std::vector<RVec> rij;
     //! The reduced mass of the two atoms in each constraint times 0.5
@@ -92,8 +98,32 @@ struct shakedata
      * Value is -2 * eta from p. 336 of the paper, divided by the
      * constraint distance. */
     std::vector<real> scaled_lagrange_multiplier;
+    /*! \brief The SHAKE block indices ordered by colour
+     *
+     * Blocks of the same colour do not share atoms and can be constrained
+     * in parallel. Colour c contains the blocks blocksByColor[colorStart[c]]
+     * to blocksByColor[colorStart[c+1]]. */
+    std::vector<int> blocksByColor;
+    //! Start of each colour in blocksByColor, the last entry is the number of blocks
+    std::vector<int> colorStart = { 0 };
+    //! Whether the last colour contains blocks that share atoms and should be run serially
+    bool lastColorIsSerial = false;
+    //! The number of OpenMP threads to use
+    int numThreads = 1;
+    //! The number of iterations used for each block, only used internally
+    std::vector<int> blockNumIterations;
+    //! The error code for each block, only used internally
+    std::vector<int> blockError;
+    //! The constraint virial contribution for each thread, only used internally
+    std::vector<std::array<RVec, DIM>> threadVirial;
 };
 
+/*! \brief Assigns colours to the SHAKE blocks such that blocks with the same colour share no atoms
+ *
+ * Should be called after the SHAKE blocks in \p shaked have been set up for \p iatoms.
+ */
+void colorShakeBlocks(shakedata* shaked, ArrayRef<const int> iatoms);
+
 //! Make SHAKE blocks when not using DD.
 void make_shake_sblock_serial(shakedata* shaked, InteractionDefinitions* idef, int numAtoms);
 
@@ -0,0 +1,174 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2020, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for collecting the positions of a group over several ranks.
+ *
+ * \ingroup module_mdlib
+ */
+#include "gmxpre.h"
+
+#include "gromacs/mdlib/groupcoord.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/domdec/atomdistribution.h"
+#include "gromacs/domdec/domdec_struct.h"
+#include "gromacs/domdec/gpuhaloexchange.h"
+#include "gromacs/gmxlib/network.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/mdtypes/commrec.h"
+#include "gromacs/mdtypes/inputrec.h"
+
+#include "testutils/mpitest.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+//! The number of atoms in the group
+const int c_numAtoms = 23;
+
+//! Returns the rank that has atom \p i of the group as home atom with partitioning \p partitioning
+int homeRank(int i, int partitioning)
+{
+    if (partitioning == 0)
+    {
+        // Rank 0 has no atoms of the group, the others have 3, 12 and 8
+        return i < 3 ? 1 : (i < 15 ? 2 : 3);
+    }
+    else
+    {
+        // Rank 2 has no atoms of the group
+        return i % 5 == 0 ? 0 : (i % 2 == 0 ? 1 : 3);
+    }
+}
+
+//! Returns the position of atom \p i of the group at step \p step
+RVec groupPosition(int i, int step)
+{
+    return { real(i), real(2 * i + step), real(0.25 * i - step) };
+}
+
+//! The positions and group indices on a single rank
+struct LocalGroup
+{
+    //! The local positions, including atoms that are not in the group
+    std::vector<RVec> x;
+    //! The local index of each home atom of the group
+    std::vector<int> localIndex;
+    //! The index in the group of each home atom of the group
+    std::vector<int> collectiveIndex;
+};
+
+/*! \brief Returns the local positions and group indices of rank \p rank
+ *
+ * The home atoms of the group are stored in reverse order, with other
+ * atoms in between.
+ */
+LocalGroup makeLocalGroup(int rank, int partitioning, int step)
+{
+    LocalGroup local;
+    for (int i = c_numAtoms - 1; i >= 0; i--)
+    {
+        if (homeRank(i, partitioning) == rank)
+        {
+            local.x.emplace_back(-1, -1, -1);
+            local.localIndex.push_back(local.x.size());
+            local.x.push_back(groupPosition(i, step));
+            local.collectiveIndex.push_back(i);
+        }
+    }
+    return local;
+}
+
+//! Collects the positions of the group on all ranks, using \p plan when it is not nullptr
+std::vector<RVec> collectGroup(const t_commrec*     cr,
+                               const LocalGroup&    local,
+                               GroupCollectionPlan* plan)
+{
+    std::vector<RVec> xcoll(c_numAtoms);
+    communicate_group_positions(cr, as_rvec_array(xcoll.data()), nullptr, nullptr, FALSE,
+                                as_rvec_array(local.x.data()), c_numAtoms, local.localIndex.size(),
+                                local.localIndex.data(), local.collectiveIndex.data(), nullptr,
+                                nullptr, plan);
+    return xcoll;
+}
+
+TEST(GroupCoordMultiRankTest, GatheringMatchesSumming)
+{
+    GMX_MPI_TEST(4);
+    CommrecHandle crHandle = init_commrec(MPI_COMM_WORLD, nullptr);
+    t_commrec*    cr       = crHandle.get();
+    t_inputrec    ir;
+    gmx_domdec_t  dd(ir);
+    dd.nnodes       = cr->nnodes;
+    dd.rank         = cr->nodeid;
+    dd.mpi_comm_all = cr->mpi_comm_mygroup;
+    cr->dd          = &dd;
+
+    // Steps 0 and 1 use the same partitioning, so the plan is reused at step 1
+    GroupCollectionPlan plan;
+    for (int step = 0; step < 3; step++)
+    {
+        const int partitioning = (step < 2 ? 0 : 1);
+        dd.ddp_count           = 1 + partitioning;
+
+        const LocalGroup        local    = makeLocalGroup(cr->nodeid, partitioning, step);
+        const std::vector<RVec> summed   = collectGroup(cr, local, nullptr);
+        const std::vector<RVec> gathered = collectGroup(cr, local, &plan);
+        EXPECT_EQ(dd.ddp_count, plan.partitioningCount);
+        for (int i = 0; i < c_numAtoms; i++)
+        {
+            for (int d = 0; d < DIM; d++)
+            {
+                EXPECT_EQ(groupPosition(i, step)[d], summed[i][d]);
+                EXPECT_EQ(summed[i][d], gathered[i][d])
+                        << "for atom " << i << " at step " << step << " on rank " << cr->nodeid;
+            }
+        }
+    }
+
+    cr->dd = nullptr;
+}
+
+} // namespace
+} // namespace test
+} // namespace gmx
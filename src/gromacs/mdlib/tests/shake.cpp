@@ -45,6 +45,13 @@
 
 #include <gtest/gtest.h>
 
+#include "gromacs/gmxlib/nrnb.h"
+#include "gromacs/mdlib/constr.h"
+#include "gromacs/mdtypes/inputrec.h"
+#include "gromacs/mdtypes/md_enums.h"
+#include "gromacs/topology/forcefieldparameters.h"
+#include "gromacs/topology/idef.h"
+#include "gromacs/topology/ifunc.h"
 #include "gromacs/utility/arrayref.h"
 
 #include "testutils/refdata.h"
@@ -338,5 +345,146 @@ TEST_F(ShakeTest, ConstrainsThreeBondsWithCommonAtoms)
     runTest(numAtoms, numConstraints, iatom, constrainedDistances, inverseMasses, positions);
 }
 
+TEST(ShakeBlockColoringTest, BlocksWithoutCommonAtomsShareAColor)
+{
+    // Four blocks of one constraint each, block 3 connects blocks 1 and 2
+    std::vector<int> iatom = { -1, 0, 1, -1, 1, 2, -1, 3, 4, -1, 2, 3 };
+
+    shakedata shaked;
+    shaked.sblock = { 0, 3, 6, 9, 12 };
+    colorShakeBlocks(&shaked, iatom);
+
+    ASSERT_EQ(3, shaked.numColors());
+    EXPECT_EQ((std::vector<int>{ 0, 2, 3, 4 }), shaked.colorStart);
+    EXPECT_EQ((std::vector<int>{ 0, 2, 1, 3 }), shaked.blocksByColor);
+    EXPECT_FALSE(shaked.lastColorIsSerial);
+}
+
+TEST(ShakeBlockColoringTest, IndependentBlocksGetOneColor)
+{
+    std::vector<int> iatom = { -1, 0, 1, -1, 1, 2, -1, 3, 4, -1, 5, 6 };
+
+    shakedata shaked;
+    shaked.sblock = { 0, 6, 9, 12 };
+    colorShakeBlocks(&shaked, iatom);
+
+    ASSERT_EQ(1, shaked.numColors());
+    EXPECT_EQ((std::vector<int>{ 0, 1, 2 }), shaked.blocksByColor);
+}
+
+/*! \brief Returns the positions of a system of chains after constraining them with SHAKE
+ *
+ * \param[in]  useDDBlocks  Whether to make the SHAKE blocks as with domain decomposition,
+ *                          these share atoms and need several colours
+ * \param[in]  numThreads   The number of OpenMP threads to use
+ * \param[out] virial       The constraint virial
+ */
+std::vector<RVec> constrainChainsWithShake(bool useDDBlocks, int numThreads, tensor virial)
+{
+    // The number of chains is not a multiple of the number of threads
+    const int numChains       = 37;
+    const int numAtomsInChain = 4;
+    const int numAtoms        = numChains * numAtomsInChain;
+
+    gmx_ffparams_t ffparams;
+    ffparams.functype.push_back(F_CONSTR);
+    ffparams.iparams.resize(1);
+    ffparams.iparams[0].constr.dA = 0.1;
+    ffparams.iparams[0].constr.dB = 0.1;
+    InteractionDefinitions idef(ffparams);
+
+    std::vector<real> inverseMasses;
+    std::vector<RVec> x;
+    std::vector<RVec> xPrime;
+    for (int c = 0; c < numChains; c++)
+    {
+        for (int a = 0; a < numAtomsInChain; a++)
+        {
+            const int i = c * numAtomsInChain + a;
+            inverseMasses.push_back(1.0 / (12.0 + 2 * (i % 3)));
+            x.emplace_back(0.1 * a, 0.3 * c, 0.02 * (a % 2));
+            xPrime.emplace_back(x.back()[XX] + 0.005 * ((7 * i) % 5 - 2),
+                                x.back()[YY] + 0.004 * ((3 * i) % 5 - 2),
+                                x.back()[ZZ] + 0.003 * ((11 * i) % 5 - 2));
+            if (a > 0)
+            {
+                idef.il[F_CONSTR].push_back(0, std::array<int, 2>{ i - 1, i });
+            }
+        }
+    }
+
+    t_inputrec ir;
+    ir.efep      = efepNO;
+    ir.delta_t   = 0.001;
+    ir.shake_tol = 0.0001;
+    ir.bShakeSOR = false;
+
+    shakedata shaked;
+    if (useDDBlocks)
+    {
+        make_shake_sblock_dd(&shaked, idef.il[F_CONSTR]);
+    }
+    else
+    {
+        make_shake_sblock_serial(&shaked, &idef, numAtoms);
+    }
+    shaked.numThreads = numThreads;
+
+    t_nrnb nrnb;
+    real   dHdLambda = 0;
+    clear_mat(virial);
+    const bool success =
+            constrain_shake(nullptr, &shaked, inverseMasses.data(), idef, ir, x, xPrime, {},
+                            nullptr, &nrnb, 0, &dHdLambda, 1 / ir.delta_t, {}, true, virial,
+                            false, ConstraintVariable::Positions);
+    EXPECT_TRUE(success);
+
+    return xPrime;
+}
+
+class ShakeThreadingTest : public ::testing::TestWithParam<bool>
+{
+};
+
+TEST_P(ShakeThreadingTest, GivesTheSameResultWithOneAndSeveralThreads)
+{
+    const bool useDDBlocks = GetParam();
+
+    tensor                  virialSerial;
+    const std::vector<RVec> xSerial = constrainChainsWithShake(useDDBlocks, 1, virialSerial);
+    tensor                  virialParallel;
+    const std::vector<RVec> xParallel = constrainChainsWithShake(useDDBlocks, 4, virialParallel);
+
+    for (size_t i = 0; i < xSerial.size(); i++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            EXPECT_REAL_EQ(xSerial[i][d], xParallel[i][d]) << "atom " << i << " dim " << d;
+        }
+    }
+    real virialMagnitude = 0;
+    for (int d = 0; d < DIM; d++)
+    {
+        for (int d2 = 0; d2 < DIM; d2++)
+        {
+            virialMagnitude = std::max(virialMagnitude, std::abs(virialSerial[d][d2]));
+        }
+    }
+    EXPECT_GT(virialMagnitude, 0);
+    // The virial contributions of the threads are summed in a different order,
+    // which changes the result by a few ULP
+    const auto virialTolerance = test::relativeToleranceAsUlp(virialMagnitude, 8);
+    for (int d = 0; d < DIM; d++)
+    {
+        for (int d2 = 0; d2 < DIM; d2++)
+        {
+            EXPECT_REAL_EQ_TOL(virialSerial[d][d2], virialParallel[d][d2], virialTolerance)
+                    << "virial element " << d << " " << d2;
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(WithBlocks, ShakeThreadingTest, ::testing::Bool());
+
 } // namespace
 } // namespace gmx
@@ -0,0 +1,282 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2020, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the construction of virtual sites.
+ *
+ * \ingroup module_mdlib
+ */
+#include "gmxpre.h"
+
+#include "gromacs/mdlib/vsite.h"
+
+#include <array>
+#include <cmath>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/gmxlib/nrnb.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
+#include "gromacs/mdtypes/mdatom.h"
+#include "gromacs/pbcutil/ishift.h"
+#include "gromacs/pbcutil/pbc.h"
+#include "gromacs/topology/idef.h"
+#include "gromacs/topology/ifunc.h"
+#include "gromacs/topology/topology.h"
+
+#include "testutils/testasserts.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+/*! \brief The number of vsites per test
+ *
+ * This is not a multiple of any SIMD width, so also partially
+ * filled batches of vsites are tested.
+ */
+const int c_numVsites = 21;
+
+//! Returns the reference position of a vsite of type \p ftype, computed in double precision
+DVec referenceVsitePosition(int              ftype,
+                            const RVec&      xiR,
+                            const RVec&      xjR,
+                            const RVec&      xkR,
+                            const t_iparams& ip)
+{
+    const DVec xi(xiR[XX], xiR[YY], xiR[ZZ]);
+    const DVec xij = DVec(xjR[XX], xjR[YY], xjR[ZZ]) - xi;
+    const DVec xik = DVec(xkR[XX], xkR[YY], xkR[ZZ]) - xi;
+    const DVec xjk = xik - xij;
+    const double a = ip.vsite.a;
+    const double b = ip.vsite.b;
+    const double c = ip.vsite.c;
+    switch (ftype)
+    {
+        case F_VSITE3: return xi + a * xij + b * xik;
+        case F_VSITE3FD:
+        {
+            const DVec temp = xij + a * xjk;
+            return xi + (b / temp.norm()) * temp;
+        }
+        case F_VSITE3FAD:
+        {
+            const DVec xp = xjk - (xij.dot(xjk) / xij.dot(xij)) * xij;
+            return xi + (a / xij.norm()) * xij + (b / xp.norm()) * xp;
+        }
+        case F_VSITE3OUT: return xi + a * xij + b * xik + c * xij.cross(xik);
+        default: GMX_RELEASE_ASSERT(false, "Unsupported vsite type"); return xi;
+    }
+}
+
+class VsiteConstructionTest : public ::testing::TestWithParam<int>
+{
+};
+
+TEST_P(VsiteConstructionTest, ConstructsAllVsites)
+{
+    const int ftype = GetParam();
+
+    std::vector<t_iparams> ip(1);
+    ip[0].vsite.a = 0.3;
+    ip[0].vsite.b = (ftype == F_VSITE3FD || ftype == F_VSITE3FAD) ? 0.1 : 0.2;
+    ip[0].vsite.c = 1.5;
+
+    /* Each vsite has its own three constructing atoms, in a slightly
+     * different geometry for each vsite.
+     */
+    std::vector<RVec>                  x;
+    std::array<InteractionList, F_NRE> ilist;
+    for (int v = 0; v < c_numVsites; v++)
+    {
+        const real offset = 0.5 * v;
+        const int  ai     = x.size();
+        x.emplace_back(offset, 1.0, 2.0);
+        x.emplace_back(offset + 0.1, 1.0 + 0.01 * v, 2.0);
+        x.emplace_back(offset, 1.1, 2.0 - 0.005 * v);
+        x.emplace_back(0, 0, 0);
+        ilist[ftype].push_back(0, std::array<int, 4>{ ai + 3, ai, ai + 1, ai + 2 });
+    }
+
+    constructVirtualSites(x, ip, ilist);
+
+    const auto tolerance = absoluteTolerance(1e-5);
+    for (int v = 0; v < c_numVsites; v++)
+    {
+        const int  ai        = 4 * v;
+        const DVec reference = referenceVsitePosition(ftype, x[ai], x[ai + 1], x[ai + 2], ip[0]);
+        for (int d = 0; d < DIM; d++)
+        {
+            EXPECT_REAL_EQ_TOL(static_cast<real>(reference[d]), x[ai + 3][d], tolerance)
+                    << "vsite " << v << " dim " << d;
+        }
+    }
+}
+
+TEST_P(VsiteConstructionTest, ConstructsVsitesFromEarlierVsitesOfTheSameType)
+{
+    const int ftype = GetParam();
+
+    std::vector<t_iparams> ip(1);
+    ip[0].vsite.a = 0.3;
+    ip[0].vsite.b = (ftype == F_VSITE3FD || ftype == F_VSITE3FAD) ? 0.1 : 0.2;
+    ip[0].vsite.c = 1.5;
+
+    /* Each vsite is constructed from the previous vsite and two fixed atoms */
+    std::vector<RVec> x;
+    x.emplace_back(1.0, 1.0, 1.0);
+    x.emplace_back(1.1, 1.0, 1.0);
+    x.emplace_back(1.0, 1.1, 1.05);
+    std::array<InteractionList, F_NRE> ilist;
+    for (int v = 0; v < c_numVsites; v++)
+    {
+        const int previous = (v == 0 ? 0 : x.size() - 1);
+        x.emplace_back(0, 0, 0);
+        ilist[ftype].push_back(
+                0, std::array<int, 4>{ static_cast<int>(x.size()) - 1, 1, previous, 2 });
+    }
+
+    constructVirtualSites(x, ip, ilist);
+
+    const auto tolerance = absoluteTolerance(1e-4);
+    for (int v = 0; v < c_numVsites; v++)
+    {
+        const int  previous  = (v == 0 ? 0 : 2 + v);
+        const DVec reference = referenceVsitePosition(ftype, x[1], x[previous], x[2], ip[0]);
+        for (int d = 0; d < DIM; d++)
+        {
+            EXPECT_REAL_EQ_TOL(static_cast<real>(reference[d]), x[3 + v][d], tolerance)
+                    << "vsite " << v << " dim " << d;
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(WithVsiteTypes,
+                        VsiteConstructionTest,
+                        ::testing::Values(F_VSITE3, F_VSITE3FD, F_VSITE3FAD, F_VSITE3OUT));
+
+//! The parameters for the force spreading tests: the vsite type and whether to use PBC
+using VsiteSpreadTestParameters = std::tuple<int, bool>;
+
+class VsiteForceSpreadingTest : public ::testing::TestWithParam<VsiteSpreadTestParameters>
+{
+};
+
+/* Without virial the forces of non-linear vsites are spread with SIMD,
+ * with the PBC virial with the scalar code. Both should give the same forces.
+ */
+TEST_P(VsiteForceSpreadingTest, SpreadsTheSameForcesWithAndWithoutVirial)
+{
+    const int  ftype  = std::get<0>(GetParam());
+    const bool usePbc = std::get<1>(GetParam());
+
+    std::vector<t_iparams> ip(1);
+    ip[0].vsite.a = 0.3;
+    ip[0].vsite.b = (ftype == F_VSITE3FD || ftype == F_VSITE3FAD) ? 0.1 : 0.2;
+    ip[0].vsite.c = 1.5;
+
+    const real boxSize = 3.0;
+    matrix     box     = { { boxSize, 0, 0 }, { 0, boxSize, 0 }, { 0, 0, boxSize } };
+    /* Each vsite has its own three constructing atoms. With PBC the first
+     * two constructing atoms are on opposite sides of the box.
+     */
+    std::vector<RVec>                  x;
+    std::vector<RVec>                  f;
+    std::array<InteractionList, F_NRE> ilist;
+    for (int v = 0; v < c_numVsites; v++)
+    {
+        const real offset = usePbc ? boxSize - 0.05 : 0.5 * v;
+        const int  ai     = x.size();
+        x.emplace_back(offset, 1.0, 2.0);
+        x.emplace_back(offset + 0.1 - (usePbc ? boxSize : 0), 1.0 + 0.01 * v, 2.0);
+        x.emplace_back(offset, 1.1, 2.0 - 0.005 * v);
+        x.push_back(x[ai]);
+        f.emplace_back(0.1, -0.2, 0.05 * v);
+        f.emplace_back(-0.3, 0.01 * v, 0.2);
+        f.emplace_back(0.02 * v, 0.4, -0.1);
+        f.emplace_back(1.0 + 0.1 * v, -0.5 + 0.05 * v, 0.3 - 0.02 * v);
+        ilist[ftype].push_back(0, std::array<int, 4>{ ai + 3, ai, ai + 1, ai + 2 });
+    }
+
+    /* All vsites are in a single molecule, so all work over PBC.
+     * We use a single thread, so the serial spreading code is used.
+     */
+    gmx_omp_nthreads_set(emntVSITE, 1);
+    gmx_mtop_t mtop;
+    mtop.ffparams.iparams = ip;
+    mtop.moltype.resize(1);
+    mtop.moltype[0].ilist = ilist;
+    mtop.molblock.resize(1);
+    mtop.molblock[0].type = 0;
+    mtop.molblock[0].nmol = 1;
+    VirtualSitesHandler vsite(mtop, nullptr, usePbc ? PbcType::Xyz : PbcType::No);
+    t_mdatoms           mdatoms = {};
+    vsite.setVirtualSites(ilist, mdatoms);
+
+    std::vector<RVec> fWithoutVirial = f;
+    std::vector<RVec> fWithVirial    = f;
+    std::vector<RVec> fshift(SHIFTS, { 0, 0, 0 });
+    matrix            virial = { { 0 } };
+    t_nrnb            nrnb;
+    vsite.spreadForces(x, fWithoutVirial, VirtualSitesHandler::VirialHandling::None, {}, virial,
+                       &nrnb, box, nullptr);
+    vsite.spreadForces(x, fWithVirial, VirtualSitesHandler::VirialHandling::Pbc, fshift, virial,
+                       &nrnb, box, nullptr);
+
+    const auto tolerance = relativeToleranceAsFloatingPoint(1.0, 1e-5);
+    for (gmx::index i = 0; i < gmx::ssize(x); i++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            EXPECT_REAL_EQ_TOL(fWithVirial[i][d], fWithoutVirial[i][d], tolerance)
+                    << "atom " << i << " dim " << d;
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(WithVsiteTypes,
+                        VsiteForceSpreadingTest,
+                        ::testing::Combine(::testing::Values(F_VSITE3FD, F_VSITE3FAD, F_VSITE3OUT),
+                                           ::testing::Bool()));
+
+} // namespace
+} // namespace test
+} // namespace gmx
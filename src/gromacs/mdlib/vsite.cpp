@@ -64,6 +64,9 @@
 #include "gromacs/mdtypes/mdatom.h"
 #include "gromacs/pbcutil/ishift.h"
 #include "gromacs/pbcutil/pbc.h"
+#include "gromacs/pbcutil/pbc_simd.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
 #include "gromacs/timing/wallcycle.h"
 #include "gromacs/topology/ifunc.h"
 #include "gromacs/topology/mtop_util.h"
@@ -596,6 +599,301 @@ static int constr_vsiten(const t_iatom* ia, ArrayRef<const t_iparams> ip, ArrayR
     return n3;
 }
 
+#if GMX_SIMD_HAVE_REAL
+/* SIMD vsite construction and spreading routines
+ *
+ * Vsites of the same type are processed in batches of GMX_SIMD_REAL_WIDTH.
+ * The coordinates of the constructing atoms are gathered into SIMD registers
+ * and the results are stored per lane. Also the last, partially filled batch
+ * is computed with the SIMD kernel, so the result for a vsite does not depend
+ * on how the vsites are divided over threads and batches.
+ */
+
+//! Atom indices and parameters of a batch of vsites with three constructing atoms
+struct VsiteBatch
+{
+    //! The number of vsites in the batch, the remaining lanes repeat the last vsite
+    int size;
+    //! The vsite atoms
+    alignas(GMX_SIMD_ALIGNMENT) int av[GMX_SIMD_REAL_WIDTH];
+    //! The first constructing atoms
+    alignas(GMX_SIMD_ALIGNMENT) int ai[GMX_SIMD_REAL_WIDTH];
+    //! The second constructing atoms
+    alignas(GMX_SIMD_ALIGNMENT) int aj[GMX_SIMD_REAL_WIDTH];
+    //! The third constructing atoms
+    alignas(GMX_SIMD_ALIGNMENT) int ak[GMX_SIMD_REAL_WIDTH];
+    //! The a parameters
+    alignas(GMX_SIMD_ALIGNMENT) real a[GMX_SIMD_REAL_WIDTH];
+    //! The b parameters
+    alignas(GMX_SIMD_ALIGNMENT) real b[GMX_SIMD_REAL_WIDTH];
+    //! The c parameters, only used for F_VSITE3OUT
+    alignas(GMX_SIMD_ALIGNMENT) real c[GMX_SIMD_REAL_WIDTH];
+};
+
+//! Returns whether vsite type \p ftype is processed using SIMD
+static constexpr bool vsiteTypeUsesSimd(int ftype)
+{
+    return (ftype == F_VSITE3 || ftype == F_VSITE3FD || ftype == F_VSITE3FAD
+            || ftype == F_VSITE3OUT);
+}
+
+/*! \brief Fills \p batch with the vsites starting at \p ia, returns the number of vsites used
+ *
+ * The batch is ended before a vsite that depends on an earlier vsite
+ * in the batch: for construction when one of its constructing atoms
+ * is an earlier vsite, for spreading when its vsite atom is
+ * a constructing atom of an earlier vsite.
+ *
+ * \param[in]  ia           The iatoms of the vsites, with 5 entries per vsite
+ * \param[in]  numVsites    The number of vsites left in \p ia, should be > 0
+ * \param[in]  ip           The interaction parameters
+ * \param[in]  forSpreading Whether the batch is used for force spreading
+ * \param[out] batch        The batch
+ */
+static int fillVsiteBatch(const t_iatom*            ia,
+                          int                       numVsites,
+                          ArrayRef<const t_iparams> ip,
+                          bool                      forSpreading,
+                          VsiteBatch*               batch)
+{
+    const int maxSize = std::min(numVsites, GMX_SIMD_REAL_WIDTH);
+    int       s       = 0;
+    for (; s < maxSize; s++, ia += 5)
+    {
+        bool dependsOnBatch = false;
+        for (int t = 0; t < s; t++)
+        {
+            if (forSpreading)
+            {
+                dependsOnBatch = dependsOnBatch
+                                 || (ia[1] == batch->ai[t] || ia[1] == batch->aj[t]
+                                     || ia[1] == batch->ak[t]);
+            }
+            else
+            {
+                dependsOnBatch = dependsOnBatch
+                                 || (ia[2] == batch->av[t] || ia[3] == batch->av[t]
+                                     || ia[4] == batch->av[t]);
+            }
+        }
+        if (dependsOnBatch)
+        {
+            break;
+        }
+        const t_iparams& params = ip[ia[0]];
+        batch->av[s]            = ia[1];
+        batch->ai[s]            = ia[2];
+        batch->aj[s]            = ia[3];
+        batch->ak[s]            = ia[4];
+        batch->a[s]             = params.vsite.a;
+        batch->b[s]             = params.vsite.b;
+        batch->c[s]             = params.vsite.c;
+    }
+    batch->size = s;
+    for (int t = s; t < GMX_SIMD_REAL_WIDTH; t++)
+    {
+        batch->av[t] = batch->av[s - 1];
+        batch->ai[t] = batch->ai[s - 1];
+        batch->aj[t] = batch->aj[s - 1];
+        batch->ak[t] = batch->ak[s - 1];
+        batch->a[t]  = batch->a[s - 1];
+        batch->b[t]  = batch->b[s - 1];
+        batch->c[t]  = batch->c[s - 1];
+    }
+
+    return s;
+}
+
+//! Gathers the vectors \p v[index[s]] into SIMD registers, one vector per lane
+static inline void gmx_simdcall gatherVectorsSimd(ArrayRef<const RVec> v,
+                                                  const int*           index,
+                                                  SimdReal*            vS)
+{
+    alignas(GMX_SIMD_ALIGNMENT) real buffer[DIM * GMX_SIMD_REAL_WIDTH];
+    for (int s = 0; s < GMX_SIMD_REAL_WIDTH; s++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            buffer[d * GMX_SIMD_REAL_WIDTH + s] = v[index[s]][d];
+        }
+    }
+    for (int d = 0; d < DIM; d++)
+    {
+        vS[d] = load<SimdReal>(buffer + d * GMX_SIMD_REAL_WIDTH);
+    }
+}
+
+//! Returns the scalar product of SIMD vectors \p a and \p b
+static inline SimdReal gmx_simdcall dotProductSimd(const SimdReal* a, const SimdReal* b)
+{
+    return fma(a[XX], b[XX], fma(a[YY], b[YY], a[ZZ] * b[ZZ]));
+}
+
+//! Computes the cross product \p c of SIMD vectors \p a and \p b
+static inline void gmx_simdcall crossProductSimd(const SimdReal* a, const SimdReal* b, SimdReal* c)
+{
+    c[XX] = fms(a[YY], b[ZZ], a[ZZ] * b[YY]);
+    c[YY] = fms(a[ZZ], b[XX], a[XX] * b[ZZ]);
+    c[ZZ] = fms(a[XX], b[YY], a[YY] * b[XX]);
+}
+
+//! Stores SIMD vectors \p vS to \p buffer, which holds DIM*GMX_SIMD_REAL_WIDTH reals
+static inline void gmx_simdcall storeVectorsSimd(const SimdReal* vS, real* buffer)
+{
+    for (int d = 0; d < DIM; d++)
+    {
+        store(buffer + d * GMX_SIMD_REAL_WIDTH, vS[d]);
+    }
+}
+
+/*! \brief Constructs the positions of a batch of vsites of type \p ftype
+ *
+ * \param[in]  batch    The vsites
+ * \param[in]  x        The coordinates
+ * \param[in]  pbcSimd  SIMD PBC data, see set_pbc_simd()
+ * \param[out] xv       The vsite positions, DIM*GMX_SIMD_REAL_WIDTH reals, aligned
+ */
+template<int ftype>
+static void constructVsiteBatchSimd(const VsiteBatch&    batch,
+                                    ArrayRef<const RVec> x,
+                                    const real*          pbcSimd,
+                                    real*                xv)
+{
+    SimdReal xi[DIM], xj[DIM], xk[DIM];
+    gatherVectorsSimd(x, batch.ai, xi);
+    gatherVectorsSimd(x, batch.aj, xj);
+    gatherVectorsSimd(x, batch.ak, xk);
+    const SimdReal a = load<SimdReal>(batch.a);
+    const SimdReal b = load<SimdReal>(batch.b);
+
+    SimdReal xij[DIM];
+    pbc_dx_aiuc(pbcSimd, xj, xi, xij);
+
+    SimdReal result[DIM];
+    if (ftype == F_VSITE3 || ftype == F_VSITE3OUT)
+    {
+        SimdReal xik[DIM];
+        pbc_dx_aiuc(pbcSimd, xk, xi, xik);
+        for (int d = 0; d < DIM; d++)
+        {
+            result[d] = fma(b, xik[d], fma(a, xij[d], xi[d]));
+        }
+        if (ftype == F_VSITE3OUT)
+        {
+            const SimdReal c = load<SimdReal>(batch.c);
+            SimdReal       temp[DIM];
+            crossProductSimd(xij, xik, temp);
+            for (int d = 0; d < DIM; d++)
+            {
+                result[d] = fma(c, temp[d], result[d]);
+            }
+        }
+    }
+    else
+    {
+        SimdReal xjk[DIM];
+        pbc_dx_aiuc(pbcSimd, xk, xj, xjk);
+        if (ftype == F_VSITE3FD)
+        {
+            /* temp goes from i to a point on the line jk */
+            SimdReal temp[DIM];
+            for (int d = 0; d < DIM; d++)
+            {
+                temp[d] = fma(a, xjk[d], xij[d]);
+            }
+            const SimdReal c = b * invsqrt(dotProductSimd(temp, temp));
+            for (int d = 0; d < DIM; d++)
+            {
+                result[d] = fma(c, temp[d], xi[d]);
+            }
+        }
+        else
+        {
+            GMX_ASSERT(ftype == F_VSITE3FAD,
+                       "Only vsite types with 3 constructing atoms are supported");
+            const SimdReal invdij = invsqrt(dotProductSimd(xij, xij));
+            const SimdReal c1     = invdij * invdij * dotProductSimd(xij, xjk);
+            SimdReal xp[DIM];
+            for (int d = 0; d < DIM; d++)
+            {
+                xp[d] = fnma(c1, xij[d], xjk[d]);
+            }
+            const SimdReal a1 = a * invdij;
+            const SimdReal b1 = b * invsqrt(dotProductSimd(xp, xp));
+            for (int d = 0; d < DIM; d++)
+            {
+                result[d] = fma(b1, xp[d], fma(a1, xij[d], xi[d]));
+            }
+        }
+    }
+
+    storeVectorsSimd(result, xv);
+}
+
+/*! \brief Constructs all vsites of type \p ftype in \p ilist using SIMD
+ *
+ * Apart from the construction itself, this does the same as the loop
+ * in construct_vsites_thread().
+ */
+template<int ftype>
+static void constructVsitesSimd(ArrayRef<RVec>            x,
+                                const real                inv_dt,
+                                ArrayRef<RVec>            v,
+                                ArrayRef<const t_iparams> ip,
+                                const InteractionList&    ilist,
+                                const t_pbc*              pbc_null)
+{
+    alignas(GMX_SIMD_ALIGNMENT) real pbcSimd[9 * GMX_SIMD_REAL_WIDTH];
+    set_pbc_simd(pbc_null, pbcSimd);
+
+    alignas(GMX_SIMD_ALIGNMENT) real xvBatch[DIM * GMX_SIMD_REAL_WIDTH];
+    VsiteBatch                       batch;
+
+    const int      numVsites = ilist.size() / 5;
+    const t_iatom* ia        = ilist.iatoms.data();
+    for (int i = 0; i < numVsites;)
+    {
+        const int batchSize = fillVsiteBatch(ia, numVsites - i, ip, false, &batch);
+
+        constructVsiteBatchSimd<ftype>(batch, x, pbcSimd, xvBatch);
+
+        for (int s = 0; s < batchSize; s++)
+        {
+            const int avsite = batch.av[s];
+            /* Copy the old position */
+            rvec xv;
+            copy_rvec(x[avsite], xv);
+            for (int d = 0; d < DIM; d++)
+            {
+                x[avsite][d] = xvBatch[d * GMX_SIMD_REAL_WIDTH + s];
+            }
+
+            if (pbc_null)
+            {
+                /* Keep the vsite in the same periodic image as before */
+                rvec dx;
+                int  ishift = pbc_dx_aiuc(pbc_null, x[avsite], xv, dx);
+                if (ishift != CENTRAL)
+                {
+                    rvec_add(xv, dx, x[avsite]);
+                }
+            }
+            if (!v.empty())
+            {
+                /* Calculate velocity of vsite... */
+                rvec vv;
+                rvec_sub(x[avsite], xv, vv);
+                svmul(inv_dt, vv, v[avsite]);
+            }
+        }
+
+        i += batchSize;
+        ia += 5 * batchSize;
+    }
+}
+
+#endif // GMX_SIMD_HAVE_REAL
+
 #endif // DOXYGEN
 
 //! PBC modes for vsite construction and spreading
@@ -658,6 +956,28 @@ static void construct_vsites_thread(ArrayRef<RVec>                  x,
             continue;
         }
 
+#if GMX_SIMD_HAVE_REAL
+        if (vsiteTypeUsesSimd(ftype))
+        {
+            switch (ftype)
+            {
+                case F_VSITE3:
+                    constructVsitesSimd<F_VSITE3>(x, inv_dt, v, ip, ilist[ftype], pbc_null);
+                    break;
+                case F_VSITE3FD:
+                    constructVsitesSimd<F_VSITE3FD>(x, inv_dt, v, ip, ilist[ftype], pbc_null);
+                    break;
+                case F_VSITE3FAD:
+                    constructVsitesSimd<F_VSITE3FAD>(x, inv_dt, v, ip, ilist[ftype], pbc_null);
+                    break;
+                case F_VSITE3OUT:
+                    constructVsitesSimd<F_VSITE3OUT>(x, inv_dt, v, ip, ilist[ftype], pbc_null);
+                    break;
+            }
+            continue;
+        }
+#endif
+
         { // TODO remove me
             int nra = interaction_function[ftype].nratoms;
             int inc = 1 + nra;
@@ -1716,6 +2036,161 @@ static int spread_vsiten(const t_iatom             ia[],
     return n3;
 }
 
+#if GMX_SIMD_HAVE_REAL
+/*! \brief Computes the forces that a batch of vsites of type \p ftype spreads to their atoms
+ *
+ * \param[in]  batch    The vsites
+ * \param[in]  x        The coordinates
+ * \param[in]  f        The forces, only the vsite forces are used
+ * \param[in]  pbcSimd  SIMD PBC data, see set_pbc_simd()
+ * \param[out] fBatch   The forces on atoms i, j and k, each DIM*GMX_SIMD_REAL_WIDTH reals
+ */
+template<int ftype>
+static void spreadVsiteBatchSimd(const VsiteBatch&    batch,
+                                 ArrayRef<const RVec> x,
+                                 ArrayRef<const RVec> f,
+                                 const real*          pbcSimd,
+                                 real*                fBatch)
+{
+    SimdReal xi[DIM], xj[DIM], xk[DIM], fv[DIM];
+    gatherVectorsSimd(x, batch.ai, xi);
+    gatherVectorsSimd(x, batch.aj, xj);
+    gatherVectorsSimd(x, batch.ak, xk);
+    gatherVectorsSimd(f, batch.av, fv);
+    const SimdReal a = load<SimdReal>(batch.a);
+    const SimdReal b = load<SimdReal>(batch.b);
+
+    SimdReal xij[DIM];
+    pbc_dx_aiuc(pbcSimd, xj, xi, xij);
+
+    SimdReal fi[DIM], fj[DIM], fk[DIM];
+    if (ftype == F_VSITE3OUT)
+    {
+        SimdReal xik[DIM];
+        pbc_dx_aiuc(pbcSimd, xk, xi, xik);
+
+        const SimdReal c = load<SimdReal>(batch.c);
+        SimdReal       cf[DIM];
+        for (int d = 0; d < DIM; d++)
+        {
+            cf[d] = c * fv[d];
+        }
+        /* fj = a*fv + xik x c*fv, fk = b*fv - xij x c*fv */
+        crossProductSimd(xik, cf, fj);
+        crossProductSimd(cf, xij, fk);
+        for (int d = 0; d < DIM; d++)
+        {
+            fj[d] = fma(a, fv[d], fj[d]);
+            fk[d] = fma(b, fv[d], fk[d]);
+            fi[d] = fv[d] - fj[d] - fk[d];
+        }
+    }
+    else
+    {
+        SimdReal xjk[DIM];
+        pbc_dx_aiuc(pbcSimd, xk, xj, xjk);
+        if (ftype == F_VSITE3FD)
+        {
+            /* xix goes from i to point x on the line jk */
+            SimdReal xix[DIM];
+            for (int d = 0; d < DIM; d++)
+            {
+                xix[d] = fma(a, xjk[d], xij[d]);
+            }
+            const SimdReal invDistance = invsqrt(dotProductSimd(xix, xix));
+            const SimdReal c           = b * invDistance;
+            const SimdReal fproj       = dotProductSimd(xix, fv) * invDistance * invDistance;
+            const SimdReal a1 = SimdReal(1.0) - a;
+            for (int d = 0; d < DIM; d++)
+            {
+                const SimdReal temp = c * fnma(fproj, xix[d], fv[d]);
+                fi[d]               = fv[d] - temp;
+                fj[d]               = a1 * temp;
+                fk[d]               = a * temp;
+            }
+        }
+        else
+        {
+            GMX_ASSERT(ftype == F_VSITE3FAD, "Only non-linear vsite types are supported");
+            const SimdReal invdij  = invsqrt(dotProductSimd(xij, xij));
+            const SimdReal invdij2 = invdij * invdij;
+            const SimdReal c1      = dotProductSimd(xij, xjk) * invdij2;
+            /* xperp in plane ijk, perp. to ij */
+            SimdReal xperp[DIM];
+            for (int d = 0; d < DIM; d++)
+            {
+                xperp[d] = fnma(c1, xij[d], xjk[d]);
+            }
+            const SimdReal invdp = invsqrt(dotProductSimd(xperp, xperp));
+            const SimdReal a1    = a * invdij;
+            const SimdReal b1    = b * invdp;
+            const SimdReal fproj     = dotProductSimd(xij, fv) * invdij2;
+            const SimdReal fprojPerp = dotProductSimd(xperp, fv) * invdp * invdp;
+            const SimdReal c2 = SimdReal(1.0) + c1;
+            for (int d = 0; d < DIM; d++)
+            {
+                /* f1 = a1*(f - Fpij), f2 = b1*(f - Fpij - Fppp) */
+                const SimdReal fMinusFpij = fnma(fproj, xij[d], fv[d]);
+                const SimdReal f1         = a1 * fMinusFpij;
+                const SimdReal f2         = b1 * fnma(fprojPerp, xperp[d], fMinusFpij);
+                const SimdReal f3         = b1 * fproj * xperp[d];
+                fi[d]                     = fma(c1, f2, fv[d] - f1) + f3;
+                fj[d]                     = fnma(c2, f2, f1) - f3;
+                fk[d]                     = f2;
+            }
+        }
+    }
+
+    storeVectorsSimd(fi, fBatch);
+    storeVectorsSimd(fj, fBatch + DIM * GMX_SIMD_REAL_WIDTH);
+    storeVectorsSimd(fk, fBatch + 2 * DIM * GMX_SIMD_REAL_WIDTH);
+}
+
+/*! \brief Spreads the forces of all vsites of type \p ftype in \p ilist using SIMD
+ *
+ * This is only used when no virial contribution is needed. The forces are
+ * added to the constructing atoms in the same order as with the scalar code.
+ */
+template<int ftype>
+static void spreadVsitesSimd(ArrayRef<const RVec>      x,
+                             ArrayRef<RVec>            f,
+                             ArrayRef<const t_iparams> ip,
+                             const InteractionList&    ilist,
+                             const t_pbc*              pbc_null)
+{
+    alignas(GMX_SIMD_ALIGNMENT) real pbcSimd[9 * GMX_SIMD_REAL_WIDTH];
+    set_pbc_simd(pbc_null, pbcSimd);
+
+    alignas(GMX_SIMD_ALIGNMENT) real fBatch[3 * DIM * GMX_SIMD_REAL_WIDTH];
+    VsiteBatch                       batch;
+
+    const int      numVsites = ilist.size() / 5;
+    const t_iatom* ia        = ilist.iatoms.data();
+    for (int i = 0; i < numVsites;)
+    {
+        const int batchSize = fillVsiteBatch(ia, numVsites - i, ip, true, &batch);
+
+        spreadVsiteBatchSimd<ftype>(batch, x, f, pbcSimd, fBatch);
+
+        for (int s = 0; s < batchSize; s++)
+        {
+            const int* atoms[3] = { batch.ai, batch.aj, batch.ak };
+            for (int m = 0; m < 3; m++)
+            {
+                for (int d = 0; d < DIM; d++)
+                {
+                    f[atoms[m][s]][d] += fBatch[(m * DIM + d) * GMX_SIMD_REAL_WIDTH + s];
+                }
+            }
+            clear_rvec(f[batch.av[s]]);
+        }
+
+        i += batchSize;
+        ia += 5 * batchSize;
+    }
+}
+#endif // GMX_SIMD_HAVE_REAL
+
 #endif // DOXYGEN
 
 //! Returns the number of virtual sites in the interaction list, for VSITEN the number of atoms
@@ -1755,6 +2230,26 @@ static void spreadForceForThread(ArrayRef<const RVec>            x,
             continue;
         }
 
+#if GMX_SIMD_HAVE_REAL
+        /* Without virial, the non-linear constructions benefit from SIMD */
+        if (virialHandling == VirialHandling::None && vsiteTypeUsesSimd(ftype) && ftype != F_VSITE3)
+        {
+            switch (ftype)
+            {
+                case F_VSITE3FD:
+                    spreadVsitesSimd<F_VSITE3FD>(x, f, ip, ilist[ftype], pbc_null);
+                    break;
+                case F_VSITE3FAD:
+                    spreadVsitesSimd<F_VSITE3FAD>(x, f, ip, ilist[ftype], pbc_null);
+                    break;
+                case F_VSITE3OUT:
+                    spreadVsitesSimd<F_VSITE3OUT>(x, f, ip, ilist[ftype], pbc_null);
+                    break;
+            }
+            continue;
+        }
+#endif
+
         { // TODO remove me
             int nra = interaction_function[ftype].nratoms;
             int inc = 1 + nra;
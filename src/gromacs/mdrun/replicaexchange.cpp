@@ -155,6 +155,15 @@ struct gmx_repl_ex
     real*  Vol;
     real** de;
     //! \}
+
+    //! Buffers for exchanging the state, kept to avoid allocation at each exchange.
+    //! \{
+    double* stateSendBuffer;
+    double* stateRecvBuffer;
+    int     stateBufferSize;
+    rvec*   xvRecvBuffer;
+    int     xvRecvBufferSize;
+    //! \}
 };
 
 // TODO We should add Doxygen here some time.
@@ -495,124 +504,116 @@ gmx_repl_ex_t init_replica_exchange(FILE*                            fplog,
     return re;
 }
 
-static void exchange_reals(const gmx_multisim_t gmx_unused* ms, int gmx_unused b, real* v, int n)
+/*! \brief Calls \p visit for each of the small state variables that are exchanged
+ *
+ * The variables are passed as a pointer and a number of values, the
+ * pointer is to real or to double. Using a single function for packing
+ * and unpacking guarantees that both use the same order.
+ * When t_state changes, this code should be updated.
+ */
+template<typename Visitor>
+static void visitExchangedStateVariables(t_state* state, Visitor visit)
 {
-    real* buf;
-    int   i;
-
-    if (v)
-    {
-        snew(buf, n);
-#if GMX_MPI
-        /*
-           MPI_Sendrecv(v,  n*sizeof(real),MPI_BYTE,MSRANK(ms,b),0,
-           buf,n*sizeof(real),MPI_BYTE,MSRANK(ms,b),0,
-           ms->mpi_comm_masters,MPI_STATUS_IGNORE);
-         */
-        {
-            MPI_Request mpi_req;
-
-            MPI_Isend(v, n * sizeof(real), MPI_BYTE, MSRANK(ms, b), 0, ms->mpi_comm_masters, &mpi_req);
-            MPI_Recv(buf, n * sizeof(real), MPI_BYTE, MSRANK(ms, b), 0, ms->mpi_comm_masters,
-                     MPI_STATUS_IGNORE);
-            MPI_Wait(&mpi_req, MPI_STATUS_IGNORE);
-        }
-#endif
-        for (i = 0; i < n; i++)
-        {
-            v[i] = buf[i];
-        }
-        sfree(buf);
-    }
+    const int ngtc    = state->ngtc * state->nhchainlength;
+    const int nnhpres = state->nnhpres * state->nhchainlength;
+
+    visit(state->box[0], DIM * DIM);
+    visit(state->box_rel[0], DIM * DIM);
+    visit(state->boxv[0], DIM * DIM);
+    visit(&state->veta, 1);
+    visit(&state->vol0, 1);
+    visit(state->svir_prev[0], DIM * DIM);
+    visit(state->fvir_prev[0], DIM * DIM);
+    visit(state->pres_prev[0], DIM * DIM);
+    visit(state->nosehoover_xi.data(), ngtc);
+    visit(state->nosehoover_vxi.data(), ngtc);
+    visit(state->nhpres_xi.data(), nnhpres);
+    visit(state->nhpres_vxi.data(), nnhpres);
+    visit(state->therm_integral.data(), state->ngtc);
+    visit(&state->baros_integral, 1);
 }
 
-
-static void exchange_doubles(const gmx_multisim_t gmx_unused* ms, int gmx_unused b, double* v, int n)
+/*! \brief Exchanges the state with replica \p b
+ *
+ * The small state variables are packed into a single message and the
+ * coordinates and velocities are received in buffers that are kept in
+ * \p re. All messages are posted at once before waiting, so the transfers
+ * overlap each other and the packing of the small variables.
+ */
+static void exchange_state(const gmx_multisim_t gmx_unused* ms, struct gmx_repl_ex* re, int gmx_unused b, t_state* state)
 {
-    double* buf;
-    int     i;
+    int numStateValues = 0;
+    visitExchangedStateVariables(state, [&numStateValues](auto*, int n) { numStateValues += n; });
+    if (numStateValues > re->stateBufferSize)
+    {
+        re->stateBufferSize = numStateValues;
+        srenew(re->stateSendBuffer, re->stateBufferSize);
+        srenew(re->stateRecvBuffer, re->stateBufferSize);
+    }
 
-    if (v)
+    const bool haveVelocities = !state->v.empty();
+    const int  numXV          = (haveVelocities ? 2 : 1) * state->natoms;
+    if (numXV > re->xvRecvBufferSize)
     {
-        snew(buf, n);
-#if GMX_MPI
-        /*
-           MPI_Sendrecv(v,  n*sizeof(double),MPI_BYTE,MSRANK(ms,b),0,
-           buf,n*sizeof(double),MPI_BYTE,MSRANK(ms,b),0,
-           ms->mpi_comm_masters,MPI_STATUS_IGNORE);
-         */
-        {
-            MPI_Request mpi_req;
+        re->xvRecvBufferSize = numXV;
+        srenew(re->xvRecvBuffer, re->xvRecvBufferSize);
+    }
+    rvec* xRecv = re->xvRecvBuffer;
+    rvec* vRecv = re->xvRecvBuffer + state->natoms;
 
-            MPI_Isend(v, n * sizeof(double), MPI_BYTE, MSRANK(ms, b), 0, ms->mpi_comm_masters, &mpi_req);
-            MPI_Recv(buf, n * sizeof(double), MPI_BYTE, MSRANK(ms, b), 0, ms->mpi_comm_masters,
-                     MPI_STATUS_IGNORE);
-            MPI_Wait(&mpi_req, MPI_STATUS_IGNORE);
-        }
+#if GMX_MPI
+    /* Post the large transfers first, so they progress while we pack */
+    MPI_Request requests[6];
+    int         numRequests = 0;
+    MPI_Irecv(xRecv[0], state->natoms * sizeof(rvec), MPI_BYTE, MSRANK(ms, b), 1,
+              ms->mpi_comm_masters, &requests[numRequests++]);
+    MPI_Isend(state->x.rvec_array()[0], state->natoms * sizeof(rvec), MPI_BYTE, MSRANK(ms, b), 1,
+              ms->mpi_comm_masters, &requests[numRequests++]);
+    if (haveVelocities)
+    {
+        MPI_Irecv(vRecv[0], state->natoms * sizeof(rvec), MPI_BYTE, MSRANK(ms, b), 2,
+                  ms->mpi_comm_masters, &requests[numRequests++]);
+        MPI_Isend(state->v.rvec_array()[0], state->natoms * sizeof(rvec), MPI_BYTE, MSRANK(ms, b),
+                  2, ms->mpi_comm_masters, &requests[numRequests++]);
+    }
+    MPI_Irecv(re->stateRecvBuffer, numStateValues * sizeof(double), MPI_BYTE, MSRANK(ms, b), 0,
+              ms->mpi_comm_masters, &requests[numRequests++]);
 #endif
-        for (i = 0; i < n; i++)
+
+    int pos = 0;
+    visitExchangedStateVariables(state, [re, &pos](auto* v, int n) {
+        for (int i = 0; i < n; i++)
         {
-            v[i] = buf[i];
+            re->stateSendBuffer[pos++] = v[i];
         }
-        sfree(buf);
-    }
-}
+    });
 
-static void exchange_rvecs(const gmx_multisim_t gmx_unused* ms, int gmx_unused b, rvec* v, int n)
-{
-    rvec* buf;
-    int   i;
-
-    if (v)
-    {
-        snew(buf, n);
 #if GMX_MPI
-        /*
-           MPI_Sendrecv(v[0],  n*sizeof(rvec),MPI_BYTE,MSRANK(ms,b),0,
-           buf[0],n*sizeof(rvec),MPI_BYTE,MSRANK(ms,b),0,
-           ms->mpi_comm_masters,MPI_STATUS_IGNORE);
-         */
-        {
-            MPI_Request mpi_req;
+    MPI_Isend(re->stateSendBuffer, numStateValues * sizeof(double), MPI_BYTE, MSRANK(ms, b), 0,
+              ms->mpi_comm_masters, &requests[numRequests++]);
+    MPI_Waitall(numRequests, requests, MPI_STATUSES_IGNORE);
+#endif
 
-            MPI_Isend(v[0], n * sizeof(rvec), MPI_BYTE, MSRANK(ms, b), 0, ms->mpi_comm_masters, &mpi_req);
-            MPI_Recv(buf[0], n * sizeof(rvec), MPI_BYTE, MSRANK(ms, b), 0, ms->mpi_comm_masters,
-                     MPI_STATUS_IGNORE);
-            MPI_Wait(&mpi_req, MPI_STATUS_IGNORE);
+    pos = 0;
+    visitExchangedStateVariables(state, [re, &pos](auto* v, int n) {
+        for (int i = 0; i < n; i++)
+        {
+            v[i] = re->stateRecvBuffer[pos++];
         }
-#endif
-        for (i = 0; i < n; i++)
+    });
+    for (int i = 0; i < state->natoms; i++)
+    {
+        copy_rvec(xRecv[i], state->x[i]);
+    }
+    if (haveVelocities)
+    {
+        for (int i = 0; i < state->natoms; i++)
         {
-            copy_rvec(buf[i], v[i]);
+            copy_rvec(vRecv[i], state->v[i]);
         }
-        sfree(buf);
     }
 }
 
-static void exchange_state(const gmx_multisim_t* ms, int b, t_state* state)
-{
-    /* When t_state changes, this code should be updated. */
-    int ngtc, nnhpres;
-    ngtc    = state->ngtc * state->nhchainlength;
-    nnhpres = state->nnhpres * state->nhchainlength;
-    exchange_rvecs(ms, b, state->box, DIM);
-    exchange_rvecs(ms, b, state->box_rel, DIM);
-    exchange_rvecs(ms, b, state->boxv, DIM);
-    exchange_reals(ms, b, &(state->veta), 1);
-    exchange_reals(ms, b, &(state->vol0), 1);
-    exchange_rvecs(ms, b, state->svir_prev, DIM);
-    exchange_rvecs(ms, b, state->fvir_prev, DIM);
-    exchange_rvecs(ms, b, state->pres_prev, DIM);
-    exchange_doubles(ms, b, state->nosehoover_xi.data(), ngtc);
-    exchange_doubles(ms, b, state->nosehoover_vxi.data(), ngtc);
-    exchange_doubles(ms, b, state->nhpres_xi.data(), nnhpres);
-    exchange_doubles(ms, b, state->nhpres_vxi.data(), nnhpres);
-    exchange_doubles(ms, b, state->therm_integral.data(), state->ngtc);
-    exchange_doubles(ms, b, &state->baros_integral, 1);
-    exchange_rvecs(ms, b, state->x.rvec_array(), state->natoms);
-    exchange_rvecs(ms, b, state->v.rvec_array(), state->natoms);
-}
-
 static void copy_state_serial(const t_state* src, t_state* dest)
 {
     if (dest != src)
@@ -1314,7 +1315,7 @@ gmx_bool replica_exchange(FILE*                 fplog,
                     {
                         fprintf(debug, "Exchanging %d with %d\n", replica_id, exchange_partner);
                     }
-                    exchange_state(ms, exchange_partner, state);
+                    exchange_state(ms, re, exchange_partner, state);
                 }
             }
             /* For temperature-type replica exchange, we need to scale
@@ -47,6 +47,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <vector>
 
 #include "gromacs/commandline/filenm.h"
 #include "gromacs/domdec/dlbtiming.h"
@@ -61,6 +62,7 @@
 #include "gromacs/math/functions.h"
 #include "gromacs/math/utilities.h"
 #include "gromacs/math/vec.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdlib/groupcoord.h"
 #include "gromacs/mdlib/stat.h"
 #include "gromacs/mdrunutility/handlerestart.h"
@@ -70,12 +72,17 @@
 #include "gromacs/mdtypes/mdrunoptions.h"
 #include "gromacs/mdtypes/state.h"
 #include "gromacs/pbcutil/pbc.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/simd/simd_math.h"
 #include "gromacs/timing/cyclecounter.h"
 #include "gromacs/timing/wallcycle.h"
 #include "gromacs/topology/mtop_lookup.h"
 #include "gromacs/topology/mtop_util.h"
+#include "gromacs/utility/alignedallocator.h"
 #include "gromacs/utility/basedefinitions.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/pleasecite.h"
 #include "gromacs/utility/smalloc.h"
 
@@ -133,6 +140,22 @@ struct gmx_potfit
 };
 
 
+//! Per-thread work data for the flexible rotation potentials
+struct gmx_flexthreaddata
+{
+    //! Precalculated gaussians for a single atom
+    std::vector<real> gn_atom;
+    //! Tells to which slab each precalculated gaussian belongs
+    std::vector<int> gn_slabind;
+    //! Contribution of this thread to the torque of each slab
+    std::vector<real> slab_torque_v;
+    //! Contribution of this thread to the potential for the fit angles
+    std::vector<real> fitV;
+    //! Contribution of this thread to the rotation potential
+    real V;
+};
+
+
 //! Enforced rotation data for a single rotation group
 struct gmx_enfrotgrp
 {
@@ -167,6 +190,8 @@ struct gmx_enfrotgrp
     ivec* xc_shifts;
     //! Extra shifts since last DD step
     ivec* xc_eshifts;
+    //! Setup for gathering xc with domain decomposition
+    GroupCollectionPlan xcCollectionPlan;
     //! Old (collective) positions
     rvec* xc_old;
     //! Normalized form of the current positions
@@ -223,10 +248,14 @@ struct gmx_enfrotgrp
     real* slab_torque_v;
     //! min_gaussian from t_rotgrp is the minimum value the gaussian must have so that the force is actually evaluated. max_beta is just another way to put it
     real max_beta;
-    //! Precalculated gaussians for a single atom
-    real* gn_atom;
-    //! Tells to which slab each precalculated gaussian belongs
-    int* gn_slabind;
+    //! Number of OpenMP threads used for the flexible potentials
+    int numThreads = 1;
+    //! Work data for each thread
+    std::vector<gmx_flexthreaddata> threadData;
+    //! Positions along x, y and z and masses for the slab weights, padded to the SIMD width
+    std::vector<real, gmx::AlignedAllocator<real>> slabWeightX, slabWeightY, slabWeightZ, slabWeightM;
+    //! Projections of these positions on the rotation vector
+    std::vector<real, gmx::AlignedAllocator<real>> slabWeightProj;
     //! Inner sum of the flexible2 potential per slab; this is precalculated for optimization reasons
     rvec* slab_innersumvec;
     //! Holds atom positions and gaussian weights of atoms belonging to a slab
@@ -694,30 +723,93 @@ static inline real gaussian_weight(rvec curr_x, const gmx_enfrotgrp* erg, int n)
 }
 
 
+/* Store the positions and masses of the rotation group in the padded SoA
+ * buffers used by get_slab_weight, together with their projections on the
+ * rotation vector. The padding has zero mass and thus does not contribute. */
+static void set_slab_weight_buffers(gmx_enfrotgrp* erg, rvec xc[], const real mc[])
+{
+    const int nat       = erg->rotg->nat;
+    const int paddedNat = ((nat + GMX_SIMD_REAL_WIDTH - 1) / GMX_SIMD_REAL_WIDTH) * GMX_SIMD_REAL_WIDTH;
+
+    erg->slabWeightX.resize(paddedNat);
+    erg->slabWeightY.resize(paddedNat);
+    erg->slabWeightZ.resize(paddedNat);
+    erg->slabWeightM.resize(paddedNat);
+    erg->slabWeightProj.resize(paddedNat);
+    for (int i = 0; i < paddedNat; i++)
+    {
+        const bool isAtom      = (i < nat);
+        erg->slabWeightX[i]    = isAtom ? xc[i][XX] : 0;
+        erg->slabWeightY[i]    = isAtom ? xc[i][YY] : 0;
+        erg->slabWeightZ[i]    = isAtom ? xc[i][ZZ] : 0;
+        erg->slabWeightM[i]    = isAtom ? mc[i] : 0;
+        erg->slabWeightProj[i] = isAtom ? iprod(xc[i], erg->vec) : 0;
+    }
+}
+
+
 /* Returns the weight in a single slab, also calculates the Gaussian- and mass-
- * weighted sum of positions for that slab */
-static real get_slab_weight(int j, const gmx_enfrotgrp* erg, rvec xc[], const real mc[], rvec* x_weighted_sum)
+ * weighted sum of positions for that slab. Uses the positions stored by
+ * set_slab_weight_buffers. */
+static real get_slab_weight(int j, const gmx_enfrotgrp* erg, rvec* x_weighted_sum)
 {
-    rvec curr_x;           /* The position of an atom                      */
-    rvec curr_x_weighted;  /* The gaussian-weighted position               */
-    real gaussian;         /* A single gaussian weight                     */
-    real wgauss;           /* gaussian times current mass                  */
-    real slabweight = 0.0; /* The sum of weights in the slab               */
+    const int                paddedNat         = erg->slabWeightM.size();
+    const real               sigma             = 0.7 * erg->rotg->slab_dist;
+    const real               minusHalfOOsigma2 = -0.5 / (sigma * sigma);
+    const real               slabPosition      = erg->rotg->slab_dist * j;
+    const real* gmx_restrict x                 = erg->slabWeightX.data();
+    const real* gmx_restrict y                 = erg->slabWeightY.data();
+    const real* gmx_restrict z                 = erg->slabWeightZ.data();
+    const real* gmx_restrict m                 = erg->slabWeightM.data();
+    const real* gmx_restrict proj              = erg->slabWeightProj.data();
+
+#if GMX_SIMD_HAVE_REAL
+    using namespace gmx;
+
+    const SimdReal normS(GAUSS_NORM);
+    const SimdReal minusHalfOOsigma2S(minusHalfOOsigma2);
+    const SimdReal slabPositionS(slabPosition);
+    SimdReal       weightSumS = setZero();
+    SimdReal       xSumS      = setZero();
+    SimdReal       ySumS      = setZero();
+    SimdReal       zSumS      = setZero();
+
+    /* Loop over all atoms in the rotation group */
+    for (int i = 0; i < paddedNat; i += GMX_SIMD_REAL_WIDTH)
+    {
+        SimdReal beta     = load<SimdReal>(proj + i) - slabPositionS;
+        SimdReal gaussian = normS * exp(minusHalfOOsigma2S * beta * beta);
+        SimdReal wgauss   = gaussian * load<SimdReal>(m + i);
+        weightSumS        = weightSumS + wgauss;
+        xSumS             = fma(wgauss, load<SimdReal>(x + i), xSumS);
+        ySumS             = fma(wgauss, load<SimdReal>(y + i), ySumS);
+        zSumS             = fma(wgauss, load<SimdReal>(z + i), zSumS);
+    }
+
+    (*x_weighted_sum)[XX] = reduce(xSumS);
+    (*x_weighted_sum)[YY] = reduce(ySumS);
+    (*x_weighted_sum)[ZZ] = reduce(zSumS);
+
+    return reduce(weightSumS);
+#else
+    real slabweight = 0.0; /* The sum of weights in the slab */
 
     clear_rvec(*x_weighted_sum);
 
     /* Loop over all atoms in the rotation group */
-    for (int i = 0; i < erg->rotg->nat; i++)
+    for (int i = 0; i < paddedNat; i++)
     {
-        copy_rvec(xc[i], curr_x);
-        gaussian = gaussian_weight(curr_x, erg, j);
-        wgauss   = gaussian * mc[i];
-        svmul(wgauss, curr_x, curr_x_weighted);
-        rvec_add(*x_weighted_sum, curr_x_weighted, *x_weighted_sum);
+        real beta     = proj[i] - slabPosition;
+        real gaussian = GAUSS_NORM * std::exp(minusHalfOOsigma2 * beta * beta);
+        real wgauss   = gaussian * m[i];
+        (*x_weighted_sum)[XX] += wgauss * x[i];
+        (*x_weighted_sum)[YY] += wgauss * y[i];
+        (*x_weighted_sum)[ZZ] += wgauss * z[i];
         slabweight += wgauss;
     } /* END of loop over rotation group atoms */
 
     return slabweight;
+#endif
 }
 
 
@@ -733,11 +825,21 @@ static void get_slab_centers(gmx_enfrotgrp* erg,  /* Enforced rotation group wor
                                                      init_rot_group we need to store
                                                      the reference slab centers                   */
 {
+    set_slab_weight_buffers(erg, xc, mc);
+
+    /* The slabs are independent, so we distribute them over the threads */
+    const int nslabs = erg->slab_last - erg->slab_first + 1;
+#pragma omp parallel for num_threads(erg->numThreads) schedule(static)
+    for (int slabIndex = 0; slabIndex < nslabs; slabIndex++)
+    {
+        erg->slab_weights[slabIndex] =
+                get_slab_weight(erg->slab_first + slabIndex, erg, &erg->slab_center[slabIndex]);
+    }
+
     /* Loop over slabs */
     for (int j = erg->slab_first; j <= erg->slab_last; j++)
     {
-        int slabIndex                = j - erg->slab_first;
-        erg->slab_weights[slabIndex] = get_slab_weight(j, erg, xc, mc, &erg->slab_center[slabIndex]);
+        int slabIndex = j - erg->slab_first;
 
         /* We can do the calculations ONLY if there is weight in the slab! */
         if (erg->slab_weights[slabIndex] > WEIGHT_MIN)
@@ -865,7 +967,7 @@ static FILE* open_output_file(const char* fn, int steps, const char what[])
     FILE* fp;
 
 
-    fp = gmx_ffopen(fn, "w");
+    fp = gmx_fio_fopen(fn, "w");
 
     fprintf(fp, "# Output of %s is written in intervals of %d time step%s.\n#\n", what, steps,
             steps > 1 ? "s" : "");
@@ -1746,45 +1848,56 @@ static inline int get_homeslab(rvec curr_x, /* The position for which the home s
 
 
 /* For a local atom determine the relevant slabs, i.e. slabs in
- * which the gaussian is larger than min_gaussian
+ * which the gaussian is larger than min_gaussian, and store their gaussians
+ * in the work data of the calling thread. Since the gaussian only depends on
+ * the distance beta of the atom to the slab along the rotation vector, the
+ * range of relevant slabs follows from max_beta and only the gaussians inside
+ * that range are evaluated.
  */
-static int get_single_atom_gaussians(rvec curr_x, gmx_enfrotgrp* erg)
+static int get_single_atom_gaussians(rvec curr_x, const gmx_enfrotgrp* erg, gmx_flexthreaddata* td)
 {
+    const real slabDist          = erg->rotg->slab_dist;
+    const real sigma             = 0.7 * slabDist;
+    const real minusHalfOOsigma2 = -0.5 / (sigma * sigma);
+    const real proj              = iprod(curr_x, erg->vec);
+
+    /* Determine the 'home' slab of this atom and the range of relevant slabs,
+     * using the same criterion as get_first_slab and get_last_slab */
+    int homeslab = get_homeslab(curr_x, erg->vec, slabDist);
+    int slabMin  = static_cast<int>(ceil(static_cast<double>((proj - erg->max_beta) / slabDist)));
+    int slabMax  = static_cast<int>(floor(static_cast<double>((proj + erg->max_beta) / slabDist)));
+    slabMin      = std::max(std::min(slabMin, homeslab), erg->slab_first);
+    slabMax      = std::min(std::max(slabMax, homeslab), erg->slab_last);
+    if (slabMin > slabMax)
+    {
+        return 0;
+    }
+    homeslab = std::min(std::max(homeslab, slabMin), slabMax);
 
-    /* Determine the 'home' slab of this atom: */
-    int homeslab = get_homeslab(curr_x, erg->vec, erg->rotg->slab_dist);
-
-    /* First determine the weight in the atoms home slab: */
-    real g                 = gaussian_weight(curr_x, erg, homeslab);
-    int  count             = 0;
-    erg->gn_atom[count]    = g;
-    erg->gn_slabind[count] = homeslab;
-    count++;
-
+    const int count = slabMax - slabMin + 1;
+    if (gmx::ssize(td->gn_atom) < count)
+    {
+        td->gn_atom.resize(count);
+        td->gn_slabind.resize(count);
+    }
 
-    /* Determine the max slab */
-    int slab = homeslab;
-    while (g > erg->rotg->min_gaussian)
+    /* Start with the home slab, then the slabs above and below it */
+    int ic = 0;
+    for (int slab = homeslab; slab <= slabMax; slab++)
     {
-        slab++;
-        g                      = gaussian_weight(curr_x, erg, slab);
-        erg->gn_slabind[count] = slab;
-        erg->gn_atom[count]    = g;
-        count++;
+        td->gn_slabind[ic++] = slab;
+    }
+    for (int slab = homeslab - 1; slab >= slabMin; slab--)
+    {
+        td->gn_slabind[ic++] = slab;
     }
-    count--;
 
-    /* Determine the min slab */
-    slab = homeslab;
-    do
+    /* Calculate the Gaussian values of all relevant slabs for curr_x */
+    for (ic = 0; ic < count; ic++)
     {
-        slab--;
-        g                      = gaussian_weight(curr_x, erg, slab);
-        erg->gn_slabind[count] = slab;
-        erg->gn_atom[count]    = g;
-        count++;
-    } while (g > erg->rotg->min_gaussian);
-    count--;
+        const real beta = proj - slabDist * td->gn_slabind[ic];
+        td->gn_atom[ic] = GAUSS_NORM * std::exp(minusHalfOOsigma2 * beta * beta);
+    }
 
     return count;
 }
@@ -1792,26 +1905,26 @@ static int get_single_atom_gaussians(rvec curr_x, gmx_enfrotgrp* erg)
 
 static void flex2_precalc_inner_sum(const gmx_enfrotgrp* erg)
 {
-    rvec xi;       /* positions in the i-sum                        */
-    rvec xcn, ycn; /* the current and the reference slab centers    */
-    real gaussian_xi;
-    rvec yi0;
-    rvec rin; /* Helper variables                              */
-    real fac, fac2;
-    rvec innersumvec;
-    real OOpsii, OOpsiistar;
-    real sin_rin; /* s_ii.r_ii */
-    rvec s_in, tmpvec, tmpvec2;
-    real mi, wi; /* Mass-weighting of the positions                 */
-    real N_M;    /* N/M                                             */
-
+    const real N_M    = erg->rotg->nat * erg->invmass; /* N/M */
+    const int  nslabs = erg->slab_last - erg->slab_first + 1;
 
-    N_M = erg->rotg->nat * erg->invmass;
-
-    /* Loop over all slabs that contain something */
-    for (int n = erg->slab_first; n <= erg->slab_last; n++)
+    /* Loop over all slabs that contain something. The inner sums of the
+     * slabs are independent, so we distribute the slabs over the threads. */
+#pragma omp parallel for num_threads(erg->numThreads) schedule(static)
+    for (int slabIndex = 0; slabIndex < nslabs; slabIndex++)
     {
-        int slabIndex = n - erg->slab_first; /* slab index */
+        int  n = erg->slab_first + slabIndex; /* slab */
+        rvec xi;       /* positions in the i-sum                        */
+        rvec xcn, ycn; /* the current and the reference slab centers    */
+        real gaussian_xi;
+        rvec yi0;
+        rvec rin; /* Helper variables                              */
+        real fac, fac2;
+        rvec innersumvec;
+        real OOpsii, OOpsiistar;
+        real sin_rin; /* s_ii.r_ii */
+        rvec s_in, tmpvec, tmpvec2;
+        real mi, wi; /* Mass-weighting of the positions                 */
 
         /* The current center of this slab is saved in xcn: */
         copy_rvec(erg->slab_center[slabIndex], xcn);
@@ -1882,22 +1995,23 @@ static void flex2_precalc_inner_sum(const gmx_enfrotgrp* erg)
 
 static void flex_precalc_inner_sum(const gmx_enfrotgrp* erg)
 {
-    rvec xi;       /* position                                      */
-    rvec xcn, ycn; /* the current and the reference slab centers    */
-    rvec qin, rin; /* q_i^n and r_i^n                               */
-    real bin;
-    rvec tmpvec;
-    rvec innersumvec; /* Inner part of sum_n2                          */
-    real gaussian_xi; /* Gaussian weight gn(xi)                        */
-    real mi, wi;      /* Mass-weighting of the positions               */
-    real N_M;         /* N/M                                           */
-
-    N_M = erg->rotg->nat * erg->invmass;
+    const real N_M    = erg->rotg->nat * erg->invmass; /* N/M */
+    const int  nslabs = erg->slab_last - erg->slab_first + 1;
 
-    /* Loop over all slabs that contain something */
-    for (int n = erg->slab_first; n <= erg->slab_last; n++)
+    /* Loop over all slabs that contain something. The inner sums of the
+     * slabs are independent, so we distribute the slabs over the threads. */
+#pragma omp parallel for num_threads(erg->numThreads) schedule(static)
+    for (int slabIndex = 0; slabIndex < nslabs; slabIndex++)
     {
-        int slabIndex = n - erg->slab_first; /* slab index */
+        int  n = erg->slab_first + slabIndex; /* slab */
+        rvec xi;          /* position                                      */
+        rvec xcn, ycn;    /* the current and the reference slab centers    */
+        rvec qin, rin;    /* q_i^n and r_i^n                               */
+        real bin;
+        rvec tmpvec;
+        rvec innersumvec; /* Inner part of sum_n2                          */
+        real gaussian_xi; /* Gaussian weight gn(xi)                        */
+        real mi, wi;      /* Mass-weighting of the positions               */
 
         /* The current center of this slab is saved in xcn: */
         copy_rvec(erg->slab_center[slabIndex], xcn);
@@ -1954,6 +2068,40 @@ static void flex_precalc_inner_sum(const gmx_enfrotgrp* erg)
 }
 
 
+/* Clear the work data of a thread before running a flexible potential kernel */
+static void clear_flex_thread_data(gmx_flexthreaddata* td, int nslabs, int nfit)
+{
+    td->V = 0.0;
+    td->slab_torque_v.assign(nslabs, 0.0);
+    td->fitV.assign(nfit, 0.0);
+}
+
+
+/* Add the contributions of all threads to the slab torques and the fit
+ * potentials of the group, returns the rotation potential */
+static real reduce_flex_thread_data(gmx_enfrotgrp* erg, int nslabs, gmx_bool bCalcPotFit)
+{
+    real V = 0.0;
+    for (const gmx_flexthreaddata& td : erg->threadData)
+    {
+        V += td.V;
+        for (int l = 0; l < nslabs; l++)
+        {
+            erg->slab_torque_v[l] += td.slab_torque_v[l];
+        }
+        if (bCalcPotFit)
+        {
+            for (int ifit = 0; ifit < erg->rotg->PotAngle_nstep; ifit++)
+            {
+                erg->PotAngleFit->V[ifit] += td.fitV[ifit];
+            }
+        }
+    }
+
+    return V;
+}
+
+
 static real do_flex2_lowlevel(gmx_enfrotgrp* erg,
                               real           sigma, /* The Gaussian width sigma */
                               rvec           x[],
@@ -1961,251 +2109,261 @@ static real do_flex2_lowlevel(gmx_enfrotgrp* erg,
                               gmx_bool       bOutstepSlab,
                               const matrix   box)
 {
-    int  count, ii, iigrp;
-    rvec xj;          /* position in the i-sum                         */
-    rvec yj0;         /* the reference position in the j-sum           */
-    rvec xcn, ycn;    /* the current and the reference slab centers    */
-    real V;           /* This node's part of the rotation pot. energy  */
-    real gaussian_xj; /* Gaussian weight                               */
-    real beta;
-
-    real numerator, fit_numerator;
-    rvec rjn, fit_rjn; /* Helper variables                              */
-    real fac, fac2;
-
-    real     OOpsij, OOpsijstar;
-    real     OOsigma2; /* 1/(sigma^2)                                   */
-    real     sjn_rjn;
-    real     betasigpsi;
-    rvec     sjn, tmpvec, tmpvec2, yj0_ycn;
-    rvec     sum1vec_part, sum1vec, sum2vec_part, sum2vec, sum3vec, sum4vec, innersumvec;
-    real     sum3, sum4;
-    real     mj, wj; /* Mass-weighting of the positions               */
-    real     N_M;    /* N/M                                           */
-    real     Wjn;    /* g_n(x_j) m_j / Mjn                            */
-    gmx_bool bCalcPotFit;
-
-    /* To calculate the torque per slab */
-    rvec slab_force; /* Single force from slab n on one atom          */
-    rvec slab_sum1vec_part;
-    real slab_sum3part, slab_sum4part;
-    rvec slab_sum1vec, slab_sum2vec, slab_sum3vec, slab_sum4vec;
-
     /* Pre-calculate the inner sums, so that we do not have to calculate
      * them again for every atom */
     flex2_precalc_inner_sum(erg);
 
-    bCalcPotFit = (bOutstepRot || bOutstepSlab) && (erotgFitPOT == erg->rotg->eFittype);
+    const gmx_bool bCalcPotFit = (bOutstepRot || bOutstepSlab) && (erotgFitPOT == erg->rotg->eFittype);
 
     /********************************************************/
     /* Main loop over all local atoms of the rotation group */
     /********************************************************/
-    N_M                                      = erg->rotg->nat * erg->invmass;
-    V                                        = 0.0;
-    OOsigma2                                 = 1.0 / (sigma * sigma);
+    const real  N_M                          = erg->rotg->nat * erg->invmass;
+    const real  OOsigma2                     = 1.0 / (sigma * sigma);
     const auto& localRotationGroupIndex      = erg->atomSet->localIndex();
     const auto& collectiveRotationGroupIndex = erg->atomSet->collectiveIndex();
+    const int   nslabs                       = erg->slab_last - erg->slab_first + 1;
 
-    for (gmx::index j = 0; j < localRotationGroupIndex.ssize(); j++)
+    /* The local atoms are distributed over the threads. Each thread sums its
+     * contributions to the potential and the slab torques separately, these
+     * are reduced in a fixed order after the loop. */
+#pragma omp parallel num_threads(erg->numThreads)
     {
-        /* Local index of a rotation group atom  */
-        ii = localRotationGroupIndex[j];
-        /* Position of this atom in the collective array */
-        iigrp = collectiveRotationGroupIndex[j];
-        /* Mass-weighting */
-        mj = erg->mc[iigrp]; /* need the unsorted mass here */
-        wj = N_M * mj;
-
-        /* Current position of this atom: x[ii][XX/YY/ZZ]
-         * Note that erg->xc_center contains the center of mass in case the flex2-t
-         * potential was chosen. For the flex2 potential erg->xc_center must be
-         * zero. */
-        rvec_sub(x[ii], erg->xc_center, xj);
-
-        /* Shift this atom such that it is near its reference */
-        shift_single_coord(box, xj, erg->xc_shifts[iigrp]);
-
-        /* Determine the slabs to loop over, i.e. the ones with contributions
-         * larger than min_gaussian */
-        count = get_single_atom_gaussians(xj, erg);
-
-        clear_rvec(sum1vec_part);
-        clear_rvec(sum2vec_part);
-        sum3 = 0.0;
-        sum4 = 0.0;
-        /* Loop over the relevant slabs for this atom */
-        for (int ic = 0; ic < count; ic++)
+        try
         {
-            int n = erg->gn_slabind[ic];
-
-            /* Get the precomputed Gaussian value of curr_slab for curr_x */
-            gaussian_xj = erg->gn_atom[ic];
-
-            int slabIndex = n - erg->slab_first; /* slab index */
+            gmx_flexthreaddata* td = &erg->threadData[gmx_omp_get_thread_num()];
+            clear_flex_thread_data(td, nslabs, bCalcPotFit ? erg->rotg->PotAngle_nstep : 0);
+
+            int  count, ii, iigrp;
+            rvec xj;          /* position in the i-sum                         */
+            rvec yj0;         /* the reference position in the j-sum           */
+            rvec xcn, ycn;    /* the current and the reference slab centers    */
+            real gaussian_xj; /* Gaussian weight                               */
+            real beta;
+
+            real numerator, fit_numerator;
+            rvec rjn, fit_rjn; /* Helper variables                              */
+            real fac, fac2;
+
+            real     OOpsij, OOpsijstar;
+            real     sjn_rjn;
+            real     betasigpsi;
+            rvec     sjn, tmpvec, tmpvec2, yj0_ycn;
+            rvec     sum1vec_part, sum1vec, sum2vec_part, sum2vec, sum3vec, sum4vec, innersumvec;
+            real     sum3, sum4;
+            real     mj, wj; /* Mass-weighting of the positions               */
+            real     Wjn;    /* g_n(x_j) m_j / Mjn                            */
+
+            /* To calculate the torque per slab */
+            rvec slab_force; /* Single force from slab n on one atom          */
+            rvec slab_sum1vec_part;
+            real slab_sum3part, slab_sum4part;
+            rvec slab_sum1vec, slab_sum2vec, slab_sum3vec, slab_sum4vec;
+
+#pragma omp for schedule(static)
+            for (gmx::index j = 0; j < localRotationGroupIndex.ssize(); j++)
+            {
+                /* Local index of a rotation group atom  */
+                ii = localRotationGroupIndex[j];
+                /* Position of this atom in the collective array */
+                iigrp = collectiveRotationGroupIndex[j];
+                /* Mass-weighting */
+                mj = erg->mc[iigrp]; /* need the unsorted mass here */
+                wj = N_M * mj;
+
+                /* Current position of this atom: x[ii][XX/YY/ZZ]
+                 * Note that erg->xc_center contains the center of mass in case the flex2-t
+                 * potential was chosen. For the flex2 potential erg->xc_center must be
+                 * zero. */
+                rvec_sub(x[ii], erg->xc_center, xj);
+
+                /* Shift this atom such that it is near its reference */
+                shift_single_coord(box, xj, erg->xc_shifts[iigrp]);
+
+                /* Determine the slabs to loop over, i.e. the ones with contributions
+                 * larger than min_gaussian */
+                count = get_single_atom_gaussians(xj, erg, td);
+
+                clear_rvec(sum1vec_part);
+                clear_rvec(sum2vec_part);
+                sum3 = 0.0;
+                sum4 = 0.0;
+                /* Loop over the relevant slabs for this atom */
+                for (int ic = 0; ic < count; ic++)
+                {
+                    int n = td->gn_slabind[ic];
 
-            /* The (unrotated) reference position of this atom is copied to yj0: */
-            copy_rvec(erg->rotg->x_ref[iigrp], yj0);
+                    /* Get the precomputed Gaussian value of curr_slab for curr_x */
+                    gaussian_xj = td->gn_atom[ic];
 
-            beta = calc_beta(xj, erg, n);
+                    int slabIndex = n - erg->slab_first; /* slab index */
 
-            /* The current center of this slab is saved in xcn: */
-            copy_rvec(erg->slab_center[slabIndex], xcn);
-            /* ... and the reference center in ycn: */
-            copy_rvec(erg->slab_center_ref[slabIndex + erg->slab_buffer], ycn);
+                    /* The (unrotated) reference position of this atom is copied to yj0: */
+                    copy_rvec(erg->rotg->x_ref[iigrp], yj0);
 
-            rvec_sub(yj0, ycn, yj0_ycn); /* yj0_ycn = yj0 - ycn      */
+                    beta = calc_beta(xj, erg, n);
 
-            /* Rotate: */
-            mvmul(erg->rotmat, yj0_ycn, rjn); /* rjn = Omega.(yj0 - ycn)  */
+                    /* The current center of this slab is saved in xcn: */
+                    copy_rvec(erg->slab_center[slabIndex], xcn);
+                    /* ... and the reference center in ycn: */
+                    copy_rvec(erg->slab_center_ref[slabIndex + erg->slab_buffer], ycn);
 
-            /* Subtract the slab center from xj */
-            rvec_sub(xj, xcn, tmpvec2); /* tmpvec2 = xj - xcn       */
+                    rvec_sub(yj0, ycn, yj0_ycn); /* yj0_ycn = yj0 - ycn      */
 
-            /* In rare cases, when an atom position coincides with a slab center
-             * (tmpvec2 == 0) we cannot compute the vector product for sjn.
-             * However, since the atom is located directly on the pivot, this
-             * slab's contribution to the force on that atom will be zero
-             * anyway. Therefore, we directly move on to the next slab.       */
-            if (gmx_numzero(norm(tmpvec2))) /* 0 == norm(xj - xcn) */
-            {
-                continue;
-            }
+                    /* Rotate: */
+                    mvmul(erg->rotmat, yj0_ycn, rjn); /* rjn = Omega.(yj0 - ycn)  */
 
-            /* Calculate sjn */
-            cprod(erg->vec, tmpvec2, tmpvec); /* tmpvec = v x (xj - xcn)  */
+                    /* Subtract the slab center from xj */
+                    rvec_sub(xj, xcn, tmpvec2); /* tmpvec2 = xj - xcn       */
 
-            OOpsijstar = norm2(tmpvec) + erg->rotg->eps; /* OOpsij* = 1/psij* = |v x (xj-xcn)|^2 + eps */
+                    /* In rare cases, when an atom position coincides with a slab center
+                     * (tmpvec2 == 0) we cannot compute the vector product for sjn.
+                     * However, since the atom is located directly on the pivot, this
+                     * slab's contribution to the force on that atom will be zero
+                     * anyway. Therefore, we directly move on to the next slab.       */
+                    if (gmx_numzero(norm(tmpvec2))) /* 0 == norm(xj - xcn) */
+                    {
+                        continue;
+                    }
 
-            numerator = gmx::square(iprod(tmpvec, rjn));
+                    /* Calculate sjn */
+                    cprod(erg->vec, tmpvec2, tmpvec); /* tmpvec = v x (xj - xcn)  */
 
-            /*********************************/
-            /* Add to the rotation potential */
-            /*********************************/
-            V += 0.5 * erg->rotg->k * wj * gaussian_xj * numerator / OOpsijstar;
+                    OOpsijstar = norm2(tmpvec) + erg->rotg->eps; /* OOpsij* = 1/psij* = |v x (xj-xcn)|^2 + eps */
 
-            /* If requested, also calculate the potential for a set of angles
-             * near the current reference angle */
-            if (bCalcPotFit)
-            {
-                for (int ifit = 0; ifit < erg->rotg->PotAngle_nstep; ifit++)
-                {
-                    mvmul(erg->PotAngleFit->rotmat[ifit], yj0_ycn, fit_rjn);
-                    fit_numerator = gmx::square(iprod(tmpvec, fit_rjn));
-                    erg->PotAngleFit->V[ifit] +=
-                            0.5 * erg->rotg->k * wj * gaussian_xj * fit_numerator / OOpsijstar;
-                }
-            }
+                    numerator = gmx::square(iprod(tmpvec, rjn));
 
-            /*************************************/
-            /* Now calculate the force on atom j */
-            /*************************************/
+                    /*********************************/
+                    /* Add to the rotation potential */
+                    /*********************************/
+                    td->V += 0.5 * erg->rotg->k * wj * gaussian_xj * numerator / OOpsijstar;
 
-            OOpsij = norm(tmpvec); /* OOpsij = 1 / psij = |v x (xj - xcn)| */
+                    /* If requested, also calculate the potential for a set of angles
+                     * near the current reference angle */
+                    if (bCalcPotFit)
+                    {
+                        for (int ifit = 0; ifit < erg->rotg->PotAngle_nstep; ifit++)
+                        {
+                            mvmul(erg->PotAngleFit->rotmat[ifit], yj0_ycn, fit_rjn);
+                            fit_numerator = gmx::square(iprod(tmpvec, fit_rjn));
+                            td->fitV[ifit] +=
+                                    0.5 * erg->rotg->k * wj * gaussian_xj * fit_numerator / OOpsijstar;
+                        }
+                    }
 
-            /*                              *         v x (xj - xcn)          */
-            unitv(tmpvec, sjn); /*  sjn = ----------------         */
-                                /*        |v x (xj - xcn)|         */
+                    /*************************************/
+                    /* Now calculate the force on atom j */
+                    /*************************************/
+
+                    OOpsij = norm(tmpvec); /* OOpsij = 1 / psij = |v x (xj - xcn)| */
+
+                    /*                              *         v x (xj - xcn)          */
+                    unitv(tmpvec, sjn); /*  sjn = ----------------         */
+                                        /*        |v x (xj - xcn)|         */
+
+                    sjn_rjn = iprod(sjn, rjn); /* sjn_rjn = sjn . rjn             */
+
+
+                    /*** A. Calculate the first of the four sum terms: ****************/
+                    fac = OOpsij / OOpsijstar;
+                    svmul(fac, rjn, tmpvec);
+                    fac2 = fac * fac * OOpsij;
+                    svmul(fac2 * sjn_rjn, sjn, tmpvec2);
+                    rvec_dec(tmpvec, tmpvec2);
+                    fac2 = wj * gaussian_xj; /* also needed for sum4 */
+                    svmul(fac2 * sjn_rjn, tmpvec, slab_sum1vec_part);
+                    /********************/
+                    /*** Add to sum1: ***/
+                    /********************/
+                    rvec_inc(sum1vec_part, slab_sum1vec_part); /* sum1 still needs to vector multiplied with v */
+
+                    /*** B. Calculate the forth of the four sum terms: ****************/
+                    betasigpsi = beta * OOsigma2 * OOpsij; /* this is also needed for sum3 */
+                    /********************/
+                    /*** Add to sum4: ***/
+                    /********************/
+                    slab_sum4part = fac2 * betasigpsi * fac * sjn_rjn
+                                    * sjn_rjn; /* Note that fac is still valid from above */
+                    sum4 += slab_sum4part;
+
+                    /*** C. Calculate Wjn for second and third sum */
+                    /* Note that we can safely divide by slab_weights since we check in
+                     * get_slab_centers that it is non-zero. */
+                    Wjn = gaussian_xj * mj / erg->slab_weights[slabIndex];
+
+                    /* We already have precalculated the inner sum for slab n */
+                    copy_rvec(erg->slab_innersumvec[slabIndex], innersumvec);
+
+                    /* Weigh the inner sum vector with Wjn */
+                    svmul(Wjn, innersumvec, innersumvec);
+
+                    /*** E. Calculate the second of the four sum terms: */
+                    /********************/
+                    /*** Add to sum2: ***/
+                    /********************/
+                    rvec_inc(sum2vec_part, innersumvec); /* sum2 still needs to be vector crossproduct'ed with v */
+
+                    /*** F. Calculate the third of the four sum terms: */
+                    slab_sum3part = betasigpsi * iprod(sjn, innersumvec);
+                    sum3 += slab_sum3part; /* still needs to be multiplied with v */
+
+                    /*** G. Calculate the torque on the local slab's axis: */
+                    if (bOutstepRot)
+                    {
+                        /* Sum1 */
+                        cprod(slab_sum1vec_part, erg->vec, slab_sum1vec);
+                        /* Sum2 */
+                        cprod(innersumvec, erg->vec, slab_sum2vec);
+                        /* Sum3 */
+                        svmul(slab_sum3part, erg->vec, slab_sum3vec);
+                        /* Sum4 */
+                        svmul(slab_sum4part, erg->vec, slab_sum4vec);
+
+                        /* The force on atom ii from slab n only: */
+                        for (int m = 0; m < DIM; m++)
+                        {
+                            slab_force[m] = erg->rotg->k
+                                            * (-slab_sum1vec[m] + slab_sum2vec[m] - slab_sum3vec[m]
+                                               + 0.5 * slab_sum4vec[m]);
+                        }
 
-            sjn_rjn = iprod(sjn, rjn); /* sjn_rjn = sjn . rjn             */
+                        td->slab_torque_v[slabIndex] += torque(erg->vec, slab_force, xj, xcn);
+                    }
+                } /* END of loop over slabs */
 
+                /* Construct the four individual parts of the vector sum: */
+                cprod(sum1vec_part, erg->vec, sum1vec); /* sum1vec =   { } x v  */
+                cprod(sum2vec_part, erg->vec, sum2vec); /* sum2vec =   { } x v  */
+                svmul(sum3, erg->vec, sum3vec);         /* sum3vec =   { } . v  */
+                svmul(sum4, erg->vec, sum4vec);         /* sum4vec =   { } . v  */
 
-            /*** A. Calculate the first of the four sum terms: ****************/
-            fac = OOpsij / OOpsijstar;
-            svmul(fac, rjn, tmpvec);
-            fac2 = fac * fac * OOpsij;
-            svmul(fac2 * sjn_rjn, sjn, tmpvec2);
-            rvec_dec(tmpvec, tmpvec2);
-            fac2 = wj * gaussian_xj; /* also needed for sum4 */
-            svmul(fac2 * sjn_rjn, tmpvec, slab_sum1vec_part);
-            /********************/
-            /*** Add to sum1: ***/
-            /********************/
-            rvec_inc(sum1vec_part, slab_sum1vec_part); /* sum1 still needs to vector multiplied with v */
-
-            /*** B. Calculate the forth of the four sum terms: ****************/
-            betasigpsi = beta * OOsigma2 * OOpsij; /* this is also needed for sum3 */
-            /********************/
-            /*** Add to sum4: ***/
-            /********************/
-            slab_sum4part = fac2 * betasigpsi * fac * sjn_rjn
-                            * sjn_rjn; /* Note that fac is still valid from above */
-            sum4 += slab_sum4part;
-
-            /*** C. Calculate Wjn for second and third sum */
-            /* Note that we can safely divide by slab_weights since we check in
-             * get_slab_centers that it is non-zero. */
-            Wjn = gaussian_xj * mj / erg->slab_weights[slabIndex];
-
-            /* We already have precalculated the inner sum for slab n */
-            copy_rvec(erg->slab_innersumvec[slabIndex], innersumvec);
-
-            /* Weigh the inner sum vector with Wjn */
-            svmul(Wjn, innersumvec, innersumvec);
-
-            /*** E. Calculate the second of the four sum terms: */
-            /********************/
-            /*** Add to sum2: ***/
-            /********************/
-            rvec_inc(sum2vec_part, innersumvec); /* sum2 still needs to be vector crossproduct'ed with v */
-
-            /*** F. Calculate the third of the four sum terms: */
-            slab_sum3part = betasigpsi * iprod(sjn, innersumvec);
-            sum3 += slab_sum3part; /* still needs to be multiplied with v */
-
-            /*** G. Calculate the torque on the local slab's axis: */
-            if (bOutstepRot)
-            {
-                /* Sum1 */
-                cprod(slab_sum1vec_part, erg->vec, slab_sum1vec);
-                /* Sum2 */
-                cprod(innersumvec, erg->vec, slab_sum2vec);
-                /* Sum3 */
-                svmul(slab_sum3part, erg->vec, slab_sum3vec);
-                /* Sum4 */
-                svmul(slab_sum4part, erg->vec, slab_sum4vec);
-
-                /* The force on atom ii from slab n only: */
+                /* Store the additional force so that it can be added to the force
+                 * array after the normal forces have been evaluated */
                 for (int m = 0; m < DIM; m++)
                 {
-                    slab_force[m] = erg->rotg->k
-                                    * (-slab_sum1vec[m] + slab_sum2vec[m] - slab_sum3vec[m]
-                                       + 0.5 * slab_sum4vec[m]);
+                    erg->f_rot_loc[j][m] =
+                            erg->rotg->k * (-sum1vec[m] + sum2vec[m] - sum3vec[m] + 0.5 * sum4vec[m]);
                 }
 
-                erg->slab_torque_v[slabIndex] += torque(erg->vec, slab_force, xj, xcn);
-            }
-        } /* END of loop over slabs */
-
-        /* Construct the four individual parts of the vector sum: */
-        cprod(sum1vec_part, erg->vec, sum1vec); /* sum1vec =   { } x v  */
-        cprod(sum2vec_part, erg->vec, sum2vec); /* sum2vec =   { } x v  */
-        svmul(sum3, erg->vec, sum3vec);         /* sum3vec =   { } . v  */
-        svmul(sum4, erg->vec, sum4vec);         /* sum4vec =   { } . v  */
-
-        /* Store the additional force so that it can be added to the force
-         * array after the normal forces have been evaluated */
-        for (int m = 0; m < DIM; m++)
-        {
-            erg->f_rot_loc[j][m] =
-                    erg->rotg->k * (-sum1vec[m] + sum2vec[m] - sum3vec[m] + 0.5 * sum4vec[m]);
-        }
-
 #ifdef SUM_PARTS
-        fprintf(stderr, "sum1: %15.8f %15.8f %15.8f\n", -erg->rotg->k * sum1vec[XX],
-                -erg->rotg->k * sum1vec[YY], -erg->rotg->k * sum1vec[ZZ]);
-        fprintf(stderr, "sum2: %15.8f %15.8f %15.8f\n", erg->rotg->k * sum2vec[XX],
-                erg->rotg->k * sum2vec[YY], erg->rotg->k * sum2vec[ZZ]);
-        fprintf(stderr, "sum3: %15.8f %15.8f %15.8f\n", -erg->rotg->k * sum3vec[XX],
-                -erg->rotg->k * sum3vec[YY], -erg->rotg->k * sum3vec[ZZ]);
-        fprintf(stderr, "sum4: %15.8f %15.8f %15.8f\n", 0.5 * erg->rotg->k * sum4vec[XX],
-                0.5 * erg->rotg->k * sum4vec[YY], 0.5 * erg->rotg->k * sum4vec[ZZ]);
+                fprintf(stderr, "sum1: %15.8f %15.8f %15.8f\n", -erg->rotg->k * sum1vec[XX],
+                        -erg->rotg->k * sum1vec[YY], -erg->rotg->k * sum1vec[ZZ]);
+                fprintf(stderr, "sum2: %15.8f %15.8f %15.8f\n", erg->rotg->k * sum2vec[XX],
+                        erg->rotg->k * sum2vec[YY], erg->rotg->k * sum2vec[ZZ]);
+                fprintf(stderr, "sum3: %15.8f %15.8f %15.8f\n", -erg->rotg->k * sum3vec[XX],
+                        -erg->rotg->k * sum3vec[YY], -erg->rotg->k * sum3vec[ZZ]);
+                fprintf(stderr, "sum4: %15.8f %15.8f %15.8f\n", 0.5 * erg->rotg->k * sum4vec[XX],
+                        0.5 * erg->rotg->k * sum4vec[YY], 0.5 * erg->rotg->k * sum4vec[ZZ]);
 #endif
 
-        PRINT_FORCE_J
+                PRINT_FORCE_J
 
-    } /* END of loop over local atoms */
+            } /* END of loop over local atoms */
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
 
-    return V;
+    return reduce_flex_thread_data(erg, nslabs, bCalcPotFit);
 }
 
 
@@ -2216,199 +2374,209 @@ static real do_flex_lowlevel(gmx_enfrotgrp* erg,
                              gmx_bool     bOutstepSlab,
                              const matrix box)
 {
-    int      count, iigrp;
-    rvec     xj, yj0;        /* current and reference position                */
-    rvec     xcn, ycn;       /* the current and the reference slab centers    */
-    rvec     yj0_ycn;        /* yj0 - ycn                                     */
-    rvec     xj_xcn;         /* xj - xcn                                      */
-    rvec     qjn, fit_qjn;   /* q_i^n                                         */
-    rvec     sum_n1, sum_n2; /* Two contributions to the rotation force       */
-    rvec     innersumvec;    /* Inner part of sum_n2                          */
-    rvec     s_n;
-    rvec     force_n;                /* Single force from slab n on one atom          */
-    rvec     force_n1, force_n2;     /* First and second part of force_n              */
-    rvec     tmpvec, tmpvec2, tmp_f; /* Helper variables                              */
-    real     V;                      /* The rotation potential energy                 */
-    real     OOsigma2;               /* 1/(sigma^2)                                   */
-    real     beta;                   /* beta_n(xj)                                    */
-    real     bjn, fit_bjn;           /* b_j^n                                         */
-    real     gaussian_xj;            /* Gaussian weight gn(xj)                        */
-    real     betan_xj_sigma2;
-    real     mj, wj; /* Mass-weighting of the positions               */
-    real     N_M;    /* N/M                                           */
-    gmx_bool bCalcPotFit;
-
     /* Pre-calculate the inner sums, so that we do not have to calculate
      * them again for every atom */
     flex_precalc_inner_sum(erg);
 
-    bCalcPotFit = (bOutstepRot || bOutstepSlab) && (erotgFitPOT == erg->rotg->eFittype);
+    const gmx_bool bCalcPotFit = (bOutstepRot || bOutstepSlab) && (erotgFitPOT == erg->rotg->eFittype);
 
     /********************************************************/
     /* Main loop over all local atoms of the rotation group */
     /********************************************************/
-    OOsigma2                                 = 1.0 / (sigma * sigma);
-    N_M                                      = erg->rotg->nat * erg->invmass;
-    V                                        = 0.0;
+    const real  OOsigma2                     = 1.0 / (sigma * sigma);
+    const real  N_M                          = erg->rotg->nat * erg->invmass;
     const auto& localRotationGroupIndex      = erg->atomSet->localIndex();
     const auto& collectiveRotationGroupIndex = erg->atomSet->collectiveIndex();
+    const int   nslabs                       = erg->slab_last - erg->slab_first + 1;
 
-    for (gmx::index j = 0; j < localRotationGroupIndex.ssize(); j++)
+    /* The local atoms are distributed over the threads. Each thread sums its
+     * contributions to the potential and the slab torques separately, these
+     * are reduced in a fixed order after the loop. */
+#pragma omp parallel num_threads(erg->numThreads)
     {
-        /* Local index of a rotation group atom  */
-        int ii = localRotationGroupIndex[j];
-        /* Position of this atom in the collective array */
-        iigrp = collectiveRotationGroupIndex[j];
-        /* Mass-weighting */
-        mj = erg->mc[iigrp]; /* need the unsorted mass here */
-        wj = N_M * mj;
-
-        /* Current position of this atom: x[ii][XX/YY/ZZ]
-         * Note that erg->xc_center contains the center of mass in case the flex-t
-         * potential was chosen. For the flex potential erg->xc_center must be
-         * zero. */
-        rvec_sub(x[ii], erg->xc_center, xj);
-
-        /* Shift this atom such that it is near its reference */
-        shift_single_coord(box, xj, erg->xc_shifts[iigrp]);
-
-        /* Determine the slabs to loop over, i.e. the ones with contributions
-         * larger than min_gaussian */
-        count = get_single_atom_gaussians(xj, erg);
-
-        clear_rvec(sum_n1);
-        clear_rvec(sum_n2);
-
-        /* Loop over the relevant slabs for this atom */
-        for (int ic = 0; ic < count; ic++)
+        try
         {
-            int n = erg->gn_slabind[ic];
+            gmx_flexthreaddata* td = &erg->threadData[gmx_omp_get_thread_num()];
+            clear_flex_thread_data(td, nslabs, bCalcPotFit ? erg->rotg->PotAngle_nstep : 0);
+
+            int      count, iigrp;
+            rvec     xj, yj0;        /* current and reference position                */
+            rvec     xcn, ycn;       /* the current and the reference slab centers    */
+            rvec     yj0_ycn;        /* yj0 - ycn                                     */
+            rvec     xj_xcn;         /* xj - xcn                                      */
+            rvec     qjn, fit_qjn;   /* q_i^n                                         */
+            rvec     sum_n1, sum_n2; /* Two contributions to the rotation force       */
+            rvec     innersumvec;    /* Inner part of sum_n2                          */
+            rvec     s_n;
+            rvec     force_n;                /* Single force from slab n on one atom          */
+            rvec     force_n1, force_n2;     /* First and second part of force_n              */
+            rvec     tmpvec, tmpvec2, tmp_f; /* Helper variables                              */
+            real     beta;                   /* beta_n(xj)                                    */
+            real     bjn, fit_bjn;           /* b_j^n                                         */
+            real     gaussian_xj;            /* Gaussian weight gn(xj)                        */
+            real     betan_xj_sigma2;
+            real     mj, wj; /* Mass-weighting of the positions               */
+
+#pragma omp for schedule(static)
+            for (gmx::index j = 0; j < localRotationGroupIndex.ssize(); j++)
+            {
+                /* Local index of a rotation group atom  */
+                int ii = localRotationGroupIndex[j];
+                /* Position of this atom in the collective array */
+                iigrp = collectiveRotationGroupIndex[j];
+                /* Mass-weighting */
+                mj = erg->mc[iigrp]; /* need the unsorted mass here */
+                wj = N_M * mj;
+
+                /* Current position of this atom: x[ii][XX/YY/ZZ]
+                 * Note that erg->xc_center contains the center of mass in case the flex-t
+                 * potential was chosen. For the flex potential erg->xc_center must be
+                 * zero. */
+                rvec_sub(x[ii], erg->xc_center, xj);
+
+                /* Shift this atom such that it is near its reference */
+                shift_single_coord(box, xj, erg->xc_shifts[iigrp]);
+
+                /* Determine the slabs to loop over, i.e. the ones with contributions
+                 * larger than min_gaussian */
+                count = get_single_atom_gaussians(xj, erg, td);
+
+                clear_rvec(sum_n1);
+                clear_rvec(sum_n2);
+
+                /* Loop over the relevant slabs for this atom */
+                for (int ic = 0; ic < count; ic++)
+                {
+                    int n = td->gn_slabind[ic];
 
-            /* Get the precomputed Gaussian for xj in slab n */
-            gaussian_xj = erg->gn_atom[ic];
+                    /* Get the precomputed Gaussian for xj in slab n */
+                    gaussian_xj = td->gn_atom[ic];
 
-            int slabIndex = n - erg->slab_first; /* slab index */
+                    int slabIndex = n - erg->slab_first; /* slab index */
 
-            /* The (unrotated) reference position of this atom is saved in yj0: */
-            copy_rvec(erg->rotg->x_ref[iigrp], yj0);
+                    /* The (unrotated) reference position of this atom is saved in yj0: */
+                    copy_rvec(erg->rotg->x_ref[iigrp], yj0);
 
-            beta = calc_beta(xj, erg, n);
+                    beta = calc_beta(xj, erg, n);
 
-            /* The current center of this slab is saved in xcn: */
-            copy_rvec(erg->slab_center[slabIndex], xcn);
-            /* ... and the reference center in ycn: */
-            copy_rvec(erg->slab_center_ref[slabIndex + erg->slab_buffer], ycn);
+                    /* The current center of this slab is saved in xcn: */
+                    copy_rvec(erg->slab_center[slabIndex], xcn);
+                    /* ... and the reference center in ycn: */
+                    copy_rvec(erg->slab_center_ref[slabIndex + erg->slab_buffer], ycn);
 
-            rvec_sub(yj0, ycn, yj0_ycn); /* yj0_ycn = yj0 - ycn */
+                    rvec_sub(yj0, ycn, yj0_ycn); /* yj0_ycn = yj0 - ycn */
 
-            /* In rare cases, when an atom position coincides with a reference slab
-             * center (yj0_ycn == 0) we cannot compute the normal vector qjn.
-             * However, since the atom is located directly on the pivot, this
-             * slab's contribution to the force on that atom will be zero
-             * anyway. Therefore, we directly move on to the next slab.       */
-            if (gmx_numzero(norm(yj0_ycn))) /* 0 == norm(yj0 - ycn) */
-            {
-                continue;
-            }
+                    /* In rare cases, when an atom position coincides with a reference slab
+                     * center (yj0_ycn == 0) we cannot compute the normal vector qjn.
+                     * However, since the atom is located directly on the pivot, this
+                     * slab's contribution to the force on that atom will be zero
+                     * anyway. Therefore, we directly move on to the next slab.       */
+                    if (gmx_numzero(norm(yj0_ycn))) /* 0 == norm(yj0 - ycn) */
+                    {
+                        continue;
+                    }
 
-            /* Rotate: */
-            mvmul(erg->rotmat, yj0_ycn, tmpvec2); /* tmpvec2= Omega.(yj0-ycn) */
+                    /* Rotate: */
+                    mvmul(erg->rotmat, yj0_ycn, tmpvec2); /* tmpvec2= Omega.(yj0-ycn) */
 
-            /* Subtract the slab center from xj */
-            rvec_sub(xj, xcn, xj_xcn); /* xj_xcn = xj - xcn         */
+                    /* Subtract the slab center from xj */
+                    rvec_sub(xj, xcn, xj_xcn); /* xj_xcn = xj - xcn         */
 
-            /* Calculate qjn */
-            cprod(erg->vec, tmpvec2, tmpvec); /* tmpvec= v x Omega.(yj0-ycn) */
+                    /* Calculate qjn */
+                    cprod(erg->vec, tmpvec2, tmpvec); /* tmpvec= v x Omega.(yj0-ycn) */
 
-            /*                         *         v x Omega.(yj0-ycn)    */
-            unitv(tmpvec, qjn); /*  qjn = ---------------------   */
-                                /*        |v x Omega.(yj0-ycn)|   */
+                    /*                         *         v x Omega.(yj0-ycn)    */
+                    unitv(tmpvec, qjn); /*  qjn = ---------------------   */
+                                        /*        |v x Omega.(yj0-ycn)|   */
 
-            bjn = iprod(qjn, xj_xcn); /* bjn = qjn * (xj - xcn) */
+                    bjn = iprod(qjn, xj_xcn); /* bjn = qjn * (xj - xcn) */
 
-            /*********************************/
-            /* Add to the rotation potential */
-            /*********************************/
-            V += 0.5 * erg->rotg->k * wj * gaussian_xj * gmx::square(bjn);
+                    /*********************************/
+                    /* Add to the rotation potential */
+                    /*********************************/
+                    td->V += 0.5 * erg->rotg->k * wj * gaussian_xj * gmx::square(bjn);
 
-            /* If requested, also calculate the potential for a set of angles
-             * near the current reference angle */
-            if (bCalcPotFit)
-            {
-                for (int ifit = 0; ifit < erg->rotg->PotAngle_nstep; ifit++)
-                {
-                    /* As above calculate Omega.(yj0-ycn), now for the other angles */
-                    mvmul(erg->PotAngleFit->rotmat[ifit], yj0_ycn, tmpvec2); /* tmpvec2= Omega.(yj0-ycn) */
-                    /* As above calculate qjn */
-                    cprod(erg->vec, tmpvec2, tmpvec); /* tmpvec= v x Omega.(yj0-ycn) */
-                    /*                                                        *             v x Omega.(yj0-ycn) */
-                    unitv(tmpvec, fit_qjn);           /*  fit_qjn = ---------------------   */
-                                                      /*            |v x Omega.(yj0-ycn)|   */
-                    fit_bjn = iprod(fit_qjn, xj_xcn); /* fit_bjn = fit_qjn * (xj - xcn) */
-                    /* Add to the rotation potential for this angle */
-                    erg->PotAngleFit->V[ifit] +=
-                            0.5 * erg->rotg->k * wj * gaussian_xj * gmx::square(fit_bjn);
-                }
-            }
+                    /* If requested, also calculate the potential for a set of angles
+                     * near the current reference angle */
+                    if (bCalcPotFit)
+                    {
+                        for (int ifit = 0; ifit < erg->rotg->PotAngle_nstep; ifit++)
+                        {
+                            /* As above calculate Omega.(yj0-ycn), now for the other angles */
+                            mvmul(erg->PotAngleFit->rotmat[ifit], yj0_ycn, tmpvec2); /* tmpvec2= Omega.(yj0-ycn) */
+                            /* As above calculate qjn */
+                            cprod(erg->vec, tmpvec2, tmpvec); /* tmpvec= v x Omega.(yj0-ycn) */
+                            /*                                                        *             v x Omega.(yj0-ycn) */
+                            unitv(tmpvec, fit_qjn);           /*  fit_qjn = ---------------------   */
+                                                              /*            |v x Omega.(yj0-ycn)|   */
+                            fit_bjn = iprod(fit_qjn, xj_xcn); /* fit_bjn = fit_qjn * (xj - xcn) */
+                            /* Add to the rotation potential for this angle */
+                            td->fitV[ifit] +=
+                                    0.5 * erg->rotg->k * wj * gaussian_xj * gmx::square(fit_bjn);
+                        }
+                    }
 
-            /****************************************************************/
-            /* sum_n1 will typically be the main contribution to the force: */
-            /****************************************************************/
-            betan_xj_sigma2 = beta * OOsigma2; /*  beta_n(xj)/sigma^2  */
+                    /****************************************************************/
+                    /* sum_n1 will typically be the main contribution to the force: */
+                    /****************************************************************/
+                    betan_xj_sigma2 = beta * OOsigma2; /*  beta_n(xj)/sigma^2  */
 
-            /* The next lines calculate
-             *  qjn - (bjn*beta(xj)/(2sigma^2))v  */
-            svmul(bjn * 0.5 * betan_xj_sigma2, erg->vec, tmpvec2);
-            rvec_sub(qjn, tmpvec2, tmpvec);
+                    /* The next lines calculate
+                     *  qjn - (bjn*beta(xj)/(2sigma^2))v  */
+                    svmul(bjn * 0.5 * betan_xj_sigma2, erg->vec, tmpvec2);
+                    rvec_sub(qjn, tmpvec2, tmpvec);
 
-            /* Multiply with gn(xj)*bjn: */
-            svmul(gaussian_xj * bjn, tmpvec, tmpvec2);
+                    /* Multiply with gn(xj)*bjn: */
+                    svmul(gaussian_xj * bjn, tmpvec, tmpvec2);
 
-            /* Sum over n: */
-            rvec_inc(sum_n1, tmpvec2);
+                    /* Sum over n: */
+                    rvec_inc(sum_n1, tmpvec2);
 
-            /* We already have precalculated the Sn term for slab n */
-            copy_rvec(erg->slab_innersumvec[slabIndex], s_n);
-            /*                                                             *          beta_n(xj) */
-            svmul(betan_xj_sigma2 * iprod(s_n, xj_xcn), erg->vec, tmpvec); /* tmpvec = ---------- s_n (xj-xcn) */
-            /*            sigma^2               */
+                    /* We already have precalculated the Sn term for slab n */
+                    copy_rvec(erg->slab_innersumvec[slabIndex], s_n);
+                    /*                                                             *          beta_n(xj) */
+                    svmul(betan_xj_sigma2 * iprod(s_n, xj_xcn), erg->vec, tmpvec); /* tmpvec = ---------- s_n (xj-xcn) */
+                    /*            sigma^2               */
 
-            rvec_sub(s_n, tmpvec, innersumvec);
+                    rvec_sub(s_n, tmpvec, innersumvec);
 
-            /* We can safely divide by slab_weights since we check in get_slab_centers
-             * that it is non-zero. */
-            svmul(gaussian_xj / erg->slab_weights[slabIndex], innersumvec, innersumvec);
+                    /* We can safely divide by slab_weights since we check in get_slab_centers
+                     * that it is non-zero. */
+                    svmul(gaussian_xj / erg->slab_weights[slabIndex], innersumvec, innersumvec);
 
-            rvec_add(sum_n2, innersumvec, sum_n2);
+                    rvec_add(sum_n2, innersumvec, sum_n2);
 
-            /* Calculate the torque: */
-            if (bOutstepRot)
-            {
-                /* The force on atom ii from slab n only: */
-                svmul(-erg->rotg->k * wj, tmpvec2, force_n1);    /* part 1 */
-                svmul(erg->rotg->k * mj, innersumvec, force_n2); /* part 2 */
-                rvec_add(force_n1, force_n2, force_n);
-                erg->slab_torque_v[slabIndex] += torque(erg->vec, force_n, xj, xcn);
-            }
-        } /* END of loop over slabs */
+                    /* Calculate the torque: */
+                    if (bOutstepRot)
+                    {
+                        /* The force on atom ii from slab n only: */
+                        svmul(-erg->rotg->k * wj, tmpvec2, force_n1);    /* part 1 */
+                        svmul(erg->rotg->k * mj, innersumvec, force_n2); /* part 2 */
+                        rvec_add(force_n1, force_n2, force_n);
+                        td->slab_torque_v[slabIndex] += torque(erg->vec, force_n, xj, xcn);
+                    }
+                } /* END of loop over slabs */
 
-        /* Put both contributions together: */
-        svmul(wj, sum_n1, sum_n1);
-        svmul(mj, sum_n2, sum_n2);
-        rvec_sub(sum_n2, sum_n1, tmp_f); /* F = -grad V */
+                /* Put both contributions together: */
+                svmul(wj, sum_n1, sum_n1);
+                svmul(mj, sum_n2, sum_n2);
+                rvec_sub(sum_n2, sum_n1, tmp_f); /* F = -grad V */
 
-        /* Store the additional force so that it can be added to the force
-         * array after the normal forces have been evaluated */
-        for (int m = 0; m < DIM; m++)
-        {
-            erg->f_rot_loc[j][m] = erg->rotg->k * tmp_f[m];
-        }
+                /* Store the additional force so that it can be added to the force
+                 * array after the normal forces have been evaluated */
+                for (int m = 0; m < DIM; m++)
+                {
+                    erg->f_rot_loc[j][m] = erg->rotg->k * tmp_f[m];
+                }
 
-        PRINT_FORCE_J
+                PRINT_FORCE_J
 
-    } /* END of loop over local atoms */
+            } /* END of loop over local atoms */
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
 
-    return V;
+    return reduce_flex_thread_data(erg, nslabs, bCalcPotFit);
 }
 
 static void sort_collective_coordinates(gmx_enfrotgrp* erg,
@@ -3283,8 +3451,6 @@ static void allocate_slabs(gmx_enfrotgrp* erg, FILE* fplog, gmx_bool bVerbose)
     snew(erg->slab_weights, nslabs);
     snew(erg->slab_torque_v, nslabs);
     snew(erg->slab_data, nslabs);
-    snew(erg->gn_atom, nslabs);
-    snew(erg->gn_slabind, nslabs);
     snew(erg->slab_innersumvec, nslabs);
     for (int i = 0; i < nslabs; i++)
     {
@@ -3296,6 +3462,7 @@ static void allocate_slabs(gmx_enfrotgrp* erg, FILE* fplog, gmx_bool bVerbose)
     snew(erg->xc_sortind, erg->rotg->nat);
     snew(erg->firstatom, nslabs);
     snew(erg->lastatom, nslabs);
+    erg->threadData.resize(erg->numThreads);
 }
 
 
@@ -3310,12 +3477,13 @@ static void get_firstlast_slab_ref(gmx_enfrotgrp* erg, real mc[], int ref_firsti
     int first = get_first_slab(erg, erg->rotg->x_ref[ref_firstindex]);
     int last  = get_last_slab(erg, erg->rotg->x_ref[ref_lastindex]);
 
-    while (get_slab_weight(first, erg, erg->rotg->x_ref, mc, &dummy) > WEIGHT_MIN)
+    set_slab_weight_buffers(erg, erg->rotg->x_ref, mc);
+    while (get_slab_weight(first, erg, &dummy) > WEIGHT_MIN)
     {
         first--;
     }
     erg->slab_first_ref = first + 1;
-    while (get_slab_weight(last, erg, erg->rotg->x_ref, mc, &dummy) > WEIGHT_MIN)
+    while (get_slab_weight(last, erg, &dummy) > WEIGHT_MIN)
     {
         last++;
     }
@@ -3688,6 +3856,7 @@ std::unique_ptr<gmx::EnforcedRotation> init_rot(FILE*                       fplo
         erg->atomSet       = std::make_unique<gmx::LocalAtomSet>(
                 atomSets->add({ erg->rotg->ind, erg->rotg->ind + erg->rotg->nat }));
         erg->groupIndex = groupIndex;
+        erg->numThreads = std::max(1, gmx_omp_nthreads_get(emntDefault));
 
         if (nullptr != fplog)
         {
@@ -3840,7 +4009,8 @@ void do_rotation(const t_commrec* cr, gmx_enfrot* er, const matrix box, rvec x[]
             communicate_group_positions(cr, erg->xc, erg->xc_shifts, erg->xc_eshifts, bNS, x,
                                         rotg->nat, erg->atomSet->numAtomsLocal(),
                                         erg->atomSet->localIndex().data(),
-                                        erg->atomSet->collectiveIndex().data(), erg->xc_old, box);
+                                        erg->atomSet->collectiveIndex().data(), erg->xc_old, box,
+                                        &erg->xcCollectionPlan);
         }
         else
         {
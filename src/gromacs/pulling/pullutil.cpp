@@ -53,7 +53,10 @@
 #include "gromacs/mdtypes/mdatom.h"
 #include "gromacs/mdtypes/state.h"
 #include "gromacs/pbcutil/pbc.h"
+#include "gromacs/pbcutil/pbc_simd.h"
 #include "gromacs/pulling/pull.h"
+#include "gromacs/simd/simd.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/fatalerror.h"
 #include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
@@ -383,6 +386,126 @@ static double atan2_0_2pi(double y, double x)
     return a;
 }
 
+/* We use SIMD for the COM sums when we can accumulate in double precision SIMD */
+#if GMX_SIMD_HAVE_REAL && GMX_SIMD_HAVE_DOUBLE \
+        && (GMX_DOUBLE                         \
+            || (GMX_SIMD_HAVE_FLOAT && GMX_SIMD_FLOAT_WIDTH == 2 * GMX_SIMD_DOUBLE_WIDTH))
+#    define PULL_COM_SIMD 1
+#else
+#    define PULL_COM_SIMD 0
+#endif
+
+#if PULL_COM_SIMD
+/* Adds the real SIMD values v to the double SIMD accumulator sum */
+static inline void gmx_simdcall addToDoubleSum(gmx::SimdDouble* sum, gmx::SimdReal v)
+{
+#    if GMX_DOUBLE
+    *sum = *sum + v;
+#    else
+    gmx::SimdDouble v0, v1;
+    gmx::cvtF2DD(v, &v0, &v1);
+    *sum = *sum + (v0 + v1);
+#    endif
+}
+
+/* SIMD version of the sums in sum_com_part for groups with a PBC reference,
+ * processes a multiple of the SIMD width.
+ *
+ * As in the scalar code, the weighted masses and products are computed
+ * in real precision and summed in double precision.
+ */
+template<bool haveWeights, bool haveXp>
+static void sum_com_part_simd(const pull_group_work_t* pgrp,
+                              int                      ind_start,
+                              int                      ind_end,
+                              const rvec*              x,
+                              const rvec*              xp,
+                              const real*              mass,
+                              const t_pbc*             pbc,
+                              const rvec               x_pbc,
+                              double*                  sum_wm,
+                              double*                  sum_wwm,
+                              dvec                     sum_wmx,
+                              dvec                     sum_wmxp)
+{
+    using namespace gmx;
+
+    constexpr int c_width = GMX_SIMD_REAL_WIDTH;
+
+    alignas(GMX_SIMD_ALIGNMENT) real pbcSimd[9 * c_width];
+    set_pbc_simd(pbc, pbcSimd);
+
+    alignas(GMX_SIMD_ALIGNMENT) real wBuffer[c_width];
+    alignas(GMX_SIMD_ALIGNMENT) real wmBuffer[c_width];
+    alignas(GMX_SIMD_ALIGNMENT) real xBuffer[DIM][c_width];
+    alignas(GMX_SIMD_ALIGNMENT) real xpBuffer[DIM][c_width];
+
+    SimdDouble sumWm(0.0);
+    SimdDouble sumWwm(0.0);
+    SimdDouble sumWmx[DIM]  = { SimdDouble(0.0), SimdDouble(0.0), SimdDouble(0.0) };
+    SimdDouble sumWmxp[DIM] = { SimdDouble(0.0), SimdDouble(0.0), SimdDouble(0.0) };
+
+    auto localAtomIndices = pgrp->atomSet.localIndex();
+    for (int i = ind_start; i < ind_end; i += c_width)
+    {
+        for (int k = 0; k < c_width; k++)
+        {
+            const int ii = localAtomIndices[i + k];
+            if (haveWeights)
+            {
+                wBuffer[k]  = pgrp->localWeights[i + k];
+                wmBuffer[k] = wBuffer[k] * mass[ii];
+            }
+            else
+            {
+                wmBuffer[k] = mass[ii];
+            }
+            for (int d = 0; d < DIM; d++)
+            {
+                xBuffer[d][k] = x[ii][d];
+                if (haveXp)
+                {
+                    xpBuffer[d][k] = xp[ii][d];
+                }
+            }
+        }
+
+        const SimdReal wm = load<SimdReal>(wmBuffer);
+        addToDoubleSum(&sumWm, wm);
+        if (haveWeights)
+        {
+            addToDoubleSum(&sumWwm, wm * load<SimdReal>(wBuffer));
+        }
+
+        SimdReal xS[DIM], dx[DIM];
+        for (int d = 0; d < DIM; d++)
+        {
+            xS[d] = load<SimdReal>(xBuffer[d]);
+            dx[d] = xS[d] - SimdReal(x_pbc[d]);
+        }
+        pbc_correct_dx_simd(&dx[XX], &dx[YY], &dx[ZZ], pbcSimd);
+        for (int d = 0; d < DIM; d++)
+        {
+            addToDoubleSum(&sumWmx[d], wm * dx[d]);
+            if (haveXp)
+            {
+                /* With PBC, use the same periodic image as for x */
+                const SimdReal xpS = load<SimdReal>(xpBuffer[d]);
+                addToDoubleSum(&sumWmxp[d], wm * ((dx[d] + xpS) - xS[d]));
+            }
+        }
+    }
+
+    *sum_wm += reduce(sumWm);
+    *sum_wwm += reduce(sumWwm);
+    for (int d = 0; d < DIM; d++)
+    {
+        sum_wmx[d] += reduce(sumWmx[d]);
+        sum_wmxp[d] += reduce(sumWmxp[d]);
+    }
+}
+#endif
+
 static void sum_com_part(const pull_group_work_t* pgrp,
                          int                      ind_start,
                          int                      ind_end,
@@ -398,6 +521,29 @@ static void sum_com_part(const pull_group_work_t* pgrp,
     dvec   sum_wmx  = { 0, 0, 0 };
     dvec   sum_wmxp = { 0, 0, 0 };
 
+#if PULL_COM_SIMD
+    /* Only groups with a single atom have no PBC reference, these are not worth SIMD.
+     * The SIMD PBC correction gives the minimum image only for rectangular boxes.
+     */
+    if (pgrp->epgrppbc != epgrppbcNONE && pbc->pbcType != PbcType::Screw && !TRICLINIC(pbc->box))
+    {
+        const int simdEnd =
+                ind_start + ((ind_end - ind_start) / GMX_SIMD_REAL_WIDTH) * GMX_SIMD_REAL_WIDTH;
+        auto sumSimd = sum_com_part_simd<false, false>;
+        if (!pgrp->localWeights.empty())
+        {
+            sumSimd = xp ? sum_com_part_simd<true, true> : sum_com_part_simd<true, false>;
+        }
+        else
+        {
+            sumSimd = xp ? sum_com_part_simd<false, true> : sum_com_part_simd<false, false>;
+        }
+        sumSimd(pgrp, ind_start, simdEnd, x, xp, mass, pbc, x_pbc, &sum_wm, &sum_wwm, sum_wmx,
+                sum_wmxp);
+        ind_start = simdEnd;
+    }
+#endif
+
     auto localAtomIndices = pgrp->atomSet.localIndex();
     for (int i = ind_start; i < ind_end; i++)
     {
@@ -517,6 +663,112 @@ static void sum_com_part_cosweight(const pull_group_work_t* pgrp,
     sum_com->sum_smp = sum_smp;
 }
 
+/* Returns whether the COM of pull group pgrp is summed single-threaded */
+static bool isSmallNormalGroup(const pull_group_work_t& pgrp)
+{
+    return pgrp.needToCalcCom && pgrp.epgrppbc != epgrppbcCOS
+           && pgrp.atomSet.numAtomsLocal() <= c_pullMaxNumLocalAtomsSingleThreaded;
+}
+
+/* Computes the local COM sums of normal (not cosine-weighted) pull group g
+ * and stores them in the COM buffer. Large groups are summed with
+ * pull->nthreads threads, which use pull->comSums, while small groups
+ * are summed into comSumsTotal only. So different small groups can be
+ * processed concurrently, when each thread passes its own comSumsTotal.
+ */
+static void sum_group_com(pull_t*      pull,
+                          size_t       g,
+                          const real*  masses,
+                          const t_pbc* pbc,
+                          const rvec   x[],
+                          const rvec*  xp,
+                          ComSums*     comSumsTotalPtr)
+{
+    pull_comm_t*       comm = &pull->comm;
+    pull_group_work_t* pgrp = &pull->group[g];
+
+    auto comBuffer = gmx::arrayRefFromArray(comm->comBuffer.data() + g * c_comBufferStride,
+                                            c_comBufferStride);
+
+    rvec x_pbc = { 0, 0, 0 };
+
+    switch (pgrp->epgrppbc)
+    {
+        case epgrppbcREFAT:
+            /* Set the pbc atom */
+            copy_rvec(comm->pbcAtomBuffer[g], x_pbc);
+            break;
+        case epgrppbcPREVSTEPCOM:
+            /* Set the pbc reference to the COM of the group of the last step */
+            copy_dvec_to_rvec(pgrp->x_prev_step, comm->pbcAtomBuffer[g]);
+            copy_dvec_to_rvec(pgrp->x_prev_step, x_pbc);
+    }
+
+    /* The final sums should end up in comSumsTotal */
+    ComSums& comSumsTotal = *comSumsTotalPtr;
+
+    /* If we have a single-atom group the mass is irrelevant, so
+     * we can remove the mass factor to avoid division by zero.
+     * Note that with constraint pulling the mass does matter, but
+     * in that case a check group mass != 0 has been done before.
+     */
+    if (pgrp->params.nat == 1 && pgrp->atomSet.numAtomsLocal() == 1
+        && masses[pgrp->atomSet.localIndex()[0]] == 0)
+    {
+        GMX_ASSERT(xp == nullptr,
+                   "We should not have groups with zero mass with constraints, i.e. "
+                   "xp!=NULL");
+
+        /* Copy the single atom coordinate */
+        for (int d = 0; d < DIM; d++)
+        {
+            comSumsTotal.sum_wmx[d] = x[pgrp->atomSet.localIndex()[0]][d];
+        }
+        /* Set all mass factors to 1 to get the correct COM */
+        comSumsTotal.sum_wm  = 1;
+        comSumsTotal.sum_wwm = 1;
+    }
+    else if (pgrp->atomSet.numAtomsLocal() <= c_pullMaxNumLocalAtomsSingleThreaded)
+    {
+        sum_com_part(pgrp, 0, pgrp->atomSet.numAtomsLocal(), x, xp, masses, pbc, x_pbc,
+                     &comSumsTotal);
+    }
+    else
+    {
+#pragma omp parallel for num_threads(pull->nthreads) schedule(static)
+        for (int t = 0; t < pull->nthreads; t++)
+        {
+            int ind_start = (pgrp->atomSet.numAtomsLocal() * (t + 0)) / pull->nthreads;
+            int ind_end   = (pgrp->atomSet.numAtomsLocal() * (t + 1)) / pull->nthreads;
+            sum_com_part(pgrp, ind_start, ind_end, x, xp, masses, pbc, x_pbc,
+                         &pull->comSums[t]);
+        }
+
+        /* Reduce the thread contributions to sum_com[0] */
+        for (int t = 1; t < pull->nthreads; t++)
+        {
+            comSumsTotal.sum_wm += pull->comSums[t].sum_wm;
+            comSumsTotal.sum_wwm += pull->comSums[t].sum_wwm;
+            dvec_inc(comSumsTotal.sum_wmx, pull->comSums[t].sum_wmx);
+            dvec_inc(comSumsTotal.sum_wmxp, pull->comSums[t].sum_wmxp);
+        }
+    }
+
+    if (pgrp->localWeights.empty())
+    {
+        comSumsTotal.sum_wwm = comSumsTotal.sum_wm;
+    }
+
+    /* Copy local sums to a buffer for global summing */
+    copy_dvec(comSumsTotal.sum_wmx, comBuffer[0]);
+
+    copy_dvec(comSumsTotal.sum_wmxp, comBuffer[1]);
+
+    comBuffer[2][0] = comSumsTotal.sum_wm;
+    comBuffer[2][1] = comSumsTotal.sum_wwm;
+    comBuffer[2][2] = 0;
+}
+
 /* calculates center of mass of selection index from all coordinates x */
 // Compiler segfault with 2019_update_5 and 2020_initial
 #if defined(__INTEL_COMPILER) \
@@ -568,6 +820,36 @@ void pull_calc_coms(const t_commrec* cr, pull_t* pull, const real* masses, t_pbc
         twopi_box = 2.0 * M_PI / pbc->box[pull->cosdim][pull->cosdim];
     }
 
+    /* With many small groups, e.g. with many umbrella restraints, we sum
+     * the small groups concurrently. Each group is summed by one thread,
+     * so the result does not depend on the number of threads.
+     */
+    int numGroupsToSumConcurrently = 0;
+    if (pull->nthreads > 1)
+    {
+        for (const pull_group_work_t& pgrp : pull->group)
+        {
+            numGroupsToSumConcurrently += (isSmallNormalGroup(pgrp) ? 1 : 0);
+        }
+    }
+    if (numGroupsToSumConcurrently > 1)
+    {
+        const int numGroups = pull->group.size();
+#pragma omp parallel for num_threads(pull->nthreads) schedule(dynamic)
+        for (int g = 0; g < numGroups; g++)
+        {
+            try
+            {
+                if (isSmallNormalGroup(pull->group[g]))
+                {
+                    ComSums comSums = {};
+                    sum_group_com(pull, g, masses, pbc, x, xp, &comSums);
+                }
+            }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+        }
+    }
+
     for (size_t g = 0; g < pull->group.size(); g++)
     {
         pull_group_work_t* pgrp = &pull->group[g];
@@ -588,83 +870,10 @@ void pull_calc_coms(const t_commrec* cr, pull_t* pull, const real* masses, t_pbc
         {
             if (pgrp->epgrppbc != epgrppbcCOS)
             {
-                rvec x_pbc = { 0, 0, 0 };
-
-                switch (pgrp->epgrppbc)
+                if (!isSmallNormalGroup(*pgrp) || numGroupsToSumConcurrently <= 1)
                 {
-                    case epgrppbcREFAT:
-                        /* Set the pbc atom */
-                        copy_rvec(comm->pbcAtomBuffer[g], x_pbc);
-                        break;
-                    case epgrppbcPREVSTEPCOM:
-                        /* Set the pbc reference to the COM of the group of the last step */
-                        copy_dvec_to_rvec(pgrp->x_prev_step, comm->pbcAtomBuffer[g]);
-                        copy_dvec_to_rvec(pgrp->x_prev_step, x_pbc);
+                    sum_group_com(pull, g, masses, pbc, x, xp, &pull->comSums[0]);
                 }
-
-                /* The final sums should end up in comSums[0] */
-                ComSums& comSumsTotal = pull->comSums[0];
-
-                /* If we have a single-atom group the mass is irrelevant, so
-                 * we can remove the mass factor to avoid division by zero.
-                 * Note that with constraint pulling the mass does matter, but
-                 * in that case a check group mass != 0 has been done before.
-                 */
-                if (pgrp->params.nat == 1 && pgrp->atomSet.numAtomsLocal() == 1
-                    && masses[pgrp->atomSet.localIndex()[0]] == 0)
-                {
-                    GMX_ASSERT(xp == nullptr,
-                               "We should not have groups with zero mass with constraints, i.e. "
-                               "xp!=NULL");
-
-                    /* Copy the single atom coordinate */
-                    for (int d = 0; d < DIM; d++)
-                    {
-                        comSumsTotal.sum_wmx[d] = x[pgrp->atomSet.localIndex()[0]][d];
-                    }
-                    /* Set all mass factors to 1 to get the correct COM */
-                    comSumsTotal.sum_wm  = 1;
-                    comSumsTotal.sum_wwm = 1;
-                }
-                else if (pgrp->atomSet.numAtomsLocal() <= c_pullMaxNumLocalAtomsSingleThreaded)
-                {
-                    sum_com_part(pgrp, 0, pgrp->atomSet.numAtomsLocal(), x, xp, masses, pbc, x_pbc,
-                                 &comSumsTotal);
-                }
-                else
-                {
-#pragma omp parallel for num_threads(pull->nthreads) schedule(static)
-                    for (int t = 0; t < pull->nthreads; t++)
-                    {
-                        int ind_start = (pgrp->atomSet.numAtomsLocal() * (t + 0)) / pull->nthreads;
-                        int ind_end   = (pgrp->atomSet.numAtomsLocal() * (t + 1)) / pull->nthreads;
-                        sum_com_part(pgrp, ind_start, ind_end, x, xp, masses, pbc, x_pbc,
-                                     &pull->comSums[t]);
-                    }
-
-                    /* Reduce the thread contributions to sum_com[0] */
-                    for (int t = 1; t < pull->nthreads; t++)
-                    {
-                        comSumsTotal.sum_wm += pull->comSums[t].sum_wm;
-                        comSumsTotal.sum_wwm += pull->comSums[t].sum_wwm;
-                        dvec_inc(comSumsTotal.sum_wmx, pull->comSums[t].sum_wmx);
-                        dvec_inc(comSumsTotal.sum_wmxp, pull->comSums[t].sum_wmxp);
-                    }
-                }
-
-                if (pgrp->localWeights.empty())
-                {
-                    comSumsTotal.sum_wwm = comSumsTotal.sum_wm;
-                }
-
-                /* Copy local sums to a buffer for global summing */
-                copy_dvec(comSumsTotal.sum_wmx, comBuffer[0]);
-
-                copy_dvec(comSumsTotal.sum_wmxp, comBuffer[1]);
-
-                comBuffer[2][0] = comSumsTotal.sum_wm;
-                comBuffer[2][1] = comSumsTotal.sum_wwm;
-                comBuffer[2][2] = 0;
             }
             else
             {
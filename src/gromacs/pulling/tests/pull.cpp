@@ -46,12 +46,17 @@
 #include <cmath>
 
 #include <algorithm>
+#include <tuple>
+#include <vector>
 
 #include <gtest/gtest.h>
 
+#include "gromacs/domdec/localatomset.h"
+#include "gromacs/domdec/localatomsetmanager.h"
 #include "gromacs/math/vec.h"
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/pulling/pull_internal.h"
+#include "gromacs/simd/simd.h"
 #include "gromacs/utility/smalloc.h"
 
 #include "testutils/refdata.h"
@@ -192,6 +197,127 @@ TEST_F(PullTest, MaxPullDistanceXySkewedBox)
     test(PbcType::XY, box);
 }
 
+#if GMX_SIMD_HAVE_REAL
+//! The SIMD width used for the COM sums
+constexpr int c_simdWidth = GMX_SIMD_REAL_WIDTH;
+#else
+//! Without SIMD, the width of the sums
+constexpr int c_simdWidth = 1;
+#endif
+
+/*! \brief Parameters for the COM tests
+ *
+ * Whether the group is weighted, whether PBC is used, whether xp is set
+ * and the number of atoms in the group beyond a multiple of the SIMD width.
+ */
+using PullComTestParameters = std::tuple<bool, bool, bool, int>;
+
+//! Test fixture for checking the COM of a pull group with a PBC reference atom
+class PullComTest : public ::testing::TestWithParam<PullComTestParameters>
+{
+};
+
+TEST_P(PullComTest, MatchesReferenceCom)
+{
+    bool haveWeights, usePbc, haveXp;
+    int  numExtraAtoms;
+    std::tie(haveWeights, usePbc, haveXp, numExtraAtoms) = GetParam();
+
+    /* Fill two whole SIMD registers, when SIMD is supported, plus the extra atoms */
+    const int        numAtoms = 2 * c_simdWidth + numExtraAtoms;
+    std::vector<int> globalIndex(numAtoms);
+    for (int i = 0; i < numAtoms; i++)
+    {
+        globalIndex[i] = i;
+    }
+
+    LocalAtomSetManager atomSets;
+    pull_t              pull{};
+    pull.pbcType      = usePbc ? PbcType::Xyz : PbcType::No;
+    pull.bRefAt       = TRUE;
+    pull.cosdim       = -1;
+    pull.bSetPBCatoms = TRUE;
+    pull.nthreads     = 1;
+    pull.comSums.resize(pull.nthreads);
+
+    /* Group 0 is the absolute reference, group 1 the group we test */
+    t_pull_group params = {};
+    pull.group.emplace_back(params, atomSets.add(ArrayRef<const int>()), false);
+    params.nat     = numAtoms;
+    params.ind     = globalIndex.data();
+    params.pbcatom = 0;
+    pull.group.emplace_back(params, atomSets.add(globalIndex), false);
+    pull_group_work_t& pgrp = pull.group[1];
+    ASSERT_EQ(pgrp.epgrppbc, epgrppbcREFAT);
+    pgrp.needToCalcCom = true;
+    if (haveWeights)
+    {
+        for (int i = 0; i < numAtoms; i++)
+        {
+            pgrp.localWeights.push_back(0.5 + 0.1 * (i % 5));
+        }
+    }
+    pull.comm.pbcAtomBuffer.resize(pull.group.size());
+    pull.comm.comBuffer.resize(pull.group.size() * c_comBufferStride);
+
+    /* Spread the atoms over the whole box, such that, with PBC,
+     * many atoms are closer to a periodic image of the reference atom.
+     */
+    const matrix      box = { { 2.5, 0, 0 }, { 0, 3, 0 }, { 0, 0, 3.5 } };
+    std::vector<RVec> x(numAtoms);
+    std::vector<RVec> xp(numAtoms);
+    std::vector<real> mass(numAtoms);
+    for (int i = 0; i < numAtoms; i++)
+    {
+        for (int d = 0; d < DIM; d++)
+        {
+            x[i][d]  = std::fmod(0.1 + 0.37 * (d + 1) * i, box[d][d]);
+            xp[i][d] = x[i][d] + 0.02 * std::sin(i + d);
+        }
+        mass[i] = 1 + 0.5 * (i % 7);
+    }
+
+    t_pbc pbc;
+    set_pbc(&pbc, pull.pbcType, box);
+
+    pull_calc_coms(nullptr, &pull, mass.data(), &pbc, 0, as_rvec_array(x.data()),
+                   haveXp ? as_rvec_array(xp.data()) : nullptr);
+
+    /* Compute the reference COM with the scalar PBC code in double precision */
+    double sumWm = 0;
+    dvec   sumWmx  = { 0, 0, 0 };
+    dvec   sumWmxp = { 0, 0, 0 };
+    for (int i = 0; i < numAtoms; i++)
+    {
+        const double wm = (haveWeights ? pgrp.localWeights[i] : 1) * mass[i];
+        rvec         dx;
+        pbc_dx(&pbc, x[i], x[0], dx);
+        sumWm += wm;
+        for (int d = 0; d < DIM; d++)
+        {
+            sumWmx[d] += wm * dx[d];
+            sumWmxp[d] += wm * (dx[d] + xp[i][d] - x[i][d]);
+        }
+    }
+
+    const auto tolerance = test::relativeToleranceAsFloatingPoint(box[ZZ][ZZ], 1e-6);
+    for (int d = 0; d < DIM; d++)
+    {
+        EXPECT_REAL_EQ_TOL(x[0][d] + sumWmx[d] / sumWm, pgrp.x[d], tolerance);
+        if (haveXp)
+        {
+            EXPECT_REAL_EQ_TOL(x[0][d] + sumWmxp[d] / sumWm, pgrp.xp[d], tolerance);
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(WithGroupSetups,
+                        PullComTest,
+                        ::testing::Combine(::testing::Bool(),
+                                           ::testing::Bool(),
+                                           ::testing::Bool(),
+                                           ::testing::Values(0, 3)));
+
 } // namespace
 
 } // namespace gmx
@@ -0,0 +1,400 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2020, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the threaded flexible enforced rotation potentials.
+ *
+ * \ingroup module_pulling
+ */
+#include "gmxpre.h"
+
+#include "gromacs/pulling/pull_rotation.h"
+
+#include <cmath>
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/commandline/filenm.h"
+#include "gromacs/domdec/localatomsetmanager.h"
+#include "gromacs/fileio/filetypes.h"
+#include "gromacs/fileio/oenv.h"
+#include "gromacs/math/vec.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
+#include "gromacs/mdrunutility/handlerestart.h"
+#include "gromacs/mdtypes/commrec.h"
+#include "gromacs/mdtypes/inputrec.h"
+#include "gromacs/mdtypes/md_enums.h"
+#include "gromacs/mdtypes/mdrunoptions.h"
+#include "gromacs/mdtypes/state.h"
+#include "gromacs/pbcutil/pbc.h"
+#include "gromacs/topology/atoms.h"
+#include "gromacs/topology/mtop_util.h"
+#include "gromacs/topology/topology.h"
+#include "gromacs/utility/arraysize.h"
+#include "gromacs/utility/smalloc.h"
+#include "gromacs/utility/textreader.h"
+
+#include "testutils/testasserts.h"
+#include "testutils/testfilemanager.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+//! Number of atoms in the rotation group, not a multiple of the SIMD width
+const int c_numAtoms = 101;
+//! Number of MD steps to evaluate
+const int c_numSteps = 4;
+//! Time step in ps
+const double c_timeStep = 0.01;
+//! Distance between the slabs in nm
+const real c_slabDistance = 1.0;
+
+//! Returns the position of atom \p i at step \p step, step -1 gives the reference
+RVec atomPosition(int i, int step)
+{
+    const double fraction = double(i) / (c_numAtoms - 1);
+    const double phi      = 0.9 * i;
+    const double radius   = 0.6 + 0.3 * std::sin(1.7 * i);
+    RVec         x(5 + radius * std::cos(phi), 5 + radius * std::sin(phi), 2 + 6 * fraction);
+    if (step >= 0)
+    {
+        x += RVec(0.05 * std::sin(i + step), 0.05 * std::cos(2 * i + step),
+                  0.05 * std::sin(3 * i - step));
+    }
+    return x;
+}
+
+//! Returns the mass of atom \p i
+real atomMass(int i)
+{
+    return 12 + 2 * (i % 3);
+}
+
+//! Returns the normalized rotation vector
+RVec rotationVector()
+{
+    RVec vec(0.1, 0.2, 1);
+    unitv(vec, vec);
+    return vec;
+}
+
+//! Returns the numbers in the data lines of a rotation output file, one row per line
+std::vector<std::vector<double>> readOutputFile(const std::string& fileName)
+{
+    std::vector<std::vector<double>> rows;
+    std::istringstream               stream(TextReader::readFileToString(fileName));
+    std::string                      line;
+    while (std::getline(stream, line))
+    {
+        if (line.empty() || line[0] == '#' || line[0] == '@')
+        {
+            continue;
+        }
+        std::istringstream  lineStream(line);
+        std::vector<double> row;
+        double              value;
+        while (lineStream >> value)
+        {
+            row.push_back(value);
+        }
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+//! The results of a short run with enforced rotation
+struct RotationResults
+{
+    //! The rotation forces on all atoms for each step
+    std::vector<std::vector<RVec>> forces;
+    //! The rotation energy for each step
+    std::vector<real> energies;
+    //! The data in the main rotation output file, including the torque and energy
+    std::vector<std::vector<double>> rotationOutput;
+    //! The data in the per-slab torque output file
+    std::vector<std::vector<double>> torqueOutput;
+    //! The data in the slab center output file
+    std::vector<std::vector<double>> slabCenterOutput;
+};
+
+//! Test fixture for the flexible rotation types, parametrized by the rotation type
+class FlexibleRotationTest : public ::testing::TestWithParam<int>
+{
+public:
+    //! Runs the rotation group for c_numSteps steps using \p numThreads threads
+    RotationResults runRotation(int numThreads)
+    {
+        t_inputrec ir;
+        ir.pbcType = PbcType::Xyz;
+        ir.delta_t = c_timeStep;
+        ir.bRot    = TRUE;
+        snew(ir.rot, 1);
+        ir.rot->ngrp    = 1;
+        ir.rot->nstrout = 1;
+        ir.rot->nstsout = 1;
+        snew(ir.rot->grp, 1);
+        t_rotgrp& rotg = ir.rot->grp[0];
+        rotg.eType     = GetParam();
+        rotg.bMassW    = TRUE;
+        rotg.nat       = c_numAtoms;
+        snew(rotg.ind, c_numAtoms);
+        snew(rotg.x_ref, c_numAtoms);
+        for (int i = 0; i < c_numAtoms; i++)
+        {
+            rotg.ind[i] = i;
+            copy_rvec(atomPosition(i, -1), rotg.x_ref[i]);
+        }
+        copy_rvec(rotationVector(), rotg.inputVec);
+        rotg.rate           = 20;
+        rotg.k              = 200;
+        rotg.eFittype       = erotgFitRMSD;
+        rotg.PotAngle_nstep = 21;
+        rotg.PotAngle_step  = 0.25;
+        rotg.slab_dist      = c_slabDistance;
+        rotg.min_gaussian   = 0.001;
+        rotg.eps            = 1e-4;
+
+        gmx_mtop_t mtop;
+        mtop.moltype.resize(1);
+        init_t_atoms(&mtop.moltype[0].atoms, c_numAtoms, FALSE);
+        for (int i = 0; i < c_numAtoms; i++)
+        {
+            mtop.moltype[0].atoms.atom[i].m = atomMass(i);
+        }
+        mtop.molblock.resize(1);
+        mtop.molblock[0].type = 0;
+        mtop.molblock[0].nmol = 1;
+        mtop.natoms           = c_numAtoms;
+        gmx_mtop_finalize(&mtop);
+
+        t_state state;
+        state.flags = (1 << estX);
+        state_change_natoms(&state, c_numAtoms);
+        clear_mat(state.box);
+        state.box[XX][XX] = 10;
+        state.box[YY][YY] = 10;
+        state.box[ZZ][ZZ] = 10;
+        for (int i = 0; i < c_numAtoms; i++)
+        {
+            state.x[i] = atomPosition(i, -1);
+        }
+
+        const std::string prefix           = "threads" + std::to_string(numThreads);
+        const std::string rotationFileName = fileManager_.getTemporaryFilePath(prefix + "rot.xvg");
+        const std::string anglesFileName = fileManager_.getTemporaryFilePath(prefix + "angles.log");
+        const std::string slabsFileName  = fileManager_.getTemporaryFilePath(prefix + "slabs.log");
+        const std::string torqueFileName = fileManager_.getTemporaryFilePath(prefix + "torque.log");
+        const t_filenm    fnm[] = { { efXVG, "-ro", nullptr, ffWRITE, { rotationFileName } },
+                                 { efLOG, "-ra", nullptr, ffWRITE, { anglesFileName } },
+                                 { efLOG, "-rs", nullptr, ffWRITE, { slabsFileName } },
+                                 { efLOG, "-rt", nullptr, ffWRITE, { torqueFileName } } };
+
+        t_commrec cr = {};
+        cr.nnodes    = 1;
+        cr.duty      = DUTY_PP | DUTY_PME;
+        gmx_output_env_t* oenv;
+        output_env_init_default(&oenv);
+        LocalAtomSetManager atomSets;
+        MdrunOptions        mdrunOptions;
+
+        const int numThreadsBefore = gmx_omp_nthreads_get(emntDefault);
+        gmx_omp_nthreads_set(emntDefault, numThreads);
+
+        RotationResults results;
+        {
+            std::unique_ptr<EnforcedRotation> enforcedRotation =
+                    init_rot(nullptr, &ir, asize(fnm), fnm, &cr, &atomSets, &state, &mtop,
+                             oenv, mdrunOptions, StartingBehavior::NewSimulation);
+            gmx_enfrot* er = enforcedRotation->getLegacyEnfrot();
+            for (int step = 0; step < c_numSteps; step++)
+            {
+                std::vector<RVec> x(c_numAtoms);
+                std::vector<RVec> f(c_numAtoms, { 0, 0, 0 });
+                for (int i = 0; i < c_numAtoms; i++)
+                {
+                    x[i] = atomPosition(i, step);
+                }
+                const real t = step * c_timeStep;
+                do_rotation(&cr, er, state.box, as_rvec_array(x.data()), t, step, TRUE);
+                results.energies.push_back(
+                        add_rot_forces(er, as_rvec_array(f.data()), &cr, step, t));
+                results.forces.push_back(f);
+            }
+        }
+
+        gmx_omp_nthreads_set(emntDefault, numThreadsBefore);
+        output_env_done(oenv);
+
+        results.rotationOutput   = readOutputFile(rotationFileName);
+        results.torqueOutput     = readOutputFile(torqueFileName);
+        results.slabCenterOutput = readOutputFile(slabsFileName);
+
+        return results;
+    }
+
+private:
+    TestFileManager fileManager_;
+};
+
+//! Expects equal rows of numbers that were written with four significant digits
+void compareOutput(const std::vector<std::vector<double>>& reference,
+                   const std::vector<std::vector<double>>& result)
+{
+    ASSERT_EQ(reference.size(), result.size());
+    for (size_t row = 0; row < reference.size(); row++)
+    {
+        ASSERT_EQ(reference[row].size(), result[row].size());
+        for (size_t column = 0; column < reference[row].size(); column++)
+        {
+            const double value = reference[row][column];
+            EXPECT_REAL_EQ_TOL(value, result[row][column],
+                               relativeToleranceAsFloatingPoint(std::fabs(value), 1.1e-3))
+                    << "in row " << row << ", column " << column;
+        }
+    }
+}
+
+TEST_P(FlexibleRotationTest, ThreadedMatchesSerial)
+{
+    const RotationResults serial   = runRotation(1);
+    const RotationResults threaded = runRotation(4);
+
+    ASSERT_EQ(c_numSteps, gmx::ssize(serial.energies));
+    ASSERT_EQ(c_numSteps, gmx::ssize(threaded.energies));
+    for (int step = 0; step < c_numSteps; step++)
+    {
+        EXPECT_NE(0, serial.energies[step]);
+        // The thread contributions to the energy are summed in a different order
+        EXPECT_REAL_EQ_TOL(serial.energies[step], threaded.energies[step],
+                           relativeToleranceAsFloatingPoint(serial.energies[step], 1e-5));
+        for (int i = 0; i < c_numAtoms; i++)
+        {
+            for (int d = 0; d < DIM; d++)
+            {
+                EXPECT_EQ(serial.forces[step][i][d], threaded.forces[step][i][d])
+                        << "at step " << step << ", atom " << i << ", dimension " << d;
+            }
+        }
+    }
+
+    // The torque and energy are only written with four significant digits
+    EXPECT_FALSE(serial.rotationOutput.empty());
+    EXPECT_FALSE(serial.torqueOutput.empty());
+    compareOutput(serial.rotationOutput, threaded.rotationOutput);
+    compareOutput(serial.torqueOutput, threaded.torqueOutput);
+    compareOutput(serial.slabCenterOutput, threaded.slabCenterOutput);
+}
+
+TEST_P(FlexibleRotationTest, SlabCentersUseGaussianWeights)
+{
+    const RotationResults results        = runRotation(4);
+    const bool            subtractCenter = (GetParam() == erotgFLEXT || GetParam() == erotgFLEX2T);
+    const RVec            vec            = rotationVector();
+    const double          sigma          = 0.7 * c_slabDistance;
+
+    // The reference centers at t=-1 come first, followed by one row per output step
+    ASSERT_LT(1, results.slabCenterOutput.size());
+    for (const auto& row : results.slabCenterOutput)
+    {
+        const int step = (row[0] < 0 ? -1 : static_cast<int>(std::round(row[0] / c_timeStep)));
+
+        std::vector<DVec> positions(c_numAtoms);
+        DVec              center = { 0, 0, 0 };
+        double            mass   = 0;
+        for (int i = 0; i < c_numAtoms; i++)
+        {
+            positions[i] = atomPosition(i, step).toDVec();
+            center += double(atomMass(i)) * positions[i];
+            mass += atomMass(i);
+        }
+        // The T types use the positions relative to the center of mass
+        if (subtractCenter)
+        {
+            for (auto& x : positions)
+            {
+                x -= center / mass;
+            }
+        }
+
+        ASSERT_EQ(0U, (row.size() - 2) % 4);
+        for (size_t column = 2; column < row.size(); column += 4)
+        {
+            const int slab        = static_cast<int>(row[column]);
+            DVec      slabCenter  = { 0, 0, 0 };
+            double    weightSum   = 0;
+            double    maxGaussian = 0;
+            for (int i = 0; i < c_numAtoms; i++)
+            {
+                // The scalar Gaussian weight of the atom in this slab
+                const double beta     = positions[i].dot(vec.toDVec()) - c_slabDistance * slab;
+                const double gaussian = std::exp(-0.5 * gmx::square(beta / sigma));
+                slabCenter += atomMass(i) * gaussian * positions[i];
+                weightSum += atomMass(i) * gaussian;
+                maxGaussian = std::max(maxGaussian, gaussian);
+            }
+            // The buffer slabs far from all atoms have weights close to underflow
+            if (maxGaussian < 1e-6)
+            {
+                continue;
+            }
+            for (int d = 0; d < DIM; d++)
+            {
+                const double expected  = slabCenter[d] / weightSum;
+                const double magnitude = std::max(std::fabs(expected), 0.1);
+                EXPECT_REAL_EQ_TOL(expected, row[column + 1 + d],
+                                   relativeToleranceAsFloatingPoint(magnitude, 1.1e-3))
+                        << "for slab " << slab << " at step " << step;
+            }
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(FlexibleTypes,
+                        FlexibleRotationTest,
+                        ::testing::Values(erotgFLEX, erotgFLEXT, erotgFLEX2, erotgFLEX2T));
+
+} // namespace
+} // namespace test
+} // namespace gmx
@@ -1126,12 +1126,15 @@ void _gmx_sel_evaluate_or(gmx_sel_evaluate_t*                     data,
             child->evaluate(data, child, &tmp);
             gmx_ana_index_partition(&tmp, &tmp2, &tmp, child->v.u.g);
         }
+        /* Both the previous result and the new part are sorted, so a
+         * linear merge keeps the result sorted. */
+        int* const begin = sel->v.u.g->index;
+        std::inplace_merge(begin, begin + sel->v.u.g->isize, begin + sel->v.u.g->isize + tmp.isize);
         sel->v.u.g->isize += tmp.isize;
         tmp.isize = tmp2.isize;
         tmp.index = tmp2.index;
         child     = child->next;
     }
-    gmx_ana_index_sort(sel->v.u.g);
 }
 
 
@@ -1139,6 +1142,64 @@ void _gmx_sel_evaluate_or(gmx_sel_evaluate_t*                     data,
  * ARITHMETIC EVALUATION
  ********************************************************************/
 
+namespace
+{
+
+/*! \brief
+ * Applies a binary arithmetic operation over contiguous value arrays.
+ *
+ * \param[in]  n            Number of output values.
+ * \param[in]  left         Left operand values.
+ * \param[in]  bLeftSingle  Whether \p left has a single value.
+ * \param[in]  right        Right operand values.
+ * \param[in]  bRightSingle Whether \p right has a single value.
+ * \param[out] out          Output values (can alias \p left or \p right).
+ * \param[in]  op           Operation to apply.
+ *
+ * Single-valued operands are hoisted out of the loop, such that each case
+ * is a flat loop without branches that the compiler can vectorize.
+ */
+template<typename BinaryOp>
+void evaluateArithmeticValues(int         n,
+                              const real* left,
+                              bool        bLeftSingle,
+                              const real* right,
+                              bool        bRightSingle,
+                              real*       out,
+                              BinaryOp    op)
+{
+    if (bLeftSingle && bRightSingle)
+    {
+        const real val = op(left[0], right[0]);
+        std::fill(out, out + n, val);
+    }
+    else if (bLeftSingle)
+    {
+        const real lval = left[0];
+        for (int i = 0; i < n; ++i)
+        {
+            out[i] = op(lval, right[i]);
+        }
+    }
+    else if (bRightSingle)
+    {
+        const real rval = right[0];
+        for (int i = 0; i < n; ++i)
+        {
+            out[i] = op(left[i], rval);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            out[i] = op(left[i], right[i]);
+        }
+    }
+}
+
+} // namespace
+
 /*!
  * \param[in] data Data for the current frame.
  * \param[in] sel  Selection element being evaluated.
@@ -1149,9 +1210,6 @@ void _gmx_sel_evaluate_arithmetic(gmx_sel_evaluate_t*                     data,
                                   const gmx::SelectionTreeElementPointer& sel,
                                   gmx_ana_index_t*                        g)
 {
-    int  n, i, i1, i2;
-    real lval, rval = 0., val = 0.;
-
     const SelectionTreeElementPointer& left  = sel->child;
     const SelectionTreeElementPointer& right = left->next;
 
@@ -1171,35 +1229,44 @@ void _gmx_sel_evaluate_arithmetic(gmx_sel_evaluate_t*                     data,
     }
     _gmx_sel_evaluate_children(data, sel, g);
 
-    n         = (sel->flags & SEL_SINGLEVAL) ? 1 : g->isize;
-    sel->v.nr = n;
+    const int n = (sel->flags & SEL_SINGLEVAL) ? 1 : g->isize;
+    sel->v.nr   = n;
 
-    bool bArithNeg = (sel->u.arith.type == ARITH_NEG);
-    GMX_ASSERT(right || bArithNeg, "Right operand cannot be null except for negations");
-    for (i = i1 = i2 = 0; i < n; ++i)
+    const bool bLeftSingle = ((left->flags & SEL_SINGLEVAL) != 0);
+    const real* lval        = left->v.u.r;
+    real*       out         = sel->v.u.r;
+    if (sel->u.arith.type == ARITH_NEG)
     {
-        lval = left->v.u.r[i1];
-        if (!bArithNeg)
-        {
-            rval = right->v.u.r[i2];
-        }
-        switch (sel->u.arith.type)
-        {
-            case ARITH_PLUS: val = lval + rval; break;
-            case ARITH_MINUS: val = lval - rval; break;
-            case ARITH_NEG: val = -lval; break;
-            case ARITH_MULT: val = lval * rval; break;
-            case ARITH_DIV: val = lval / rval; break;
-            case ARITH_EXP: val = pow(lval, rval); break;
-        }
-        sel->v.u.r[i] = val;
-        if (!(left->flags & SEL_SINGLEVAL))
-        {
-            ++i1;
-        }
-        if (!bArithNeg && !(right->flags & SEL_SINGLEVAL))
-        {
-            ++i2;
-        }
+        evaluateArithmeticValues(
+                n, lval, bLeftSingle, lval, bLeftSingle, out, [](real l, real /*r*/) { return -l; });
+        return;
+    }
+    GMX_ASSERT(right, "Right operand cannot be null except for negations");
+    const bool  bRightSingle = ((right->flags & SEL_SINGLEVAL) != 0);
+    const real* rval         = right->v.u.r;
+    switch (sel->u.arith.type)
+    {
+        case ARITH_PLUS:
+            evaluateArithmeticValues(
+                    n, lval, bLeftSingle, rval, bRightSingle, out, [](real l, real r) { return l + r; });
+            break;
+        case ARITH_MINUS:
+            evaluateArithmeticValues(
+                    n, lval, bLeftSingle, rval, bRightSingle, out, [](real l, real r) { return l - r; });
+            break;
+        case ARITH_MULT:
+            evaluateArithmeticValues(
+                    n, lval, bLeftSingle, rval, bRightSingle, out, [](real l, real r) { return l * r; });
+            break;
+        case ARITH_DIV:
+            evaluateArithmeticValues(
+                    n, lval, bLeftSingle, rval, bRightSingle, out, [](real l, real r) { return l / r; });
+            break;
+        case ARITH_EXP:
+            evaluateArithmeticValues(n, lval, bLeftSingle, rval, bRightSingle, out, [](real l, real r) {
+                return static_cast<real>(pow(l, r));
+            });
+            break;
+        case ARITH_NEG: break;
     }
 }
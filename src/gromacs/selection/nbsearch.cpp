@@ -56,9 +56,11 @@
 #include "nbsearch.h"
 
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include "gromacs/math/functions.h"
@@ -125,7 +127,16 @@ public:
     typedef std::vector<PairSearchImplPointer>          PairSearchList;
     typedef std::vector<std::vector<int>>               CellList;
 
-    explicit AnalysisNeighborhoodSearchImpl(real cutoff);
+    /*! \brief
+     * Creates a search with the given cutoff.
+     *
+     * \param[in] cutoff      Cutoff distance (<=0 stands for no cutoff).
+     * \param[in] bCache      Whether the grid can be reused through
+     *     tryReuse().
+     * \param[in] bufferSkin  Buffer added to the cutoff when building the
+     *     grid, to allow reusing it for displaced positions.
+     */
+    AnalysisNeighborhoodSearchImpl(real cutoff, bool bCache, real bufferSkin);
     ~AnalysisNeighborhoodSearchImpl();
 
     /*! \brief
@@ -142,7 +153,41 @@ public:
                                const ListOfLists<int>*              excls,
                                const t_pbc*                         pbc,
                                const AnalysisNeighborhoodPositions& positions);
+    /*! \brief
+     * Tries to reuse the grid from the previous init() call.
+     *
+     * \param[in] mode            Search mode to use.
+     * \param[in] bXY             Whether to use 2D searching.
+     * \param[in] excls           Exclusions.
+     * \param[in] pbc             PBC information.
+     * \param[in] positions       Set of reference positions.
+     * \param[in] bShared         Whether the search is in use elsewhere,
+     *     in which case it cannot be modified and the positions must be
+     *     identical to reuse it.
+     * \returns   `true` if the search has been set up for \p positions
+     *     without rebuilding the grid.
+     *
+     * The grid can be reused if all other input is the same as in the
+     * previous init() call, and no reference position has moved more than
+     * half the buffer skin since the grid was built.
+     */
+    bool                  tryReuse(AnalysisNeighborhood::SearchMode     mode,
+                                   bool                                 bXY,
+                                   const ListOfLists<int>*              excls,
+                                   const t_pbc*                         pbc,
+                                   const AnalysisNeighborhoodPositions& positions,
+                                   bool                                 bShared);
     PairSearchImplPointer getPairSearch();
+    /*! \brief
+     * Finds all pairs within the cutoff.
+     *
+     * \param[in]  positions  Test positions, or `nullptr` for a self search.
+     * \param[out] pairs      All pairs within the cutoff.
+     * \param[in]  numThreads Number of OpenMP threads to use.
+     */
+    void findAllPairs(const AnalysisNeighborhoodPositions* positions,
+                      AnalysisNeighborhoodPairList*        pairs,
+                      int                                  numThreads) const;
 
     real cutoffSquared() const { return cutoff2_; }
     bool usesGridSearch() const { return bGrid_; }
@@ -263,6 +308,16 @@ private:
      * \returns    Grid cell index corresponding to `cell`.
      */
     int shiftCell(const ivec cell, rvec shift) const;
+    /*! \brief
+     * Stores the input of init() for later checks in tryReuse().
+     *
+     * \param[in] mode            Search mode to use.
+     * \param[in] pbc             PBC information.
+     * \param[in] positions       Set of reference positions.
+     */
+    void storeCacheKey(AnalysisNeighborhood::SearchMode     mode,
+                       const t_pbc*                         pbc,
+                       const AnalysisNeighborhoodPositions& positions);
 
     //! Whether to try grid searching.
     bool bTryGrid_;
@@ -270,6 +325,14 @@ private:
     real cutoff_;
     //! The cutoff squared.
     real cutoff2_;
+    //! Cutoff used for the grid cell loops (includes the buffer skin).
+    real gridCutoff_;
+    //! The grid cutoff squared.
+    real gridCutoff2_;
+    //! Buffer skin for reusing the grid over displaced positions.
+    real bufferSkin_;
+    //! Whether the grid should be stored for reuse by tryReuse().
+    bool bCache_;
     //! Whether to do searching in XY plane only.
     bool bXY_;
 
@@ -319,6 +382,25 @@ private:
     ivec ncelldim_;
     //! Data structure to hold the grid cell contents.
     CellList cells_;
+    //! Grid cell index for each reference position.
+    std::vector<int> refCellIndex_;
+
+    //! Whether the input stored below is valid for tryReuse().
+    bool bCacheValid_;
+    //! Search mode passed to init().
+    AnalysisNeighborhood::SearchMode cachedMode_;
+    //! PBC type passed to init().
+    PbcType cachedPbcType_;
+    //! Box passed to init().
+    matrix cachedBox_;
+    //! Copy of the reference position indices passed to init().
+    std::vector<int> cachedRefIndices_;
+    //! Copy of the reference position exclusion IDs passed to init().
+    std::vector<int> cachedRefExclusionIds_;
+    //! Reference positions at the time the grid was built.
+    std::vector<RVec> gridPositions_;
+    //! Periodic shift applied to each reference position when gridding.
+    std::vector<RVec> gridShifts_;
 
     Mutex          createPairSearchMutex_;
     PairSearchList pairSearchList_;
@@ -355,6 +437,16 @@ public:
     bool searchNext(Action action);
     //! Initializes a pair representing the pair found by searchNext().
     void initFoundPair(AnalysisNeighborhoodPair* pair) const;
+    /*! \brief
+     * Finds all pairs for a range of test positions.
+     *
+     * \param[in]  testBegin  First test position to search.
+     * \param[in]  testEnd    End of the test position range.
+     * \param[out] pairs      Found pairs are appended here.
+     *
+     * startSearch() or startSelfSearch() must have been called before.
+     */
+    void findAllPairs(int testBegin, int testEnd, AnalysisNeighborhoodPairList* pairs);
     //! Advances to the next test position, skipping any remaining pairs.
     void nextTestPosition();
 
@@ -400,6 +492,10 @@ private:
     ivec cellBound_;
     //! Stores the index within the current cell during pair loops.
     int prevcai_;
+    //! Distance vectors to the positions in a cell in findAllPairs().
+    std::vector<RVec> cellDx_;
+    //! Squared distances to the positions in a cell in findAllPairs().
+    std::vector<real> cellDistances2_;
 
     GMX_DISALLOW_COPY_AND_ASSIGN(AnalysisNeighborhoodPairSearchImpl);
 };
@@ -408,18 +504,23 @@ private:
  * AnalysisNeighborhoodSearchImpl
  */
 
-AnalysisNeighborhoodSearchImpl::AnalysisNeighborhoodSearchImpl(real cutoff)
+AnalysisNeighborhoodSearchImpl::AnalysisNeighborhoodSearchImpl(real cutoff, bool bCache, real bufferSkin)
 {
-    bTryGrid_ = true;
-    cutoff_   = cutoff;
+    bTryGrid_   = true;
+    cutoff_     = cutoff;
+    bCache_     = bCache;
+    bufferSkin_ = bCache ? std::max<real>(bufferSkin, 0.0) : 0.0;
     if (cutoff_ <= 0)
     {
         cutoff_ = cutoff2_ = GMX_REAL_MAX;
-        bTryGrid_          = false;
+        gridCutoff_ = gridCutoff2_ = GMX_REAL_MAX;
+        bTryGrid_                  = false;
     }
     else
     {
-        cutoff2_ = gmx::square(cutoff_);
+        cutoff2_     = gmx::square(cutoff_);
+        gridCutoff_  = cutoff_ + bufferSkin_;
+        gridCutoff2_ = gmx::square(gridCutoff_);
     }
     bXY_             = false;
     nref_            = 0;
@@ -438,6 +539,11 @@ AnalysisNeighborhoodSearchImpl::AnalysisNeighborhoodSearchImpl(real cutoff)
     clear_rvec(cellSize_);
     clear_rvec(invCellSize_);
     clear_ivec(ncelldim_);
+
+    bCacheValid_   = false;
+    cachedMode_    = AnalysisNeighborhood::eSearchMode_Automatic;
+    cachedPbcType_ = PbcType::No;
+    clear_mat(cachedBox_);
 }
 
 AnalysisNeighborhoodSearchImpl::~AnalysisNeighborhoodSearchImpl()
@@ -630,7 +736,7 @@ bool AnalysisNeighborhoodSearchImpl::initGrid(const t_pbc& pbc, int posCount, co
             // TODO: It could be better to avoid this when determining the cell
             // size, but this can still remain here as a fallback to avoid
             // incorrect results.
-            if (std::ceil(2 * cutoff_ * invCellSize_[dd]) >= ncelldim_[dd])
+            if (std::ceil(2 * gridCutoff_ * invCellSize_[dd]) >= ncelldim_[dd])
             {
                 // Cutoff is too close to half the box size for grid searching
                 // (it is not possible to find a single shift for every pair of
@@ -712,6 +818,7 @@ void AnalysisNeighborhoodSearchImpl::addToGridCell(const rvec cell, int i)
 {
     const int ci = getGridCellIndex(cell);
     cells_[ci].push_back(i);
+    refCellIndex_[i] = ci;
 }
 
 void AnalysisNeighborhoodSearchImpl::initCellRange(const rvec centerCell, ivec currCell, ivec upperBound, int dim) const
@@ -778,7 +885,7 @@ real AnalysisNeighborhoodSearchImpl::computeCutoffExtent(const RVec centerCell,
 {
     if (dim == ZZ)
     {
-        return cutoff_;
+        return gridCutoff_;
     }
 
     real dist2 = 0;
@@ -795,11 +902,11 @@ real AnalysisNeighborhoodSearchImpl::computeCutoffExtent(const RVec centerCell,
         }
         dist2 += dimDist * dimDist * cellSize_[d] * cellSize_[d];
     }
-    if (dist2 >= cutoff2_)
+    if (dist2 >= gridCutoff2_)
     {
         return 0;
     }
-    return std::sqrt(cutoff2_ - dist2);
+    return std::sqrt(gridCutoff2_ - dist2);
 }
 
 bool AnalysisNeighborhoodSearchImpl::nextCell(const rvec centerCell, ivec cell, ivec upperBound) const
@@ -910,10 +1017,12 @@ void AnalysisNeighborhoodSearchImpl::init(AnalysisNeighborhood::SearchMode     m
                           mode == AnalysisNeighborhood::eSearchMode_Grid);
     }
     refIndices_ = positions.indices_;
+    bCacheValid_ = false;
     if (bGrid_)
     {
         xrefAlloc_.resize(nref_);
         xref_ = as_rvec_array(xrefAlloc_.data());
+        refCellIndex_.resize(nref_);
 
         for (int i = 0; i < nref_; ++i)
         {
@@ -946,6 +1055,227 @@ void AnalysisNeighborhoodSearchImpl::init(AnalysisNeighborhood::SearchMode     m
                            "Exclusion IDs must be set for reference positions "
                            "when exclusions are enabled");
     }
+    if (bGrid_ && bCache_)
+    {
+        storeCacheKey(mode, pbc, positions);
+    }
+}
+
+void AnalysisNeighborhoodSearchImpl::storeCacheKey(AnalysisNeighborhood::SearchMode     mode,
+                                                   const t_pbc*                         pbc,
+                                                   const AnalysisNeighborhoodPositions& positions)
+{
+    cachedMode_    = mode;
+    cachedPbcType_ = (pbc != nullptr ? pbc->pbcType : PbcType::No);
+    if (pbc != nullptr)
+    {
+        copy_mat(pbc->box, cachedBox_);
+    }
+    else
+    {
+        clear_mat(cachedBox_);
+    }
+    // A cached search can be shared by callers that pass their own arrays,
+    // so it keeps copies of the indices and exclusion IDs and never refers
+    // to the arrays of the caller.
+    if (refIndices_ != nullptr)
+    {
+        cachedRefIndices_.assign(refIndices_, refIndices_ + nref_);
+        refIndices_ = cachedRefIndices_.data();
+    }
+    else
+    {
+        cachedRefIndices_.clear();
+    }
+    if (refExclusionIds_ != nullptr)
+    {
+        // Keep the indexing of the original array, which is also used for
+        // the test positions in self-pair searches.
+        int idCount = 0;
+        for (int i = 0; i < nref_; ++i)
+        {
+            const int ii = (refIndices_ != nullptr) ? refIndices_[i] : i;
+            idCount      = std::max(idCount, ii + 1);
+        }
+        cachedRefExclusionIds_.assign(idCount, -1);
+        for (int i = 0; i < nref_; ++i)
+        {
+            const int ii               = (refIndices_ != nullptr) ? refIndices_[i] : i;
+            cachedRefExclusionIds_[ii] = refExclusionIds_[ii];
+        }
+        refExclusionIds_ = cachedRefExclusionIds_.data();
+    }
+    gridPositions_.resize(nref_);
+    gridShifts_.resize(nref_);
+    for (int i = 0; i < nref_; ++i)
+    {
+        const int ii = (refIndices_ != nullptr) ? refIndices_[i] : i;
+        copy_rvec(positions.x_[ii], gridPositions_[i]);
+        rvec_sub(xrefAlloc_[i], gridPositions_[i], gridShifts_[i]);
+    }
+    bCacheValid_ = true;
+}
+
+bool AnalysisNeighborhoodSearchImpl::tryReuse(AnalysisNeighborhood::SearchMode     mode,
+                                              bool                                 bXY,
+                                              const ListOfLists<int>*              excls,
+                                              const t_pbc*                         pbc,
+                                              const AnalysisNeighborhoodPositions& positions,
+                                              bool                                 bShared)
+{
+    if (!bCacheValid_ || mode != cachedMode_ || bXY != bXY_ || excls != excls_
+        || positions.count_ != nref_ || positions.index_ != -1)
+    {
+        return false;
+    }
+    if (excls != nullptr && positions.exclusionIds_ == nullptr)
+    {
+        return false;
+    }
+    const PbcType pbcType = (pbc != nullptr ? pbc->pbcType : PbcType::No);
+    if (pbcType != cachedPbcType_)
+    {
+        return false;
+    }
+    if (pbc != nullptr)
+    {
+        for (int d = 0; d < DIM; ++d)
+        {
+            for (int e = 0; e < DIM; ++e)
+            {
+                if (pbc->box[d][e] != cachedBox_[d][e])
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    if (positions.indices_ != nullptr)
+    {
+        if (cachedRefIndices_.empty()
+            || !std::equal(cachedRefIndices_.begin(), cachedRefIndices_.end(), positions.indices_))
+        {
+            return false;
+        }
+    }
+    else if (!cachedRefIndices_.empty())
+    {
+        return false;
+    }
+    bool bSameExclusionIds = true;
+    if (excls != nullptr)
+    {
+        for (int i = 0; i < nref_ && bSameExclusionIds; ++i)
+        {
+            const int ii      = (positions.indices_ != nullptr) ? positions.indices_[i] : i;
+            bSameExclusionIds = (positions.exclusionIds_[ii] == refExclusionIds_[ii]);
+        }
+        if (bShared && !bSameExclusionIds)
+        {
+            return false;
+        }
+    }
+    // Check that the grid is still valid for the current positions: with
+    // the grid cell loops extended by the buffer skin, no pair within the
+    // cutoff can be missed as long as each position has moved at most half
+    // the skin from where it was put on the grid.
+    const real maxDisplacement2 = gmx::square(0.5 * bufferSkin_);
+    bool       bIdentical       = true;
+    for (int i = 0; i < nref_; ++i)
+    {
+        const int ii = (positions.indices_ != nullptr) ? positions.indices_[i] : i;
+        rvec      dx;
+        rvec_sub(positions.x_[ii], gridPositions_[i], dx);
+        const real displacement2 = norm2(dx);
+        if (displacement2 > 0)
+        {
+            if (bShared || displacement2 > maxDisplacement2)
+            {
+                return false;
+            }
+            bIdentical = false;
+        }
+    }
+    if (!bIdentical)
+    {
+        for (int i = 0; i < nref_; ++i)
+        {
+            const int ii = (positions.indices_ != nullptr) ? positions.indices_[i] : i;
+            rvec_add(positions.x_[ii], gridShifts_[i], xrefAlloc_[i]);
+        }
+    }
+    if (!bSameExclusionIds)
+    {
+        for (int i = 0; i < nref_; ++i)
+        {
+            const int ii               = (refIndices_ != nullptr) ? refIndices_[i] : i;
+            cachedRefExclusionIds_[ii] = positions.exclusionIds_[ii];
+        }
+    }
+    return true;
+}
+
+void AnalysisNeighborhoodSearchImpl::findAllPairs(const AnalysisNeighborhoodPositions* positions,
+                                                  AnalysisNeighborhoodPairList*        pairs,
+                                                  int                                  numThreads) const
+{
+    int testBegin = 0;
+    int testEnd   = nref_;
+    if (positions != nullptr)
+    {
+        testBegin = std::max(positions->index_, 0);
+        testEnd   = (positions->index_ >= 0 ? positions->index_ + 1 : positions->count_);
+    }
+    pairs->clear();
+    numThreads = std::max(1, std::min(numThreads, testEnd - testBegin));
+    if (numThreads == 1)
+    {
+        AnalysisNeighborhoodPairSearchImpl pairSearch(*this);
+        if (positions != nullptr)
+        {
+            pairSearch.startSearch(*positions);
+        }
+        else
+        {
+            pairSearch.startSelfSearch();
+        }
+        pairSearch.findAllPairs(testBegin, testEnd, pairs);
+        return;
+    }
+    // Use more blocks than threads to balance the load, in particular for
+    // self searches without a grid, where the work per test position is
+    // not uniform.  The blocks are concatenated in order afterwards, which
+    // makes the result independent of the number of threads.
+    const int                                 blockCount = std::min(4 * numThreads, testEnd - testBegin);
+    std::vector<AnalysisNeighborhoodPairList> blockPairs(blockCount);
+#pragma omp parallel num_threads(numThreads)
+    {
+        try
+        {
+            AnalysisNeighborhoodPairSearchImpl pairSearch(*this);
+            if (positions != nullptr)
+            {
+                pairSearch.startSearch(*positions);
+            }
+            else
+            {
+                pairSearch.startSelfSearch();
+            }
+#pragma omp for schedule(dynamic)
+            for (int block = 0; block < blockCount; ++block)
+            {
+                const int count = testEnd - testBegin;
+                const int begin = testBegin + static_cast<int>((static_cast<int64_t>(count) * block) / blockCount);
+                const int end = testBegin + static_cast<int>((static_cast<int64_t>(count) * (block + 1)) / blockCount);
+                pairSearch.findAllPairs(begin, end, &blockPairs[block]);
+            }
+        }
+        GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
+    }
+    for (const auto& blockPairList : blockPairs)
+    {
+        pairs->append(blockPairList);
+    }
 }
 
 /********************************************************************
@@ -972,7 +1302,9 @@ void AnalysisNeighborhoodPairSearchImpl::reset(int testIndex)
             search_.initCellRange(testcell_, currCell_, cellBound_, XX);
             if (selfSearchMode_)
             {
-                testCellIndex_ = search_.getGridCellIndex(testcell_);
+                // Use the cell where the position was put on the grid;
+                // the grid may have been built for earlier positions.
+                testCellIndex_ = search_.refCellIndex_[testIndex_];
             }
         }
         else
@@ -1145,6 +1477,97 @@ bool AnalysisNeighborhoodPairSearchImpl::searchNext(Action action)
     return false;
 }
 
+void AnalysisNeighborhoodPairSearchImpl::findAllPairs(int testBegin, int testEnd, AnalysisNeighborhoodPairList* pairs)
+{
+    const real cutoff2 = search_.cutoff2_;
+    for (int testIndex = testBegin; testIndex < testEnd; ++testIndex)
+    {
+        reset(testIndex);
+        if (search_.bGrid_)
+        {
+            do
+            {
+                rvec      shift;
+                const int ci = search_.shiftCell(currCell_, shift);
+                if (selfSearchMode_ && ci > testCellIndex_)
+                {
+                    continue;
+                }
+                const std::vector<int>& cell     = search_.cells_[ci];
+                const int               cellSize = ssize(cell);
+                if (ssize(cellDx_) < cellSize)
+                {
+                    cellDx_.resize(cellSize);
+                    cellDistances2_.resize(cellSize);
+                }
+                // Compute all the distances first in a loop without
+                // branches, and only then filter them.
+                for (int k = 0; k < cellSize; ++k)
+                {
+                    rvec_sub(search_.xref_[cell[k]], xtest_, cellDx_[k]);
+                    rvec_dec(cellDx_[k], shift);
+                }
+                if (search_.bXY_)
+                {
+                    for (int k = 0; k < cellSize; ++k)
+                    {
+                        cellDistances2_[k] = cellDx_[k][XX] * cellDx_[k][XX] + cellDx_[k][YY] * cellDx_[k][YY];
+                    }
+                }
+                else
+                {
+                    for (int k = 0; k < cellSize; ++k)
+                    {
+                        cellDistances2_[k] = norm2(cellDx_[k]);
+                    }
+                }
+                for (int k = 0; k < cellSize; ++k)
+                {
+                    if (cellDistances2_[k] > cutoff2)
+                    {
+                        continue;
+                    }
+                    const int i = cell[k];
+                    if (selfSearchMode_ && ci == testCellIndex_ && i >= testIndex_)
+                    {
+                        continue;
+                    }
+                    // The exclusion check only relies on the reference
+                    // positions being checked in ascending order, so it is
+                    // fine to skip those outside the cutoff.
+                    if (isExcluded(i))
+                    {
+                        continue;
+                    }
+                    pairs->addPair(i, testIndex_, cellDistances2_[k], cellDx_[k]);
+                }
+                exclind_ = 0;
+            } while (search_.nextCell(testcell_, currCell_, cellBound_));
+        }
+        else
+        {
+            for (int i = previ_ + 1; i < search_.nref_; ++i)
+            {
+                rvec dx;
+                if (search_.pbc_.pbcType != PbcType::No)
+                {
+                    pbc_dx(&search_.pbc_, search_.xref_[i], xtest_, dx);
+                }
+                else
+                {
+                    rvec_sub(search_.xref_[i], xtest_, dx);
+                }
+                const real r2 = search_.bXY_ ? dx[XX] * dx[XX] + dx[YY] * dx[YY] : norm2(dx);
+                if (r2 <= cutoff2 && !isExcluded(i))
+                {
+                    pairs->addPair(i, testIndex_, r2, dx);
+                }
+            }
+        }
+    }
+    reset(testEnd);
+}
+
 void AnalysisNeighborhoodPairSearchImpl::initFoundPair(AnalysisNeighborhoodPair* pair) const
 {
     if (previ_ < 0)
@@ -1242,7 +1665,17 @@ public:
     typedef AnalysisNeighborhoodSearch::ImplPointer SearchImplPointer;
     typedef std::vector<SearchImplPointer>          SearchList;
 
-    Impl() : cutoff_(0), excls_(nullptr), mode_(eSearchMode_Automatic), bXY_(false) {}
+    Impl() :
+        cutoff_(0),
+        excls_(nullptr),
+        mode_(eSearchMode_Automatic),
+        bXY_(false),
+        bCache_(false),
+        bufferSkin_(0),
+        initCount_(0),
+        reuseCount_(0)
+    {
+    }
     ~Impl()
     {
         SearchList::const_iterator i;
@@ -1253,6 +1686,13 @@ public:
     }
 
     SearchImplPointer getSearch();
+    /*! \brief
+     * Returns a search initialized for the given input.
+     *
+     * If caching is enabled, a previous search is returned if its grid
+     * can be reused for the input; otherwise, a new search is initialized.
+     */
+    SearchImplPointer initSearch(const t_pbc* pbc, const AnalysisNeighborhoodPositions& positions);
 
     Mutex                   createSearchMutex_;
     SearchList              searchList_;
@@ -1260,6 +1700,10 @@ public:
     const ListOfLists<int>* excls_;
     SearchMode              mode_;
     bool                    bXY_;
+    bool                    bCache_;
+    real                    bufferSkin_;
+    std::atomic<int>        initCount_;
+    std::atomic<int>        reuseCount_;
 };
 
 AnalysisNeighborhood::Impl::SearchImplPointer AnalysisNeighborhood::Impl::getSearch()
@@ -1275,11 +1719,48 @@ AnalysisNeighborhood::Impl::SearchImplPointer AnalysisNeighborhood::Impl::getSea
             return *i;
         }
     }
-    SearchImplPointer search(new internal::AnalysisNeighborhoodSearchImpl(cutoff_));
+    SearchImplPointer search(new internal::AnalysisNeighborhoodSearchImpl(cutoff_, bCache_, bufferSkin_));
     searchList_.push_back(search);
     return search;
 }
 
+AnalysisNeighborhood::Impl::SearchImplPointer
+AnalysisNeighborhood::Impl::initSearch(const t_pbc* pbc, const AnalysisNeighborhoodPositions& positions)
+{
+    if (!bCache_)
+    {
+        SearchImplPointer search(getSearch());
+        search->init(mode_, bXY_, excls_, pbc, positions);
+        ++initCount_;
+        return search;
+    }
+    // With caching, the whole initialization is done under the lock, such
+    // that a search that is being initialized is never shared.
+    lock_guard<Mutex> lock(createSearchMutex_);
+    for (const auto& search : searchList_)
+    {
+        if (search->tryReuse(mode_, bXY_, excls_, pbc, positions, !search.unique()))
+        {
+            ++reuseCount_;
+            return search;
+        }
+    }
+    for (const auto& search : searchList_)
+    {
+        if (search.unique())
+        {
+            search->init(mode_, bXY_, excls_, pbc, positions);
+            ++initCount_;
+            return search;
+        }
+    }
+    SearchImplPointer search(new internal::AnalysisNeighborhoodSearchImpl(cutoff_, bCache_, bufferSkin_));
+    searchList_.push_back(search);
+    search->init(mode_, bXY_, excls_, pbc, positions);
+    ++initCount_;
+    return search;
+}
+
 /********************************************************************
  * AnalysisNeighborhood
  */
@@ -1312,17 +1793,40 @@ void AnalysisNeighborhood::setMode(SearchMode mode)
     impl_->mode_ = mode;
 }
 
+void AnalysisNeighborhood::setSearchCaching(bool bCache)
+{
+    GMX_RELEASE_ASSERT(impl_->searchList_.empty(),
+                       "Changing the caching after initSearch() not currently supported");
+    impl_->bCache_ = bCache;
+}
+
+void AnalysisNeighborhood::setSearchBuffer(real bufferSkin)
+{
+    GMX_RELEASE_ASSERT(impl_->searchList_.empty(),
+                       "Changing the buffer after initSearch() not currently supported");
+    GMX_RELEASE_ASSERT(bufferSkin >= 0, "Buffer skin cannot be negative");
+    impl_->bufferSkin_ = bufferSkin;
+}
+
 AnalysisNeighborhood::SearchMode AnalysisNeighborhood::mode() const
 {
     return impl_->mode_;
 }
 
+int AnalysisNeighborhood::searchInitCount() const
+{
+    return impl_->initCount_;
+}
+
+int AnalysisNeighborhood::searchReuseCount() const
+{
+    return impl_->reuseCount_;
+}
+
 AnalysisNeighborhoodSearch AnalysisNeighborhood::initSearch(const t_pbc* pbc,
                                                             const AnalysisNeighborhoodPositions& positions)
 {
-    Impl::SearchImplPointer search(impl_->getSearch());
-    search->init(mode(), impl_->bXY_, impl_->excls_, pbc, positions);
-    return AnalysisNeighborhoodSearch(search);
+    return AnalysisNeighborhoodSearch(impl_->initSearch(pbc, positions));
 }
 
 /********************************************************************
@@ -1396,6 +1900,20 @@ AnalysisNeighborhoodSearch::startPairSearch(const AnalysisNeighborhoodPositions&
     return AnalysisNeighborhoodPairSearch(pairSearch);
 }
 
+void AnalysisNeighborhoodSearch::findAllPairs(const AnalysisNeighborhoodPositions& positions,
+                                              AnalysisNeighborhoodPairList*        pairs,
+                                              int                                  numThreads) const
+{
+    GMX_RELEASE_ASSERT(impl_, "Accessing an invalid search object");
+    impl_->findAllPairs(&positions, pairs, numThreads);
+}
+
+void AnalysisNeighborhoodSearch::findAllSelfPairs(AnalysisNeighborhoodPairList* pairs, int numThreads) const
+{
+    GMX_RELEASE_ASSERT(impl_, "Accessing an invalid search object");
+    impl_->findAllPairs(nullptr, pairs, numThreads);
+}
+
 /********************************************************************
  * AnalysisNeighborhoodPairSearch
  */
@@ -74,6 +74,7 @@ class AnalysisNeighborhoodPairSearchImpl;
 
 class AnalysisNeighborhoodSearch;
 class AnalysisNeighborhoodPairSearch;
+class AnalysisNeighborhoodPairList;
 
 /*! \brief
  * Input positions for neighborhood searching.
@@ -299,6 +300,56 @@ public:
     void setMode(SearchMode mode);
     //! Returns the currently active search mode.
     SearchMode mode() const;
+    /*! \brief
+     * Sets the search to reuse search grids between initSearch() calls.
+     *
+     * If enabled, initSearch() returns a search that shares the grid with
+     * an earlier search instead of building a new grid if the input is
+     * the same.  This makes it cheap for several callers (e.g., different
+     * selections or analysis modules) to search against the same reference
+     * positions within a frame.
+     * Together with setSearchBuffer(), the grid can also be reused across
+     * frames.
+     *
+     * Currently, can only be called before the first call to initSearch().
+     *
+     * Does not throw.
+     */
+    void setSearchCaching(bool bCache);
+    /*! \brief
+     * Sets a buffer for reusing search grids over multiple frames.
+     *
+     * \param[in] bufferSkin  Buffer distance (>= 0).
+     *
+     * Only has an effect together with setSearchCaching().  The grid is
+     * built such that all pairs within the cutoff plus \p bufferSkin are
+     * considered, and initSearch() keeps using the same grid (with the
+     * distances computed from the current positions) as long as no
+     * reference position has moved more than half of \p bufferSkin from
+     * where it was when the grid was built, and the box and other input is
+     * the same.  Larger values make grid rebuilds rarer, at the cost of
+     * checking more distances for each test position.
+     *
+     * Currently, can only be called before the first call to initSearch().
+     *
+     * Does not throw.
+     */
+    void setSearchBuffer(real bufferSkin);
+    /*! \brief
+     * Returns the number of initSearch() calls that set up a search from
+     * scratch.
+     *
+     * Mainly useful for testing the caching set with setSearchCaching().
+     *
+     * Does not throw.
+     */
+    int searchInitCount() const;
+    /*! \brief
+     * Returns the number of initSearch() calls that reused an existing grid.
+     *
+     * Does not throw.
+     */
+    int searchReuseCount() const;
 
     /*! \brief
      * Initializes neighborhood search for a set of positions.
@@ -399,6 +450,92 @@ private:
     rvec dx_;
 };
 
+/*! \brief
+ * List of position pairs found in neighborhood searching.
+ *
+ * An instance of this class is filled by
+ * AnalysisNeighborhoodSearch::findAllPairs() and
+ * AnalysisNeighborhoodSearch::findAllSelfPairs().
+ * The data for the pairs is stored in separate flat arrays, such that all
+ * pairs found for a set of test positions can be processed as a batch
+ * instead of going through AnalysisNeighborhoodPairSearch::findNextPair()
+ * for each pair.  The indices have the same meaning as in
+ * AnalysisNeighborhoodPair.
+ *
+ * The same object can be reused for multiple searches to avoid
+ * reallocating memory.
+ *
+ * \inpublicapi
+ * \ingroup module_selection
+ */
+class AnalysisNeighborhoodPairList
+{
+public:
+    //! Returns the number of pairs in the list.
+    int size() const { return ssize(refIndices_); }
+    //! Whether the list is empty.
+    bool empty() const { return refIndices_.empty(); }
+    //! Removes all pairs from the list (keeping the allocated memory).
+    void clear()
+    {
+        refIndices_.clear();
+        testIndices_.clear();
+        distances2_.clear();
+        dx_.clear();
+    }
+
+    //! Returns the reference position indices for all pairs.
+    ArrayRef<const int> refIndices() const { return refIndices_; }
+    //! Returns the test position indices for all pairs.
+    ArrayRef<const int> testIndices() const { return testIndices_; }
+    //! Returns the squared distances for all pairs.
+    ArrayRef<const real> distances2() const { return distances2_; }
+    /*! \brief
+     * Returns the shortest vectors for all pairs.
+     *
+     * The vectors are from the test position to the reference position.
+     */
+    ArrayRef<const RVec> dx() const { return dx_; }
+    //! Returns a single pair from the list.
+    AnalysisNeighborhoodPair pair(int index) const
+    {
+        GMX_ASSERT(index >= 0 && index < size(), "Pair index out of range");
+        return AnalysisNeighborhoodPair(refIndices_[index], testIndices_[index],
+                                        distances2_[index], dx_[index]);
+    }
+
+    /*! \brief
+     * Adds a pair to the list.
+     *
+     * Used to implement the pair searches.
+     */
+    void addPair(int refIndex, int testIndex, real distance2, const rvec dx)
+    {
+        refIndices_.push_back(refIndex);
+        testIndices_.push_back(testIndex);
+        distances2_.push_back(distance2);
+        dx_.emplace_back(dx);
+    }
+    /*! \brief
+     * Adds all pairs from another list to the end of this list.
+     *
+     * Used to implement the pair searches.
+     */
+    void append(const AnalysisNeighborhoodPairList& other)
+    {
+        refIndices_.insert(refIndices_.end(), other.refIndices_.begin(), other.refIndices_.end());
+        testIndices_.insert(testIndices_.end(), other.testIndices_.begin(), other.testIndices_.end());
+        distances2_.insert(distances2_.end(), other.distances2_.begin(), other.distances2_.end());
+        dx_.insert(dx_.end(), other.dx_.begin(), other.dx_.end());
+    }
+
+private:
+    std::vector<int>  refIndices_;
+    std::vector<int>  testIndices_;
+    std::vector<real> distances2_;
+    std::vector<RVec> dx_;
+};
+
 /*! \brief
  * Initialized neighborhood search with a fixed set of reference positions.
  *
@@ -534,6 +671,36 @@ public:
      */
     AnalysisNeighborhoodPairSearch startPairSearch(const AnalysisNeighborhoodPositions& positions) const;
 
+    /*! \brief
+     * Finds all reference positions within the cutoff of test positions.
+     *
+     * \param[in]  positions  Set of test positions to use.
+     * \param[out] pairs      All pairs within the cutoff.
+     * \param[in]  numThreads Number of OpenMP threads to use.
+     * \throws    std::bad_alloc if out of memory.
+     *
+     * Returns the same pairs as looping over startPairSearch() with
+     * AnalysisNeighborhoodPairSearch::findNextPair(), and in the same
+     * order, but stores them all in \p pairs at once.  The test positions
+     * are divided into blocks that are searched in parallel, and the
+     * distances to all positions in a grid cell are computed in a single
+     * loop.  The result does not depend on \p numThreads.
+     */
+    void findAllPairs(const AnalysisNeighborhoodPositions& positions,
+                      AnalysisNeighborhoodPairList*        pairs,
+                      int                                  numThreads = 1) const;
+    /*! \brief
+     * Finds all reference position pairs within the cutoff.
+     *
+     * \param[out] pairs      All pairs within the cutoff.
+     * \param[in]  numThreads Number of OpenMP threads to use.
+     * \throws    std::bad_alloc if out of memory.
+     *
+     * Works as findAllPairs() for the pairs that startSelfPairSearch()
+     * would return.
+     */
+    void findAllSelfPairs(AnalysisNeighborhoodPairList* pairs, int numThreads = 1) const;
+
 private:
     typedef internal::AnalysisNeighborhoodSearchImpl Impl;
 
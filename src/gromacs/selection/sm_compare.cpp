@@ -45,6 +45,10 @@
 
 #include <cmath>
 
+#include <algorithm>
+#include <array>
+#include <type_traits>
+
 #include "gromacs/math/utilities.h"
 #include "gromacs/utility/arraysize.h"
 #include "gromacs/utility/basedefinitions.h"
@@ -498,98 +502,172 @@ static void free_data_compare(void* data)
 }
 
 /*! \brief
- * Implementation for evaluate_compare() for integer values.
+ * Number of values that the comparison kernels process in one block.
  *
- * \param[in]  g     Evaluation index group.
- * \param[out] out   Output data structure (\p out->u.g is used).
- * \param[in]  data  Should point to a \c t_methoddata_compare.
+ * The accept flags for a block are computed in one flat loop over the
+ * contiguous value arrays, after which the accepted indices are compacted.
+ * Keeping the two passes separate keeps the comparison loop free of
+ * data-dependent branches so that the compiler can vectorize it.
+ */
+static const int c_compareBlockSize = 256;
+
+/*! \brief
+ * Evaluates a single comparison for a compile-time comparison operator.
+ *
+ * \tparam    cmpt  Comparison operator.
+ * \param[in] a     Left value.
+ * \param[in] b     Right value.
+ * \returns   true if `a cmpt b` holds.
+ *
+ * For real values, equality is tested within a relative tolerance of
+ * \c GMX_REAL_EPS with gmx_within_tol().
  */
-static void evaluate_compare_int(gmx_ana_index_t* g, gmx_ana_selvalue_t* out, void* data)
+template<e_comparison_t cmpt, typename T>
+static inline bool acceptComparison(T a, T b)
 {
-    t_methoddata_compare* d = static_cast<t_methoddata_compare*>(data);
-    int                   i, i1, i2, ig;
-    int                   a, b;
-    bool                  bAccept;
+    if constexpr (cmpt == CMP_LESS)
+    {
+        return a < b;
+    }
+    else if constexpr (cmpt == CMP_LEQ)
+    {
+        return a <= b;
+    }
+    else if constexpr (cmpt == CMP_GTR)
+    {
+        return a > b;
+    }
+    else if constexpr (cmpt == CMP_GEQ)
+    {
+        return a >= b;
+    }
+    else if constexpr (std::is_integral<T>::value)
+    {
+        return (cmpt == CMP_EQUAL) == (a == b);
+    }
+    else
+    {
+        return (cmpt == CMP_EQUAL) == gmx_within_tol(a, b, GMX_REAL_EPS);
+    }
+}
 
-    for (i = i1 = i2 = ig = 0; i < g->isize; ++i)
+/*! \brief
+ * Comparison kernel for a fixed operator and operand layout.
+ *
+ * \tparam     cmpt          Comparison operator.
+ * \tparam     bLeftSingle   Whether \p left has a single value for all atoms.
+ * \tparam     bRightSingle  Whether \p right has a single value for all atoms.
+ * \tparam     T             Type in which the comparison is made.
+ * \param[in]  g      Evaluation index group.
+ * \param[in]  left   Left values.
+ * \param[in]  right  Right values.
+ * \param[out] out    Output group; can share the index array with \p g.
+ */
+template<e_comparison_t cmpt, bool bLeftSingle, bool bRightSingle, typename T, typename TLeft, typename TRight>
+static void compareAndCompact(const gmx_ana_index_t* g, const TLeft* left, const TRight* right, gmx_ana_index_t* out)
+{
+    std::array<unsigned char, c_compareBlockSize> accept;
+    int                                           ig = 0;
+    for (int start = 0; start < g->isize; start += c_compareBlockSize)
     {
-        a       = d->left.i[i1];
-        b       = d->right.i[i2];
-        bAccept = false;
-        switch (d->cmpt)
+        const int n = std::min(c_compareBlockSize, g->isize - start);
+        for (int i = 0; i < n; ++i)
         {
-            case CMP_INVALID: break;
-            case CMP_LESS: bAccept = a < b; break;
-            case CMP_LEQ: bAccept = a <= b; break;
-            case CMP_GTR: bAccept = a > b; break;
-            case CMP_GEQ: bAccept = a >= b; break;
-            case CMP_EQUAL: bAccept = a == b; break;
-            case CMP_NEQ: bAccept = a != b; break;
+            const T a = static_cast<T>(bLeftSingle ? left[0] : left[start + i]);
+            const T b = static_cast<T>(bRightSingle ? right[0] : right[start + i]);
+            accept[i] = acceptComparison<cmpt, T>(a, b) ? 1 : 0;
         }
-        if (bAccept)
+        /* Branch-free compaction: ig <= start + i always holds, so this
+         * is safe also when out and g share the same index array. */
+        for (int i = 0; i < n; ++i)
         {
-            out->u.g->index[ig++] = g->index[i];
+            out->index[ig] = g->index[start + i];
+            ig += accept[i];
         }
-        if (!(d->left.flags & CMP_SINGLEVAL))
-        {
-            ++i1;
-        }
-        if (!(d->right.flags & CMP_SINGLEVAL))
+    }
+    out->isize = ig;
+}
+
+/*! \brief
+ * Selects the comparison kernel for the operand layout.
+ *
+ * \tparam     cmpt   Comparison operator.
+ * \tparam     T      Type in which the comparison is made.
+ * \param[in]  g      Evaluation index group.
+ * \param[in]  left   Left operand.
+ * \param[in]  lval   Left values (either \p left.i or \p left.r).
+ * \param[in]  right  Right operand.
+ * \param[in]  rval   Right values (either \p right.i or \p right.r).
+ * \param[out] out    Output group.
+ */
+template<e_comparison_t cmpt, typename T, typename TLeft, typename TRight>
+static void compareWithLayout(const gmx_ana_index_t* g,
+                              const t_compare_value& left,
+                              const TLeft*           lval,
+                              const t_compare_value& right,
+                              const TRight*          rval,
+                              gmx_ana_index_t*       out)
+{
+    const bool bLeftSingle  = ((left.flags & CMP_SINGLEVAL) != 0);
+    const bool bRightSingle = ((right.flags & CMP_SINGLEVAL) != 0);
+    if (bLeftSingle && bRightSingle)
+    {
+        /* The result is the same for all atoms. */
+        const bool bAccept =
+                acceptComparison<cmpt, T>(static_cast<T>(lval[0]), static_cast<T>(rval[0]));
+        if (out->index != g->index)
         {
-            ++i2;
+            std::copy(g->index, g->index + g->isize, out->index);
         }
+        out->isize = bAccept ? g->isize : 0;
+    }
+    else if (bLeftSingle)
+    {
+        compareAndCompact<cmpt, true, false, T>(g, lval, rval, out);
+    }
+    else if (bRightSingle)
+    {
+        compareAndCompact<cmpt, false, true, T>(g, lval, rval, out);
+    }
+    else
+    {
+        compareAndCompact<cmpt, false, false, T>(g, lval, rval, out);
     }
-    out->u.g->isize = ig;
 }
 
 /*! \brief
- * Implementation for evaluate_compare() if either value is non-integer.
+ * Dispatches to a comparison kernel specialized for the operator.
  *
+ * \tparam     T     Type in which the comparison is made.
  * \param[in]  g     Evaluation index group.
- * \param[out] out   Output data structure (\p out->u.g is used).
- * \param[in]  data  Should point to a \c t_methoddata_compare.
- *
- * Left value is assumed to be real-valued; right value can be either.
- * This is ensured by the initialization method.
+ * \param[in]  d     Comparison data.
+ * \param[in]  lval  Left values.
+ * \param[in]  rval  Right values.
+ * \param[out] out   Output group.
  */
-static void evaluate_compare_real(gmx_ana_index_t* g, gmx_ana_selvalue_t* out, void* data)
+template<typename T, typename TLeft, typename TRight>
+static void compareValues(const gmx_ana_index_t*      g,
+                          const t_methoddata_compare& d,
+                          const TLeft*                lval,
+                          const TRight*               rval,
+                          gmx_ana_index_t*            out)
 {
-    t_methoddata_compare* d = static_cast<t_methoddata_compare*>(data);
-    int                   i, i1, i2, ig;
-    real                  a, b;
-    bool                  bAccept;
-
-    for (i = i1 = i2 = ig = 0; i < g->isize; ++i)
+    switch (d.cmpt)
     {
-        a       = d->left.r[i1];
-        b       = (d->right.flags & CMP_REALVAL) ? d->right.r[i2] : d->right.i[i2];
-        bAccept = false;
-        switch (d->cmpt)
-        {
-            case CMP_INVALID: break;
-            case CMP_LESS: bAccept = a < b; break;
-            case CMP_LEQ: bAccept = a <= b; break;
-            case CMP_GTR: bAccept = a > b; break;
-            case CMP_GEQ: bAccept = a >= b; break;
-            case CMP_EQUAL: bAccept = gmx_within_tol(a, b, GMX_REAL_EPS); break;
-            case CMP_NEQ: bAccept = !gmx_within_tol(a, b, GMX_REAL_EPS); break;
-        }
-        if (bAccept)
-        {
-            out->u.g->index[ig++] = g->index[i];
-        }
-        if (!(d->left.flags & CMP_SINGLEVAL))
-        {
-            ++i1;
-        }
-        if (!(d->right.flags & CMP_SINGLEVAL))
-        {
-            ++i2;
-        }
+        case CMP_INVALID: out->isize = 0; break;
+        case CMP_LESS: compareWithLayout<CMP_LESS, T>(g, d.left, lval, d.right, rval, out); break;
+        case CMP_LEQ: compareWithLayout<CMP_LEQ, T>(g, d.left, lval, d.right, rval, out); break;
+        case CMP_GTR: compareWithLayout<CMP_GTR, T>(g, d.left, lval, d.right, rval, out); break;
+        case CMP_GEQ: compareWithLayout<CMP_GEQ, T>(g, d.left, lval, d.right, rval, out); break;
+        case CMP_EQUAL: compareWithLayout<CMP_EQUAL, T>(g, d.left, lval, d.right, rval, out); break;
+        case CMP_NEQ: compareWithLayout<CMP_NEQ, T>(g, d.left, lval, d.right, rval, out); break;
     }
-    out->u.g->isize = ig;
 }
 
+/*!
+ * If either value is real, the left value is real-valued and the right
+ * value can be either.  This is ensured by the initialization method.
+ */
 static void evaluate_compare(const gmx::SelMethodEvalContext& /*context*/,
                              gmx_ana_index_t*    g,
                              gmx_ana_selvalue_t* out,
@@ -599,10 +677,14 @@ static void evaluate_compare(const gmx::SelMethodEvalContext& /*context*/,
 
     if (!((d->left.flags | d->right.flags) & CMP_REALVAL))
     {
-        evaluate_compare_int(g, out, data);
+        compareValues<int>(g, *d, d->left.i, d->right.i, out->u.g);
+    }
+    else if (d->right.flags & CMP_REALVAL)
+    {
+        compareValues<real>(g, *d, d->left.r, d->right.r, out->u.g);
     }
     else
     {
-        evaluate_compare_real(g, out, data);
+        compareValues<real>(g, *d, d->left.r, d->right.i, out->u.g);
     }
 }
@@ -244,6 +244,8 @@ static void init_common(const gmx_mtop_t* /* top */, int /* npar */, gmx_ana_sel
         GMX_THROW(gmx::InvalidInputError("Distance cutoff should be > 0"));
     }
     d->nb.setCutoff(d->cutoff);
+    // Reuse the grid across frames if the reference positions are static.
+    d->nb.setSearchCaching(true);
 }
 
 /*!
@@ -154,6 +154,7 @@ public:
     void                    generateRandomRefPositions(int count);
     void                    generateRandomTestPositions(int count);
     void                    useRefPositionsAsTestPositions();
+    void                    displaceRefPositions(real maxDisplacement);
     void                    computeReferences(t_pbc* pbc) { computeReferencesInternal(pbc, false); }
     void computeReferencesXY(t_pbc* pbc) { computeReferencesInternal(pbc, true); }
 
@@ -261,6 +262,18 @@ void NeighborhoodSearchTestData::useRefPositionsAsTestPositions()
     }
 }
 
+void NeighborhoodSearchTestData::displaceRefPositions(real maxDisplacement)
+{
+    gmx::UniformRealDistribution<real> dist;
+    for (auto& refPos : refPos_)
+    {
+        for (int d = 0; d < DIM; ++d)
+        {
+            refPos[d] += maxDisplacement * (2 * dist(rng_) - 1);
+        }
+    }
+}
+
 void NeighborhoodSearchTestData::computeReferencesInternal(t_pbc* pbc, bool bXY)
 {
     real cutoff = cutoff_;
@@ -407,6 +420,10 @@ public:
                                    const gmx::ArrayRef<const int>&           refIndices,
                                    const gmx::ArrayRef<const int>&           testIndices,
                                    bool                                      selfPairs);
+    static void testAllPairs(gmx::AnalysisNeighborhoodSearch*          search,
+                             const NeighborhoodSearchTestData&         data,
+                             const gmx::AnalysisNeighborhoodPositions& pos,
+                             bool                                      selfPairs);
 
     gmx::AnalysisNeighborhood nb_;
 };
@@ -646,6 +663,48 @@ void NeighborhoodSearchTest::testPairSearchFull(gmx::AnalysisNeighborhoodSearch*
  * Test data generation
  */
 
+/*! \brief
+ * Checks that the bulk pair search returns the same pairs as the iterator.
+ *
+ * The iterator is checked against the reference data in the other tests, so
+ * it is sufficient to check that the pairs are the same and in the same
+ * order, independent of the number of threads.
+ */
+void NeighborhoodSearchTest::testAllPairs(gmx::AnalysisNeighborhoodSearch*          search,
+                                          const NeighborhoodSearchTestData&         data,
+                                          const gmx::AnalysisNeighborhoodPositions& pos,
+                                          bool                                      selfPairs)
+{
+    for (int numThreads : { 1, 3 })
+    {
+        SCOPED_TRACE(gmx::formatString("Using %d threads", numThreads));
+        gmx::AnalysisNeighborhoodPairList pairs;
+        gmx::AnalysisNeighborhoodPairSearch pairSearch =
+                selfPairs ? search->startSelfPairSearch() : search->startPairSearch(pos);
+        if (selfPairs)
+        {
+            search->findAllSelfPairs(&pairs, numThreads);
+        }
+        else
+        {
+            search->findAllPairs(pos, &pairs, numThreads);
+        }
+        gmx::AnalysisNeighborhoodPair pair;
+        int                           index = 0;
+        while (pairSearch.findNextPair(&pair))
+        {
+            ASSERT_LT(index, pairs.size());
+            EXPECT_EQ(pair.refIndex(), pairs.refIndices()[index]);
+            EXPECT_EQ(pair.testIndex(), pairs.testIndices()[index]);
+            EXPECT_REAL_EQ_TOL(pair.distance2(), pairs.distances2()[index], data.relativeTolerance());
+            EXPECT_REAL_EQ_TOL(pair.dx()[XX], pairs.dx()[index][XX], data.relativeTolerance());
+            ++index;
+        }
+        EXPECT_EQ(index, pairs.size());
+        EXPECT_FALSE(pairs.empty());
+    }
+}
+
 class TrivialTestData
 {
 public:
@@ -873,6 +932,53 @@ private:
     NeighborhoodSearchTestData data_;
 };
 
+/*! \brief
+ * Same positions as RandomBoxFullPBCData and RandomBoxSelfPairsData, with
+ * the reference positions displaced by a random amount.
+ */
+class RandomBoxDisplacedData
+{
+public:
+    static const NeighborhoodSearchTestData& getSmallDisplacement()
+    {
+        static RandomBoxDisplacedData singleton(0.05, false);
+        return singleton.data_;
+    }
+    static const NeighborhoodSearchTestData& getLargeDisplacement()
+    {
+        static RandomBoxDisplacedData singleton(0.5, false);
+        return singleton.data_;
+    }
+    static const NeighborhoodSearchTestData& getSmallDisplacementSelfPairs()
+    {
+        static RandomBoxDisplacedData singleton(0.05, true);
+        return singleton.data_;
+    }
+
+    RandomBoxDisplacedData(real maxDisplacement, bool bSelfPairs) : data_(12345, 1.0)
+    {
+        data_.box_[XX][XX] = 10.0;
+        data_.box_[YY][YY] = 5.0;
+        data_.box_[ZZ][ZZ] = 7.0;
+        data_.generateRandomRefPositions(1000);
+        if (bSelfPairs)
+        {
+            data_.displaceRefPositions(maxDisplacement);
+            data_.useRefPositionsAsTestPositions();
+        }
+        else
+        {
+            data_.generateRandomTestPositions(100);
+            data_.displaceRefPositions(maxDisplacement);
+        }
+        set_pbc(&data_.pbc_, PbcType::Xyz, data_.box_);
+        data_.computeReferences(&data_.pbc_);
+    }
+
+private:
+    NeighborhoodSearchTestData data_;
+};
+
 /********************************************************************
  * Actual tests
  */
@@ -1133,4 +1239,184 @@ TEST_F(NeighborhoodSearchTest, GridSearchExclusions)
                        helper.exclusions(), {}, {}, false);
 }
 
+TEST_F(NeighborhoodSearchTest, CachedGridSearch)
+{
+    const NeighborhoodSearchTestData& data = RandomBoxFullPBCData::get();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    nb_.setSearchCaching(true);
+    gmx::AnalysisNeighborhoodSearch search1 = nb_.initSearch(&data.pbc_, data.refPositions());
+    gmx::AnalysisNeighborhoodSearch search2 = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search1.mode());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search2.mode());
+    EXPECT_EQ(1, nb_.searchInitCount());
+    EXPECT_EQ(1, nb_.searchReuseCount());
+
+    testPairSearch(&search1, data);
+    testPairSearch(&search2, data);
+    testNearestPoint(&search2, data);
+
+    search1.reset();
+    search2.reset();
+    testPairSearchIndexed(&nb_, data, 456);
+    testPairSearchIndexed(&nb_, data, 789);
+}
+
+TEST_F(NeighborhoodSearchTest, BufferedGridSearchHandlesDisplacements)
+{
+    const NeighborhoodSearchTestData& data      = RandomBoxFullPBCData::get();
+    const NeighborhoodSearchTestData& smallData = RandomBoxDisplacedData::getSmallDisplacement();
+    const NeighborhoodSearchTestData& largeData = RandomBoxDisplacedData::getLargeDisplacement();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    nb_.setSearchCaching(true);
+    nb_.setSearchBuffer(0.2);
+    gmx::AnalysisNeighborhoodSearch search = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+    testPairSearch(&search, data);
+
+    search.reset();
+    search = nb_.initSearch(&smallData.pbc_, smallData.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+    EXPECT_EQ(1, nb_.searchInitCount());
+    EXPECT_EQ(1, nb_.searchReuseCount());
+    testIsWithin(&search, smallData);
+    testMinimumDistance(&search, smallData);
+    testPairSearch(&search, smallData);
+
+    search.reset();
+    search = nb_.initSearch(&largeData.pbc_, largeData.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+    EXPECT_EQ(2, nb_.searchInitCount());
+    EXPECT_EQ(1, nb_.searchReuseCount());
+    testPairSearch(&search, largeData);
+
+    search.reset();
+    search = nb_.initSearch(&data.pbc_, data.refPositions());
+    testPairSearch(&search, data);
+}
+
+TEST_F(NeighborhoodSearchTest, BufferedGridSelfPairsSearchHandlesDisplacements)
+{
+    const NeighborhoodSearchTestData& data = RandomBoxSelfPairsData::get();
+    const NeighborhoodSearchTestData& smallData =
+            RandomBoxDisplacedData::getSmallDisplacementSelfPairs();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    nb_.setSearchCaching(true);
+    nb_.setSearchBuffer(0.2);
+    gmx::AnalysisNeighborhoodSearch search = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+    testPairSearchFull(&search, data, data.testPositions(), nullptr, {}, {}, true);
+
+    search.reset();
+    search = nb_.initSearch(&smallData.pbc_, smallData.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+    EXPECT_EQ(1, nb_.searchReuseCount());
+    testPairSearchFull(&search, smallData, smallData.testPositions(), nullptr, {}, {}, true);
+}
+
+TEST_F(NeighborhoodSearchTest, CachedGridSearchExclusions)
+{
+    const NeighborhoodSearchTestData& data = RandomBoxFullPBCData::get();
+
+    ExclusionsHelper helper(data.refPosCount_, data.testPositions_.size());
+    helper.generateExclusions();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setTopologyExclusions(helper.exclusions());
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    nb_.setSearchCaching(true);
+    gmx::AnalysisNeighborhoodSearch search1 =
+            nb_.initSearch(&data.pbc_, data.refPositions().exclusionIds(helper.refPosIds()));
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search1.mode());
+    // The second caller shares the grid, but passes its own array of
+    // exclusion IDs, which it overwrites while the search is in use.
+    std::vector<int> refPosIds(helper.refPosIds().begin(), helper.refPosIds().end());
+    gmx::AnalysisNeighborhoodSearch search2 =
+            nb_.initSearch(&data.pbc_, data.refPositions().exclusionIds(refPosIds));
+    EXPECT_EQ(1, nb_.searchInitCount());
+    EXPECT_EQ(1, nb_.searchReuseCount());
+    std::fill(refPosIds.begin(), refPosIds.end(), -1);
+
+    testPairSearchFull(&search1, data, data.testPositions().exclusionIds(helper.testPosIds()),
+                       helper.exclusions(), {}, {}, false);
+    testPairSearchFull(&search2, data, data.testPositions().exclusionIds(helper.testPosIds()),
+                       helper.exclusions(), {}, {}, false);
+}
+
+TEST_F(NeighborhoodSearchTest, SimpleBulkPairSearch)
+{
+    const NeighborhoodSearchTestData& data = RandomBoxFullPBCData::get();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Simple);
+    gmx::AnalysisNeighborhoodSearch search = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Simple, search.mode());
+
+    testAllPairs(&search, data, data.testPositions(), false);
+}
+
+TEST_F(NeighborhoodSearchTest, GridBulkPairSearch)
+{
+    const NeighborhoodSearchTestData& data = RandomBoxFullPBCData::get();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    gmx::AnalysisNeighborhoodSearch search = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+
+    testAllPairs(&search, data, data.testPositions(), false);
+    testAllPairs(&search, data, data.testPosition(2), false);
+}
+
+TEST_F(NeighborhoodSearchTest, GridBulkPairSearchTriclinic)
+{
+    const NeighborhoodSearchTestData& data = RandomTriclinicFullPBCData::get();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    gmx::AnalysisNeighborhoodSearch search = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+
+    testAllPairs(&search, data, data.testPositions(), false);
+}
+
+TEST_F(NeighborhoodSearchTest, BulkSelfPairsSearch)
+{
+    const NeighborhoodSearchTestData& data = RandomBoxSelfPairsData::get();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    gmx::AnalysisNeighborhoodSearch search = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+    testAllPairs(&search, data, data.testPositions(), true);
+
+    search.reset();
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Simple);
+    search = nb_.initSearch(&data.pbc_, data.refPositions());
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Simple, search.mode());
+    testAllPairs(&search, data, data.testPositions(), true);
+}
+
+TEST_F(NeighborhoodSearchTest, GridBulkPairSearchExclusions)
+{
+    const NeighborhoodSearchTestData& data = RandomBoxFullPBCData::get();
+
+    ExclusionsHelper helper(data.refPosCount_, data.testPositions_.size());
+    helper.generateExclusions();
+
+    nb_.setCutoff(data.cutoff_);
+    nb_.setTopologyExclusions(helper.exclusions());
+    nb_.setMode(gmx::AnalysisNeighborhood::eSearchMode_Grid);
+    gmx::AnalysisNeighborhoodSearch search =
+            nb_.initSearch(&data.pbc_, data.refPositions().exclusionIds(helper.refPosIds()));
+    ASSERT_EQ(gmx::AnalysisNeighborhood::eSearchMode_Grid, search.mode());
+
+    testAllPairs(&search, data, data.testPositions().exclusionIds(helper.testPosIds()), false);
+}
+
 } // namespace
@@ -44,6 +44,7 @@
 
 #include "swapcoords.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
@@ -60,6 +61,7 @@
 #include "gromacs/fileio/xvgr.h"
 #include "gromacs/gmxlib/network.h"
 #include "gromacs/math/vec.h"
+#include "gromacs/mdlib/gmx_omp_nthreads.h"
 #include "gromacs/mdlib/groupcoord.h"
 #include "gromacs/mdrunutility/handlerestart.h"
 #include "gromacs/mdtypes/commrec.h"
@@ -138,6 +140,15 @@ std::unique_ptr<IMDModule> createSwapCoordinatesModule()
 
 } // namespace gmx
 
+/*! \internal \brief
+ * A molecule in a compartment that can be selected for a position exchange.
+ */
+struct SwapCandidate
+{
+    real dist; /**< Distance of the molecule to the bulk layer              */
+    int  ind;  /**< Index of its first atom in the collective array         */
+};
+
 /*! \internal \brief
  * Structure containing compartment-specific data.
  */
@@ -150,10 +161,11 @@ typedef struct swap_compartment
     real nMolAv;     /**< Time-averaged number of molecules matching
                           the compartment conditions.                   */
     int*  nMolPast;  /**< Past molecule counts for time-averaging.      */
-    int*  ind;       /**< Indices to collective array of atoms.         */
-    real* dist;      /**< Distance of atom to bulk layer, which is
-                          normally the center layer of the compartment  */
-    int nalloc;      /**< Allocation size for ind array.                */
+    std::vector<SwapCandidate> candidates; /**< Molecules in this compartment with their
+                                                distance to the bulk layer, which is
+                                                normally the center layer of the
+                                                compartment. Kept as a min-heap on the
+                                                distance while swapping.           */
     int inflow_net;  /**< Net inflow of ions into this compartment.     */
 } t_compartment;
 
@@ -176,6 +188,7 @@ typedef struct swap_group
     ivec* xc_shifts      = nullptr; /**< Current (collective) shifts (size nat)                */
     ivec* xc_eshifts     = nullptr; /**< Extra shifts since last DD step (size nat)            */
     rvec* xc_old         = nullptr; /**< Old (collective) positions (size nat)                 */
+    GroupCollectionPlan xcCollectionPlan; /**< Setup for gathering xc with DD                 */
     real  q              = 0.;      /**< Total charge of one molecule of this group            */
     real* m              = nullptr; /**< Masses (can be omitted, size apm)                     */
     unsigned char* comp_from = nullptr; /**< (Collective) Stores from which compartment this
@@ -185,6 +198,9 @@ typedef struct swap_group
     unsigned char* comp_now = nullptr; /**< In which compartment this ion is now (size nMol)      */
     unsigned char* channel_label = nullptr; /**< Which channel was passed at last by this ion?
                                                (size nMol) */
+    std::vector<real> molDistance[eCompNR]; /**< Distance of each molecule to the bulk layer
+                                               of a compartment, negative if the molecule
+                                               is not in it (size nMol)                  */
     rvec          center;        /**< Center of the group; COM if masses are used           */
     t_compartment comp[eCompNR]; /**< Distribution of particles of this group across
                                        the two compartments                                 */
@@ -470,16 +486,7 @@ static void update_time_window(t_compartment* comp, int values, int replace)
  */
 static void add_to_list(int ci, t_compartment* comp, real distance)
 {
-    int nr = comp->nMol;
-
-    if (nr >= comp->nalloc)
-    {
-        comp->nalloc = over_alloc_dd(nr + 1);
-        srenew(comp->ind, comp->nalloc);
-        srenew(comp->dist, comp->nalloc);
-    }
-    comp->ind[nr]  = ci;
-    comp->dist[nr] = distance;
+    comp->candidates.push_back({ distance, ci });
     comp->nMol++;
 }
 
@@ -681,7 +688,13 @@ static void detect_flux_per_channel(t_swapgrp*     g,
 }
 
 
-/*! \brief Determines which ions or solvent molecules are in compartment A and B */
+/*! \brief Determines which ions or solvent molecules are in compartment A and B
+ *
+ * The compartment tests only depend on the position of the first atom of each
+ * molecule, so they are done in one threaded pass over all molecules that
+ * stores the distance to the bulk layer of each compartment. The compartment
+ * lists and the flux detection are then filled from these in molecule order.
+ */
 static void sortMoleculesIntoCompartments(t_swapgrp*    g,
                                           t_commrec*    cr,
                                           t_swapcoords* sc,
@@ -699,27 +712,49 @@ static void sortMoleculesIntoCompartments(t_swapgrp*    g,
     /* Get us a counter that cycles in the range of [0 ... sc->nAverage[ */
     int replace = (step / sc->nstswap) % sc->nAverage;
 
+    const int numMolecules = static_cast<int>(g->atomset.numAtomsGlobal()) / g->apm;
+    const int sd           = s->swapdim;
+    real      left[eCompNR], right[eCompNR];
     for (int comp = eCompA; comp <= eCompB; comp++)
     {
-        real left, right;
+        get_compartment_boundaries(comp, s, box, &left[comp], &right[comp]);
+        g->molDistance[comp].resize(numMolecules);
+    }
 
-        /* Get lists of atoms that match criteria for this compartment */
-        get_compartment_boundaries(comp, s, box, &left, &right);
+    /* Test all molecules against both compartments */
+    const int numThreads = std::max(1, gmx_omp_nthreads_get(emntDefault));
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int iMol = 0; iMol < numMolecules; iMol++)
+    {
+        const real x = g->xc[iMol * g->apm][sd];
+        for (int comp = eCompA; comp <= eCompB; comp++)
+        {
+            real dist;
+            if (compartment_contains_atom(left[comp], right[comp], x, box[sd][sd],
+                                          sc->bulkOffset[comp], &dist))
+            {
+                g->molDistance[comp][iMol] = dist;
+            }
+            else
+            {
+                g->molDistance[comp][iMol] = -1;
+            }
+        }
+    }
 
-        /* First clear the ion molecule lists */
-        g->comp[comp].nMol  = 0;
+    for (int comp = eCompA; comp <= eCompB; comp++)
+    {
+        /* First clear the ion molecule lists, keeping their allocation */
+        g->comp[comp].nMol = 0;
+        g->comp[comp].candidates.clear();
         nMolNotInComp[comp] = 0; /* consistency check */
 
-        /* Loop over the molecules and atoms of this group */
-        for (int iMol = 0, iAtom = 0; iAtom < static_cast<int>(g->atomset.numAtomsGlobal());
-             iAtom += g->apm, iMol++)
+        for (int iMol = 0; iMol < numMolecules; iMol++)
         {
-            real dist;
-            int  sd = s->swapdim;
+            const real dist  = g->molDistance[comp][iMol];
+            const int  iAtom = iMol * g->apm;
 
-            /* Is this first atom of the molecule in the compartment that we look at? */
-            if (compartment_contains_atom(left, right, g->xc[iAtom][sd], box[sd][sd],
-                                          sc->bulkOffset[comp], &dist))
+            if (dist >= 0)
             {
                 /* Add the first atom of this molecule to the list of molecules in this compartment */
                 add_to_list(iAtom, &g->comp[comp], dist);
@@ -771,7 +806,6 @@ static void sortMoleculesIntoCompartments(t_swapgrp*    g,
     }
 
     /* Consistency checks */
-    const auto numMolecules = static_cast<int>(g->atomset.numAtomsGlobal() / g->apm);
     if (nMolNotInComp[eCompA] + nMolNotInComp[eCompB] != numMolecules)
     {
         fprintf(stderr,
@@ -1837,6 +1871,22 @@ static gmx_bool need_swap(t_swapcoords* sc, t_swap* s)
 }
 
 
+/*! \brief Orders candidates by their distance to the bulk layer, then by index. */
+static bool isFartherFromBulkLayer(const SwapCandidate& a, const SwapCandidate& b)
+{
+    return (a.dist > b.dist) || (a.dist == b.dist && a.ind > b.ind);
+}
+
+
+/*! \brief Arranges the molecules of a compartment such that the ones nearest
+ * to the bulk layer can be taken off one by one while swapping.
+ */
+static void prepare_swap_candidates(t_compartment* comp)
+{
+    std::make_heap(comp->candidates.begin(), comp->candidates.end(), isFartherFromBulkLayer);
+}
+
+
 /*! \brief Return the index of an atom or molecule suitable for swapping.
  *
  * Returns the index of an atom that is far off the compartment boundaries,
@@ -1850,24 +1900,12 @@ static gmx_bool need_swap(t_swapcoords* sc, t_swap* s)
  */
 static int get_index_of_distant_atom(t_compartment* comp, const char molname[])
 {
-    int  ibest = -1;
-    real d     = GMX_REAL_MAX;
-
-
-    /* comp->nat contains the original number of atoms in this compartment
-     * prior to doing any swaps. Some of these atoms may already have been
-     * swapped out, but then they are marked with a distance of GMX_REAL_MAX
+    /* The candidates form a min-heap on the distance to the bulk layer (see
+     * prepare_swap_candidates()). Molecules that were already swapped in this
+     * time step have been taken off the heap, such that they won't get
+     * selected again.
      */
-    for (int iMol = 0; iMol < comp->nMolBefore; iMol++)
-    {
-        if (comp->dist[iMol] < d)
-        {
-            ibest = iMol;
-            d     = comp->dist[ibest];
-        }
-    }
-
-    if (ibest < 0)
+    if (comp->candidates.empty())
     {
         gmx_fatal(FARGS,
                   "Could not get index of %s atom. Compartment contains %d %s molecules before "
@@ -1875,12 +1913,11 @@ static int get_index_of_distant_atom(t_compartment* comp, const char molname[])
                   molname, comp->nMolBefore, molname);
     }
 
-    /* Set the distance of this index to infinity such that it won't get selected again in
-     * this time step
-     */
-    comp->dist[ibest] = GMX_REAL_MAX;
+    std::pop_heap(comp->candidates.begin(), comp->candidates.end(), isFartherFromBulkLayer);
+    const int ibest = comp->candidates.back().ind;
+    comp->candidates.pop_back();
 
-    return comp->ind[ibest];
+    return ibest;
 }
 
 
@@ -1960,7 +1997,8 @@ gmx_bool do_swapcoords(t_commrec*     cr,
         communicate_group_positions(cr, g->xc, g->xc_shifts, g->xc_eshifts, TRUE, x,
                                     g->atomset.numAtomsGlobal(), g->atomset.numAtomsLocal(),
                                     g->atomset.localIndex().data(),
-                                    g->atomset.collectiveIndex().data(), g->xc_old, box);
+                                    g->atomset.collectiveIndex().data(), g->xc_old, box,
+                                    &g->xcCollectionPlan);
 
         get_center(g->xc, g->m, g->atomset.numAtomsGlobal(), g->center); /* center of split groups == channels */
     }
@@ -1973,7 +2011,8 @@ gmx_bool do_swapcoords(t_commrec*     cr,
         g = &(s->group[ig]);
         communicate_group_positions(cr, g->xc, nullptr, nullptr, FALSE, x, g->atomset.numAtomsGlobal(),
                                     g->atomset.numAtomsLocal(), g->atomset.localIndex().data(),
-                                    g->atomset.collectiveIndex().data(), nullptr, nullptr);
+                                    g->atomset.collectiveIndex().data(), nullptr, nullptr,
+                                    &g->xcCollectionPlan);
 
         /* Determine how many ions of this type each compartment contains */
         sortMoleculesIntoCompartments(g, cr, sc, s, box, step, s->fpout, bRerun, FALSE);
@@ -2001,7 +2040,8 @@ gmx_bool do_swapcoords(t_commrec*     cr,
         g = &(s->group[eGrpSolvent]);
         communicate_group_positions(cr, g->xc, nullptr, nullptr, FALSE, x, g->atomset.numAtomsGlobal(),
                                     g->atomset.numAtomsLocal(), g->atomset.localIndex().data(),
-                                    g->atomset.collectiveIndex().data(), nullptr, nullptr);
+                                    g->atomset.collectiveIndex().data(), nullptr, nullptr,
+                                    &g->xcCollectionPlan);
 
         /* Determine how many molecules of solvent each compartment contains */
         sortMoleculesIntoCompartments(g, cr, sc, s, box, step, s->fpout, bRerun, TRUE);
@@ -2009,6 +2049,8 @@ gmx_bool do_swapcoords(t_commrec*     cr,
         /* Save number of solvent molecules per compartment prior to any swaps */
         g->comp[eCompA].nMolBefore = g->comp[eCompA].nMol;
         g->comp[eCompB].nMolBefore = g->comp[eCompB].nMol;
+        prepare_swap_candidates(&g->comp[eCompA]);
+        prepare_swap_candidates(&g->comp[eCompB]);
 
         for (ig = eSwapFixedGrpNR; ig < s->ngrp; ig++)
         {
@@ -2021,6 +2063,7 @@ gmx_bool do_swapcoords(t_commrec*     cr,
 
                 /* Save number of ions per compartment prior to swaps */
                 g->comp[ic].nMolBefore = g->comp[ic].nMol;
+                prepare_swap_candidates(&g->comp[ic]);
             }
         }
 
@@ -0,0 +1,337 @@
+/*
+ * This file is part of the GROMACS molecular simulation package.
+ *
+ * Copyright (c) 2020, by the GROMACS development team, led by
+ * Mark Abraham, David van der Spoel, Berk Hess, and Erik Lindahl,
+ * and including many others, as listed in the AUTHORS file in the
+ * top-level source directory and at http://www.gromacs.org.
+ *
+ * GROMACS is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ *
+ * GROMACS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with GROMACS; if not, see
+ * http://www.gnu.org/licenses, or write to the Free Software Foundation,
+ * Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ * If you want to redistribute modifications to GROMACS, please
+ * consider that scientific software is very special. Version
+ * control is crucial - bugs must be traceable. We will be happy to
+ * consider code for inclusion in the official distribution, but
+ * derived work must not be called official GROMACS. Details are found
+ * in the README & COPYING files - if they are missing, get the
+ * official version at http://www.gromacs.org.
+ *
+ * To help us fund GROMACS development, we humbly ask that you cite
+ * the research papers on the package. Check out http://www.gromacs.org.
+ */
+/*! \internal \file
+ * \brief
+ * Tests for the tracing of the cycle counters.
+ *
+ * \ingroup module_timing
+ */
+#include "gmxpre.h"
+
+#include "gromacs/timing/wallcycle.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "gromacs/mdtypes/commrec.h"
+#include "gromacs/utility/textreader.h"
+
+#include "testutils/setenv.h"
+#include "testutils/testfilemanager.h"
+
+namespace gmx
+{
+namespace test
+{
+namespace
+{
+
+//! The number of events kept per rank, as documented for GMX_CYCLE_TRACE
+const int c_numEventsKept = 262144;
+
+/*! \brief Checks that a string is a single valid JSON value
+ *
+ * This only validates the syntax, it does not build the values.
+ */
+class JsonValidator
+{
+public:
+    //! Validates \p text
+    explicit JsonValidator(const std::string& text) : text_(text), pos_(0)
+    {
+        isValid_ = parseValue();
+        skipWhitespace();
+        isValid_ = isValid_ && pos_ == text_.size();
+    }
+    //! Returns whether the whole text is a valid JSON value
+    bool isValid() const { return isValid_; }
+
+private:
+    void skipWhitespace()
+    {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_])))
+        {
+            pos_++;
+        }
+    }
+    bool consume(char c)
+    {
+        skipWhitespace();
+        if (pos_ < text_.size() && text_[pos_] == c)
+        {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+    bool parseString()
+    {
+        if (!consume('"'))
+        {
+            return false;
+        }
+        while (pos_ < text_.size() && text_[pos_] != '"')
+        {
+            if (static_cast<unsigned char>(text_[pos_]) < 0x20)
+            {
+                return false;
+            }
+            pos_ += (text_[pos_] == '\\' ? 2 : 1);
+        }
+        return consume('"');
+    }
+    bool parseNumber()
+    {
+        const char* begin = text_.c_str() + pos_;
+        char*       end   = nullptr;
+        std::strtod(begin, &end);
+        pos_ += end - begin;
+        return end != begin;
+    }
+    bool parseLiteral(const std::string& literal)
+    {
+        if (text_.compare(pos_, literal.size(), literal) != 0)
+        {
+            return false;
+        }
+        pos_ += literal.size();
+        return true;
+    }
+    bool parseObject()
+    {
+        if (consume('}'))
+        {
+            return true;
+        }
+        do
+        {
+            if (!parseString() || !consume(':') || !parseValue())
+            {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}');
+    }
+    bool parseArray()
+    {
+        if (consume(']'))
+        {
+            return true;
+        }
+        do
+        {
+            if (!parseValue())
+            {
+                return false;
+            }
+        } while (consume(','));
+        return consume(']');
+    }
+    bool parseValue()
+    {
+        skipWhitespace();
+        if (pos_ >= text_.size())
+        {
+            return false;
+        }
+        switch (text_[pos_])
+        {
+            case '{': pos_++; return parseObject();
+            case '[': pos_++; return parseArray();
+            case '"': return parseString();
+            case 't': return parseLiteral("true");
+            case 'f': return parseLiteral("false");
+            case 'n': return parseLiteral("null");
+            default: return parseNumber();
+        }
+    }
+
+    const std::string& text_;
+    size_t             pos_;
+    bool               isValid_;
+};
+
+//! Returns the values of all fields named \p key in \p text that hold an integer
+std::vector<int64_t> extractIntegerFields(const std::string& text, const std::string& key)
+{
+    const std::string    pattern = "\"" + key + "\":";
+    std::vector<int64_t> values;
+    for (size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos))
+    {
+        pos += pattern.size();
+        values.push_back(std::strtoll(text.c_str() + pos, nullptr, 10));
+    }
+    return values;
+}
+
+//! Returns the number of occurrences of \p pattern in \p text
+int countOccurrences(const std::string& text, const std::string& pattern)
+{
+    int count = 0;
+    for (size_t pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos))
+    {
+        pos += pattern.size();
+        count++;
+    }
+    return count;
+}
+
+/*! \brief Test fixture that runs the cycle counters with tracing enabled
+ *
+ * The trace of rank 0 is written to a temporary file that is returned by
+ * finishTrace().
+ */
+class WallcycleTraceTest : public ::testing::Test
+{
+public:
+    WallcycleTraceTest()
+    {
+        cr_.nnodes     = 1;
+        cr_.nodeid     = 0;
+        traceFileName_ = fileManager_.getTemporaryFilePath("0.json");
+        const std::string prefix =
+                traceFileName_.substr(0, traceFileName_.size() - std::string("0.json").size());
+        gmxSetenv("GMX_CYCLE_TRACE", prefix.c_str(), 1);
+    }
+    ~WallcycleTraceTest() override
+    {
+        gmxUnsetenv("GMX_CYCLE_TRACE");
+        gmxUnsetenv("GMX_CYCLE_TRACE_STEPS");
+    }
+
+    //! Sets up the cycle counters, reading the trace settings from the environment
+    gmx_wallcycle_t startTrace() { return wallcycle_init(nullptr, 0, &cr_); }
+
+    //! Writes the trace of \p wcycle and returns the contents of the file
+    std::string finishTrace(gmx_wallcycle_t wcycle)
+    {
+        wallcycle_destroy(wcycle);
+        return TextReader::readFileToString(traceFileName_);
+    }
+
+private:
+    TestFileManager fileManager_;
+    t_commrec       cr_ = {};
+    std::string     traceFileName_;
+};
+
+TEST_F(WallcycleTraceTest, WritesOnlyTheSelectedSteps)
+{
+    gmxSetenv("GMX_CYCLE_TRACE_STEPS", "1:2", 1);
+    gmx_wallcycle_t wcycle = startTrace();
+    if (wcycle == nullptr)
+    {
+        // Without a cycle counter there is nothing to trace
+        return;
+    }
+    wallcycle_start(wcycle, ewcRUN);
+    for (int step = 0; step < 5; step++)
+    {
+        wallcycle_start(wcycle, ewcSTEP);
+        wallcycle_start(wcycle, ewcFORCE);
+        wallcycle_stop(wcycle, ewcFORCE);
+        wallcycle_stop(wcycle, ewcSTEP);
+    }
+    wallcycle_stop(wcycle, ewcRUN);
+    const std::string trace = finishTrace(wcycle);
+
+    EXPECT_TRUE(JsonValidator(trace).isValid()) << trace;
+    EXPECT_EQ(4, countOccurrences(trace, "\"ph\":\"X\""));
+    EXPECT_EQ(2, countOccurrences(trace, "\"name\":\"Force\""));
+    EXPECT_EQ(2, countOccurrences(trace, "\"name\":\"Step\""));
+    EXPECT_EQ(0, countOccurrences(trace, "\"name\":\"Run\""));
+    const std::vector<int64_t> expectedSteps = { 1, 1, 2, 2 };
+    EXPECT_EQ(expectedSteps, extractIntegerFields(trace, "step"));
+}
+
+TEST_F(WallcycleTraceTest, CountsPmeMeshStepsOnRanksWithoutSteps)
+{
+    gmxSetenv("GMX_CYCLE_TRACE_STEPS", "2:2", 1);
+    gmx_wallcycle_t wcycle = startTrace();
+    if (wcycle == nullptr)
+    {
+        return;
+    }
+    for (int step = 0; step < 4; step++)
+    {
+        wallcycle_start(wcycle, ewcPMEMESH);
+        wallcycle_stop(wcycle, ewcPMEMESH);
+    }
+    const std::string trace = finishTrace(wcycle);
+
+    EXPECT_TRUE(JsonValidator(trace).isValid()) << trace;
+    EXPECT_EQ(1, countOccurrences(trace, "\"name\":\"PME mesh\""));
+    const std::vector<int64_t> expectedSteps = { 2 };
+    EXPECT_EQ(expectedSteps, extractIntegerFields(trace, "step"));
+}
+
+TEST_F(WallcycleTraceTest, KeepsTheLastEventsWhenTheBufferWraps)
+{
+    gmx_wallcycle_t wcycle = startTrace();
+    if (wcycle == nullptr)
+    {
+        return;
+    }
+    // Two events per step, so the oldest events are overwritten
+    const int numSteps = c_numEventsKept / 2 + 1000;
+    for (int step = 0; step < numSteps; step++)
+    {
+        wallcycle_start(wcycle, ewcSTEP);
+        wallcycle_start(wcycle, ewcFORCE);
+        wallcycle_stop(wcycle, ewcFORCE);
+        wallcycle_stop(wcycle, ewcSTEP);
+    }
+    const std::string trace = finishTrace(wcycle);
+
+    EXPECT_TRUE(JsonValidator(trace).isValid());
+    const std::vector<int64_t> steps = extractIntegerFields(trace, "step");
+    ASSERT_EQ(c_numEventsKept, static_cast<int>(steps.size()));
+    EXPECT_EQ(numSteps - c_numEventsKept / 2, steps.front());
+    EXPECT_EQ(numSteps - 1, steps.back());
+    for (size_t i = 1; i < steps.size(); i++)
+    {
+        ASSERT_LE(steps[i - 1], steps[i]) << "Events should be written from old to new";
+    }
+}
+
+} // namespace
+} // namespace test
+} // namespace gmx
@@ -41,9 +41,13 @@
 
 #include "config.h"
 
+#include <cinttypes>
 #include <cstdlib>
 
 #include <array>
+#include <chrono>
+#include <limits>
+#include <string>
 #include <vector>
 
 #include "gromacs/math/functions.h"
@@ -52,11 +56,14 @@
 #include "gromacs/timing/gpu_timing.h"
 #include "gromacs/timing/wallcyclereporting.h"
 #include "gromacs/utility/cstringutil.h"
+#include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/futil.h"
 #include "gromacs/utility/gmxassert.h"
 #include "gromacs/utility/gmxmpi.h"
 #include "gromacs/utility/logger.h"
 #include "gromacs/utility/smalloc.h"
 #include "gromacs/utility/snprintf.h"
+#include "gromacs/utility/stringutil.h"
 
 static const bool useCycleSubcounters = GMX_CYCLE_SUBCOUNTERS;
 
@@ -66,10 +73,6 @@ static const bool useCycleSubcounters = GMX_CYCLE_SUBCOUNTERS;
  */
 /* #define DEBUG_WCYCLE */
 
-#ifdef DEBUG_WCYCLE
-#    include "gromacs/utility/fatalerror.h"
-#endif
-
 typedef struct
 {
     int          n;
@@ -77,6 +80,58 @@ typedef struct
     gmx_cycles_t start;
 } wallcc_t;
 
+/*! \brief The maximum number of events stored per rank for tracing
+ *
+ * When more events are recorded, the oldest ones are overwritten.
+ */
+static const int c_traceBufferSize = 1 << 18;
+
+//! A completed counter interval recorded for tracing
+struct WallcycleTraceEvent
+{
+    //! Start time in nanoseconds
+    int64_t startNs;
+    //! Duration in nanoseconds
+    int64_t durationNs;
+    //! The step counted from the start of the run
+    int64_t step;
+    //! The counter index, sub-counters are stored with offset ewcNR
+    int counter;
+};
+
+/*! \brief Per-rank tracing state, only allocated when tracing is requested
+ *
+ * The wallcycle routines are only called by the master thread of each
+ * rank, so the ring buffer has a single producer and needs no locking.
+ */
+struct WallcycleTrace
+{
+    //! The name of the JSON file to write at the end of the run
+    std::string fileName;
+    //! The rank, used as process id in the trace
+    int rank = 0;
+    //! The first step to trace
+    int64_t firstStep = std::numeric_limits<int64_t>::min();
+    //! The last step to trace
+    int64_t lastStep = std::numeric_limits<int64_t>::max();
+    /*! \brief The current step, incremented at each start of ewcSTEP
+     *
+     * Ranks that do not run ewcSTEP, such as PME-only ranks, count
+     * the starts of ewcPMEMESH instead.
+     */
+    int64_t step = -1;
+    //! Whether ewcSTEP has been started on this rank
+    bool haveStepCounter = false;
+    //! Whether the current step is within the traced range
+    bool isActive = false;
+    //! Start times for each counter and sub-counter, -1 when not traced
+    std::array<int64_t, ewcNR + ewcsNR> startNs;
+    //! Ring buffer of events
+    std::vector<WallcycleTraceEvent> events;
+    //! The total number of recorded events
+    int64_t numRecorded = 0;
+};
+
 struct gmx_wallcycle
 {
     wallcc_t* wcc;
@@ -97,7 +152,8 @@ struct gmx_wallcycle
 #if GMX_MPI
     MPI_Comm mpi_comm_mygroup;
 #endif
-    wallcc_t* wcsc;
+    wallcc_t*       wcsc;
+    WallcycleTrace* trace;
 };
 
 /* Each name should not exceed 19 printing characters
@@ -184,6 +240,104 @@ static const char* PMEStageNames[] = {
     "PME solve",  "PME 3D-FFT c2r", "PME gather",
 };
 
+//! Returns the time in nanoseconds, comparable between ranks on the same node
+static int64_t traceTimeNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+//! Sets up tracing when requested through the environment
+static WallcycleTrace* initTrace(FILE* fplog, const t_commrec* cr)
+{
+    const char* prefix = getenv("GMX_CYCLE_TRACE");
+    if (prefix == nullptr)
+    {
+        return nullptr;
+    }
+
+    WallcycleTrace* trace = new WallcycleTrace;
+    trace->rank           = (cr != nullptr ? cr->nodeid : 0);
+    trace->fileName       = gmx::formatString("%s%d.json", prefix, trace->rank);
+    const char* steps     = getenv("GMX_CYCLE_TRACE_STEPS");
+    if (steps != nullptr
+        && sscanf(steps, "%" SCNd64 ":%" SCNd64, &trace->firstStep, &trace->lastStep) != 2)
+    {
+        gmx_fatal(FARGS, "GMX_CYCLE_TRACE_STEPS should be formatted as first:last, not '%s'",
+                  steps);
+    }
+    trace->isActive = (trace->step >= trace->firstStep && trace->step <= trace->lastStep);
+    trace->startNs.fill(-1);
+    trace->events.resize(c_traceBufferSize);
+
+    if (fplog)
+    {
+        fprintf(fplog, "\nWill write a trace of the cycle counters to %s\n\n",
+                trace->fileName.c_str());
+    }
+
+    return trace;
+}
+
+//! Records the start of counter \p counter when the current step is traced
+static void traceStart(WallcycleTrace* trace, int counter)
+{
+    if (counter == ewcSTEP)
+    {
+        trace->haveStepCounter = true;
+    }
+    if (counter == ewcSTEP || (counter == ewcPMEMESH && !trace->haveStepCounter))
+    {
+        trace->step++;
+        trace->isActive = (trace->step >= trace->firstStep && trace->step <= trace->lastStep);
+    }
+    trace->startNs[counter] = (trace->isActive ? traceTimeNs() : -1);
+}
+
+//! Stores an event in the ring buffer when the interval for \p counter was started while traced
+static void traceStop(WallcycleTrace* trace, int counter)
+{
+    if (trace->startNs[counter] < 0)
+    {
+        return;
+    }
+    WallcycleTraceEvent& event = trace->events[trace->numRecorded % c_traceBufferSize];
+    event.startNs              = trace->startNs[counter];
+    event.durationNs           = traceTimeNs() - trace->startNs[counter];
+    event.step                 = trace->step;
+    event.counter              = counter;
+    trace->numRecorded++;
+    trace->startNs[counter] = -1;
+}
+
+//! Writes the recorded events in the Chrome trace event JSON format
+static void writeTrace(const WallcycleTrace& trace)
+{
+    FILE* fp = gmx_ffopen(trace.fileName.c_str(), "w");
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    fprintf(fp,
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+            "\"args\":{\"name\":\"rank %d\"}}",
+            trace.rank, trace.rank);
+    const int64_t numEvents = std::min<int64_t>(trace.numRecorded, c_traceBufferSize);
+    for (int64_t i = trace.numRecorded - numEvents; i < trace.numRecorded; i++)
+    {
+        const WallcycleTraceEvent& event  = trace.events[i % c_traceBufferSize];
+        const bool                 isMain = (event.counter < ewcNR);
+        const char* name = isMain ? wcn[event.counter] : wcsn[event.counter - ewcNR];
+        fprintf(fp,
+                ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":%d,\"tid\":0,\"args\":{\"step\":%" PRId64 "}}",
+                name, isMain ? "counter" : "subcounter", event.startNs * 1e-3,
+                event.durationNs * 1e-3, trace.rank, event.step);
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    gmx_ffclose(fp);
+}
+
 gmx_bool wallcycle_have_counter()
 {
     return gmx_cycles_have_counter();
@@ -239,6 +393,8 @@ gmx_wallcycle_t wallcycle_init(FILE* fplog, int resetstep, t_commrec gmx_unused*
     wc->count_depth = 0;
 #endif
 
+    wc->trace = initTrace(fplog, cr);
+
     return wc;
 }
 
@@ -261,6 +417,11 @@ void wallcycle_destroy(gmx_wallcycle_t wc)
     {
         sfree(wc->wcsc);
     }
+    if (wc->trace != nullptr)
+    {
+        writeTrace(*wc->trace);
+        delete wc->trace;
+    }
     sfree(wc);
 }
 
@@ -331,6 +492,10 @@ void wallcycle_start(gmx_wallcycle_t wc, int ewc)
 
     cycle              = gmx_cycles_read();
     wc->wcc[ewc].start = cycle;
+    if (wc->trace != nullptr)
+    {
+        traceStart(wc->trace, ewc);
+    }
     if (wc->wcc_all != nullptr)
     {
         wc->wc_depth++;
@@ -405,6 +570,10 @@ double wallcycle_stop(gmx_wallcycle_t wc, int ewc)
     }
     wc->wcc[ewc].c += last;
     wc->wcc[ewc].n++;
+    if (wc->trace != nullptr)
+    {
+        traceStop(wc->trace, ewc);
+    }
     if (wc->wcc_all)
     {
         wc->wc_depth--;
@@ -1160,6 +1329,10 @@ void wallcycle_sub_start(gmx_wallcycle_t wc, int ewcs)
     {
         wc->wcsc[ewcs].start = gmx_cycles_read();
     }
+    if (wc != nullptr && wc->trace != nullptr)
+    {
+        traceStart(wc->trace, ewcNR + ewcs);
+    }
 }
 
 void wallcycle_sub_start_nocount(gmx_wallcycle_t wc, int ewcs)
@@ -1178,4 +1351,8 @@ void wallcycle_sub_stop(gmx_wallcycle_t wc, int ewcs)
         wc->wcsc[ewcs].c += gmx_cycles_read() - wc->wcsc[ewcs].start;
         wc->wcsc[ewcs].n++;
     }
+    if (wc != nullptr && wc->trace != nullptr)
+    {
+        traceStop(wc->trace, ewcNR + ewcs);
+    }
 }
@@ -63,6 +63,7 @@
 #include "gromacs/trajectoryanalysis/topologyinformation.h"
 #include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/stringutil.h"
 
 namespace gmx
@@ -370,6 +371,8 @@ public:
         }
     }
 
+    //! Pairs within the cutoff found for the current selection.
+    AnalysisNeighborhoodPairList pairs_;
     /*! \brief
      * Squared distance between each group
      *
@@ -438,16 +441,16 @@ void PairDistance::analyzeFrame(int frnr, const t_trxframe& fr, t_pbc* pbc, Traj
 
         // Accumulate the number of position pairs within the cutoff and the
         // min/max distance for each group pair.
-        AnalysisNeighborhoodPairSearch pairSearch = nbsearch.startPairSearch(sel[g]);
-        AnalysisNeighborhoodPair       pair;
-        while (pairSearch.findNextPair(&pair))
+        AnalysisNeighborhoodPairList& pairs = frameData.pairs_;
+        nbsearch.findAllPairs(sel[g], &pairs, gmx_omp_get_max_threads());
+        for (int p = 0; p < pairs.size(); ++p)
         {
-            const SelectionPosition& refPos   = refSel.position(pair.refIndex());
-            const SelectionPosition& selPos   = sel[g].position(pair.testIndex());
+            const SelectionPosition& refPos   = refSel.position(pairs.refIndices()[p]);
+            const SelectionPosition& selPos   = sel[g].position(pairs.testIndices()[p]);
             const int                refIndex = refPos.mappedId();
             const int                selIndex = selPos.mappedId();
             const int                index    = selIndex * refGroupCount_ + refIndex;
-            const real               r2       = pair.distance2();
+            const real               r2       = pairs.distances2()[p];
             if (distanceType_ == DistanceType::Min)
             {
                 if (distArray[index] > r2)
@@ -49,6 +49,7 @@
 #include <cmath>
 
 #include <algorithm>
+#include <array>
 #include <limits>
 #include <string>
 #include <vector>
@@ -72,7 +73,9 @@
 #include "gromacs/trajectoryanalysis/analysismodule.h"
 #include "gromacs/trajectoryanalysis/analysissettings.h"
 #include "gromacs/trajectoryanalysis/topologyinformation.h"
+#include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/exceptions.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/stringutil.h"
 
 namespace gmx
@@ -155,13 +158,27 @@ private:
     SelectionList sel_;
 
     /*! \brief
-     * Raw pairwise distance data from which the RDF is computed.
+     * Raw pairwise distance data that contributes to the RDF.
      *
      * There is a data set for each selection in `sel_`, with a single
      * column.  Each point set will contain a single pairwise distance
      * that contributes to the RDF.
+     *
+     * The RDF itself is computed from `binnedPairDist_`, so the distances
+     * are only produced if some other module has been attached.
      */
     AnalysisData pairDist_;
+    /*! \brief
+     * Binned pairwise distance data from which the RDF is computed.
+     *
+     * There is a data set for each selection in `sel_`, with two
+     * columns.  Each point set contains the center of a histogram bin and
+     * the number of pairwise distances in that bin in the frame.
+     * The distances are binned in analyzeFrame() instead of passing each
+     * distance through the data framework, which would dominate the cost
+     * for large selections.
+     */
+    AnalysisData binnedPairDist_;
     /*! \brief
      * Normalization factors for each frame.
      *
@@ -172,13 +189,15 @@ private:
      */
     AnalysisData normFactors_;
     /*! \brief
-     * Histogram module that computes the actual RDF from `pairDist_`.
+     * Histogram module that computes the actual RDF from `binnedPairDist_`.
+     *
+     * Also provides the binning used for the per-frame pair counts.
      *
      * The per-frame histograms are raw pair counts in each bin;
      * the averager is normalized by the average number of reference
      * positions (average of the first column of `normFactors_`).
      */
-    AnalysisDataSimpleHistogramModulePointer pairCounts_;
+    AnalysisDataWeightedHistogramModulePointer pairCounts_;
     /*! \brief
      * Average normalization factors.
      */
@@ -207,7 +226,7 @@ private:
 
 Rdf::Rdf() :
     surface_(SurfaceType::None),
-    pairCounts_(new AnalysisDataSimpleHistogramModule()),
+    pairCounts_(new AnalysisDataWeightedHistogramModule()),
     normAve_(new AnalysisDataAverageModule()),
     localTop_(nullptr),
     binwidth_(0.002),
@@ -222,8 +241,10 @@ Rdf::Rdf() :
     surfaceGroupCount_(0)
 {
     pairDist_.setMultipoint(true);
-    pairDist_.addModule(pairCounts_);
     registerAnalysisDataset(&pairDist_, "pairdist");
+    binnedPairDist_.setMultipoint(true);
+    binnedPairDist_.addModule(pairCounts_);
+    registerAnalysisDataset(&binnedPairDist_, "binnedpairdist");
     registerBasicDataset(pairCounts_.get(), "paircount");
 
     normFactors_.addModule(normAve_);
@@ -354,9 +375,11 @@ void Rdf::optionsFinished(TrajectoryAnalysisSettings* settings)
 void Rdf::initAnalysis(const TrajectoryAnalysisSettings& settings, const TopologyInformation& top)
 {
     pairDist_.setDataSetCount(sel_.size());
+    binnedPairDist_.setDataSetCount(sel_.size());
     for (size_t i = 0; i < sel_.size(); ++i)
     {
         pairDist_.setColumnCount(i, 1);
+        binnedPairDist_.setColumnCount(i, 2);
     }
     plotSettings_ = settings.plotSettings();
     nb_.setXYMode(bXY_);
@@ -432,6 +455,65 @@ void Rdf::initAfterFirstFrame(const TrajectoryAnalysisSettings& settings, const
     pairCounts_->init(histogramFromRange(0.0, rmax_).binWidth(binwidth_ / 2.0));
 }
 
+//! Number of selection positions for which neighbor pairs are searched at a time.
+const int c_rdfPositionBlockSize = 1024;
+//! Number of distances for which histogram bins are computed in one loop.
+const int c_rdfBinBlockSize = 256;
+
+/*! \brief
+ * Adds pair distances to a histogram of pair counts.
+ *
+ * \param[in]     distances2 Squared pair distances.
+ * \param[in]     cut2       Distances with square at most this are skipped.
+ * \param[in]     rmax2      Distances with square above this are skipped.
+ * \param[in]     settings   Binning for the histogram.
+ * \param[in,out] counts     Pair counts, with one extra element after
+ *     the last bin that collects the skipped distances.
+ *
+ * The bins for a block of distances are computed in a separate loop from
+ * the counting, so that the bin computation can be vectorized.  The bins
+ * are the same as AnalysisHistogramSettings::findBin() gives, including
+ * the handling of distances outside the histogram range.
+ */
+void addToPairCounts(ArrayRef<const real>             distances2,
+                     real                             cut2,
+                     real                             rmax2,
+                     const AnalysisHistogramSettings& settings,
+                     ArrayRef<int>                    counts)
+{
+    const real                         firstEdge       = settings.firstEdge();
+    const real                         inverseBinWidth = 1.0 / settings.binWidth();
+    const int                          binCount        = settings.binCount();
+    const bool                         bAll            = settings.includeAll();
+    std::array<int, c_rdfBinBlockSize> bins;
+    for (size_t start = 0; start < distances2.size(); start += c_rdfBinBlockSize)
+    {
+        const int n = std::min<size_t>(c_rdfBinBlockSize, distances2.size() - start);
+        for (int k = 0; k < n; ++k)
+        {
+            const real r2 = distances2[start + k];
+            const real r  = std::sqrt(std::min(r2, rmax2));
+            // Clamping before the conversion keeps it defined for all
+            // distances; values below the first edge end up in bin zero
+            // and values beyond the last edge in bin binCount.
+            const real y        = std::max(r - firstEdge, static_cast<real>(0.0)) * inverseBinWidth;
+            int        bin      = static_cast<int>(std::min(y, static_cast<real>(binCount)));
+            bool       bInRange = (r >= firstEdge && bin < binCount);
+            if (bAll)
+            {
+                bin      = std::min(bin, binCount - 1);
+                bInRange = true;
+            }
+            const bool bKeep = (r2 > cut2 && r2 <= rmax2 && bInRange);
+            bins[k]          = bKeep ? bin : binCount;
+        }
+        for (int k = 0; k < n; ++k)
+        {
+            ++counts[bins[k]];
+        }
+    }
+}
+
 /*! \brief
  * Temporary memory for use within a single-frame calculation.
  */
@@ -466,6 +548,12 @@ public:
      * the RDF from these numbers.
      */
     std::vector<real> surfaceDist2_;
+    //! Pairs within the cutoff found for the current block of positions.
+    AnalysisNeighborhoodPairList pairs_;
+    //! Pair counts in each bin for the current selection.
+    std::vector<int> binCounts_;
+    //! Thread-private pair counts, merged into `binCounts_`.
+    std::vector<std::vector<int>> threadBinCounts_;
 };
 
 TrajectoryAnalysisModuleDataPointer Rdf::startFrames(const AnalysisDataParallelOptions& opt,
@@ -477,6 +565,7 @@ TrajectoryAnalysisModuleDataPointer Rdf::startFrames(const AnalysisDataParallelO
 void Rdf::analyzeFrame(int frnr, const t_trxframe& fr, t_pbc* pbc, TrajectoryAnalysisModuleData* pdata)
 {
     AnalysisDataHandle   dh        = pdata->dataHandle(pairDist_);
+    AnalysisDataHandle   bh        = pdata->dataHandle(binnedPairDist_);
     AnalysisDataHandle   nh        = pdata->dataHandle(normFactors_);
     const Selection&     refSel    = TrajectoryAnalysisModuleData::parallelSelection(refSel_);
     const SelectionList& sel       = TrajectoryAnalysisModuleData::parallelSelections(sel_);
@@ -526,10 +615,19 @@ void Rdf::analyzeFrame(int frnr, const t_trxframe& fr, t_pbc* pbc, TrajectoryAna
     }
 
     dh.startFrame(frnr, fr.time);
-    AnalysisNeighborhoodSearch nbsearch = nb_.initSearch(pbc, refSel);
+    bh.startFrame(frnr, fr.time);
+    const bool                       bRawDist   = pairDist_.hasModules();
+    AnalysisNeighborhoodSearch       nbsearch   = nb_.initSearch(pbc, refSel);
+    const AnalysisHistogramSettings& binning    = pairCounts_->settings();
+    const int                        binCount   = binning.binCount();
+    const int                        numThreads = gmx_omp_get_max_threads();
+    std::vector<int>&                binCounts  = frameData.binCounts_;
+    frameData.threadBinCounts_.resize(numThreads);
     for (size_t g = 0; g < sel.size(); ++g)
     {
         dh.selectDataSet(g);
+        bh.selectDataSet(g);
+        binCounts.assign(binCount + 1, 0);
 
         if (bSurface)
         {
@@ -552,16 +650,19 @@ void Rdf::analyzeFrame(int frnr, const t_trxframe& fr, t_pbc* pbc, TrajectoryAna
                     }
                 }
                 // Accumulate the RDF from the distances to the surface.
-                for (size_t i = 0; i < surfaceDist2.size(); ++i)
+                // Here, we need to check for rmax, since the value might
+                // be above the cutoff if no points were close to some
+                // surface positions.
+                addToPairCounts(surfaceDist2, cut2_, rmax2_, binning, binCounts);
+                if (bRawDist)
                 {
-                    const real r2 = surfaceDist2[i];
-                    // Here, we need to check for rmax, since the value might
-                    // be above the cutoff if no points were close to some
-                    // surface positions.
-                    if (r2 > cut2_ && r2 <= rmax2_)
+                    for (const real r2 : surfaceDist2)
                     {
-                        dh.setPoint(0, std::sqrt(r2));
-                        dh.finishPointSet();
+                        if (r2 > cut2_ && r2 <= rmax2_)
+                        {
+                            dh.setPoint(0, std::sqrt(r2));
+                            dh.finishPointSet();
+                        }
                     }
                 }
             }
@@ -569,19 +670,68 @@ void Rdf::analyzeFrame(int frnr, const t_trxframe& fr, t_pbc* pbc, TrajectoryAna
         else
         {
             // Standard neighborhood search over all pairs within the cutoff
-            // for the -surf no case.
-            AnalysisNeighborhoodPairSearch pairSearch = nbsearch.startPairSearch(sel[g]);
-            AnalysisNeighborhoodPair       pair;
-            while (pairSearch.findNextPair(&pair))
+            // for the -surf no case.  The pairs are searched for blocks of
+            // positions to bound the memory needed for the pair list, and
+            // binned into thread-private histograms that are merged after
+            // all the pairs have been processed.
+            AnalysisNeighborhoodPairList& pairs       = frameData.pairs_;
+            const rvec*                   x           = sel[g].coordinates().data();
+            const int                     posCount    = sel[g].posCount();
+            const bool                    bHasAtomIds = sel[g].hasOnlyAtoms();
+            for (auto& threadCounts : frameData.threadBinCounts_)
+            {
+                threadCounts.assign(binCount + 1, 0);
+            }
+            for (int blockStart = 0; blockStart < posCount; blockStart += c_rdfPositionBlockSize)
             {
-                const real r2 = pair.distance2();
-                if (r2 > cut2_)
+                const int blockSize = std::min(c_rdfPositionBlockSize, posCount - blockStart);
+                AnalysisNeighborhoodPositions blockPos(x + blockStart, blockSize);
+                if (bHasAtomIds)
+                {
+                    blockPos.exclusionIds(sel[g].atomIndices().subArray(blockStart, blockSize));
+                }
+                nbsearch.findAllPairs(blockPos, &pairs, numThreads);
+                const ArrayRef<const real> distances2 = pairs.distances2();
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+                for (int t = 0; t < numThreads; ++t)
                 {
-                    // TODO: Consider whether the histogramming could be done with
-                    // less overhead (after first measuring the overhead).
-                    dh.setPoint(0, std::sqrt(r2));
-                    dh.finishPointSet();
+                    try
+                    {
+                        const size_t begin = distances2.size() * t / numThreads;
+                        const size_t end   = distances2.size() * (t + 1) / numThreads;
+                        addToPairCounts(distances2.subArray(begin, end - begin), cut2_,
+                                        std::numeric_limits<real>::max(), binning,
+                                        frameData.threadBinCounts_[t]);
+                    }
+                    GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
                 }
+                if (bRawDist)
+                {
+                    for (const real r2 : distances2)
+                    {
+                        if (r2 > cut2_)
+                        {
+                            dh.setPoint(0, std::sqrt(r2));
+                            dh.finishPointSet();
+                        }
+                    }
+                }
+            }
+            for (const auto& threadCounts : frameData.threadBinCounts_)
+            {
+                for (int b = 0; b < binCount; ++b)
+                {
+                    binCounts[b] += threadCounts[b];
+                }
+            }
+        }
+        for (int b = 0; b < binCount; ++b)
+        {
+            if (binCounts[b] > 0)
+            {
+                bh.setPoint(0, binning.firstEdge() + (b + 0.5) * binning.binWidth());
+                bh.setPoint(1, binCounts[b]);
+                bh.finishPointSet();
             }
         }
         // Normalization factor for the number density (only used without
@@ -589,6 +739,7 @@ void Rdf::analyzeFrame(int frnr, const t_trxframe& fr, t_pbc* pbc, TrajectoryAna
         nh.setPoint(g + 1, sel[g].posCount() * inverseVolume);
     }
     dh.finishFrame();
+    bh.finishFrame();
     nh.finishFrame();
 }
 
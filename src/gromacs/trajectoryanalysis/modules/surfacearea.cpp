@@ -53,7 +53,9 @@
 #include "gromacs/pbcutil/pbc.h"
 #include "gromacs/selection/nbsearch.h"
 #include "gromacs/utility/fatalerror.h"
+#include "gromacs/utility/exceptions.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 using namespace gmx;
@@ -65,6 +67,9 @@ using namespace gmx;
 #define TORAD(A) ((A)*0.017453293)
 #define DP_TOL 0.001
 
+//! Number of atoms for which neighbor pairs are searched at a time.
+static const int c_surfaceAreaAtomBlockSize = 4096;
+
 static real safe_asin(real f)
 {
     if ((fabs(f) < 1.00))
@@ -646,94 +651,158 @@ static void nsc_dclm_pbc(const rvec*                 coords,
     ys /= nat;
     zs /= nat;
 
+    // Store the unit sphere dots as separate coordinate arrays, so that the
+    // occlusion test below is a flat loop that the compiler can vectorize.
+    std::vector<real> dotX(n_dot), dotY(n_dot), dotZ(n_dot);
+    for (int j = 0; j < n_dot; ++j)
+    {
+        dotX[j] = xus[3 * j];
+        dotY[j] = xus[1 + 3 * j];
+        dotZ[j] = xus[2 + 3 * j];
+    }
+
     AnalysisNeighborhoodPositions pos(coords, radius.size());
     pos.indexed(constArrayRefFromArray(index, nat));
     AnalysisNeighborhoodSearch nbsearch(nb->initSearch(pbc, pos));
 
-    std::vector<int> wkdot(n_dot);
+    // Per-atom results, combined in atom order after the parallel loop to
+    // keep the output independent of the number of threads.
+    std::vector<int>              freeDotCount(nat);
+    std::vector<real>             atomVolume((mode & FLAG_VOLUME) ? nat : 0);
+    std::vector<std::vector<int>> freeDots((mode & FLAG_DOTS) ? nat : 0);
+
+    const int                    numThreads = gmx_omp_get_max_threads();
+    AnalysisNeighborhoodPairList pairs;
+    std::vector<int>             pairStart;
+    std::vector<unsigned char>   covered(n_dot);
+    // The neighbor pairs are found for blocks of atoms at a time to bound
+    // the memory used by the pair list for large selections.
+    for (int blockStart = 0; blockStart < nat; blockStart += c_surfaceAreaAtomBlockSize)
+    {
+        const int blockSize = std::min(c_surfaceAreaAtomBlockSize, nat - blockStart);
+        AnalysisNeighborhoodPositions blockPos(coords, radius.size());
+        blockPos.indexed(constArrayRefFromArray(index + blockStart, blockSize));
+        nbsearch.findAllPairs(blockPos, &pairs, numThreads);
+
+        pairStart.assign(blockSize + 1, 0);
+        for (const int testIndex : pairs.testIndices())
+        {
+            ++pairStart[testIndex + 1];
+        }
+        for (int i = 0; i < blockSize; ++i)
+        {
+            pairStart[i + 1] += pairStart[i];
+        }
 
-    for (int i = 0; i < nat; ++i)
-    {
-        const int                      iat  = index[i];
-        const real                     ai   = radius[iat];
-        const real                     aisq = ai * ai;
-        AnalysisNeighborhoodPairSearch pairSearch(nbsearch.startPairSearch(coords[iat]));
-        AnalysisNeighborhoodPair       pair;
-        std::fill(wkdot.begin(), wkdot.end(), 1);
-        int currDotCount = n_dot;
-        while (currDotCount > 0 && pairSearch.findNextPair(&pair))
+#pragma omp parallel num_threads(numThreads) firstprivate(covered)
         {
-            const int  jat = index[pair.refIndex()];
-            const real aj  = radius[jat];
-            const real d2  = pair.distance2();
-            if (iat == jat || d2 > gmx::square(ai + aj))
-            {
-                continue;
-            }
-            const rvec& dx     = pair.dx();
-            const real  refdot = (d2 + aisq - aj * aj) / (2 * ai);
-            // TODO: Consider whether micro-optimizations from the old
-            // implementation would be useful, compared to the complexity that
-            // they bring: instead of this direct loop, the neighbors were
-            // stored into a temporary array, the loop order was
-            // reversed (first over dots, then over neighbors), and for each
-            // dot, it was first checked whether the same neighbor that
-            // resulted in marking the previous dot covered would also cover
-            // this dot. This presumably plays together with sorting of the
-            // surface dots (done in make_unsp) to avoid some of the looping.
-            // Alternatively, we could keep a skip list here to avoid
-            // repeatedly looping over dots that have already marked as
-            // covered.
-            for (int j = 0; j < n_dot; ++j)
+            try
             {
-                if (wkdot[j] && iprod(&xus[3 * j], dx) > refdot)
+#pragma omp for schedule(dynamic, 16)
+                for (int b = 0; b < blockSize; ++b)
                 {
-                    --currDotCount;
-                    wkdot[j] = 0;
+                    const int  i    = blockStart + b;
+                    const int  iat  = index[i];
+                    const real ai   = radius[iat];
+                    const real aisq = ai * ai;
+                    std::fill(covered.begin(), covered.end(), 0);
+                    int currDotCount = n_dot;
+                    for (int p = pairStart[b]; currDotCount > 0 && p < pairStart[b + 1]; ++p)
+                    {
+                        const int  jat = index[pairs.refIndices()[p]];
+                        const real aj  = radius[jat];
+                        const real d2  = pairs.distances2()[p];
+                        if (iat == jat || d2 > gmx::square(ai + aj))
+                        {
+                            continue;
+                        }
+                        const rvec& dx     = pairs.dx()[p];
+                        const real  refdot = (d2 + aisq - aj * aj) / (2 * ai);
+                        const real  dxx    = dx[XX];
+                        const real  dxy    = dx[YY];
+                        const real  dxz    = dx[ZZ];
+                        // Marking all dots on every neighbor, instead of
+                        // skipping the dots that are already covered, keeps
+                        // this loop branch-free.
+                        int coveredCount = 0;
+                        for (int j = 0; j < n_dot; ++j)
+                        {
+                            const bool bCovered = dotX[j] * dxx + dotY[j] * dxy + dotZ[j] * dxz > refdot;
+                            covered[j] |= static_cast<unsigned char>(bCovered);
+                            coveredCount += covered[j];
+                        }
+                        currDotCount = n_dot - coveredCount;
+                    }
+                    freeDotCount[i] = currDotCount;
+
+                    if (mode & FLAG_DOTS)
+                    {
+                        freeDots[i].clear();
+                        for (int l = 0; l < n_dot; l++)
+                        {
+                            if (!covered[l])
+                            {
+                                freeDots[i].push_back(l);
+                            }
+                        }
+                    }
+                    if (mode & FLAG_VOLUME)
+                    {
+                        const real xi = coords[iat][XX];
+                        const real yi = coords[iat][YY];
+                        const real zi = coords[iat][ZZ];
+                        real       dx = 0.0, dy = 0.0, dz = 0.0;
+                        for (int l = 0; l < n_dot; l++)
+                        {
+                            if (!covered[l])
+                            {
+                                dx = dx + dotX[l];
+                                dy = dy + dotY[l];
+                                dz = dz + dotZ[l];
+                            }
+                        }
+                        atomVolume[i] = aisq
+                                        * (dx * (xi - xs) + dy * (yi - ys) + dz * (zi - zs)
+                                           + ai * currDotCount);
+                    }
                 }
             }
+            GMX_CATCH_ALL_AND_EXIT_WITH_FATAL_ERROR
         }
+    }
 
-        const real a = aisq * dotarea * currDotCount;
-        area         = area + a;
+    for (int i = 0; i < nat; ++i)
+    {
+        const int  iat  = index[i];
+        const real ai   = radius[iat];
+        const real aisq = ai * ai;
+        const real a    = aisq * dotarea * freeDotCount[i];
+        area            = area + a;
         if (mode & FLAG_ATOM_AREA)
         {
             atom_area[i] = a;
         }
-        const real xi = coords[iat][XX];
-        const real yi = coords[iat][YY];
-        const real zi = coords[iat][ZZ];
         if (mode & FLAG_DOTS)
         {
-            for (int l = 0; l < n_dot; l++)
+            const real xi = coords[iat][XX];
+            const real yi = coords[iat][YY];
+            const real zi = coords[iat][ZZ];
+            for (const int l : freeDots[i])
             {
-                if (wkdot[l])
+                lfnr++;
+                if (maxdots <= 3 * lfnr + 1)
                 {
-                    lfnr++;
-                    if (maxdots <= 3 * lfnr + 1)
-                    {
-                        maxdots = maxdots + n_dot * 3;
-                        srenew(dots, maxdots);
-                    }
-                    dots[3 * lfnr - 3] = ai * xus[3 * l] + xi;
-                    dots[3 * lfnr - 2] = ai * xus[1 + 3 * l] + yi;
-                    dots[3 * lfnr - 1] = ai * xus[2 + 3 * l] + zi;
+                    maxdots = maxdots + n_dot * 3;
+                    srenew(dots, maxdots);
                 }
+                dots[3 * lfnr - 3] = ai * xus[3 * l] + xi;
+                dots[3 * lfnr - 2] = ai * xus[1 + 3 * l] + yi;
+                dots[3 * lfnr - 1] = ai * xus[2 + 3 * l] + zi;
             }
         }
         if (mode & FLAG_VOLUME)
         {
-            real dx = 0.0, dy = 0.0, dz = 0.0;
-            for (int l = 0; l < n_dot; l++)
-            {
-                if (wkdot[l])
-                {
-                    dx = dx + xus[3 * l];
-                    dy = dy + xus[1 + 3 * l];
-                    dz = dz + xus[2 + 3 * l];
-                }
-            }
-            vol = vol + aisq * (dx * (xi - xs) + dy * (yi - ys) + dz * (zi - zs) + ai * currDotCount);
+            vol = vol + atomVolume[i];
         }
     }
 
@@ -38,7 +38,7 @@
  *
  * These tests are essentially regression tests for the actual RDF calculation
  * from very small configurations.  Exclusions are not tested (since the input
- * does not contain any), nor is the effect of -cut of -rmax.
+ * does not contain any).
  * At the moment, they do not test the final normalization, but only the pair
  * counts calculated for each frame.  Tests for the final normalization should
  * be added once related TODOs in the implementation/framework have been
@@ -79,6 +79,7 @@ TEST_F(RdfModuleTest, BasicTest)
     setTopology("spc216.gro");
     setOutputFile("-o", ".xvg", NoTextMatch());
     excludeDataset("pairdist");
+    excludeDataset("binnedpairdist");
     runTest(CommandLine(cmdline));
 }
 
@@ -94,6 +95,7 @@ TEST_F(RdfModuleTest, SelectionsSolelyFromIndexFileWork)
     setInputFile("-n", "index.ndx");
     setOutputFile("-o", ".xvg", NoTextMatch());
     excludeDataset("pairdist");
+    excludeDataset("binnedpairdist");
     runTest(CommandLine(cmdline));
 }
 
@@ -109,6 +111,7 @@ TEST_F(RdfModuleTest, SelectionsFromBothTopologyFileAndIndexFileWork)
     setInputFile("-n", "index.ndx");
     setOutputFile("-o", ".xvg", NoTextMatch());
     excludeDataset("pairdist");
+    excludeDataset("binnedpairdist");
     runTest(CommandLine(cmdline));
 }
 
@@ -127,6 +130,7 @@ TEST_F(RdfModuleTest, CalculatesSurf)
     setTopology("spc216.gro");
     setOutputFile("-o", ".xvg", NoTextMatch());
     excludeDataset("pairdist");
+    excludeDataset("binnedpairdist");
     runTest(CommandLine(cmdline));
 }
 
@@ -137,6 +141,7 @@ TEST_F(RdfModuleTest, CalculatesXY)
     setTopology("spc216.gro");
     setOutputFile("-o", ".xvg", NoTextMatch());
     excludeDataset("pairdist");
+    excludeDataset("binnedpairdist");
     // TODO: Consider if it is possible to get a more reproducible result
     // and/or a stricter tolerance (e.g., by checking that the sum of
     // neighboring values still stays constant).
@@ -144,4 +149,38 @@ TEST_F(RdfModuleTest, CalculatesXY)
     runTest(CommandLine(cmdline));
 }
 
+TEST_F(RdfModuleTest, CalculatesWithCutAndRmax)
+{
+    const char* const cmdline[] = { "rdf",  "-bin", "0.05",    "-cut", "0.3",     "-rmax",
+                                    "0.73", "-ref", "name OW", "-sel", "name OW", "not name OW" };
+    setTopology("spc216.gro");
+    setOutputFile("-o", ".xvg", NoTextMatch());
+    excludeDataset("pairdist");
+    excludeDataset("binnedpairdist");
+    runTest(CommandLine(cmdline));
+}
+
+TEST_F(RdfModuleTest, CalculatesSurfWithCutAndRmax)
+{
+    const char* const cmdline[] = { "rdf",
+                                    "-bin",
+                                    "0.04",
+                                    "-cut",
+                                    "0.1",
+                                    "-rmax",
+                                    "0.62",
+                                    "-surf",
+                                    "res",
+                                    "-ref",
+                                    "within 0.5 of (resnr 1 and name OW)",
+                                    "-sel",
+                                    "name OW",
+                                    "not name OW" };
+    setTopology("spc216.gro");
+    setOutputFile("-o", ".xvg", NoTextMatch());
+    excludeDataset("pairdist");
+    excludeDataset("binnedpairdist");
+    runTest(CommandLine(cmdline));
+}
+
 } // namespace
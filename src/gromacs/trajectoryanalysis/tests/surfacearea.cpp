@@ -46,6 +46,8 @@
 
 #include <cstdlib>
 
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include "gromacs/math/utilities.h"
@@ -55,6 +57,7 @@
 #include "gromacs/random/uniformrealdistribution.h"
 #include "gromacs/utility/arrayref.h"
 #include "gromacs/utility/gmxassert.h"
+#include "gromacs/utility/gmxomp.h"
 #include "gromacs/utility/smalloc.h"
 
 #include "testutils/refdata.h"
@@ -151,6 +154,7 @@ public:
                              index_.data(), flags, &area_, &volume_, &atomArea_, &dots_, &dotCount_);
     }
     real resultArea() const { return area_; }
+    int  resultDotCount() const { return dotCount_; }
     real resultVolume() const { return volume_; }
     real atomArea(int index) const { return atomArea_[index]; }
 
@@ -363,4 +367,38 @@ TEST_F(SurfaceAreaTest, Computes100PointsWithTriclinicPBC)
     checkReference(&checker, "100Points", false);
 }
 
+
+TEST_F(SurfaceAreaTest, ResultsAreIndependentOfThreadCount)
+{
+    // Use enough points that the neighbor search is done in several blocks.
+    box_[XX][XX] = 40.0;
+    box_[YY][YY] = 40.0;
+    box_[ZZ][ZZ] = 40.0;
+    generateRandomPositions(5000);
+    const int flags = FLAG_ATOM_AREA | FLAG_VOLUME | FLAG_DOTS;
+
+    const int maxThreads = gmx_omp_get_max_threads();
+    gmx_omp_set_num_threads(1);
+    ASSERT_NO_FATAL_FAILURE(calculate(32, flags, true));
+    const real        area     = resultArea();
+    const real        volume   = resultVolume();
+    const int         dotCount = resultDotCount();
+    std::vector<real> atomArea(5000);
+    for (int i = 0; i < 5000; ++i)
+    {
+        atomArea[i] = this->atomArea(i);
+    }
+
+    gmx_omp_set_num_threads(4);
+    ASSERT_NO_FATAL_FAILURE(calculate(32, flags, true));
+    gmx_omp_set_num_threads(maxThreads);
+    EXPECT_EQ(area, resultArea());
+    EXPECT_EQ(volume, resultVolume());
+    EXPECT_EQ(dotCount, resultDotCount());
+    for (int i = 0; i < 5000; ++i)
+    {
+        EXPECT_EQ(atomArea[i], this->atomArea(i));
+    }
+}
+
 } // namespace
@@ -274,6 +274,20 @@ public:
         }
         pos_ += CharBuffer<T>::ValueSize;
     }
+    template<typename T>
+    void doValueArray(T* values, int elements)
+    {
+        const size_t size = elements * CharBuffer<T>::ValueSize;
+        std::copy(buffer_.data() + pos_, buffer_.data() + pos_ + size, reinterpret_cast<char*>(values));
+        if (endianSwapBehavior_ == EndianSwapBehavior::Swap)
+        {
+            for (int i = 0; i < elements; i++)
+            {
+                values[i] = swapEndian(values[i]);
+            }
+        }
+        pos_ += size;
+    }
     void doString(std::string* value)
     {
         uint64_t size;
@@ -394,4 +408,30 @@ void InMemoryDeserializer::doOpaque(char* data, std::size_t size)
     impl_->doOpaque(data, size);
 }
 
+void InMemoryDeserializer::doIntArray(int* values, int elements)
+{
+    impl_->doValueArray(values, elements);
+}
+
+void InMemoryDeserializer::doRealArray(real* values, int elements)
+{
+    if (sourceIsDouble() == (GMX_DOUBLE != 0))
+    {
+        impl_->doValueArray(values, elements);
+    }
+    else
+    {
+        // Conversion between precisions needs to go through each value.
+        for (int i = 0; i < elements; i++)
+        {
+            doReal(&values[i]);
+        }
+    }
+}
+
+void InMemoryDeserializer::doRvecArray(rvec* values, int elements)
+{
+    doRealArray(values[0], DIM * elements);
+}
+
 } // namespace gmx
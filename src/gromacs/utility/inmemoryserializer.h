@@ -126,6 +126,10 @@ public:
     void doRvec(rvec* value) override;
     void doString(std::string* value) override;
     void doOpaque(char* data, std::size_t size) override;
+    // Arrays are copied from the buffer in a single operation.
+    void doIntArray(int* values, int elements) override;
+    void doRealArray(real* values, int elements) override;
+    void doRvecArray(rvec* values, int elements) override;
 
 private:
     class Impl;
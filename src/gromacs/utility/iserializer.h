@@ -99,8 +99,8 @@ public:
             doBool(&(values[i]));
         }
     }
-    // Char, UChar and RVec have vector specializations that can be
-    // used instead of the default looping.
+    // Char, UChar, Int, Real and RVec have vector specializations that
+    // can be used instead of the default looping.
     virtual void doCharArray(char* values, int elements)
     {
         for (int i = 0; i < elements; i++)
@@ -122,7 +122,7 @@ public:
             doUShort(&(values[i]));
         }
     }
-    void doIntArray(int* values, int elements)
+    virtual void doIntArray(int* values, int elements)
     {
         for (int i = 0; i < elements; i++)
         {
@@ -157,7 +157,7 @@ public:
             doDouble(&(values[i]));
         }
     }
-    void doRealArray(real* values, int elements)
+    virtual void doRealArray(real* values, int elements)
     {
         for (int i = 0; i < elements; i++)
         {
@@ -263,6 +263,50 @@ TEST_F(InMemorySerializerTest, SizeIsCorrect)
     EXPECT_EQ(buffer.size(), 56);
 }
 
+TEST_F(InMemorySerializerTest, ArraysRoundtripWithEndianessSwap)
+{
+    InMemorySerializer serializer(EndianSwapBehavior::Swap);
+    std::vector<int>   intValues  = { integerSizeDependentTestingValue(), -5, 0, 12345 };
+    std::vector<real>  realValues = { defaultValues_.realValue_, -1.5, 0.0, 2.25, 0.125, 7.0 };
+    serializer.doIntArray(intValues.data(), intValues.size());
+    serializer.doRealArray(realValues.data(), realValues.size());
+    serializer.doRvecArray(reinterpret_cast<rvec*>(realValues.data()), realValues.size() / DIM);
+
+    auto buffer = serializer.finishAndGetBuffer();
+
+    InMemoryDeserializer deserializer(buffer, std::is_same<real, double>::value, EndianSwapBehavior::Swap);
+    std::vector<int>     intResult(intValues.size());
+    std::vector<real>    realResult(realValues.size());
+    std::vector<real>    rvecResult(realValues.size());
+    deserializer.doIntArray(intResult.data(), intResult.size());
+    deserializer.doRealArray(realResult.data(), realResult.size());
+    deserializer.doRvecArray(reinterpret_cast<rvec*>(rvecResult.data()), rvecResult.size() / DIM);
+    EXPECT_THAT(intResult, ::testing::Pointwise(::testing::Eq(), intValues));
+    EXPECT_THAT(realResult, ::testing::Pointwise(::testing::Eq(), realValues));
+    EXPECT_THAT(rvecResult, ::testing::Pointwise(::testing::Eq(), realValues));
+}
+
+TEST_F(InMemorySerializerTest, DeserializerArraysMatchSingleValues)
+{
+    InMemorySerializer serializer;
+    std::vector<int>   intValues = { c_int32Value, -5, 0, 12345 };
+    serializer.doIntArray(intValues.data(), intValues.size());
+
+    auto buffer = serializer.finishAndGetBuffer();
+
+    InMemoryDeserializer deserializer(buffer, std::is_same<real, double>::value, EndianSwapBehavior::Swap);
+    std::vector<int>     intResult(intValues.size());
+    deserializer.doIntArray(intResult.data(), intResult.size());
+    InMemoryDeserializer singleValueDeserializer(buffer, std::is_same<real, double>::value,
+                                                 EndianSwapBehavior::Swap);
+    for (size_t i = 0; i < intValues.size(); ++i)
+    {
+        int value;
+        singleValueDeserializer.doInt(&value);
+        EXPECT_EQ(value, intResult[i]);
+    }
+}
+
 } // namespace
 } // namespace test
 } // namespace gmx